@@ -80,6 +80,7 @@ static void group_add                   (EelCanvasGroup *group,
         EelCanvasItem  *item);
 static void group_remove                (EelCanvasGroup *group,
         EelCanvasItem  *item);
+static void group_index_restack         (EelCanvasGroup *group);
 static void redraw_and_repick_if_mapped (EelCanvasItem *item);
 
 /*** EelCanvasItem ***/
@@ -610,6 +611,9 @@ put_item_after (GList *link, GList *before)
         else
             parent->item_list_end = link;
     }
+
+    group_index_restack (parent);
+
     return TRUE;
 }
 
@@ -1230,6 +1234,398 @@ static void   eel_canvas_group_bounds      (EelCanvasItem *item, double *x1, dou
 
 static EelCanvasItemClass *group_parent_class;
 
+/* Spatial index of a group's children.  The canvas is cut into square cells
+ * and each child is filed under the cells its bounding box touches, so an
+ * area can be searched by only looking at the cells it covers.  Children
+ * that cover too many cells are kept apart and checked every time.
+ *
+ * The bounds are in canvas pixel coordinates, as found in the x1, y1, x2, y2
+ * fields of the items, and are refreshed after every update of a child.
+ */
+
+#define GROUP_INDEX_CELL_SIZE 256
+#define GROUP_INDEX_MAX_CELLS 64
+
+typedef struct
+{
+    EelCanvasItem *item;
+
+    /* Bounds the item is filed with */
+    double x1, y1, x2, y2;
+    int cx1, cy1, cx2, cy2;
+    gboolean large;
+
+    /* Position in the group's stack, from the bottom */
+    guint stack;
+
+    /* Last query that found the item */
+    guint query;
+} GroupIndexEntry;
+
+struct _EelCanvasGroupIndex
+{
+    GHashTable *entries;   /* EelCanvasItem -> GroupIndexEntry */
+    GHashTable *cells;     /* cell key -> set of GroupIndexEntry */
+    GHashTable *large;     /* set of GroupIndexEntry */
+
+    guint next_stack;
+    gboolean stack_dirty;
+    guint query;
+};
+
+static int
+group_index_cell (double coord)
+{
+    coord = CLAMP (coord, -1e9, 1e9);
+
+    return (int) floor (coord / GROUP_INDEX_CELL_SIZE);
+}
+
+/* Cells that are far apart may share a key, which only makes them
+ * return some extra candidates.
+ */
+static gpointer
+group_index_cell_key (int cx, int cy)
+{
+    return GUINT_TO_POINTER ((((guint) cx & 0xffff) << 16) | ((guint) cy & 0xffff));
+}
+
+static void
+group_index_file (EelCanvasGroupIndex *index, GroupIndexEntry *entry)
+{
+    GHashTable *cell;
+    gpointer key;
+    int cx, cy;
+
+    entry->x1 = entry->item->x1;
+    entry->y1 = entry->item->y1;
+    entry->x2 = entry->item->x2;
+    entry->y2 = entry->item->y2;
+
+    entry->cx1 = group_index_cell (entry->x1);
+    entry->cy1 = group_index_cell (entry->y1);
+    entry->cx2 = group_index_cell (MAX (entry->x1, entry->x2));
+    entry->cy2 = group_index_cell (MAX (entry->y1, entry->y2));
+
+    entry->large = (gint64) (entry->cx2 - entry->cx1 + 1) * (entry->cy2 - entry->cy1 + 1) > GROUP_INDEX_MAX_CELLS;
+    if (entry->large)
+    {
+        g_hash_table_add (index->large, entry);
+        return;
+    }
+
+    for (cx = entry->cx1; cx <= entry->cx2; cx++)
+    {
+        for (cy = entry->cy1; cy <= entry->cy2; cy++)
+        {
+            key = group_index_cell_key (cx, cy);
+            cell = g_hash_table_lookup (index->cells, key);
+            if (cell == NULL)
+            {
+                cell = g_hash_table_new (NULL, NULL);
+                g_hash_table_insert (index->cells, key, cell);
+            }
+            g_hash_table_add (cell, entry);
+        }
+    }
+}
+
+static void
+group_index_unfile (EelCanvasGroupIndex *index, GroupIndexEntry *entry)
+{
+    GHashTable *cell;
+    gpointer key;
+    int cx, cy;
+
+    if (entry->large)
+    {
+        g_hash_table_remove (index->large, entry);
+        return;
+    }
+
+    for (cx = entry->cx1; cx <= entry->cx2; cx++)
+    {
+        for (cy = entry->cy1; cy <= entry->cy2; cy++)
+        {
+            key = group_index_cell_key (cx, cy);
+            cell = g_hash_table_lookup (index->cells, key);
+            if (cell == NULL)
+                continue;
+
+            g_hash_table_remove (cell, entry);
+            if (g_hash_table_size (cell) == 0)
+                g_hash_table_remove (index->cells, key);
+        }
+    }
+}
+
+static void
+group_index_add_item (EelCanvasGroupIndex *index, EelCanvasItem *item)
+{
+    GroupIndexEntry *entry;
+
+    entry = g_new0 (GroupIndexEntry, 1);
+    entry->item = item;
+    entry->stack = index->next_stack++;
+
+    g_hash_table_insert (index->entries, item, entry);
+    group_index_file (index, entry);
+}
+
+static void
+group_index_remove_item (EelCanvasGroupIndex *index, EelCanvasItem *item)
+{
+    GroupIndexEntry *entry;
+
+    entry = g_hash_table_lookup (index->entries, item);
+    if (entry == NULL)
+        return;
+
+    group_index_unfile (index, entry);
+    g_hash_table_remove (index->entries, item);
+}
+
+static void
+group_index_update_item (EelCanvasGroupIndex *index, EelCanvasItem *item)
+{
+    GroupIndexEntry *entry;
+
+    entry = g_hash_table_lookup (index->entries, item);
+    if (entry == NULL)
+        return;
+
+    if (entry->x1 == item->x1 && entry->y1 == item->y1 &&
+            entry->x2 == item->x2 && entry->y2 == item->y2)
+        return;
+
+    group_index_unfile (index, entry);
+    group_index_file (index, entry);
+}
+
+/* Called when the children were reordered; the positions are recomputed
+ * on the next query, so that raising many items in a row is not quadratic.
+ */
+static void
+group_index_restack (EelCanvasGroup *group)
+{
+    if (group->spatial_index)
+        group->spatial_index->stack_dirty = TRUE;
+}
+
+static void
+group_index_update_stack (EelCanvasGroup *group)
+{
+    EelCanvasGroupIndex *index;
+    GroupIndexEntry *entry;
+    GList *list;
+
+    index = group->spatial_index;
+    index->next_stack = 0;
+
+    for (list = group->item_list; list; list = list->next)
+    {
+        entry = g_hash_table_lookup (index->entries, list->data);
+        if (entry != NULL)
+            entry->stack = index->next_stack++;
+    }
+
+    index->stack_dirty = FALSE;
+}
+
+static gint
+group_index_compare_stack (gconstpointer a, gconstpointer b)
+{
+    const GroupIndexEntry *entry_a = *(GroupIndexEntry * const *) a;
+    const GroupIndexEntry *entry_b = *(GroupIndexEntry * const *) b;
+
+    if (entry_a->stack < entry_b->stack)
+        return -1;
+
+    return entry_a->stack > entry_b->stack;
+}
+
+static void
+group_index_collect (EelCanvasGroupIndex *index, GHashTable *set, GPtrArray *found,
+                     int x1, int y1, int x2, int y2)
+{
+    GHashTableIter iter;
+    GroupIndexEntry *entry;
+
+    g_hash_table_iter_init (&iter, set);
+    while (g_hash_table_iter_next (&iter, (gpointer *) &entry, NULL))
+    {
+        if (entry->query == index->query)
+            continue;
+
+        entry->query = index->query;
+
+        if (entry->x1 > x2 || entry->y1 > y2 || entry->x2 < x1 || entry->y2 < y1)
+            continue;
+
+        g_ptr_array_add (found, entry);
+    }
+}
+
+/* Returns the children whose bounds touch the given rectangle, bottom to top,
+ * or NULL if walking the whole list would be cheaper.
+ */
+static GPtrArray *
+group_index_query (EelCanvasGroup *group, int x1, int y1, int x2, int y2)
+{
+    EelCanvasGroupIndex *index;
+    GHashTable *cell;
+    GHashTableIter iter;
+    GroupIndexEntry *entry;
+    GPtrArray *found;
+    int cx1, cy1, cx2, cy2, cx, cy;
+    guint i;
+
+    index = group->spatial_index;
+
+    cx1 = group_index_cell (x1);
+    cy1 = group_index_cell (y1);
+    cx2 = group_index_cell (x2);
+    cy2 = group_index_cell (y2);
+
+    if (cx2 < cx1 || cy2 < cy1)
+        return g_ptr_array_new ();
+
+    if ((gint64) (cx2 - cx1 + 1) * (cy2 - cy1 + 1) > g_hash_table_size (index->entries))
+        return NULL;
+
+    if (index->stack_dirty)
+        group_index_update_stack (group);
+
+    if (++index->query == 0)
+    {
+        /* Wrapped around, forget which items the old queries found */
+        g_hash_table_iter_init (&iter, index->entries);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+            entry->query = 0;
+        index->query = 1;
+    }
+
+    found = g_ptr_array_new ();
+
+    for (cx = cx1; cx <= cx2; cx++)
+    {
+        for (cy = cy1; cy <= cy2; cy++)
+        {
+            cell = g_hash_table_lookup (index->cells, group_index_cell_key (cx, cy));
+            if (cell != NULL)
+                group_index_collect (index, cell, found, x1, y1, x2, y2);
+        }
+    }
+    group_index_collect (index, index->large, found, x1, y1, x2, y2);
+
+    g_ptr_array_sort (found, group_index_compare_stack);
+
+    for (i = 0; i < found->len; i++)
+    {
+        entry = g_ptr_array_index (found, i);
+        g_ptr_array_index (found, i) = entry->item;
+    }
+
+    return found;
+}
+
+static void
+group_index_free (EelCanvasGroupIndex *index)
+{
+    g_hash_table_destroy (index->cells);
+    g_hash_table_destroy (index->large);
+    g_hash_table_destroy (index->entries);
+    g_free (index);
+}
+
+/**
+ * eel_canvas_group_set_spatial_index:
+ * @group: A canvas group.
+ * @enabled: Whether to index the children of the group.
+ *
+ * Keeps an index of the children of @group by their bounds, which drawing,
+ * picking and eel_canvas_group_get_items_in_area() use to only look at the
+ * children in the area concerned.  This pays off for groups with many
+ * children spread out over a large canvas, like the icons of a big folder.
+ **/
+void
+eel_canvas_group_set_spatial_index (EelCanvasGroup *group, gboolean enabled)
+{
+    EelCanvasGroupIndex *index;
+    GList *list;
+
+    g_return_if_fail (EEL_IS_CANVAS_GROUP (group));
+
+    if (enabled == (group->spatial_index != NULL))
+        return;
+
+    if (!enabled)
+    {
+        group_index_free (group->spatial_index);
+        group->spatial_index = NULL;
+        return;
+    }
+
+    index = g_new0 (EelCanvasGroupIndex, 1);
+    index->entries = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+    index->cells = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) g_hash_table_unref);
+    index->large = g_hash_table_new (NULL, NULL);
+
+    for (list = group->item_list; list; list = list->next)
+        group_index_add_item (index, list->data);
+
+    group->spatial_index = index;
+}
+
+/**
+ * eel_canvas_group_get_items_in_area:
+ * @group: A canvas group.
+ * @x1: Left edge of the area, in canvas pixels.
+ * @y1: Top edge of the area, in canvas pixels.
+ * @x2: Right edge of the area, in canvas pixels.
+ * @y2: Bottom edge of the area, in canvas pixels.
+ *
+ * Finds the children of @group whose bounding box intersects the area.
+ *
+ * Return value: The children found, from the bottom of the stack to the top.
+ * Free the list with g_list_free().
+ **/
+GList *
+eel_canvas_group_get_items_in_area (EelCanvasGroup *group,
+                                    int x1, int y1, int x2, int y2)
+{
+    GPtrArray *children;
+    GList *result, *list;
+    EelCanvasItem *child;
+    guint i;
+
+    g_return_val_if_fail (EEL_IS_CANVAS_GROUP (group), NULL);
+
+    result = NULL;
+
+    children = group->spatial_index ? group_index_query (group, x1, y1, x2, y2) : NULL;
+    if (children != NULL)
+    {
+        for (i = children->len; i > 0; i--)
+            result = g_list_prepend (result, g_ptr_array_index (children, i - 1));
+        g_ptr_array_free (children, TRUE);
+
+        return result;
+    }
+
+    for (list = group->item_list_end; list; list = list->prev)
+    {
+        child = list->data;
+
+        if ((child->x1 > x2) || (child->y1 > y2) || (child->x2 < x1) || (child->y2 < y1))
+            continue;
+
+        result = g_list_prepend (result, child);
+    }
+
+    return result;
+}
+
 /**
  * eel_canvas_group_get_type:
  *
@@ -1412,6 +1808,8 @@ eel_canvas_group_destroy (EelCanvasItem *object)
         eel_canvas_item_destroy (child);
     }
 
+    eel_canvas_group_set_spatial_index (group, FALSE);
+
     if (EEL_CANVAS_ITEM_CLASS (group_parent_class)->destroy)
         (* EEL_CANVAS_ITEM_CLASS (group_parent_class)->destroy) (object);
 }
@@ -1441,6 +1839,9 @@ eel_canvas_group_update (EelCanvasItem *item, double i2w_dx, double i2w_dy, int
 
         eel_canvas_item_invoke_update (i, i2w_dx + group->xpos, i2w_dy + group->ypos, flags);
 
+        if (group->spatial_index)
+            group_index_update_item (group->spatial_index, i);
+
         if (first)
         {
             first = FALSE;
@@ -1536,6 +1937,26 @@ eel_canvas_group_unmap (EelCanvasItem *item)
     (* group_parent_class->unmap) (item);
 }
 
+static void
+group_draw_child (EelCanvasItem  *child,
+                  cairo_t        *cr,
+                  cairo_region_t *region)
+{
+    if ((child->flags & EEL_CANVAS_ITEM_MAPPED) &&
+            (EEL_CANVAS_ITEM_GET_CLASS (child)->draw))
+    {
+        GdkRectangle child_rect;
+
+        child_rect.x = child->x1;
+        child_rect.y = child->y1;
+        child_rect.width = child->x2 - child->x1 + 1;
+        child_rect.height = child->y2 - child->y1 + 1;
+
+        if (cairo_region_contains_rectangle (region, &child_rect) != CAIRO_REGION_OVERLAP_OUT)
+            EEL_CANVAS_ITEM_GET_CLASS (child)->draw (child, cr, region);
+    }
+}
+
 /* Draw handler for canvas groups */
 static void
 eel_canvas_group_draw (EelCanvasItem  *item,
@@ -1544,28 +1965,64 @@ eel_canvas_group_draw (EelCanvasItem  *item,
 {
     EelCanvasGroup *group;
     GList *list;
-    EelCanvasItem *child = NULL;
+    GPtrArray *children;
+    cairo_rectangle_int_t extents;
+    guint i;
 
     group = EEL_CANVAS_GROUP (item);
 
-    for (list = group->item_list; list; list = list->next)
+    children = NULL;
+    if (group->spatial_index)
     {
-        child = list->data;
+        /* A pixel of slack, the bounds are rounded when drawing */
+        cairo_region_get_extents (region, &extents);
+        children = group_index_query (group,
+                                      extents.x - 1, extents.y - 1,
+                                      extents.x + extents.width,
+                                      extents.y + extents.height);
+    }
 
-        if ((child->flags & EEL_CANVAS_ITEM_MAPPED) &&
-                (EEL_CANVAS_ITEM_GET_CLASS (child)->draw))
-        {
-            GdkRectangle child_rect;
+    if (children != NULL)
+    {
+        for (i = 0; i < children->len; i++)
+            group_draw_child (g_ptr_array_index (children, i), cr, region);
+        g_ptr_array_free (children, TRUE);
+        return;
+    }
 
-            child_rect.x = child->x1;
-            child_rect.y = child->y1;
-            child_rect.width = child->x2 - child->x1 + 1;
-            child_rect.height = child->y2 - child->y1 + 1;
+    for (list = group->item_list; list; list = list->next)
+        group_draw_child (list->data, cr, region);
+}
 
-            if (cairo_region_contains_rectangle (region, &child_rect) != CAIRO_REGION_OVERLAP_OUT)
-                EEL_CANVAS_ITEM_GET_CLASS (child)->draw (child, cr, region);
-        }
-    }
+/* Checks whether the point hits a child of the group, the coordinates are
+ * relative to the group.  Returns TRUE and the distance and item hit if so.
+ */
+static gboolean
+group_point_child (EelCanvasItem *item, EelCanvasItem *child,
+                   double gx, double gy, int cx, int cy,
+                   double *dist, EelCanvasItem **point_item)
+{
+    int x1, y1, x2, y2;
+
+    x1 = cx - item->canvas->close_enough;
+    y1 = cy - item->canvas->close_enough;
+    x2 = cx + item->canvas->close_enough;
+    y2 = cy + item->canvas->close_enough;
+
+    if ((child->x1 > x2) || (child->y1 > y2) || (child->x2 < x1) || (child->y2 < y1))
+        return FALSE;
+
+    *point_item = NULL; /* cater for incomplete item implementations */
+
+    if (!(child->flags & EEL_CANVAS_ITEM_MAPPED)
+            || !EEL_CANVAS_ITEM_GET_CLASS (child)->point)
+        return FALSE;
+
+    *dist = eel_canvas_item_invoke_point (child, gx, gy, cx, cy, point_item);
+
+    return *point_item
+           && ((int) (*dist * item->canvas->pixels_per_unit + 0.5)
+               <= item->canvas->close_enough);
 }
 
 /* Point handler for canvas groups */
@@ -1573,22 +2030,16 @@ static double
 eel_canvas_group_point (EelCanvasItem *item, double x, double y, int cx, int cy,
                         EelCanvasItem **actual_item)
 {
-    int x1, y1, x2, y2;
     double gx, gy;
     double dist, best;
-    int has_point;
     EelCanvasGroup *group;
     GList *list;
+    GPtrArray *children;
     EelCanvasItem *point_item;
-    EelCanvasItem *child = NULL;
+    guint i;
 
     group = EEL_CANVAS_GROUP (item);
 
-    x1 = cx - item->canvas->close_enough;
-    y1 = cy - item->canvas->close_enough;
-    x2 = cx + item->canvas->close_enough;
-    y2 = cy + item->canvas->close_enough;
-
     best = 0.0;
     *actual_item = NULL;
 
@@ -1597,28 +2048,35 @@ eel_canvas_group_point (EelCanvasItem *item, double x, double y, int cx, int cy,
 
     dist = 0.0; /* keep gcc happy */
 
-    for (list = group->item_list; list; list = list->next)
-    {
-        child = list->data;
-
-        if ((child->x1 > x2) || (child->y1 > y2) || (child->x2 < x1) || (child->y2 < y1))
-            continue;
+    /* The topmost child hit wins, so all of them are checked in stacking order */
 
-        point_item = NULL; /* cater for incomplete item implementations */
+    children = NULL;
+    if (group->spatial_index)
+        children = group_index_query (group,
+                                      cx - item->canvas->close_enough,
+                                      cy - item->canvas->close_enough,
+                                      cx + item->canvas->close_enough,
+                                      cy + item->canvas->close_enough);
 
-        if ((child->flags & EEL_CANVAS_ITEM_MAPPED)
-                && EEL_CANVAS_ITEM_GET_CLASS (child)->point)
+    if (children != NULL)
+    {
+        for (i = 0; i < children->len; i++)
         {
-            dist = eel_canvas_item_invoke_point (child, gx, gy, cx, cy, &point_item);
-            has_point = TRUE;
+            if (group_point_child (item, g_ptr_array_index (children, i),
+                                   gx, gy, cx, cy, &dist, &point_item))
+            {
+                best = dist;
+                *actual_item = point_item;
+            }
         }
-        else
-            has_point = FALSE;
+        g_ptr_array_free (children, TRUE);
+
+        return best;
+    }
 
-        if (has_point
-                && point_item
-                && ((int) (dist * item->canvas->pixels_per_unit + 0.5)
-                    <= item->canvas->close_enough))
+    for (list = group->item_list; list; list = list->next)
+    {
+        if (group_point_child (item, list->data, gx, gy, cx, cy, &dist, &point_item))
         {
             best = dist;
             *actual_item = point_item;
@@ -1734,6 +2192,9 @@ group_add (EelCanvasGroup *group, EelCanvasItem *item)
     else
         group->item_list_end = g_list_append (group->item_list_end, item)->next;
 
+    if (group->spatial_index)
+        group_index_add_item (group->spatial_index, item);
+
     if (item->flags & EEL_CANVAS_ITEM_VISIBLE &&
             group->item.flags & EEL_CANVAS_ITEM_MAPPED)
     {
@@ -1770,6 +2231,9 @@ group_remove (EelCanvasGroup *group, EelCanvasItem *item)
             if (item->flags & EEL_CANVAS_ITEM_VISIBLE)
                     eel_canvas_queue_resize (item->canvas);
 
+            if (group->spatial_index)
+                group_index_remove_item (group->spatial_index, item);
+
             /* Unparent the child */
 
             item->parent = NULL;
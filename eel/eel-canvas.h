@@ -69,6 +69,7 @@ extern "C" {
     typedef struct _EelCanvasItemClass  EelCanvasItemClass;
     typedef struct _EelCanvasGroup      EelCanvasGroup;
     typedef struct _EelCanvasGroupClass EelCanvasGroupClass;
+    typedef struct _EelCanvasGroupIndex EelCanvasGroupIndex;
 
     /* EelCanvasItem - base item class for canvas items
      *
@@ -327,6 +328,9 @@ extern "C" {
         /* Children of the group */
         GList *item_list;
         GList *item_list_end;
+
+        /* Children by position, if enabled with eel_canvas_group_set_spatial_index() */
+        EelCanvasGroupIndex *spatial_index;
     };
 
     struct _EelCanvasGroupClass
@@ -337,6 +341,20 @@ extern "C" {
     /* Standard Gtk function */
     GType eel_canvas_group_get_type (void) G_GNUC_CONST;
 
+    /* Keeps an index of the children by their bounds, so that drawing and
+     * picking only look at the children in the area concerned instead of
+     * all of them.  Worth it for groups with many children spread out over
+     * a large canvas.
+     */
+    void eel_canvas_group_set_spatial_index (EelCanvasGroup *group, gboolean enabled);
+
+    /* Returns the children whose bounding box, in canvas pixel coordinates,
+     * intersects the given rectangle, from the bottom of the stack to the
+     * top.  The list must be freed with g_list_free().
+     */
+    GList *eel_canvas_group_get_items_in_area (EelCanvasGroup *group,
+            int x1, int y1, int x2, int y2);
+
     /*** EelCanvas ***/
 
 #define EEL_TYPE_CANVAS            (eel_canvas_get_type ())
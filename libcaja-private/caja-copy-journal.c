@@ -0,0 +1,653 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*-
+
+   caja-copy-journal.c: checkpoints of running copy and move jobs.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, write to the
+   Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include <config.h>
+#ifdef HAVE_SYNCFS
+/* for syncfs() */
+#define _GNU_SOURCE
+#endif
+#include "caja-copy-journal.h"
+
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "caja-file-utilities.h"
+
+/* A journal is a text file, one record per line, appended to as the
+ * job goes:
+ *
+ *   caja-copy-journal 1
+ *   copy                          or "move"
+ *   dest <uri>                    the destination folder
+ *   src <uri>                     one line per file given to the job
+ *   D <uri>                       a file that is finished
+ *   F <size> <mtime> <src> <dest> a large file that was started
+ *   P <offset>                    how far the last started file got
+ *
+ * "D" records are only written once the destination is synced. A
+ * crash can leave the last line unfinished, it is cut off when the
+ * journal is opened again. Running jobs keep their journal locked with
+ * flock(), so journals that can be locked belong to jobs that are gone.
+ */
+
+#define JOURNAL_MAGIC "caja-copy-journal 1"
+#define JOURNAL_SUFFIX ".journal"
+
+/* Finished files are written out this often, losing a few of them
+ * only costs copying them again when resuming. Each write syncs the
+ * destination first, so it is not done too often.
+ */
+#define JOURNAL_FLUSH_INTERVAL (2 * G_USEC_PER_SEC)
+
+struct CajaCopyJournal
+{
+    char *path;
+    FILE *stream;
+    gboolean failed;
+    gint64 last_flush;
+    /* "D" records held back until the files are synced */
+    GString *unflushed_done;
+
+    gboolean is_move;
+    GList *files;
+    GFile *destination;
+
+    /* What the interrupted job got done, only set when resuming */
+    gboolean resumed;
+    GHashTable *done;
+    char *partial_uri;
+    char *partial_dest_uri;
+    goffset partial_offset;
+    goffset partial_size;
+    guint64 partial_mtime;
+};
+
+static char *
+get_journal_directory (void)
+{
+    char *user_directory, *path;
+
+    user_directory = caja_get_user_directory ();
+    path = g_build_filename (user_directory, "journals", NULL);
+    g_free (user_directory);
+
+    g_mkdir_with_parents (path, 0700);
+
+    return path;
+}
+
+static void
+journal_write (CajaCopyJournal *journal,
+               const char *format,
+               ...)
+{
+    va_list args;
+
+    if (journal->failed)
+    {
+        return;
+    }
+
+    va_start (args, format);
+    if (vfprintf (journal->stream, format, args) < 0)
+    {
+        /* A journal with holes could skip files that were never
+         * copied, better to have none.
+         */
+        journal->failed = TRUE;
+    }
+    va_end (args);
+}
+
+static void
+journal_write_uri (CajaCopyJournal *journal,
+                   const char *prefix,
+                   GFile *file)
+{
+    char *uri;
+
+    uri = g_file_get_uri (file);
+    journal_write (journal, "%s %s\n", prefix, uri);
+    g_free (uri);
+}
+
+CajaCopyJournal *
+caja_copy_journal_new (gboolean is_move,
+                       GList *files,
+                       GFile *destination)
+{
+    CajaCopyJournal *journal;
+    char *directory;
+    GList *l;
+    int fd;
+
+    journal = g_new0 (CajaCopyJournal, 1);
+
+    directory = get_journal_directory ();
+    journal->path = g_build_filename (directory, "XXXXXX" JOURNAL_SUFFIX, NULL);
+    g_free (directory);
+
+    fd = g_mkstemp_full (journal->path, O_WRONLY | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        g_free (journal->path);
+        g_free (journal);
+        return NULL;
+    }
+    /* An unlocked journal would be taken for an interrupted job */
+    if (flock (fd, LOCK_EX | LOCK_NB) != 0 ||
+        (journal->stream = fdopen (fd, "w")) == NULL)
+    {
+        g_unlink (journal->path);
+        close (fd);
+        g_free (journal->path);
+        g_free (journal);
+        return NULL;
+    }
+
+    journal->unflushed_done = g_string_new (NULL);
+
+    journal->is_move = is_move;
+    journal->files = g_list_copy_deep (files, (GCopyFunc) g_object_ref, NULL);
+    journal->destination = g_object_ref (destination);
+
+    journal_write (journal, "%s\n%s\n", JOURNAL_MAGIC, is_move ? "move" : "copy");
+    journal_write_uri (journal, "dest", destination);
+    for (l = files; l != NULL; l = l->next)
+    {
+        journal_write_uri (journal, "src", l->data);
+    }
+    caja_copy_journal_flush (journal);
+
+    if (journal->failed)
+    {
+        caja_copy_journal_free (journal, TRUE);
+        return NULL;
+    }
+
+    return journal;
+}
+
+/* Reads "<size> <mtime> <src> <dest>", URIs have no spaces */
+static gboolean
+parse_started_record (const char *record,
+                      goffset *size,
+                      guint64 *mtime,
+                      char **src_uri,
+                      char **dest_uri)
+{
+    const char *uri, *space;
+    char *end;
+
+    *size = g_ascii_strtoll (record, &end, 10);
+    if (end == record || *end != ' ')
+    {
+        return FALSE;
+    }
+    record = end + 1;
+    *mtime = g_ascii_strtoull (record, &end, 10);
+    if (end == record || *end != ' ')
+    {
+        return FALSE;
+    }
+    uri = end + 1;
+    space = strchr (uri, ' ');
+    if (space == NULL || space == uri || space[1] == '\0')
+    {
+        return FALSE;
+    }
+    *src_uri = g_strndup (uri, space - uri);
+    *dest_uri = g_strdup (space + 1);
+
+    return TRUE;
+}
+
+static gboolean
+journal_parse (CajaCopyJournal *journal,
+               const char *contents)
+{
+    char **lines;
+    const char *line;
+    char *src_uri, *dest_uri;
+    goffset size;
+    guint64 mtime;
+    guint n_lines, i;
+
+    lines = g_strsplit (contents, "\n", -1);
+    n_lines = g_strv_length (lines);
+
+    /* The last element is empty, or a line cut short */
+    if (n_lines < 3 ||
+        strcmp (lines[0], JOURNAL_MAGIC) != 0 ||
+        (strcmp (lines[1], "copy") != 0 && strcmp (lines[1], "move") != 0))
+    {
+        g_strfreev (lines);
+        return FALSE;
+    }
+    journal->is_move = strcmp (lines[1], "move") == 0;
+
+    journal->done = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    for (i = 2; i < n_lines - 1; i++)
+    {
+        line = lines[i];
+
+        if (g_str_has_prefix (line, "D "))
+        {
+            if (g_strcmp0 (journal->partial_uri, line + 2) == 0)
+            {
+                g_clear_pointer (&journal->partial_uri, g_free);
+            }
+            g_hash_table_add (journal->done, g_strdup (line + 2));
+        }
+        else if (g_str_has_prefix (line, "F "))
+        {
+            if (parse_started_record (line + 2, &size, &mtime, &src_uri, &dest_uri))
+            {
+                g_free (journal->partial_uri);
+                g_free (journal->partial_dest_uri);
+                journal->partial_uri = src_uri;
+                journal->partial_dest_uri = dest_uri;
+                journal->partial_size = size;
+                journal->partial_mtime = mtime;
+                journal->partial_offset = 0;
+            }
+        }
+        else if (g_str_has_prefix (line, "P "))
+        {
+            journal->partial_offset = g_ascii_strtoll (line + 2, NULL, 10);
+        }
+        else if (g_str_has_prefix (line, "src "))
+        {
+            journal->files = g_list_prepend (journal->files,
+                                             g_file_new_for_uri (line + 4));
+        }
+        else if (g_str_has_prefix (line, "dest ") && journal->destination == NULL)
+        {
+            journal->destination = g_file_new_for_uri (line + 5);
+        }
+    }
+    journal->files = g_list_reverse (journal->files);
+
+    g_strfreev (lines);
+
+    return journal->files != NULL && journal->destination != NULL;
+}
+
+/* Opens the journal of an interrupted job to resume it. New records
+ * are appended to it.
+ */
+CajaCopyJournal *
+caja_copy_journal_open (const char *path,
+                        GError **error)
+{
+    CajaCopyJournal *journal;
+    char *contents, *end;
+    gsize length;
+    int fd, errsv;
+
+    fd = g_open (path, O_RDWR | O_APPEND | O_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        errsv = errno;
+        g_set_error_literal (error, G_IO_ERROR,
+                             g_io_error_from_errno (errsv),
+                             g_strerror (errsv));
+        return NULL;
+    }
+    if (flock (fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_BUSY,
+                             "The job is still running");
+        close (fd);
+        return NULL;
+    }
+
+    if (!g_file_get_contents (path, &contents, &length, error))
+    {
+        close (fd);
+        return NULL;
+    }
+
+    journal = g_new0 (CajaCopyJournal, 1);
+    journal->path = g_strdup (path);
+    journal->resumed = TRUE;
+    journal->unflushed_done = g_string_new (NULL);
+
+    if (!journal_parse (journal, contents))
+    {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Not a copy journal");
+        g_free (contents);
+        close (fd);
+        caja_copy_journal_free (journal, FALSE);
+        return NULL;
+    }
+
+    /* Remove a line the crash cut short, so that the records appended
+     * now can't complete it into something else. The header parsed,
+     * so there is a complete line.
+     */
+    if (length > 0 && contents[length - 1] != '\n')
+    {
+        end = strrchr (contents, '\n');
+        if (ftruncate (fd, end + 1 - contents) != 0)
+        {
+            errsv = errno;
+            g_set_error_literal (error, G_IO_ERROR,
+                                 g_io_error_from_errno (errsv),
+                                 g_strerror (errsv));
+            g_free (contents);
+            close (fd);
+            caja_copy_journal_free (journal, FALSE);
+            return NULL;
+        }
+    }
+    g_free (contents);
+
+    journal->stream = fdopen (fd, "a");
+    if (journal->stream == NULL)
+    {
+        errsv = errno;
+        g_set_error_literal (error, G_IO_ERROR,
+                             g_io_error_from_errno (errsv),
+                             g_strerror (errsv));
+        close (fd);
+        caja_copy_journal_free (journal, FALSE);
+        return NULL;
+    }
+
+    return journal;
+}
+
+/* Closes @journal, and deletes it if @remove is set. */
+void
+caja_copy_journal_free (CajaCopyJournal *journal,
+                        gboolean remove)
+{
+    /* Delete before closing, closing gives up the lock */
+    if (remove)
+    {
+        g_unlink (journal->path);
+    }
+    if (journal->stream != NULL)
+    {
+        if (!remove)
+        {
+            caja_copy_journal_flush (journal);
+        }
+        fclose (journal->stream);
+    }
+    if (journal->unflushed_done != NULL)
+    {
+        g_string_free (journal->unflushed_done, TRUE);
+    }
+
+    g_list_free_full (journal->files, g_object_unref);
+    if (journal->destination != NULL)
+    {
+        g_object_unref (journal->destination);
+    }
+    if (journal->done != NULL)
+    {
+        g_hash_table_destroy (journal->done);
+    }
+    g_free (journal->partial_uri);
+    g_free (journal->partial_dest_uri);
+    g_free (journal->path);
+    g_free (journal);
+}
+
+/* Returns the paths of the journals left by jobs that did not finish. */
+GList *
+caja_copy_journal_list_interrupted (void)
+{
+    GDir *dir;
+    GList *paths;
+    const char *name;
+    char *directory, *path;
+    int fd;
+
+    directory = get_journal_directory ();
+    dir = g_dir_open (directory, 0, NULL);
+    if (dir == NULL)
+    {
+        g_free (directory);
+        return NULL;
+    }
+
+    paths = NULL;
+    while ((name = g_dir_read_name (dir)) != NULL)
+    {
+        if (!g_str_has_suffix (name, JOURNAL_SUFFIX))
+        {
+            continue;
+        }
+
+        path = g_build_filename (directory, name, NULL);
+        fd = g_open (path, O_RDONLY | O_CLOEXEC, 0);
+        if (fd >= 0 && flock (fd, LOCK_EX | LOCK_NB) == 0)
+        {
+            paths = g_list_prepend (paths, path);
+            path = NULL;
+        }
+        if (fd >= 0)
+        {
+            close (fd);
+        }
+        g_free (path);
+    }
+
+    g_dir_close (dir);
+    g_free (directory);
+
+    return g_list_sort (paths, (GCompareFunc) strcmp);
+}
+
+gboolean
+caja_copy_journal_get_is_move (CajaCopyJournal *journal)
+{
+    return journal->is_move;
+}
+
+GList *
+caja_copy_journal_get_files (CajaCopyJournal *journal)
+{
+    return journal->files;
+}
+
+GFile *
+caja_copy_journal_get_destination (CajaCopyJournal *journal)
+{
+    return journal->destination;
+}
+
+gboolean
+caja_copy_journal_is_resumed (CajaCopyJournal *journal)
+{
+    return journal->resumed;
+}
+
+/* Records that copying @src to @dest started, so that the copy can be
+ * continued from the last offset passed to
+ * caja_copy_journal_file_progress() if @src still has the same @size
+ * and @mtime.
+ */
+void
+caja_copy_journal_file_started (CajaCopyJournal *journal,
+                                GFile *src,
+                                GFile *dest,
+                                goffset size,
+                                guint64 mtime)
+{
+    char *src_uri, *dest_uri;
+
+    src_uri = g_file_get_uri (src);
+    dest_uri = g_file_get_uri (dest);
+    journal_write (journal, "F %" G_GOFFSET_FORMAT " %" G_GUINT64_FORMAT " %s %s\n",
+                   size, mtime, src_uri, dest_uri);
+    g_free (src_uri);
+    g_free (dest_uri);
+}
+
+/* Records that the file last started is written up to @offset. This
+ * goes to disk right away, so the caller has to make sure the data up
+ * to @offset is on disk already.
+ */
+void
+caja_copy_journal_file_progress (CajaCopyJournal *journal,
+                                 goffset offset)
+{
+    journal_write (journal, "P %" G_GOFFSET_FORMAT "\n", offset);
+    caja_copy_journal_flush (journal);
+    if (!journal->failed)
+    {
+        fsync (fileno (journal->stream));
+    }
+}
+
+void
+caja_copy_journal_file_done (CajaCopyJournal *journal,
+                             GFile *src)
+{
+    char *uri;
+    gint64 now;
+
+    uri = g_file_get_uri (src);
+    g_string_append_printf (journal->unflushed_done, "D %s\n", uri);
+    g_free (uri);
+
+    now = g_get_monotonic_time ();
+    if (now - journal->last_flush >= JOURNAL_FLUSH_INTERVAL)
+    {
+        caja_copy_journal_flush (journal);
+    }
+}
+
+/* Gets the copied files to the disk of the destination, so that a
+ * finished file is never written out before its data.
+ */
+static void
+sync_destination (CajaCopyJournal *journal)
+{
+    char *path;
+    int fd;
+
+    path = g_file_get_path (journal->destination);
+    if (path == NULL)
+    {
+        /* Remote copies are checked against the source on resume */
+        return;
+    }
+
+    fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    g_free (path);
+    if (fd < 0)
+    {
+        return;
+    }
+
+#ifdef HAVE_SYNCFS
+    syncfs (fd);
+#else
+    sync ();
+#endif
+    close (fd);
+}
+
+void
+caja_copy_journal_flush (CajaCopyJournal *journal)
+{
+    if (journal->unflushed_done->len > 0 && !journal->failed)
+    {
+        sync_destination (journal);
+        journal_write (journal, "%s", journal->unflushed_done->str);
+    }
+    g_string_truncate (journal->unflushed_done, 0);
+
+    if (!journal->failed && fflush (journal->stream) != 0)
+    {
+        journal->failed = TRUE;
+    }
+    journal->last_flush = g_get_monotonic_time ();
+}
+
+/* Returns TRUE if the interrupted job finished @src. */
+gboolean
+caja_copy_journal_is_done (CajaCopyJournal *journal,
+                           GFile *src)
+{
+    char *uri;
+    gboolean done;
+
+    if (journal->done == NULL ||
+        g_hash_table_size (journal->done) == 0)
+    {
+        return FALSE;
+    }
+
+    uri = g_file_get_uri (src);
+    done = g_hash_table_contains (journal->done, uri);
+    g_free (uri);
+
+    return done;
+}
+
+/* Returns TRUE if the interrupted job was in the middle of copying
+ * @src to @dest, with how far it got and what @src looked like then.
+ */
+gboolean
+caja_copy_journal_get_partial (CajaCopyJournal *journal,
+                               GFile *src,
+                               GFile *dest,
+                               goffset *offset,
+                               goffset *size,
+                               guint64 *mtime)
+{
+    char *src_uri, *dest_uri;
+    gboolean partial;
+
+    if (journal->partial_uri == NULL)
+    {
+        return FALSE;
+    }
+
+    src_uri = g_file_get_uri (src);
+    dest_uri = g_file_get_uri (dest);
+    partial = strcmp (src_uri, journal->partial_uri) == 0 &&
+              strcmp (dest_uri, journal->partial_dest_uri) == 0;
+    g_free (src_uri);
+    g_free (dest_uri);
+
+    if (partial)
+    {
+        *offset = journal->partial_offset;
+        *size = journal->partial_size;
+        *mtime = journal->partial_mtime;
+    }
+
+    return partial;
+}
@@ -0,0 +1,67 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*-
+
+   caja-copy-journal.h: checkpoints of running copy and move jobs.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public
+   License along with this program; if not, write to the
+   Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef CAJA_COPY_JOURNAL_H
+#define CAJA_COPY_JOURNAL_H
+
+#include <gio/gio.h>
+
+/* A journal records what a copy or move job has finished, so that an
+ * interrupted job can be resumed later. Journals are removed when
+ * their job completes; anything left over belongs to a job that did
+ * not. A journal is only used from one thread at a time.
+ */
+typedef struct CajaCopyJournal CajaCopyJournal;
+
+CajaCopyJournal *caja_copy_journal_new                (gboolean         is_move,
+        GList           *files,
+        GFile           *destination);
+CajaCopyJournal *caja_copy_journal_open               (const char      *path,
+        GError         **error);
+void             caja_copy_journal_free               (CajaCopyJournal *journal,
+        gboolean         remove);
+GList *          caja_copy_journal_list_interrupted   (void);
+
+gboolean         caja_copy_journal_get_is_move        (CajaCopyJournal *journal);
+GList *          caja_copy_journal_get_files          (CajaCopyJournal *journal);
+GFile *          caja_copy_journal_get_destination    (CajaCopyJournal *journal);
+gboolean         caja_copy_journal_is_resumed         (CajaCopyJournal *journal);
+
+void             caja_copy_journal_file_started       (CajaCopyJournal *journal,
+        GFile           *src,
+        GFile           *dest,
+        goffset          size,
+        guint64          mtime);
+void             caja_copy_journal_file_progress      (CajaCopyJournal *journal,
+        goffset          offset);
+void             caja_copy_journal_file_done          (CajaCopyJournal *journal,
+        GFile           *src);
+void             caja_copy_journal_flush              (CajaCopyJournal *journal);
+
+gboolean         caja_copy_journal_is_done            (CajaCopyJournal *journal,
+        GFile           *src);
+gboolean         caja_copy_journal_get_partial        (CajaCopyJournal *journal,
+        GFile           *src,
+        GFile           *dest,
+        goffset         *offset,
+        goffset         *size,
+        guint64         *mtime);
+
+#endif /* CAJA_COPY_JOURNAL_H */
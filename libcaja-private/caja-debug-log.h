@@ -29,6 +29,7 @@
 
 #define CAJA_DEBUG_LOG_DOMAIN_USER "USER"   /* always enabled */
 #define CAJA_DEBUG_LOG_DOMAIN_ASYNC "async"	 /* when asynchronous notifications come in */
+#define CAJA_DEBUG_LOG_DOMAIN_THUMBNAILS "thumbnails" /* thumbnails made for icons that were not shown */
 #define CAJA_DEBUG_LOG_DOMAIN_GLOG "GLog"	 /* used for GLog messages; don't use it yourself */
 
 void caja_debug_log (gboolean is_milestone, const char *domain, const char *format, ...);
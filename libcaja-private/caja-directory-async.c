@@ -27,6 +27,7 @@
 #include <libxml/parser.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <eel/eel-glib-extensions.h>
 
@@ -56,11 +57,48 @@
 #define DEBUG_START_STOP
 #endif
 
-#define DIRECTORY_LOAD_ITEMS_PER_CALLBACK 100
-
-/* Keep async. jobs down to this number for all directories. */
+/* Enumerators start with small batches so the first files show up
+ * quickly, and grow them while handling a batch stays within the
+ * main loop budget.
+ */
+#define DIRECTORY_LOAD_MIN_ITEMS_PER_CALLBACK 32
+#define DIRECTORY_LOAD_MAX_ITEMS_PER_CALLBACK 4096
+#define DIRECTORY_LOAD_CALLBACK_BUDGET_USEC 8000
+
+/* Upper bound for the deep-count-threads preference. */
+#define DEEP_COUNT_MAX_THREADS 32
+
+/* How often the threaded deep count publishes intermediate totals. */
+#define DEEP_COUNT_UPDATE_INTERVAL_MSEC 100
+
+#define DEEP_COUNT_ATTRIBUTES \
+    G_FILE_ATTRIBUTE_STANDARD_NAME "," \
+    G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
+    G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+    G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE "," \
+    G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN "," \
+    G_FILE_ATTRIBUTE_STANDARD_IS_BACKUP "," \
+    G_FILE_ATTRIBUTE_ID_FILESYSTEM "," \
+    G_FILE_ATTRIBUTE_UNIX_DEVICE "," \
+    G_FILE_ATTRIBUTE_UNIX_INODE "," \
+    G_FILE_ATTRIBUTE_UNIX_NLINK
+
+/* Keep async. jobs down to this number for all local directories. */
 #define MAX_ASYNC_JOBS 10
 
+/* ... and to this number for each remote backend (scheme and host). */
+#define MAX_REMOTE_ASYNC_JOBS 4
+
+typedef struct
+{
+    int size;
+    gint64 requested_time;
+    gint64 received_time;
+    /* Of the last batch, taken when it arrives */
+    gint64 io_time;
+    guint n_items;
+} EnumeratorBatch;
+
 struct TopLeftTextReadState
 {
     CajaDirectory *directory;
@@ -104,6 +142,7 @@ struct DirectoryLoadState
     CajaDirectory *directory;
     GCancellable *cancellable;
     GFileEnumerator *enumerator;
+    EnumeratorBatch batch;
     GHashTable *load_mime_list_hash;
     CajaFile *load_directory_file;
     int load_file_count;
@@ -115,6 +154,7 @@ struct MimeListState
     CajaFile *mime_list_file;
     GCancellable *cancellable;
     GFileEnumerator *enumerator;
+    EnumeratorBatch batch;
     GHashTable *mime_list_hash;
 };
 
@@ -137,18 +177,49 @@ struct DirectoryCountState
     CajaFile *count_file;
     GCancellable *cancellable;
     GFileEnumerator *enumerator;
+    EnumeratorBatch batch;
     int file_count;
 };
 
+/* One thread of the parallel deep count. Each worker owns a deque of
+ * directories: it pushes and pops at the tail (depth first), idle
+ * workers steal from the head of the others. The counters are only
+ * written by the owning worker and read by the main loop without locks.
+ */
+typedef struct
+{
+    DeepCountState *state;
+    GThread *thread;
+    GMutex lock;
+    GQueue directories;
+    gint64 directory_count;
+    gint64 file_count;
+    gint64 unreadable_count;
+    gint64 size;
+    gint64 size_on_disk;
+} DeepCountWorker;
+
 struct DeepCountState
 {
     CajaDirectory *directory;
     GCancellable *cancellable;
     GFileEnumerator *enumerator;
+    EnumeratorBatch batch;
     GFile *deep_count_location;
     GList *deep_count_subdirectories;
-    GArray *seen_deep_count_inodes;
+    GHashTable *seen_deep_count_inodes;
+    GMutex seen_deep_count_inodes_lock;
     char *fs_id;
+
+    /* Used only by the threaded deep count. */
+    DeepCountWorker *workers;
+    guint n_workers;
+    gint pending_directories;
+    gint running_workers;
+    gboolean show_hidden_files;
+    GMutex idle_lock;
+    GCond idle_cond;
+    guint update_timeout_id;
 };
 
 typedef struct
@@ -187,9 +258,8 @@ typedef struct
 typedef gboolean (* RequestCheck) (Request);
 typedef gboolean (* FileCheck) (CajaFile *);
 
-/* Current number of async. jobs. */
-static int async_job_count;
-static GHashTable *waiting_directories;
+/* Async. job queues, keyed by backend. */
+static GHashTable *async_job_queues;
 #ifdef DEBUG_ASYNC_JOBS
 static GHashTable *async_jobs;
 #endif
@@ -353,14 +423,264 @@ caja_directory_verify_request_counts (CajaDirectory *directory)
 }
 #endif
 
-/* Start a job. This is really just a way of limiting the number of
- * async. requests that we issue at any given time. Without this, the
- * number of requests is unbounded.
+/* Adaptive batch size for g_file_enumerator_next_files_async. */
+static int
+enumerator_batch_next_size (EnumeratorBatch *batch)
+{
+    if (batch->size == 0)
+    {
+        batch->size = DIRECTORY_LOAD_MIN_ITEMS_PER_CALLBACK;
+    }
+    batch->requested_time = g_get_monotonic_time ();
+
+    return batch->size;
+}
+
+/* Call when a batch of @n_items arrives, before the next one is
+ * requested.
+ */
+static void
+enumerator_batch_received (EnumeratorBatch *batch,
+                           guint n_items)
+{
+    batch->received_time = g_get_monotonic_time ();
+    batch->io_time = batch->received_time - batch->requested_time;
+    batch->n_items = n_items;
+}
+
+/* Call once @n_items have been handled, which took @handling_time. They
+ * can come from more than one batch. Halves the batch if handling took
+ * longer than the main loop budget, otherwise grows it when the
+ * enumerator could fill the last one, faster if the I/O round trip
+ * itself is slow, but never beyond what fits in the budget at the
+ * measured per-item cost.
+ */
+static void
+enumerator_batch_handled (EnumeratorBatch *batch,
+                          guint n_items,
+                          gint64 handling_time)
+{
+    gint64 limit;
+
+    if (n_items == 0 || batch->requested_time == 0)
+    {
+        return;
+    }
+
+    if (handling_time > DIRECTORY_LOAD_CALLBACK_BUDGET_USEC)
+    {
+        batch->size = MAX (DIRECTORY_LOAD_MIN_ITEMS_PER_CALLBACK, batch->size / 2);
+        return;
+    }
+
+    if ((int) batch->n_items < batch->size)
+    {
+        return;
+    }
+
+    batch->size *= batch->io_time > DIRECTORY_LOAD_CALLBACK_BUDGET_USEC ? 4 : 2;
+    if (handling_time > 0)
+    {
+        limit = DIRECTORY_LOAD_CALLBACK_BUDGET_USEC * (gint64) n_items / handling_time;
+        batch->size = MIN (batch->size, MAX (limit, DIRECTORY_LOAD_MIN_ITEMS_PER_CALLBACK));
+    }
+    batch->size = MIN (batch->size, DIRECTORY_LOAD_MAX_ITEMS_PER_CALLBACK);
+}
+
+/* Call once the last batch has been handled right where it arrived */
+static void
+enumerator_batch_processed (EnumeratorBatch *batch)
+{
+    enumerator_batch_handled (batch, batch->n_items,
+                              g_get_monotonic_time () - batch->received_time);
+}
+
+/* Priority classes of async. jobs. Jobs that fill in what is visible
+ * in a view are started ahead of background work, and background work
+ * may only use part of a backend's budget so it never starves them.
+ */
+typedef enum
+{
+    ASYNC_JOB_PRIORITY_HIGH,
+    ASYNC_JOB_PRIORITY_NORMAL,
+    ASYNC_JOB_PRIORITY_LOW,
+    ASYNC_JOB_PRIORITY_LAST
+} AsyncJobPriority;
+
+static const struct
+{
+    const char *job;
+    AsyncJobPriority priority;
+} async_job_priorities[] =
+{
+    { "file list", ASYNC_JOB_PRIORITY_HIGH },
+    { "file info", ASYNC_JOB_PRIORITY_HIGH },
+    { "link info", ASYNC_JOB_PRIORITY_HIGH },
+    { "mount", ASYNC_JOB_PRIORITY_HIGH },
+    { "filesystem info", ASYNC_JOB_PRIORITY_HIGH },
+    { "directory count", ASYNC_JOB_PRIORITY_NORMAL },
+    { "top left", ASYNC_JOB_PRIORITY_NORMAL },
+    { "thumbnail", ASYNC_JOB_PRIORITY_NORMAL },
+    { "extension info", ASYNC_JOB_PRIORITY_NORMAL },
+    { "deep count", ASYNC_JOB_PRIORITY_LOW },
+    { "MIME list", ASYNC_JOB_PRIORITY_LOW }
+};
+
+/* Jobs are scheduled per backend: one queue for local files and one
+ * for each remote scheme and host, so a slow mount can only use up its
+ * own budget.
+ */
+struct AsyncJobQueue
+{
+    char *backend;
+    int max_jobs;
+    int running[ASYNC_JOB_PRIORITY_LAST];
+    GQueue waiting[ASYNC_JOB_PRIORITY_LAST];
+    guint64 started;
+    guint64 blocked;
+};
+
+static AsyncJobPriority
+async_job_get_priority (const char *job)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (async_job_priorities); i++)
+    {
+        if (strcmp (async_job_priorities[i].job, job) == 0)
+        {
+            return async_job_priorities[i].priority;
+        }
+    }
+
+    g_assert_not_reached ();
+    return ASYNC_JOB_PRIORITY_LOW;
+}
+
+static char *
+async_job_get_backend (CajaDirectory *directory)
+{
+    GFile *location;
+    char *uri, *authority_end;
+    const char *authority;
+
+    location = directory->details->location;
+    if (location == NULL || g_file_is_native (location))
+    {
+        return g_strdup ("file");
+    }
+
+    /* Use the scheme and host, e.g. "sftp://user@host". */
+    uri = g_file_get_uri (location);
+    authority = strstr (uri, "://");
+    if (authority != NULL)
+    {
+        authority_end = strchr (authority + 3, '/');
+        if (authority_end != NULL)
+        {
+            *authority_end = '\0';
+        }
+    }
+
+    return uri;
+}
+
+static AsyncJobQueue *
+async_job_get_queue (CajaDirectory *directory)
+{
+    AsyncJobQueue *queue;
+    char *backend;
+    int i;
+
+    /* Look the queue up once and keep it, so jobs keep ending in the
+     * queue they started in even if the directory is moved.
+     */
+    if (directory->details->async_job_queue != NULL)
+    {
+        return directory->details->async_job_queue;
+    }
+
+    if (async_job_queues == NULL)
+    {
+        async_job_queues = eel_g_hash_table_new_free_at_exit
+                           (g_str_hash, g_str_equal,
+                            "caja-directory-async.c: async_job_queues");
+    }
+
+    backend = async_job_get_backend (directory);
+    queue = g_hash_table_lookup (async_job_queues, backend);
+    if (queue == NULL)
+    {
+        queue = g_new0 (AsyncJobQueue, 1);
+        queue->backend = backend;
+        queue->max_jobs = strcmp (backend, "file") == 0 ?
+                          MAX_ASYNC_JOBS : MAX_REMOTE_ASYNC_JOBS;
+        for (i = 0; i < ASYNC_JOB_PRIORITY_LAST; i++)
+        {
+            g_queue_init (&queue->waiting[i]);
+        }
+        g_hash_table_insert (async_job_queues, queue->backend, queue);
+    }
+    else
+    {
+        g_free (backend);
+    }
+
+    directory->details->async_job_queue = queue;
+
+    return queue;
+}
+
+static int
+async_job_queue_get_running (AsyncJobQueue *queue)
+{
+    int i, running;
+
+    running = 0;
+    for (i = 0; i < ASYNC_JOB_PRIORITY_LAST; i++)
+    {
+        running += queue->running[i];
+    }
+
+    return running;
+}
+
+/* Background classes get a shrinking share of the budget: all of it
+ * for HIGH, three quarters for NORMAL and half for LOW, but always at
+ * least one slot.
+ */
+static gboolean
+async_job_queue_can_start (AsyncJobQueue *queue,
+                           AsyncJobPriority priority)
+{
+    int limit;
+
+    switch (priority)
+    {
+    case ASYNC_JOB_PRIORITY_HIGH:
+        limit = queue->max_jobs;
+        break;
+    case ASYNC_JOB_PRIORITY_NORMAL:
+        limit = MAX (1, queue->max_jobs * 3 / 4);
+        break;
+    default:
+        limit = MAX (1, queue->max_jobs / 2);
+        break;
+    }
+
+    return async_job_queue_get_running (queue) < limit;
+}
+
+/* Start a job. This is a way of limiting the number of async.
+ * requests that we issue at any given time for each backend. Without
+ * this, the number of requests is unbounded.
  */
 static gboolean
 async_job_start (CajaDirectory *directory,
                  const char *job)
 {
+    AsyncJobQueue *queue;
+    AsyncJobPriority priority;
 #ifdef DEBUG_ASYNC_JOBS
     char *key;
 #endif
@@ -369,21 +689,22 @@ async_job_start (CajaDirectory *directory,
     g_message ("starting %s in %p", job, directory->details->location);
 #endif
 
-    g_assert (async_job_count >= 0);
-    g_assert (async_job_count <= MAX_ASYNC_JOBS);
+    queue = async_job_get_queue (directory);
+    priority = async_job_get_priority (job);
+
+    g_assert (async_job_queue_get_running (queue) >= 0);
+    g_assert (async_job_queue_get_running (queue) <= queue->max_jobs);
 
-    if (async_job_count >= MAX_ASYNC_JOBS)
+    if (!async_job_queue_can_start (queue, priority))
     {
-        if (waiting_directories == NULL)
+        /* Wait at the end of the line, so that directories waiting
+         * on the same backend take turns.
+         */
+        if (g_queue_find (&queue->waiting[priority], directory) == NULL)
         {
-            waiting_directories = eel_g_hash_table_new_free_at_exit
-                                  (NULL, NULL,
-                                   "caja-directory-async.c: waiting_directories");
+            g_queue_push_tail (&queue->waiting[priority], directory);
         }
-
-        g_hash_table_insert (waiting_directories,
-                             directory,
-                             directory);
+        queue->blocked++;
 
         return FALSE;
     }
@@ -409,7 +730,8 @@ async_job_start (CajaDirectory *directory,
     }
 #endif
 
-    async_job_count += 1;
+    queue->running[priority] += 1;
+    queue->started += 1;
     return TRUE;
 }
 
@@ -418,6 +740,8 @@ static void
 async_job_end (CajaDirectory *directory,
                const char *job)
 {
+    AsyncJobQueue *queue;
+    AsyncJobPriority priority;
 #ifdef DEBUG_ASYNC_JOBS
     char *key;
     gpointer table_key, value;
@@ -427,7 +751,10 @@ async_job_end (CajaDirectory *directory,
     g_message ("stopping %s in %p", job, directory->details->location);
 #endif
 
-    g_assert (async_job_count > 0);
+    queue = async_job_get_queue (directory);
+    priority = async_job_get_priority (job);
+
+    g_assert (queue->running[priority] > 0);
 
 #ifdef DEBUG_ASYNC_JOBS
     {
@@ -450,65 +777,119 @@ async_job_end (CajaDirectory *directory,
     }
 #endif
 
-    async_job_count -= 1;
+    queue->running[priority] -= 1;
 }
 
-/* Helper to get one value from a hash table. */
 static void
-get_one_value_callback (gpointer key, gpointer value, gpointer callback_data)
+async_job_queue_wake_up (AsyncJobQueue *queue)
 {
-    gpointer *returned_value;
-
-    returned_value = callback_data;
-    *returned_value = value;
-}
-
-/* return a single value from a hash table. */
-static gpointer
-get_one_value (GHashTable *table)
-{
-    gpointer value;
+    AsyncJobPriority priority;
+    CajaDirectory *directory;
 
-    value = NULL;
-    if (table != NULL)
+    for (priority = ASYNC_JOB_PRIORITY_HIGH; priority < ASYNC_JOB_PRIORITY_LAST; priority++)
     {
-        g_hash_table_foreach (table, get_one_value_callback, &value);
+        while (async_job_queue_can_start (queue, priority))
+        {
+            directory = g_queue_pop_head (&queue->waiting[priority]);
+            if (directory == NULL)
+            {
+                break;
+            }
+            caja_directory_async_state_changed (directory);
+        }
     }
-    return value;
 }
 
 /* Wake up directories that are "blocked" as long as there are job
- * slots available.
+ * slots available in their backend.
  */
 static void
 async_job_wake_up (void)
 {
     static gboolean already_waking_up = FALSE;
-    gpointer value;
+    GList *queues, *l;
 
-    g_assert (async_job_count >= 0);
-    g_assert (async_job_count <= MAX_ASYNC_JOBS);
-
-    if (already_waking_up)
+    if (already_waking_up || async_job_queues == NULL)
     {
         return;
     }
 
+    /* Starting jobs can add queues for new backends to the table, so go
+     * through a copy. Queues are never removed until exit.
+     */
     already_waking_up = TRUE;
-    while (async_job_count < MAX_ASYNC_JOBS)
+    queues = g_hash_table_get_values (async_job_queues);
+    for (l = queues; l != NULL; l = l->next)
     {
-        value = get_one_value (waiting_directories);
-        if (value == NULL)
-        {
-            break;
-        }
-        g_hash_table_remove (waiting_directories, value);
-        caja_directory_async_state_changed
-        (CAJA_DIRECTORY (value));
+        async_job_queue_wake_up (l->data);
     }
+    g_list_free (queues);
     already_waking_up = FALSE;
 }
 
+static void
+async_job_forget_directory (CajaDirectory *directory)
+{
+    AsyncJobQueue *queue;
+    int i;
+
+    queue = directory->details->async_job_queue;
+    if (queue == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < ASYNC_JOB_PRIORITY_LAST; i++)
+    {
+        g_queue_remove_all (&queue->waiting[i], directory);
+    }
+}
+
+/**
+ * caja_directory_get_async_job_statistics:
+ *
+ * Describes the state of the async. job queues, one line per
+ * backend with the number of running and waiting jobs in each
+ * priority class, for debugging.
+ *
+ * Returns: a newly allocated string.
+ */
+char *
+caja_directory_get_async_job_statistics (void)
+{
+    GString *string;
+    GHashTableIter iter;
+    AsyncJobQueue *queue;
+    gpointer value;
+
+    string = g_string_new (NULL);
+    if (async_job_queues == NULL)
+    {
+        return g_string_free (string, FALSE);
+    }
+
+    g_hash_table_iter_init (&iter, async_job_queues);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+        queue = value;
+        g_string_append_printf (string,
+                                "%s: max %d, running %d/%d/%d, waiting %u/%u/%u, "
+                                "started %" G_GUINT64_FORMAT ", blocked %" G_GUINT64_FORMAT "\n",
+                                queue->backend,
+                                queue->max_jobs,
+                                queue->running[ASYNC_JOB_PRIORITY_HIGH],
+                                queue->running[ASYNC_JOB_PRIORITY_NORMAL],
+                                queue->running[ASYNC_JOB_PRIORITY_LOW],
+                                queue->waiting[ASYNC_JOB_PRIORITY_HIGH].length,
+                                queue->waiting[ASYNC_JOB_PRIORITY_NORMAL].length,
+                                queue->waiting[ASYNC_JOB_PRIORITY_LOW].length,
+                                queue->started,
+                                queue->blocked);
+    }
+
+    return g_string_free (string, FALSE);
+}
+
 static void
 directory_count_cancel (CajaDirectory *directory)
 {
@@ -893,7 +1274,7 @@ show_hidden_files_changed_callback (gpointer callback_data)
 }
 
 static gboolean
-should_skip_file (CajaDirectory *directory, GFileInfo *info)
+get_show_hidden_files (void)
 {
     static gboolean show_hidden_files_changed_callback_installed = FALSE;
 
@@ -910,7 +1291,13 @@ should_skip_file (CajaDirectory *directory, GFileInfo *info)
         show_hidden_files_changed_callback (NULL);
     }
 
-    if (!show_hidden_files && g_file_info_get_is_hidden (info))
+    return show_hidden_files;
+}
+
+static gboolean
+should_skip_file (CajaDirectory *directory, GFileInfo *info)
+{
+    if (!get_show_hidden_files () && g_file_info_get_is_hidden (info))
     {
         return TRUE;
     }
@@ -929,9 +1316,13 @@ dequeue_pending_idle_callback (gpointer callback_data)
     GFileInfo *file_info;
     const char *mimetype, *name;
     DirectoryLoadState *dir_load_state;
+    gint64 start_time;
+    guint n_items;
 
     directory = CAJA_DIRECTORY (callback_data);
 
+    start_time = g_get_monotonic_time ();
+
     caja_directory_ref (directory);
 
     directory->details->dequeue_pending_idle_id = 0;
@@ -953,9 +1344,11 @@ dequeue_pending_idle_callback (gpointer callback_data)
     dir_load_state = directory->details->directory_load_in_progress;
 
     /* Build a list of CajaFile objects. */
+    n_items = 0;
     for (node = pending_file_info; node != NULL; node = node->next)
     {
         file_info = node->data;
+        n_items++;
 
         name = g_file_info_get_name (file_info);
 
@@ -1039,6 +1432,17 @@ dequeue_pending_idle_callback (gpointer callback_data)
     caja_directory_emit_files_added (directory, added_files);
     caja_file_list_free (added_files);
 
+    /* The files of a batch are only queued where it arrives, the real
+     * work is done here. Its I/O time and size were taken back then,
+     * when the next batch was not requested yet. The views may have
+     * stopped the load.
+     */
+    if (directory->details->directory_load_in_progress != NULL)
+    {
+        enumerator_batch_handled (&directory->details->directory_load_in_progress->batch,
+                                  n_items, g_get_monotonic_time () - start_time);
+    }
+
     if (directory->details->directory_loaded &&
             !directory->details->directory_loaded_sent_notification)
     {
@@ -2200,6 +2604,7 @@ more_files_callback (GObject *source_object,
     error = NULL;
     files = g_file_enumerator_next_files_finish (state->enumerator,
             res, &error);
+    enumerator_batch_received (&state->batch, g_list_length (files));
 
     for (l = files; l != NULL; l = l->next)
     {
@@ -2216,7 +2621,7 @@ more_files_callback (GObject *source_object,
     else
     {
         g_file_enumerator_next_files_async (state->enumerator,
-                                            DIRECTORY_LOAD_ITEMS_PER_CALLBACK,
+                                            enumerator_batch_next_size (&state->batch),
                                             G_PRIORITY_DEFAULT,
                                             state->cancellable,
                                             more_files_callback,
@@ -2266,7 +2671,7 @@ enumerate_children_callback (GObject *source_object,
     {
         state->enumerator = enumerator;
         g_file_enumerator_next_files_async (state->enumerator,
-                                            DIRECTORY_LOAD_ITEMS_PER_CALLBACK,
+                                            enumerator_batch_next_size (&state->batch),
                                             G_PRIORITY_DEFAULT,
                                             state->cancellable,
                                             more_files_callback,
@@ -2633,8 +3038,10 @@ count_more_files_callback (GObject *source_object,
     error = NULL;
     files = g_file_enumerator_next_files_finish (state->enumerator,
             res, &error);
+    enumerator_batch_received (&state->batch, g_list_length (files));
 
     state->file_count += count_non_skipped_files (files);
+    enumerator_batch_processed (&state->batch);
 
     if (files == NULL)
     {
@@ -2645,7 +3052,7 @@ count_more_files_callback (GObject *source_object,
     else
     {
         g_file_enumerator_next_files_async (state->enumerator,
-                                            DIRECTORY_LOAD_ITEMS_PER_CALLBACK,
+                                            enumerator_batch_next_size (&state->batch),
                                             G_PRIORITY_DEFAULT,
                                             state->cancellable,
                                             count_more_files_callback,
@@ -2704,7 +3111,7 @@ count_children_callback (GObject *source_object,
     {
         state->enumerator = enumerator;
         g_file_enumerator_next_files_async (state->enumerator,
-                                            DIRECTORY_LOAD_ITEMS_PER_CALLBACK,
+                                            enumerator_batch_next_size (&state->batch),
                                             G_PRIORITY_DEFAULT,
                                             state->cancellable,
                                             count_more_files_callback,
@@ -2779,41 +3186,66 @@ directory_count_start (CajaDirectory *directory,
     g_object_unref (location);
 }
 
-static inline gboolean
-seen_inode (DeepCountState *state,
-            GFileInfo *info)
+typedef struct
 {
-    guint64 inode, inode2;
-    guint i;
+    guint64 device;
+    guint64 inode;
+} DeepCountInode;
 
-    inode = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+static guint
+deep_count_inode_hash (gconstpointer key)
+{
+    const DeepCountInode *id = key;
 
-    if (inode != 0)
-    {
-        for (i = 0; i < state->seen_deep_count_inodes->len; i++)
-        {
-            inode2 = g_array_index (state->seen_deep_count_inodes, guint64, i);
-            if (inode == inode2)
-            {
-                return TRUE;
-            }
-        }
-    }
+    return (guint) (id->inode ^ (id->inode >> 32) ^ (id->device * 31));
+}
 
-    return FALSE;
+static gboolean
+deep_count_inode_equal (gconstpointer a, gconstpointer b)
+{
+    const DeepCountInode *id_a = a;
+    const DeepCountInode *id_b = b;
+
+    return id_a->inode == id_b->inode && id_a->device == id_b->device;
 }
 
-static inline void
-mark_inode_as_seen (DeepCountState *state,
-                    GFileInfo *info)
+/* Returns TRUE if the (device, inode) pair of @info was already counted,
+ * otherwise records it and returns FALSE. Only entries that can have more
+ * than one name are recorded, so the set stays small on trees without
+ * hard links.
+ */
+static gboolean
+check_and_mark_inode_as_seen (DeepCountState *state,
+                              GFileInfo *info)
 {
-    guint64 inode;
+    DeepCountInode id;
+    gboolean seen;
+
+    id.inode = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+    if (id.inode == 0)
+    {
+        return FALSE;
+    }
+
+    if (g_file_info_get_file_type (info) != G_FILE_TYPE_DIRECTORY &&
+        g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_NLINK) &&
+        g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_NLINK) <= 1)
+    {
+        return FALSE;
+    }
 
-    inode = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
-    if (inode != 0)
+    id.device = g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+
+    g_mutex_lock (&state->seen_deep_count_inodes_lock);
+    seen = g_hash_table_contains (state->seen_deep_count_inodes, &id);
+    if (!seen)
     {
-        g_array_append_val (state->seen_deep_count_inodes, inode);
+        g_hash_table_add (state->seen_deep_count_inodes,
+                          g_memdup (&id, sizeof (DeepCountInode)));
     }
+    g_mutex_unlock (&state->seen_deep_count_inodes_lock);
+
+    return seen;
 }
 
 static void
@@ -2828,11 +3260,7 @@ deep_count_one (DeepCountState *state,
         return;
     }
 
-    is_seen_inode = seen_inode (state, info);
-    if (!is_seen_inode)
-    {
-        mark_inode_as_seen (state, info);
-    }
+    is_seen_inode = check_and_mark_inode_as_seen (state, info);
 
     file = state->directory->details->deep_count_file;
 
@@ -2892,7 +3320,21 @@ deep_count_state_free (DeepCountState *state)
         g_object_unref (state->deep_count_location);
     }
     g_list_free_full (state->deep_count_subdirectories, g_object_unref);
-    g_array_free (state->seen_deep_count_inodes, TRUE);
+    g_hash_table_destroy (state->seen_deep_count_inodes);
+    g_mutex_clear (&state->seen_deep_count_inodes_lock);
+    if (state->workers != NULL)
+    {
+        guint i;
+
+        for (i = 0; i < state->n_workers; i++)
+        {
+            g_list_free_full (state->workers[i].directories.head, g_object_unref);
+            g_mutex_clear (&state->workers[i].lock);
+        }
+        g_free (state->workers);
+        g_mutex_clear (&state->idle_lock);
+        g_cond_clear (&state->idle_cond);
+    }
     g_free (state->fs_id);
     g_free (state);
 }
@@ -2968,6 +3410,7 @@ deep_count_more_files_callback (GObject *source_object,
 
     files = g_file_enumerator_next_files_finish (state->enumerator,
             res, NULL);
+    enumerator_batch_received (&state->batch, g_list_length (files));
 
     for (l = files; l != NULL; l = l->next)
     {
@@ -2975,6 +3418,7 @@ deep_count_more_files_callback (GObject *source_object,
         deep_count_one (state, info);
         g_object_unref (info);
     }
+    enumerator_batch_processed (&state->batch);
 
     if (files == NULL)
     {
@@ -2987,7 +3431,7 @@ deep_count_more_files_callback (GObject *source_object,
     else
     {
         g_file_enumerator_next_files_async (state->enumerator,
-                                            DIRECTORY_LOAD_ITEMS_PER_CALLBACK,
+                                            enumerator_batch_next_size (&state->batch),
                                             G_PRIORITY_LOW,
                                             state->cancellable,
                                             deep_count_more_files_callback,
@@ -3031,7 +3475,7 @@ deep_count_callback (GObject *source_object,
     {
         state->enumerator = enumerator;
         g_file_enumerator_next_files_async (state->enumerator,
-                                            DIRECTORY_LOAD_ITEMS_PER_CALLBACK,
+                                            enumerator_batch_next_size (&state->batch),
                                             G_PRIORITY_LOW,
                                             state->cancellable,
                                             deep_count_more_files_callback,
@@ -3048,14 +3492,7 @@ deep_count_load (DeepCountState *state, GFile *location)
     g_message ("load_directory called to get deep file count for %p", location);
 #endif
     g_file_enumerate_children_async (state->deep_count_location,
-                                     G_FILE_ATTRIBUTE_STANDARD_NAME ","
-                                     G_FILE_ATTRIBUTE_STANDARD_TYPE ","
-                                     G_FILE_ATTRIBUTE_STANDARD_SIZE ","
-                                     G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE ","
-                                     G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN ","
-                                     G_FILE_ATTRIBUTE_STANDARD_IS_BACKUP ","
-                                     G_FILE_ATTRIBUTE_ID_FILESYSTEM ","
-                                     G_FILE_ATTRIBUTE_UNIX_INODE,
+                                     DEEP_COUNT_ATTRIBUTES,
                                      G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, /* flags */
                                      G_PRIORITY_LOW, /* prio */
                                      state->cancellable,
@@ -3063,6 +3500,334 @@ deep_count_load (DeepCountState *state, GFile *location)
                                      state);
 }
 
+static inline void
+deep_count_counter_add (gint64 *counter, gint64 value)
+{
+    __atomic_fetch_add (counter, value, __ATOMIC_RELAXED);
+}
+
+static inline gint64
+deep_count_counter_get (gint64 *counter)
+{
+    return __atomic_load_n (counter, __ATOMIC_RELAXED);
+}
+
+static void
+deep_count_worker_push (DeepCountWorker *worker,
+                        GFile *location)
+{
+    DeepCountState *state;
+
+    state = worker->state;
+
+    g_atomic_int_inc (&state->pending_directories);
+
+    g_mutex_lock (&worker->lock);
+    g_queue_push_tail (&worker->directories, location);
+    g_mutex_unlock (&worker->lock);
+
+    g_mutex_lock (&state->idle_lock);
+    g_cond_signal (&state->idle_cond);
+    g_mutex_unlock (&state->idle_lock);
+}
+
+static GFile *
+deep_count_worker_pop (DeepCountWorker *worker)
+{
+    DeepCountState *state;
+    GFile *location;
+    guint i, victim;
+
+    state = worker->state;
+
+    g_mutex_lock (&worker->lock);
+    location = g_queue_pop_tail (&worker->directories);
+    g_mutex_unlock (&worker->lock);
+
+    /* Nothing left of our own, steal the oldest (and therefore
+     * probably largest) subtree from another worker.
+     */
+    for (i = 1; location == NULL && i < state->n_workers; i++)
+    {
+        victim = (worker - state->workers + i) % state->n_workers;
+
+        g_mutex_lock (&state->workers[victim].lock);
+        location = g_queue_pop_head (&state->workers[victim].directories);
+        g_mutex_unlock (&state->workers[victim].lock);
+    }
+
+    return location;
+}
+
+static void
+deep_count_worker_one (DeepCountWorker *worker,
+                       GFile *location,
+                       GFileInfo *info)
+{
+    DeepCountState *state;
+    gboolean is_seen_inode;
+
+    state = worker->state;
+
+    if (!state->show_hidden_files && g_file_info_get_is_hidden (info))
+    {
+        return;
+    }
+
+    is_seen_inode = check_and_mark_inode_as_seen (state, info);
+
+    if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+    {
+        const char *fs_id;
+
+        deep_count_counter_add (&worker->directory_count, 1);
+
+        fs_id = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILESYSTEM);
+        if (g_strcmp0 (fs_id, state->fs_id) == 0)
+        {
+            deep_count_worker_push (worker,
+                                    g_file_get_child (location, g_file_info_get_name (info)));
+        }
+    }
+    else
+    {
+        deep_count_counter_add (&worker->file_count, 1);
+    }
+
+    if (!is_seen_inode && g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_STANDARD_SIZE))
+    {
+        deep_count_counter_add (&worker->size, g_file_info_get_size (info));
+    }
+    if (!is_seen_inode && g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE))
+    {
+        deep_count_counter_add (&worker->size_on_disk,
+                                g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE));
+    }
+}
+
+static void
+deep_count_worker_enumerate (DeepCountWorker *worker,
+                             GFile *location)
+{
+    GFileEnumerator *enumerator;
+    GFileInfo *info;
+    GCancellable *cancellable;
+
+    cancellable = worker->state->cancellable;
+
+    enumerator = g_file_enumerate_children (location,
+                                            DEEP_COUNT_ATTRIBUTES,
+                                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                            cancellable,
+                                            NULL);
+    if (enumerator == NULL)
+    {
+        deep_count_counter_add (&worker->unreadable_count, 1);
+        return;
+    }
+
+    while (!g_cancellable_is_cancelled (cancellable) &&
+            (info = g_file_enumerator_next_file (enumerator, cancellable, NULL)) != NULL)
+    {
+        deep_count_worker_one (worker, location, info);
+        g_object_unref (info);
+    }
+
+    g_file_enumerator_close (enumerator, NULL, NULL);
+    g_object_unref (enumerator);
+}
+
+static gboolean deep_count_threads_finished (gpointer user_data);
+
+static gpointer
+deep_count_worker_thread (gpointer user_data)
+{
+    DeepCountWorker *worker;
+    DeepCountState *state;
+    GFile *location;
+
+    worker = user_data;
+    state = worker->state;
+
+    while (!g_cancellable_is_cancelled (state->cancellable))
+    {
+        location = deep_count_worker_pop (worker);
+        if (location == NULL)
+        {
+            if (g_atomic_int_get (&state->pending_directories) == 0)
+            {
+                break;
+            }
+
+            /* Other workers are still enumerating and may push more
+             * work; wait for them, but re-check now and then so a
+             * cancellation is noticed promptly.
+             */
+            g_mutex_lock (&state->idle_lock);
+            if (g_atomic_int_get (&state->pending_directories) != 0)
+            {
+                g_cond_wait_until (&state->idle_cond, &state->idle_lock,
+                                   g_get_monotonic_time () + 10 * G_TIME_SPAN_MILLISECOND);
+            }
+            g_mutex_unlock (&state->idle_lock);
+            continue;
+        }
+
+        deep_count_worker_enumerate (worker, location);
+        g_object_unref (location);
+
+        if (g_atomic_int_dec_and_test (&state->pending_directories))
+        {
+            g_mutex_lock (&state->idle_lock);
+            g_cond_broadcast (&state->idle_cond);
+            g_mutex_unlock (&state->idle_lock);
+        }
+    }
+
+    if (g_atomic_int_dec_and_test (&state->running_workers))
+    {
+        g_idle_add (deep_count_threads_finished, state);
+    }
+
+    return NULL;
+}
+
+static void
+deep_count_threads_publish (DeepCountState *state,
+                            CajaFile *file)
+{
+    gint64 directory_count, file_count, unreadable_count, size, size_on_disk;
+    guint i;
+
+    directory_count = file_count = unreadable_count = size = size_on_disk = 0;
+    for (i = 0; i < state->n_workers; i++)
+    {
+        directory_count += deep_count_counter_get (&state->workers[i].directory_count);
+        file_count += deep_count_counter_get (&state->workers[i].file_count);
+        unreadable_count += deep_count_counter_get (&state->workers[i].unreadable_count);
+        size += deep_count_counter_get (&state->workers[i].size);
+        size_on_disk += deep_count_counter_get (&state->workers[i].size_on_disk);
+    }
+
+    file->details->deep_directory_count = directory_count;
+    file->details->deep_file_count = file_count;
+    file->details->deep_unreadable_count = unreadable_count;
+    file->details->deep_size = size;
+    file->details->deep_size_on_disk = size_on_disk;
+}
+
+static gboolean
+deep_count_threads_update (gpointer user_data)
+{
+    DeepCountState *state;
+    CajaFile *file;
+
+    state = user_data;
+
+    if (state->directory == NULL)
+    {
+        /* Cancelled, deep_count_threads_finished will clean up. */
+        state->update_timeout_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    file = state->directory->details->deep_count_file;
+    if (file != NULL)
+    {
+        deep_count_threads_publish (state, file);
+        caja_file_updated_deep_count_in_progress (file);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+deep_count_threads_finished (gpointer user_data)
+{
+    DeepCountState *state;
+    CajaDirectory *directory;
+    CajaFile *file;
+    guint i;
+
+    state = user_data;
+
+    for (i = 0; i < state->n_workers; i++)
+    {
+        g_thread_join (state->workers[i].thread);
+        state->workers[i].thread = NULL;
+    }
+
+    if (state->update_timeout_id != 0)
+    {
+        g_source_remove (state->update_timeout_id);
+        state->update_timeout_id = 0;
+    }
+
+    directory = state->directory;
+    if (directory == NULL)
+    {
+        /* Operation was cancelled. */
+        deep_count_state_free (state);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_assert (directory->details->deep_count_in_progress == state);
+
+    file = directory->details->deep_count_file;
+    if (file != NULL)
+    {
+        deep_count_threads_publish (state, file);
+        file->details->deep_counts_status = CAJA_REQUEST_DONE;
+    }
+    directory->details->deep_count_file = NULL;
+    directory->details->deep_count_in_progress = NULL;
+    deep_count_state_free (state);
+
+    if (file != NULL)
+    {
+        caja_file_updated_deep_count_in_progress (file);
+        caja_file_changed (file);
+    }
+
+    async_job_end (directory, "deep count");
+    caja_directory_async_state_changed (directory);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+deep_count_threads_start (DeepCountState *state,
+                          GFile *location)
+{
+    guint i;
+
+    state->workers = g_new0 (DeepCountWorker, state->n_workers);
+    for (i = 0; i < state->n_workers; i++)
+    {
+        state->workers[i].state = state;
+        g_mutex_init (&state->workers[i].lock);
+        g_queue_init (&state->workers[i].directories);
+    }
+    g_mutex_init (&state->idle_lock);
+    g_cond_init (&state->idle_cond);
+    state->show_hidden_files = get_show_hidden_files ();
+
+    state->pending_directories = 1;
+    g_queue_push_tail (&state->workers[0].directories, g_object_ref (location));
+
+    state->running_workers = state->n_workers;
+    for (i = 0; i < state->n_workers; i++)
+    {
+        state->workers[i].thread = g_thread_new ("caja-deep-count",
+                                                 deep_count_worker_thread,
+                                                 &state->workers[i]);
+    }
+
+    state->update_timeout_id = g_timeout_add (DEEP_COUNT_UPDATE_INTERVAL_MSEC,
+                                              deep_count_threads_update,
+                                              state);
+}
+
 static void
 deep_count_stop (CajaDirectory *directory)
 {
@@ -3106,7 +3871,21 @@ deep_count_got_info (GObject *source_object,
          state->fs_id = g_strdup (id);
          g_object_unref (info);
      }
-     deep_count_load (state, file);
+
+     if (state->n_workers > 1)
+     {
+         if (state->directory == NULL)
+         {
+             /* Operation was cancelled. Bail out */
+             deep_count_state_free (state);
+             return;
+         }
+         deep_count_threads_start (state, file);
+     }
+     else
+     {
+         deep_count_load (state, file);
+     }
 }
 
 static void
@@ -3116,6 +3895,7 @@ deep_count_start (CajaDirectory *directory,
 {
     GFile *location;
     DeepCountState *state;
+    int n_threads;
 
     if (directory->details->deep_count_in_progress != NULL)
     {
@@ -3156,9 +3936,19 @@ deep_count_start (CajaDirectory *directory,
     state = g_new0 (DeepCountState, 1);
     state->directory = directory;
     state->cancellable = g_cancellable_new ();
-    state->seen_deep_count_inodes = g_array_new (FALSE, TRUE, sizeof (guint64));
+    state->seen_deep_count_inodes = g_hash_table_new_full (deep_count_inode_hash,
+                                                           deep_count_inode_equal,
+                                                           g_free, NULL);
+    g_mutex_init (&state->seen_deep_count_inodes_lock);
     state->fs_id = NULL;
 
+    n_threads = g_settings_get_int (caja_preferences, CAJA_PREFERENCES_DEEP_COUNT_THREADS);
+    if (n_threads <= 0)
+    {
+        n_threads = g_get_num_processors ();
+    }
+    state->n_workers = CLAMP (n_threads, 1, DEEP_COUNT_MAX_THREADS);
+
     directory->details->deep_count_in_progress = state;
 
     location = caja_file_get_location (file);
@@ -3302,6 +4092,7 @@ mime_list_callback (GObject *source_object,
     error = NULL;
     files = g_file_enumerator_next_files_finish (state->enumerator,
             res, &error);
+    enumerator_batch_received (&state->batch, g_list_length (files));
 
     for (l = files; l != NULL; l = l->next)
     {
@@ -3309,6 +4100,7 @@ mime_list_callback (GObject *source_object,
         mime_list_one (state, info);
         g_object_unref (info);
     }
+    enumerator_batch_processed (&state->batch);
 
     if (files == NULL)
     {
@@ -3318,7 +4110,7 @@ mime_list_callback (GObject *source_object,
     else
     {
         g_file_enumerator_next_files_async (state->enumerator,
-                                            DIRECTORY_LOAD_ITEMS_PER_CALLBACK,
+                                            enumerator_batch_next_size (&state->batch),
                                             G_PRIORITY_DEFAULT,
                                             state->cancellable,
                                             mime_list_callback,
@@ -3375,7 +4167,7 @@ list_mime_enum_callback (GObject *source_object,
     {
         state->enumerator = enumerator;
         g_file_enumerator_next_files_async (state->enumerator,
-                                            DIRECTORY_LOAD_ITEMS_PER_CALLBACK,
+                                            enumerator_batch_next_size (&state->batch),
                                             G_PRIORITY_DEFAULT,
                                             state->cancellable,
                                             mime_list_callback,
@@ -5060,10 +5852,7 @@ caja_directory_cancel (CajaDirectory *directory)
     filesystem_info_cancel (directory);
 
     /* We aren't waiting for anything any more. */
-    if (waiting_directories != NULL)
-    {
-        g_hash_table_remove (waiting_directories, directory);
-    }
+    async_job_forget_directory (directory);
 
     /* Check if any directories should wake up. */
     async_job_wake_up ();
@@ -49,6 +49,7 @@ typedef struct MimeListState MimeListState;
 typedef struct ThumbnailState ThumbnailState;
 typedef struct MountState MountState;
 typedef struct FilesystemInfoState FilesystemInfoState;
+typedef struct AsyncJobQueue AsyncJobQueue;
 
 typedef enum
 {
@@ -103,6 +104,7 @@ struct _CajaDirectoryPrivate
 
     gboolean in_async_service_loop;
     gboolean state_changed;
+    AsyncJobQueue *async_job_queue; /* backend queue this directory's jobs run in */
 
     gboolean file_list_monitored;
     gboolean directory_loaded;
@@ -241,6 +243,7 @@ void               caja_directory_remove_file_from_work_queue     (CajaDirectory
 
 /* debugging functions */
 int                caja_directory_number_outstanding              (void);
+char *             caja_directory_get_async_job_statistics        (void);
 
 #endif	/* __CAJA_DIRECTORY_PRIVATE_H__ */
 
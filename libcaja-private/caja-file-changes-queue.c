@@ -133,6 +133,34 @@ caja_file_changes_queue_file_removed (GFile *location)
     caja_file_changes_queue_add_common (queue, new_item);
 }
 
+/* Like calling caja_file_changes_queue_file_removed() for each of
+ * locations, but only takes the queue lock once.
+ */
+void
+caja_file_changes_queue_files_removed (GList *locations)
+{
+    CajaFileChange *new_item;
+    CajaFileChangesQueue *queue;
+    GList *l;
+
+    queue = caja_file_changes_queue_get();
+
+    g_mutex_lock (&queue->mutex);
+
+    for (l = locations; l != NULL; l = l->next)
+    {
+        new_item = g_new0 (CajaFileChange, 1);
+        new_item->kind = CHANGE_FILE_REMOVED;
+        new_item->from = g_object_ref (l->data);
+
+        queue->head = g_list_prepend (queue->head, new_item);
+        if (queue->tail == NULL)
+            queue->tail = queue->head;
+    }
+
+    g_mutex_unlock (&queue->mutex);
+}
+
 void
 caja_file_changes_queue_file_moved (GFile *from,
                                     GFile *to)
@@ -29,6 +29,7 @@
 void caja_file_changes_queue_file_added                      (GFile      *location);
 void caja_file_changes_queue_file_changed                    (GFile      *location);
 void caja_file_changes_queue_file_removed                    (GFile      *location);
+void caja_file_changes_queue_files_removed                   (GList      *locations);
 void caja_file_changes_queue_file_moved                      (GFile      *from,
         GFile      *to);
 void caja_file_changes_queue_schedule_position_set           (GFile      *location,
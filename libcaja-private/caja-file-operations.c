@@ -27,14 +27,29 @@
  */
 
 #include <config.h>
+#ifdef HAVE_COPY_FILE_RANGE
+/* for copy_file_range() */
+#define _GNU_SOURCE
+#endif
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <locale.h>
 #include <math.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <stdlib.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 #include <gdk/gdk.h>
@@ -52,6 +67,7 @@
 #include "caja-file-operations.h"
 #include "caja-debug-log.h"
 #include "caja-file-changes-queue.h"
+#include "caja-copy-journal.h"
 #include "caja-lib-self-check-functions.h"
 #include "caja-progress-info.h"
 #include "caja-file-changes-queue.h"
@@ -84,9 +100,21 @@ typedef struct {
 	gboolean merge_all;
 	gboolean replace_all;
 	gboolean delete_all;
+	gboolean aborted_after_io_error;
 	CajaUndoStackActionData* undo_redo_data;
 } CommonJob;
 
+typedef struct _CopyPipeline CopyPipeline;
+
+/* How file contents were copied, see copy_file_contents() */
+typedef enum {
+	COPY_BACKEND_CLONE,
+	COPY_BACKEND_COPY_FILE_RANGE,
+	COPY_BACKEND_SPARSE,
+	COPY_BACKEND_GIO,
+	COPY_BACKEND_LAST
+} CopyBackend;
+
 typedef struct {
 	CommonJob common;
 	gboolean is_move;
@@ -98,6 +126,17 @@ typedef struct {
 	GHashTable *debuting_files;
 	CajaCopyCallback  done_callback;
 	gpointer done_callback_data;
+	CopyPipeline *pipeline;
+	/* Files copied with each backend, updated atomically */
+	int n_copied_with[COPY_BACKEND_LAST];
+	/* Background mode as applied to the job thread, see update_background_mode() */
+	gboolean background;
+	int saved_io_priority;
+	int background_speed;
+	gint64 throttle_start_time;
+	goffset throttle_start_bytes;
+	/* What is done so far, for resuming the job if it is interrupted */
+	CajaCopyJournal *journal;
 } CopyMoveJob;
 
 typedef struct {
@@ -158,11 +197,16 @@ typedef enum {
 	OP_KIND_TRASH
 } OpKind;
 
+typedef struct _SourceScan SourceScan;
+
 typedef struct {
 	int num_files;
 	goffset num_bytes;
 	int num_files_since_progress;
 	OpKind op;
+	/* Set while the totals are still being counted in the background */
+	SourceScan *scan;
+	gboolean scan_running;
 } SourceInfo;
 
 typedef struct {
@@ -174,6 +218,43 @@ typedef struct {
 } TransferInfo;
 
 #define SECONDS_NEEDED_FOR_RELIABLE_TRANSFER_RATE 15
+
+/* The background source scan publishes its totals this often */
+#define SOURCE_SCAN_PUBLISH_INTERVAL 100
+/* Free space is checked again whenever the scan found this much more */
+#define SOURCE_SCAN_SPACE_CHECK_INTERVAL (128 * 1024 * 1024)
+
+/* Small files inside copied folders are copied this many at a time */
+#define COPY_PIPELINE_THREADS 8
+/* Most copies queued or finished but not yet accounted for */
+#define COPY_PIPELINE_MAX_PENDING (COPY_PIPELINE_THREADS * 4)
+/* Larger files are copied one by one, with byte-level progress */
+#define COPY_PIPELINE_MAX_FILE_SIZE (1024 * 1024)
+
+/* Local folders are emptied by this many threads, one subfolder each */
+#define LOCAL_DELETE_THREADS 4
+/* Deeper trees are left to the GIO code */
+#define LOCAL_DELETE_MAX_DEPTH 256
+/* Threads changing permissions of local folders, see set_permissions_locally() */
+#define LOCAL_PERMISSIONS_THREADS 4
+
+/* I/O priorities, from linux/ioprio.h which not every system has */
+#ifndef IOPRIO_CLASS_SHIFT
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_PRIO_VALUE(class, data) (((class) << IOPRIO_CLASS_SHIFT) | (data))
+#endif
+
+/* Bytes per copy_file_range() call, between progress reports */
+#define COPY_FILE_RANGE_CHUNK_SIZE (8 * 1024 * 1024)
+/* Buffer for sparse copies where copy_file_range() can't be used */
+#define SPARSE_COPY_BUFFER_SIZE (1024 * 1024)
+/* Files this large get their progress checkpointed in the job's
+ * journal, every COPY_JOURNAL_CHECKPOINT_INTERVAL bytes.
+ */
+#define COPY_JOURNAL_MIN_FILE_SIZE (64 * 1024 * 1024)
+#define COPY_JOURNAL_CHECKPOINT_INTERVAL (64 * 1024 * 1024)
 #define NSEC_PER_MICROSEC 1000
 
 #define MAXIMUM_DISPLAYED_FILE_NAME_LENGTH 50
@@ -241,6 +322,24 @@ static void scan_sources (GList *files,
 			  CommonJob *job,
 			  OpKind kind);
 
+static void start_scan_sources (GList *files,
+				SourceInfo *source_info,
+				CommonJob *job,
+				OpKind kind,
+				GFile *space_dest);
+
+static void stop_scan_sources (SourceInfo *source_info);
+
+static void verify_destination (CommonJob *job,
+				GFile *dest,
+				char **dest_fs_id,
+				goffset required_size);
+
+static void update_source_info (SourceInfo *source_info);
+
+static gboolean more_files_left (SourceInfo *source_info,
+				 TransferInfo *transfer_info);
+
 static gboolean empty_trash_job (GIOSchedulerJob *io_job,
 				 GCancellable *cancellable,
 				 gpointer user_data);
@@ -1307,6 +1406,31 @@ abort_job (CommonJob *job)
 
 }
 
+/* Notes that the user stopped the job at an error it may be worth
+ * resuming after, like a device going away, see finish_journal().
+ * Call before freeing @error.
+ */
+static void
+note_aborting_error (CommonJob *job, int response, GError *error)
+{
+	if (response != 0 && response != GTK_RESPONSE_DELETE_EVENT) {
+		return;
+	}
+
+	if (IS_IO_ERROR (error, FAILED) ||
+	    IS_IO_ERROR (error, NOT_FOUND) ||
+	    IS_IO_ERROR (error, NOT_MOUNTED) ||
+	    IS_IO_ERROR (error, CLOSED) ||
+	    IS_IO_ERROR (error, TIMED_OUT) ||
+	    IS_IO_ERROR (error, BROKEN_PIPE) ||
+	    IS_IO_ERROR (error, CONNECTION_CLOSED) ||
+	    IS_IO_ERROR (error, HOST_NOT_FOUND) ||
+	    IS_IO_ERROR (error, HOST_UNREACHABLE) ||
+	    IS_IO_ERROR (error, NETWORK_UNREACHABLE)) {
+		job->aborted_after_io_error = TRUE;
+	}
+}
+
 /* Since this happens on a thread we can't use the global prefs object */
 static gboolean
 should_confirm_trash (void)
@@ -1502,6 +1626,8 @@ report_delete_progress (CommonJob *job,
 	}
 	transfer_info->last_report_time = now;
 
+	update_source_info (source_info);
+
 	files_left = source_info->num_files - transfer_info->num_files;
 
 	/* Races and whatnot could cause this to be negative... */
@@ -1518,8 +1644,9 @@ report_delete_progress (CommonJob *job,
 					    f (_("Deleting files")));
 
 	elapsed = g_timer_elapsed (job->time, NULL);
-	if (elapsed < SECONDS_NEEDED_FOR_RELIABLE_TRANSFER_RATE) {
-
+	if (elapsed < SECONDS_NEEDED_FOR_RELIABLE_TRANSFER_RATE ||
+	    source_info->scan_running) {
+		/* No time estimate until we know how many files there are */
 		caja_progress_info_set_details (job->progress, files_left_s);
 	} else {
 		char *details, *time_left_s;
@@ -1556,6 +1683,219 @@ static void delete_file (CommonJob *job, GFile *file,
 			 TransferInfo *transfer_info,
 			 gboolean toplevel);
 
+#if defined (HAVE_FDOPENDIR) && defined (HAVE_UNLINKAT)
+
+/* Empties a local folder with openat()/unlinkat() instead of resolving
+ * the full path of every file, handing the entries of the folder to a
+ * few threads. It never asks anything: whatever can't be deleted is
+ * left alone, and delete_dir() then runs into it again and shows the
+ * usual dialogs.
+ */
+typedef struct {
+	CommonJob *job;
+	int dir_fd;
+
+	/* Protected by mutex */
+	GMutex mutex;
+	GCond cond;
+	int n_pending;
+	GList *removed;
+
+	int n_deleted; /* atomic */
+} LocalDelete;
+
+static gboolean
+local_delete_at (LocalDelete *local,
+		 int parent_fd,
+		 const char *name,
+		 gboolean is_dir,
+		 int depth)
+{
+	struct dirent *entry;
+	DIR *dir;
+	int fd;
+	gboolean res;
+
+	if (!is_dir) {
+		if (unlinkat (parent_fd, name, 0) == 0) {
+			g_atomic_int_inc (&local->n_deleted);
+			return TRUE;
+		}
+		/* Linux says EISDIR, POSIX allows EPERM */
+		if (errno != EISDIR && errno != EPERM) {
+			return FALSE;
+		}
+	}
+
+	if (depth >= LOCAL_DELETE_MAX_DEPTH) {
+		return FALSE;
+	}
+
+	fd = openat (parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0) {
+		return FALSE;
+	}
+	dir = fdopendir (fd);
+	if (dir == NULL) {
+		close (fd);
+		return FALSE;
+	}
+
+	res = TRUE;
+	while ((entry = readdir (dir)) != NULL) {
+		if (strcmp (entry->d_name, ".") == 0 ||
+		    strcmp (entry->d_name, "..") == 0) {
+			continue;
+		}
+		if (job_aborted (local->job)) {
+			res = FALSE;
+			break;
+		}
+		/* Keep going on errors, so as much as possible is gone */
+		if (!local_delete_at (local, dirfd (dir), entry->d_name,
+				      entry->d_type == DT_DIR, depth + 1)) {
+			res = FALSE;
+		}
+	}
+	closedir (dir);
+
+	if (res && unlinkat (parent_fd, name, AT_REMOVEDIR) == 0) {
+		g_atomic_int_inc (&local->n_deleted);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+local_delete_thread_func (gpointer data,
+			  gpointer user_data)
+{
+	LocalDelete *local;
+	char *name;
+	gboolean is_dir, deleted;
+
+	local = user_data;
+	/* The first byte says whether the entry is a folder */
+	name = data;
+	is_dir = name[0] == 'd';
+
+	deleted = !job_aborted (local->job) &&
+		local_delete_at (local, local->dir_fd, name + 1, is_dir, 0);
+
+	g_mutex_lock (&local->mutex);
+	if (deleted) {
+		local->removed = g_list_prepend (local->removed, name);
+	} else {
+		g_free (name);
+	}
+	if (--local->n_pending == 0) {
+		g_cond_signal (&local->cond);
+	}
+	g_mutex_unlock (&local->mutex);
+}
+
+static void
+delete_dir_contents_locally (CommonJob *job,
+			     GFile *dir,
+			     SourceInfo *source_info,
+			     TransferInfo *transfer_info)
+{
+	LocalDelete local;
+	GThreadPool *pool;
+	struct dirent *entry;
+	DIR *dirp;
+	GList *removed, *l;
+	char *path;
+	int base_num_files, fd;
+	gint64 deadline;
+
+	path = g_file_get_path (dir);
+	if (path == NULL) {
+		return;
+	}
+	fd = open (path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	g_free (path);
+	if (fd < 0) {
+		return;
+	}
+
+	memset (&local, 0, sizeof (local));
+	local.job = job;
+	local.dir_fd = fd;
+	g_mutex_init (&local.mutex);
+	g_cond_init (&local.cond);
+
+	pool = NULL;
+	/* readdir() gets its own descriptor, the threads keep using dir_fd */
+	fd = dup (local.dir_fd);
+	dirp = fd < 0 ? NULL : fdopendir (fd);
+	if (dirp == NULL) {
+		if (fd >= 0) {
+			close (fd);
+		}
+	} else {
+		pool = g_thread_pool_new (local_delete_thread_func, &local,
+					  LOCAL_DELETE_THREADS, FALSE, NULL);
+	}
+
+	base_num_files = transfer_info->num_files;
+
+	while (pool != NULL && !job_aborted (job) &&
+	       (entry = readdir (dirp)) != NULL) {
+		if (strcmp (entry->d_name, ".") == 0 ||
+		    strcmp (entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		g_mutex_lock (&local.mutex);
+		local.n_pending++;
+		g_mutex_unlock (&local.mutex);
+
+		g_thread_pool_push (pool,
+				    g_strconcat (entry->d_type == DT_DIR ? "d" : "-",
+						 entry->d_name, NULL),
+				    NULL);
+	}
+
+	/* Wait for the threads, reporting progress as they go */
+	g_mutex_lock (&local.mutex);
+	while (local.n_pending > 0) {
+		deadline = g_get_monotonic_time () + 100 * NSEC_PER_MICROSEC;
+		if (!g_cond_wait_until (&local.cond, &local.mutex, deadline)) {
+			g_mutex_unlock (&local.mutex);
+			transfer_info->num_files = base_num_files + g_atomic_int_get (&local.n_deleted);
+			report_delete_progress (job, source_info, transfer_info);
+			g_mutex_lock (&local.mutex);
+		}
+	}
+	removed = local.removed;
+	local.removed = NULL;
+	g_mutex_unlock (&local.mutex);
+
+	if (pool != NULL) {
+		g_thread_pool_free (pool, FALSE, TRUE);
+		closedir (dirp);
+	}
+	close (local.dir_fd);
+
+	transfer_info->num_files = base_num_files + g_atomic_int_get (&local.n_deleted);
+	report_delete_progress (job, source_info, transfer_info);
+
+	for (l = removed; l != NULL; l = l->next) {
+		path = l->data;
+		l->data = g_file_get_child (dir, path + 1);
+		g_free (path);
+	}
+	caja_file_changes_queue_files_removed (removed);
+	g_list_free_full (removed, g_object_unref);
+
+	g_cond_clear (&local.cond);
+	g_mutex_clear (&local.mutex);
+}
+
+#endif
+
 static void
 delete_dir (CommonJob *job, GFile *dir,
 	    gboolean *skipped_file,
@@ -1575,6 +1915,14 @@ delete_dir (CommonJob *job, GFile *dir,
 	local_skipped_file = FALSE;
 
 	skip_error = should_skip_readdir_error (job, dir);
+
+#if defined (HAVE_FDOPENDIR) && defined (HAVE_UNLINKAT)
+	/* Deeper folders were already tried when their parent was */
+	if (toplevel && g_file_is_native (dir)) {
+		delete_dir_contents_locally (job, dir, source_info, transfer_info);
+	}
+#endif
+
  retry:
 	error = NULL;
 	enumerator = g_file_enumerate_children (dir,
@@ -1680,7 +2028,7 @@ delete_dir (CommonJob *job, GFile *dir,
 						primary,
 						secondary,
 						details,
-						(source_info->num_files - transfer_info->num_files) > 1,
+						more_files_left (source_info, transfer_info),
 						CANCEL, SKIP_ALL, SKIP,
 						NULL);
 
@@ -1757,7 +2105,7 @@ delete_file (CommonJob *job, GFile *file,
 					primary,
 					secondary,
 					details,
-					(source_info->num_files - transfer_info->num_files) > 1,
+					more_files_left (source_info, transfer_info),
 					CANCEL, SKIP_ALL, SKIP,
 					NULL);
 
@@ -1790,11 +2138,13 @@ delete_files (CommonJob *job, GList *files, int *files_skipped)
 		return;
 	}
 
-	scan_sources (files,
-		      &source_info,
-		      job,
-		      OP_KIND_DELETE);
+	start_scan_sources (files,
+			    &source_info,
+			    job,
+			    OP_KIND_DELETE,
+			    NULL);
 	if (job_aborted (job)) {
+		stop_scan_sources (&source_info);
 		return;
 	}
 
@@ -1817,6 +2167,8 @@ delete_files (CommonJob *job, GList *files, int *files_skipped)
 			(*files_skipped)++;
 		}
 	}
+
+	stop_scan_sources (&source_info);
 }
 
 static void
@@ -1843,6 +2195,240 @@ report_trash_progress (CommonJob *job,
 	}
 }
 
+/* Local files on the same file system as the home folder are moved to
+ * the home trash directly, looking up and creating the trash directory
+ * only once per job instead of once per file like g_file_trash() does.
+ * Everything else, and every file this fails for, still goes through
+ * g_file_trash(), which then also reports the error.
+ */
+typedef struct {
+	gboolean initialized;
+	gboolean usable;
+	dev_t home_device;
+	char *trash_dir;
+	char *files_dir;
+	char *info_dir;
+
+	time_t deletion_time;
+	char *deletion_date;
+
+	/* Trashed files not yet passed on to the changes queue */
+	GList *removed;
+	int n_removed;
+} TrashBatch;
+
+/* Removed files are passed on to the changes queue this many at a time */
+#define TRASH_BATCH_NOTIFY_INTERVAL 500
+
+static gboolean
+trash_batch_ensure_trash_dir (TrashBatch *batch)
+{
+	struct stat home_stat;
+
+	if (batch->initialized) {
+		return batch->usable;
+	}
+	batch->initialized = TRUE;
+
+	/* Same rules as g_file_trash() for the home trash */
+	if (g_stat (g_get_home_dir (), &home_stat) != 0) {
+		return FALSE;
+	}
+	batch->home_device = home_stat.st_dev;
+
+	batch->trash_dir = g_build_filename (g_get_user_data_dir (), "Trash", NULL);
+	batch->files_dir = g_build_filename (batch->trash_dir, "files", NULL);
+	batch->info_dir = g_build_filename (batch->trash_dir, "info", NULL);
+
+	batch->usable =
+		g_mkdir_with_parents (batch->trash_dir, 0700) == 0 &&
+		(g_mkdir (batch->files_dir, 0700) == 0 || errno == EEXIST) &&
+		(g_mkdir (batch->info_dir, 0700) == 0 || errno == EEXIST);
+
+	return batch->usable;
+}
+
+static const char *
+trash_batch_get_deletion_date (TrashBatch *batch)
+{
+	GDateTime *now;
+	time_t t;
+
+	t = time (NULL);
+	if (batch->deletion_date == NULL || t != batch->deletion_time) {
+		g_free (batch->deletion_date);
+		now = g_date_time_new_now_local ();
+		batch->deletion_date = g_date_time_format (now, "%Y-%m-%dT%H:%M:%S");
+		g_date_time_unref (now);
+		batch->deletion_time = t;
+	}
+
+	return batch->deletion_date;
+}
+
+/* Escapes the Path= of a .trashinfo file the way GIO does */
+static char *
+escape_trash_name (const char *name)
+{
+	GString *str;
+	const gchar hex[] = "0123456789ABCDEF";
+	char c;
+
+	str = g_string_new ("");
+	while (*name != 0) {
+		c = *name++;
+		if (g_ascii_isprint (c)) {
+			g_string_append_c (str, c);
+		} else {
+			g_string_append_c (str, '%');
+			g_string_append_c (str, hex[((guchar)c) >> 4]);
+			g_string_append_c (str, hex[((guchar)c) & 0xf]);
+		}
+	}
+
+	return g_string_free (str, FALSE);
+}
+
+static char *
+get_trash_unique_name (const char *basename, int id)
+{
+	const char *dot;
+
+	if (id == 1) {
+		return g_strdup (basename);
+	}
+
+	dot = strchr (basename, '.');
+	if (dot) {
+		return g_strdup_printf ("%.*s.%d%s", (int)(dot - basename), basename, id, dot);
+	} else {
+		return g_strdup_printf ("%s.%d", basename, id);
+	}
+}
+
+/* Returns FALSE if the file has to go through g_file_trash() instead.
+ * Sets *mtime for the undo data if the file could be looked at.
+ */
+static gboolean
+trash_file_batched (TrashBatch *batch,
+		    GFile *file,
+		    guint64 *mtime)
+{
+	struct stat file_stat;
+	char *path, *basename, *trash_name, *info_name, *info_path, *trash_path;
+	char *escaped, *data;
+	gssize len;
+	int i, fd;
+	gboolean res;
+
+	path = g_file_get_path (file);
+	if (path == NULL) {
+		return FALSE;
+	}
+
+	if (g_lstat (path, &file_stat) != 0) {
+		g_free (path);
+		return FALSE;
+	}
+	*mtime = file_stat.st_mtime;
+
+	if (!trash_batch_ensure_trash_dir (batch) ||
+	    file_stat.st_dev != batch->home_device ||
+	    g_str_has_prefix (path, batch->trash_dir)) {
+		g_free (path);
+		return FALSE;
+	}
+
+	/* Reserve a name by creating the info file */
+	basename = g_path_get_basename (path);
+	trash_name = NULL;
+	info_path = NULL;
+	fd = -1;
+	for (i = 1; fd < 0; i++) {
+		trash_name = get_trash_unique_name (basename, i);
+		info_name = g_strconcat (trash_name, ".trashinfo", NULL);
+		info_path = g_build_filename (batch->info_dir, info_name, NULL);
+		g_free (info_name);
+
+		fd = g_open (info_path, O_CREAT | O_EXCL | O_WRONLY, 0666);
+		if (fd < 0) {
+			g_free (trash_name);
+			g_free (info_path);
+			trash_name = NULL;
+			info_path = NULL;
+			if (errno != EEXIST) {
+				break;
+			}
+		}
+	}
+	g_free (basename);
+
+	if (fd < 0) {
+		g_free (path);
+		return FALSE;
+	}
+
+	escaped = escape_trash_name (path);
+	data = g_strdup_printf ("[Trash Info]\nPath=%s\nDeletionDate=%s\n",
+				escaped, trash_batch_get_deletion_date (batch));
+	len = strlen (data);
+	res = write (fd, data, len) == len;
+	res = close (fd) == 0 && res;
+	g_free (data);
+	g_free (escaped);
+
+	if (res) {
+		trash_path = g_build_filename (batch->files_dir, trash_name, NULL);
+		res = g_rename (path, trash_path) == 0;
+		g_free (trash_path);
+	}
+
+	if (!res) {
+		g_unlink (info_path);
+	}
+
+	g_free (trash_name);
+	g_free (info_path);
+	g_free (path);
+
+	return res;
+}
+
+static void
+trash_batch_flush_removed (TrashBatch *batch)
+{
+	if (batch->removed == NULL) {
+		return;
+	}
+
+	batch->removed = g_list_reverse (batch->removed);
+	caja_file_changes_queue_files_removed (batch->removed);
+	g_list_free (batch->removed);
+	batch->removed = NULL;
+	batch->n_removed = 0;
+}
+
+static void
+trash_batch_file_removed (TrashBatch *batch,
+			  GFile *file)
+{
+	batch->removed = g_list_prepend (batch->removed, file);
+	if (++batch->n_removed >= TRASH_BATCH_NOTIFY_INTERVAL) {
+		trash_batch_flush_removed (batch);
+	}
+}
+
+static void
+trash_batch_finish (TrashBatch *batch)
+{
+	trash_batch_flush_removed (batch);
+
+	g_free (batch->trash_dir);
+	g_free (batch->files_dir);
+	g_free (batch->info_dir);
+	g_free (batch->deletion_date);
+}
+
 static void
 trash_files (CommonJob *job, GList *files, int *files_skipped)
 {
@@ -1853,6 +2439,9 @@ trash_files (CommonJob *job, GList *files, int *files_skipped)
 	int total_files, files_trashed;
 	char *primary, *secondary, *details;
 	int response;
+	TrashBatch batch;
+	gboolean trashed;
+	gint64 now, last_report_time;
 
 	guint64 mtime;
 
@@ -1864,6 +2453,9 @@ trash_files (CommonJob *job, GList *files, int *files_skipped)
 	files_trashed = 0;
 
 	report_trash_progress (job, files_trashed, total_files);
+	last_report_time = g_get_monotonic_time ();
+
+	memset (&batch, 0, sizeof (batch));
 
 	to_delete = NULL;
 	for (l = files;
@@ -1875,9 +2467,16 @@ trash_files (CommonJob *job, GList *files, int *files_skipped)
 
 		error = NULL;
 
-		mtime = caja_undostack_manager_get_file_modification_time (file);
+		mtime = (guint64) -1;
+		trashed = trash_file_batched (&batch, file, &mtime);
+		if (!trashed) {
+			if (mtime == (guint64) -1) {
+				mtime = caja_undostack_manager_get_file_modification_time (file);
+			}
+			trashed = g_file_trash (file, job->cancellable, &error);
+		}
 
-		if (!g_file_trash (file, job->cancellable, &error)) {
+		if (!trashed) {
 			if (job->skip_all_error) {
 				(*files_skipped)++;
 				goto skip;
@@ -1922,17 +2521,26 @@ trash_files (CommonJob *job, GList *files, int *files_skipped)
 			g_error_free (error);
 			total_files--;
 		} else {
-			caja_file_changes_queue_file_removed (file);
+			trash_batch_file_removed (&batch, file);
 
 			// Start UNDO-REDO
 			caja_undostack_manager_data_add_trashed_file (job->undo_redo_data, file, mtime);
 			// End UNDO-REDO
 
 			files_trashed++;
-			report_trash_progress (job, files_trashed, total_files);
+
+			now = g_get_monotonic_time ();
+			if (now - last_report_time >= 100 * NSEC_PER_MICROSEC ||
+			    files_trashed == total_files) {
+				report_trash_progress (job, files_trashed, total_files);
+				last_report_time = now;
+			}
 		}
 	}
 
+	trash_batch_finish (&batch);
+	report_trash_progress (job, files_trashed, total_files);
+
 	if (to_delete) {
 		to_delete = g_list_reverse (to_delete);
 		delete_files (job, to_delete, files_skipped);
@@ -2816,38 +3424,285 @@ scan_sources (GList *files,
 	report_count_progress (job, source_info);
 }
 
-static void
-verify_destination (CommonJob *job,
-		    GFile *dest,
-		    char **dest_fs_id,
-		    goffset required_size)
-{
-	GFileInfo *info, *fsinfo;
-	GError *error;
-	guint64 free_size;
-	char *primary, *secondary, *details;
-	int response;
-	GFileType file_type;
+/* Counts the sources in a thread of its own while the job is already
+ * transferring them, so that big trees don't sit in "Preparing" first.
+ * The job thread picks up the totals with update_source_info().
+ */
+struct _SourceScan {
+	GThread *thread;
+	GCancellable *cancellable;
+	GCancellable *job_cancellable;
+	GList *files;
 
-	if (dest_fs_id) {
-		*dest_fs_id = NULL;
-	}
+	/* Protected by mutex */
+	GMutex mutex;
+	int num_files;
+	goffset num_bytes;
+	gboolean done;
 
- retry:
+	/* Only used by the job thread */
+	GFile *space_dest;
+	goffset space_checked;
+	gboolean space_forced;
+};
 
-	error = NULL;
-	info = g_file_query_info (dest,
-				  G_FILE_ATTRIBUTE_STANDARD_TYPE","
-				  G_FILE_ATTRIBUTE_ID_FILESYSTEM,
-				  0,
-				  job->cancellable,
-				  &error);
+static gboolean
+source_scan_cancelled (SourceScan *scan)
+{
+	return g_cancellable_is_cancelled (scan->cancellable) ||
+		g_cancellable_is_cancelled (scan->job_cancellable);
+}
 
-	if (info == NULL) {
-		if (IS_IO_ERROR (error, CANCELLED)) {
-			g_error_free (error);
-			return;
-		}
+static void
+source_scan_publish (SourceScan *scan,
+		     int num_files,
+		     goffset num_bytes,
+		     gboolean done)
+{
+	g_mutex_lock (&scan->mutex);
+	scan->num_files = num_files;
+	scan->num_bytes = num_bytes;
+	scan->done = done;
+	g_mutex_unlock (&scan->mutex);
+}
+
+/* Errors are ignored here, the job runs into them itself and asks
+ * the user then.
+ */
+static gpointer
+source_scan_thread_func (gpointer data)
+{
+	SourceScan *scan;
+	GQueue *dirs;
+	GFileEnumerator *enumerator;
+	GFileInfo *info;
+	GFile *dir;
+	GList *l;
+	int num_files;
+	goffset num_bytes;
+
+	scan = data;
+	dirs = g_queue_new ();
+	num_files = 0;
+	num_bytes = 0;
+
+	for (l = scan->files; l != NULL && !source_scan_cancelled (scan); l = l->next) {
+		info = g_file_query_info (l->data,
+					  G_FILE_ATTRIBUTE_STANDARD_TYPE","
+					  G_FILE_ATTRIBUTE_STANDARD_SIZE,
+					  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+					  scan->cancellable,
+					  NULL);
+		if (info == NULL) {
+			continue;
+		}
+
+		num_files += 1;
+		num_bytes += g_file_info_get_size (info);
+		if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY) {
+			g_queue_push_head (dirs, g_object_ref (l->data));
+		}
+		g_object_unref (info);
+
+		while (!source_scan_cancelled (scan) &&
+		       (dir = g_queue_pop_head (dirs)) != NULL) {
+			enumerator = g_file_enumerate_children (dir,
+								G_FILE_ATTRIBUTE_STANDARD_NAME","
+								G_FILE_ATTRIBUTE_STANDARD_TYPE","
+								G_FILE_ATTRIBUTE_STANDARD_SIZE,
+								G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+								scan->cancellable,
+								NULL);
+			if (enumerator != NULL) {
+				while (!source_scan_cancelled (scan) &&
+				       (info = g_file_enumerator_next_file (enumerator, scan->cancellable, NULL)) != NULL) {
+					num_files += 1;
+					num_bytes += g_file_info_get_size (info);
+
+					/* Push to head, to go depth-first like the transfer does */
+					if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY) {
+						g_queue_push_head (dirs,
+								   g_file_get_child (dir, g_file_info_get_name (info)));
+					}
+					g_object_unref (info);
+
+					if (num_files % SOURCE_SCAN_PUBLISH_INTERVAL == 0) {
+						source_scan_publish (scan, num_files, num_bytes, FALSE);
+					}
+				}
+				g_file_enumerator_close (enumerator, NULL, NULL);
+				g_object_unref (enumerator);
+			}
+			g_object_unref (dir);
+		}
+	}
+
+	/* Free all from queue if we exited early */
+	g_queue_foreach (dirs, (GFunc)g_object_unref, NULL);
+	g_queue_free (dirs);
+
+	source_scan_publish (scan, num_files, num_bytes, TRUE);
+
+	return NULL;
+}
+
+static void
+source_scan_free (SourceScan *scan)
+{
+	g_object_unref (scan->cancellable);
+	g_object_unref (scan->job_cancellable);
+	g_list_free_full (scan->files, g_object_unref);
+	if (scan->space_dest) {
+		g_object_unref (scan->space_dest);
+	}
+	g_mutex_clear (&scan->mutex);
+	g_free (scan);
+}
+
+/* Like scan_sources(), but returns right away and keeps counting while
+ * the job transfers the files. The totals in source_info grow until the
+ * scan is done. If space_dest is set, the free space there is checked
+ * as the totals grow, see verify_destination_space_incrementally().
+ * Call stop_scan_sources() when the job is done with source_info.
+ */
+static void
+start_scan_sources (GList *files,
+		    SourceInfo *source_info,
+		    CommonJob *job,
+		    OpKind kind,
+		    GFile *space_dest)
+{
+	SourceScan *scan;
+
+	scan = g_new0 (SourceScan, 1);
+	g_mutex_init (&scan->mutex);
+	scan->cancellable = g_cancellable_new ();
+	scan->job_cancellable = g_object_ref (job->cancellable);
+	scan->files = g_list_copy_deep (files, (GCopyFunc) g_object_ref, NULL);
+	if (space_dest) {
+		scan->space_dest = g_object_ref (space_dest);
+	}
+
+	scan->thread = g_thread_try_new ("caja-source-scan",
+					 source_scan_thread_func,
+					 scan,
+					 NULL);
+	if (scan->thread == NULL) {
+		source_scan_free (scan);
+		scan_sources (files, source_info, job, kind);
+		if (space_dest && !job_aborted (job)) {
+			verify_destination (job, space_dest, NULL, source_info->num_bytes);
+		}
+		return;
+	}
+
+	memset (source_info, 0, sizeof (SourceInfo));
+	source_info->op = kind;
+	source_info->scan = scan;
+	source_info->scan_running = TRUE;
+}
+
+static void
+stop_scan_sources (SourceInfo *source_info)
+{
+	SourceScan *scan;
+
+	scan = source_info->scan;
+	if (scan == NULL) {
+		return;
+	}
+
+	g_cancellable_cancel (scan->cancellable);
+	g_thread_join (scan->thread);
+	source_scan_free (scan);
+
+	source_info->scan = NULL;
+	source_info->scan_running = FALSE;
+}
+
+/* Picks up what the background scan has counted so far */
+static void
+update_source_info (SourceInfo *source_info)
+{
+	SourceScan *scan;
+
+	scan = source_info->scan;
+	if (scan == NULL || !source_info->scan_running) {
+		return;
+	}
+
+	g_mutex_lock (&scan->mutex);
+	source_info->num_files = scan->num_files;
+	source_info->num_bytes = scan->num_bytes;
+	source_info->scan_running = !scan->done;
+	g_mutex_unlock (&scan->mutex);
+}
+
+/* Whether dialogs should offer to handle all remaining files */
+static gboolean
+more_files_left (SourceInfo *source_info,
+		 TransferInfo *transfer_info)
+{
+	return source_info->scan_running ||
+		(source_info->num_files - transfer_info->num_files) > 1;
+}
+
+static int
+run_space_warning (CommonJob *job,
+		   GFile *dest,
+		   guint64 free_size,
+		   goffset required_size)
+{
+	char *primary, *secondary, *details;
+
+	primary = f (_("Error while copying to \"%B\"."), dest);
+	secondary = f(_("There is not enough space on the destination. Try to remove files to make space."));
+
+	details = f (_("There is %S available, but %S is required."), free_size, required_size);
+
+	return run_warning (job,
+			    primary,
+			    secondary,
+			    details,
+			    FALSE,
+			    CANCEL,
+			    COPY_FORCE,
+			    RETRY,
+			    NULL);
+}
+
+static void
+verify_destination (CommonJob *job,
+		    GFile *dest,
+		    char **dest_fs_id,
+		    goffset required_size)
+{
+	GFileInfo *info, *fsinfo;
+	GError *error;
+	guint64 free_size;
+	char *primary, *secondary, *details;
+	int response;
+	GFileType file_type;
+
+	if (dest_fs_id) {
+		*dest_fs_id = NULL;
+	}
+
+ retry:
+
+	error = NULL;
+	info = g_file_query_info (dest,
+				  G_FILE_ATTRIBUTE_STANDARD_TYPE","
+				  G_FILE_ATTRIBUTE_ID_FILESYSTEM,
+				  0,
+				  job->cancellable,
+				  &error);
+
+	if (info == NULL) {
+		if (IS_IO_ERROR (error, CANCELLED)) {
+			g_error_free (error);
+			return;
+		}
 
 		primary = f (_("Error while copying to \"%B\"."), dest);
 		details = NULL;
@@ -2924,24 +3779,12 @@ verify_destination (CommonJob *job,
 							      G_FILE_ATTRIBUTE_FILESYSTEM_FREE);
 
 		if (free_size < required_size) {
-			primary = f (_("Error while copying to \"%B\"."), dest);
-			secondary = f(_("There is not enough space on the destination. Try to remove files to make space."));
-
-			details = f (_("There is %S available, but %S is required."), free_size, required_size);
-
-			response = run_warning (job,
-						primary,
-						secondary,
-						details,
-						FALSE,
-						CANCEL,
-						COPY_FORCE,
-						RETRY,
-						NULL);
+			response = run_space_warning (job, dest, free_size, required_size);
 
 			if (response == 0 || response == GTK_RESPONSE_DELETE_EVENT) {
 				abort_job (job);
 			} else if (response == 2) {
+				g_object_unref (fsinfo);
 				goto retry;
 			} else if (response == 1) {
 				/* We are forced to copy - just fall through ... */
@@ -2973,6 +3816,209 @@ verify_destination (CommonJob *job,
 	g_object_unref (fsinfo);
 }
 
+/* The free space check of verify_destination(), for totals that are
+ * still growing. Only the part that is not transferred yet has to fit.
+ */
+static void
+verify_destination_space_incrementally (CommonJob *job,
+					SourceInfo *source_info,
+					TransferInfo *transfer_info)
+{
+	SourceScan *scan;
+	GFileInfo *fsinfo;
+	guint64 free_size;
+	goffset required_size;
+	int response;
+
+	scan = source_info->scan;
+	if (scan == NULL || scan->space_dest == NULL || scan->space_forced) {
+		return;
+	}
+
+	/* Look again whenever the scan found a good chunk more, and once
+	 * it is done.
+	 */
+	if (source_info->num_bytes == scan->space_checked ||
+	    (source_info->scan_running &&
+	     source_info->num_bytes < scan->space_checked + SOURCE_SCAN_SPACE_CHECK_INTERVAL)) {
+		return;
+	}
+
+ retry:
+	scan->space_checked = source_info->num_bytes;
+	required_size = source_info->num_bytes - transfer_info->num_bytes;
+	if (required_size <= 0) {
+		return;
+	}
+
+	fsinfo = g_file_query_filesystem_info (scan->space_dest,
+					       G_FILE_ATTRIBUTE_FILESYSTEM_FREE,
+					       job->cancellable,
+					       NULL);
+	if (fsinfo == NULL) {
+		return;
+	}
+
+	if (!g_file_info_has_attribute (fsinfo, G_FILE_ATTRIBUTE_FILESYSTEM_FREE)) {
+		g_object_unref (fsinfo);
+		return;
+	}
+
+	free_size = g_file_info_get_attribute_uint64 (fsinfo,
+						      G_FILE_ATTRIBUTE_FILESYSTEM_FREE);
+	g_object_unref (fsinfo);
+
+	if (free_size >= required_size) {
+		return;
+	}
+
+	response = run_space_warning (job, scan->space_dest, free_size, required_size);
+
+	if (response == 0 || response == GTK_RESPONSE_DELETE_EVENT) {
+		abort_job (job);
+	} else if (response == 2) {
+		update_source_info (source_info);
+		goto retry;
+	} else if (response == 1) {
+		scan->space_forced = TRUE;
+	} else {
+		g_assert_not_reached ();
+	}
+}
+
+/* Describes how most files of the job were copied, or returns NULL
+ * before anything was copied.
+ */
+static const char *
+get_copy_backend_description (CopyMoveJob *copy_job)
+{
+	int i, n, most, most_used;
+
+	most = 0;
+	most_used = COPY_BACKEND_LAST;
+	for (i = 0; i < COPY_BACKEND_LAST; i++) {
+		n = g_atomic_int_get (&copy_job->n_copied_with[i]);
+		if (n > most) {
+			most = n;
+			most_used = i;
+		}
+	}
+
+	switch (most_used) {
+	case COPY_BACKEND_CLONE:
+		return _("copy-on-write clone");
+	case COPY_BACKEND_COPY_FILE_RANGE:
+		return _("in-kernel copy");
+	case COPY_BACKEND_SPARSE:
+		return _("sparse copy");
+	case COPY_BACKEND_GIO:
+		return _("regular copy");
+	default:
+		return NULL;
+	}
+}
+
+/* Returns the I/O priority of the calling thread, or -1 */
+static int
+get_thread_io_priority (void)
+{
+#if defined (__linux__) && defined (SYS_ioprio_get)
+	return syscall (SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+#else
+	return -1;
+#endif
+}
+
+static void
+set_thread_io_priority (int priority)
+{
+#if defined (__linux__) && defined (SYS_ioprio_set)
+	if (priority >= 0) {
+		syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, priority);
+	}
+#endif
+}
+
+/* In KiB/s, 0 if unlimited */
+static int
+get_background_copy_speed (void)
+{
+	GSettings *prefs;
+	int speed;
+
+	/* Since this happens on a thread we can't use the global prefs object */
+	prefs = g_settings_new ("org.mate.caja.preferences");
+	speed = g_settings_get_int (prefs, CAJA_PREFERENCES_BACKGROUND_COPY_SPEED);
+	g_object_unref (prefs);
+
+	return MAX (speed, 0);
+}
+
+/* Sleeps until the transfer is back down to the background speed */
+static void
+throttle_copy (CopyMoveJob *job,
+	       TransferInfo *transfer_info)
+{
+	gint64 elapsed, expected;
+
+	if (job->background_speed == 0) {
+		return;
+	}
+
+	expected = (gint64) ((double) (transfer_info->num_bytes - job->throttle_start_bytes) /
+			     (job->background_speed * 1024.0) * G_USEC_PER_SEC);
+	elapsed = g_get_monotonic_time () - job->throttle_start_time;
+
+	while (expected > elapsed && !job_aborted ((CommonJob *)job)) {
+		/* Short naps, to notice cancelling and switching back soon */
+		g_usleep (MIN (expected - elapsed, G_USEC_PER_SEC / 10));
+		elapsed = g_get_monotonic_time () - job->throttle_start_time;
+
+		if (!caja_progress_info_get_background (job->common.progress)) {
+			break;
+		}
+	}
+}
+
+static void
+leave_background_mode (CopyMoveJob *job)
+{
+	if (job->background) {
+		set_thread_io_priority (job->saved_io_priority);
+		job->background = FALSE;
+	}
+}
+
+/* Applies the background mode the user picked in the progress window:
+ * the idle I/O class for the job thread and the background speed limit.
+ * Called on every bit of progress, so switching takes effect right away.
+ */
+static void
+update_background_mode (CopyMoveJob *job,
+			TransferInfo *transfer_info)
+{
+	gboolean background;
+
+	background = caja_progress_info_get_background (job->common.progress);
+
+	if (background != job->background) {
+		if (background) {
+			job->saved_io_priority = get_thread_io_priority ();
+			set_thread_io_priority (IOPRIO_PRIO_VALUE (IOPRIO_CLASS_IDLE, 0));
+			job->background = TRUE;
+			job->background_speed = get_background_copy_speed ();
+			job->throttle_start_time = g_get_monotonic_time ();
+			job->throttle_start_bytes = transfer_info->num_bytes;
+		} else {
+			leave_background_mode (job);
+		}
+	}
+
+	if (job->background) {
+		throttle_copy (job, transfer_info);
+	}
+}
+
 static void
 report_copy_progress (CopyMoveJob *copy_job,
 		      SourceInfo *source_info,
@@ -2984,11 +4030,15 @@ report_copy_progress (CopyMoveJob *copy_job,
 	guint64 now;
 	CommonJob *job;
 	gboolean is_move;
+	const char *backend;
+	char *s;
 
 	job = (CommonJob *)copy_job;
 
 	is_move = copy_job->is_move;
 
+	update_background_mode (copy_job, transfer_info);
+
 	now = g_get_monotonic_time ();
 
 	if (transfer_info->last_report_time != 0 &&
@@ -2997,6 +4047,9 @@ report_copy_progress (CopyMoveJob *copy_job,
 	}
 	transfer_info->last_report_time = now;
 
+	update_source_info (source_info);
+	verify_destination_space_incrementally (job, source_info, transfer_info);
+
 	files_left = source_info->num_files - transfer_info->num_files;
 
 	/* Races and whatnot could cause this to be negative... */
@@ -3009,7 +4062,7 @@ report_copy_progress (CopyMoveJob *copy_job,
 		/* Avoid changing this unless files_left changed since last time */
 		transfer_info->last_reported_files_left = files_left;
 
-		if (source_info->num_files == 1) {
+		if (source_info->num_files == 1 && !source_info->scan_running) {
 			if (copy_job->destination != NULL) {
 				caja_progress_info_take_status (job->progress,
 								    f (is_move ?
@@ -3075,15 +4128,16 @@ report_copy_progress (CopyMoveJob *copy_job,
 		transfer_rate = transfer_info->num_bytes / elapsed;
 	}
 
-	if (elapsed < SECONDS_NEEDED_FOR_RELIABLE_TRANSFER_RATE &&
+	if (source_info->scan_running) {
+		/* The total is still being counted, so no time estimate yet */
+		/* Translators: %S will expand to a size like "2 bytes" or "3 MB", so something like "4 kb of at least 4 MB" */
+		s = f (_("%S of at least %S"), transfer_info->num_bytes, total_size);
+	} else if (elapsed < SECONDS_NEEDED_FOR_RELIABLE_TRANSFER_RATE &&
 	    transfer_rate > 0) {
-		char *s;
 		/* Translators: %S will expand to a size like "2 bytes" or "3 MB", so something like "4 kb of 4 MB" */
 		s = f (_("%S of %S"), transfer_info->num_bytes, total_size);
-		caja_progress_info_take_details (job->progress, s);
 	} else {
 		int remaining_time;
-		char *s;
 
 		remaining_time = (total_size - transfer_info->num_bytes) / transfer_rate;
 
@@ -3098,9 +4152,20 @@ report_copy_progress (CopyMoveJob *copy_job,
 		       transfer_info->num_bytes, total_size,
 		       remaining_time,
 		       (goffset)transfer_rate);
-		caja_progress_info_take_details (job->progress, s);
 	}
 
+	backend = is_move ? NULL : get_copy_backend_description (copy_job);
+	if (backend != NULL) {
+		char *with_backend;
+
+		/* Translators: the first %s is the progress details like "2 kb of 4 MB",
+		 * the second one says how files are copied, like "copy-on-write clone" */
+		with_backend = g_strdup_printf (_("%s (%s)"), s, backend);
+		g_free (s);
+		s = with_backend;
+	}
+	caja_progress_info_take_details (job->progress, s);
+
 	caja_progress_info_set_progress (job->progress, transfer_info->num_bytes, total_size);
 }
 
@@ -3424,28 +4489,678 @@ static void copy_move_file (CopyMoveJob *job,
 			    gboolean readonly_source_fs,
 			    gboolean last_item);
 
-typedef enum {
-	CREATE_DEST_DIR_RETRY,
-	CREATE_DEST_DIR_FAILED,
-	CREATE_DEST_DIR_SUCCESS
-} CreateDestDirResult;
+#if defined (SEEK_DATA) && defined (SEEK_HOLE)
+#define HAVE_SPARSE_COPY
+#endif
 
-static CreateDestDirResult
-create_dest_dir (CommonJob *job,
-		 GFile *src,
-		 GFile **dest,
-		 gboolean same_fs,
-		 char **dest_fs_type)
-{
-	GError *error;
-	GFile *new_dest, *dest_dir;
-	char *primary, *secondary, *details;
-	int response;
-	gboolean handled_invalid_filename;
+#if (defined (HAVE_LINUX_FS_H) && defined (FICLONE)) || defined (HAVE_COPY_FILE_RANGE) || defined (HAVE_SPARSE_COPY)
+#define HAVE_KERNEL_COPY
+#endif
 
-	handled_invalid_filename = *dest_fs_type != NULL;
+#ifdef HAVE_KERNEL_COPY
+/* Errors meaning the kernel cannot do this copy, but GIO may */
+static gboolean
+kernel_copy_unsupported (int errsv)
+{
+	return errsv == EXDEV ||
+	       errsv == EINVAL ||
+	       errsv == ENOSYS ||
+	       errsv == EOPNOTSUPP ||
+	       errsv == ENOTTY ||
+	       errsv == EBADF ||
+	       errsv == EPERM;
+}
 
- retry:
+/* For a source that ends before the size it had when the copy started */
+static void
+set_file_shrank_error (GError **error)
+{
+	g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+			     _("The file got shorter while it was being copied."));
+}
+
+/* Copies up to length bytes at offset in src_fd to the same offset in
+ * dest_fd. Returns the number of bytes copied, 0 at the end of the file
+ * or -1 with errno set.
+ */
+static ssize_t
+copy_range_at (int src_fd,
+	       int dest_fd,
+	       goffset offset,
+	       size_t length,
+	       gboolean *use_copy_file_range,
+	       char **buffer)
+{
+	ssize_t n, written, w;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	if (*use_copy_file_range) {
+		loff_t src_offset, dest_offset;
+
+		src_offset = dest_offset = offset;
+		n = copy_file_range (src_fd, &src_offset, dest_fd, &dest_offset, length, 0);
+		if (n >= 0 || errno == EINTR || !kernel_copy_unsupported (errno)) {
+			return n;
+		}
+		*use_copy_file_range = FALSE;
+	}
+#endif
+
+	if (*buffer == NULL) {
+		*buffer = g_malloc (SPARSE_COPY_BUFFER_SIZE);
+	}
+
+	n = pread (src_fd, *buffer, MIN (length, SPARSE_COPY_BUFFER_SIZE), offset);
+	for (written = 0; n > 0 && written < n; written += w) {
+		w = pwrite (dest_fd, *buffer + written, n - written, offset + written);
+		if (w < 0) {
+			if (errno == EINTR) {
+				w = 0;
+				continue;
+			}
+			return -1;
+		}
+	}
+
+	return n;
+}
+
+#ifdef HAVE_SPARSE_COPY
+/* Copies only the data extents of src_fd, so the holes of sparse files
+ * like disk images stay holes instead of being written out as zeros.
+ * Progress is reported by offset, so skipped holes count as copied and
+ * the totals still add up to the file sizes.
+ */
+static gboolean
+copy_sparse_file (int src_fd,
+		  int dest_fd,
+		  goffset size,
+		  GCancellable *cancellable,
+		  GFileProgressCallback progress_callback,
+		  gpointer progress_callback_data,
+		  GError **error)
+{
+	goffset offset, data_end;
+	gboolean use_copy_file_range, res, shrank;
+	char *buffer;
+	ssize_t n;
+	int errsv;
+
+	use_copy_file_range = TRUE;
+	buffer = NULL;
+	res = TRUE;
+	shrank = FALSE;
+	errsv = 0;
+
+	offset = 0;
+	while (res && offset < size) {
+		offset = lseek (src_fd, offset, SEEK_DATA);
+		if (offset < 0) {
+			/* ENXIO: only a hole is left */
+			if (errno != ENXIO) {
+				errsv = errno;
+				res = FALSE;
+			}
+			break;
+		}
+		data_end = lseek (src_fd, offset, SEEK_HOLE);
+		if (data_end < 0) {
+			errsv = errno;
+			res = FALSE;
+			break;
+		}
+		data_end = MIN (data_end, size);
+
+		while (offset < data_end) {
+			if (g_cancellable_is_cancelled (cancellable)) {
+				res = FALSE;
+				break;
+			}
+
+			n = copy_range_at (src_fd, dest_fd, offset,
+					   MIN (data_end - offset, COPY_FILE_RANGE_CHUNK_SIZE),
+					   &use_copy_file_range, &buffer);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				errsv = errno;
+				res = FALSE;
+				break;
+			}
+			if (n == 0 && use_copy_file_range) {
+				/* copy_file_range() stops early across file
+				 * systems on some kernels, read and write the rest
+				 */
+				use_copy_file_range = FALSE;
+				continue;
+			}
+			if (n == 0) {
+				shrank = TRUE;
+				res = FALSE;
+				break;
+			}
+
+			offset += n;
+			if (progress_callback) {
+				progress_callback (offset, size, progress_callback_data);
+			}
+		}
+	}
+
+	/* Sets the size, and with it any hole at the end */
+	if (res && ftruncate (dest_fd, size) != 0) {
+		errsv = errno;
+		res = FALSE;
+	}
+
+	if (res) {
+		if (progress_callback) {
+			progress_callback (size, size, progress_callback_data);
+		}
+	} else if (shrank) {
+		set_file_shrank_error (error);
+	} else if (errsv != 0) {
+		g_set_error_literal (error, G_IO_ERROR,
+				     g_io_error_from_errno (errsv),
+				     g_strerror (errsv));
+	} else {
+		g_cancellable_set_error_if_cancelled (cancellable, error);
+	}
+
+	g_free (buffer);
+
+	return res;
+}
+#endif
+
+/* Returns TRUE if the kernel copied the file, or failed in a way that
+ * must be reported. Returns FALSE, with nothing created, if the copy
+ * should be done by GIO instead.
+ */
+static gboolean
+copy_file_in_kernel (GFile *src,
+		     GFile *dest,
+		     GFileCopyFlags flags,
+		     GCancellable *cancellable,
+		     GFileProgressCallback progress_callback,
+		     gpointer progress_callback_data,
+		     CopyBackend *backend,
+		     gboolean *res,
+		     GError **error)
+{
+	char *src_path, *dest_path;
+	int src_fd, dest_fd, errsv;
+	struct stat statbuf;
+	gboolean handled;
+
+	/* Replacing files is left to GIO, it has the backup and
+	 * atomic replace logic.
+	 */
+	if (flags & G_FILE_COPY_OVERWRITE) {
+		return FALSE;
+	}
+
+	src_path = g_file_get_path (src);
+	dest_path = g_file_get_path (dest);
+	src_fd = dest_fd = -1;
+	handled = FALSE;
+
+	if (src_path == NULL || dest_path == NULL) {
+		goto out;
+	}
+
+	/* Files in /proc and similar report no size, GIO reads them to the end */
+	src_fd = open (src_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (src_fd < 0 || fstat (src_fd, &statbuf) != 0 ||
+	    !S_ISREG (statbuf.st_mode) || statbuf.st_size == 0) {
+		goto out;
+	}
+
+#ifdef HAVE_SPARSE_COPY
+	/* Files in sysfs report a size, but usually have less data than
+	 * that. They have no blocks, yet data at the start, unlike files
+	 * that are one big hole.
+	 */
+	if (statbuf.st_blocks == 0 && lseek (src_fd, 0, SEEK_DATA) == 0) {
+		goto out;
+	}
+#endif
+
+	dest_fd = open (dest_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+			(flags & G_FILE_COPY_TARGET_DEFAULT_PERMS) ? 0666 : statbuf.st_mode & 07777);
+	if (dest_fd < 0) {
+		/* Let GIO report it */
+		goto out;
+	}
+
+	handled = TRUE;
+	*res = TRUE;
+
+#if defined (HAVE_LINUX_FS_H) && defined (FICLONE)
+	if (ioctl (dest_fd, FICLONE, src_fd) == 0) {
+		*backend = COPY_BACKEND_CLONE;
+		if (progress_callback) {
+			progress_callback (statbuf.st_size, statbuf.st_size, progress_callback_data);
+		}
+		goto out;
+	}
+#endif
+
+#ifdef HAVE_SPARSE_COPY
+	/* Fewer blocks than the size needs means there are holes */
+	if ((goffset) statbuf.st_blocks * 512 < statbuf.st_size) {
+		*res = copy_sparse_file (src_fd, dest_fd, statbuf.st_size,
+					 cancellable,
+					 progress_callback, progress_callback_data,
+					 error);
+		*backend = COPY_BACKEND_SPARSE;
+		goto out;
+	}
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+	{
+		goffset copied = 0;
+		gboolean use_copy_file_range = TRUE;
+		char *buffer = NULL;
+
+		while (copied < statbuf.st_size) {
+			ssize_t n;
+
+			if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+				*res = FALSE;
+				break;
+			}
+
+			if (use_copy_file_range) {
+				n = copy_file_range (src_fd, NULL, dest_fd, NULL,
+						     MIN (statbuf.st_size - copied, COPY_FILE_RANGE_CHUNK_SIZE), 0);
+			} else {
+				n = copy_range_at (src_fd, dest_fd, copied,
+						   MIN (statbuf.st_size - copied, COPY_FILE_RANGE_CHUNK_SIZE),
+						   &use_copy_file_range, &buffer);
+			}
+			if (n < 0) {
+				errsv = errno;
+				if (errsv == EINTR) {
+					continue;
+				}
+				if (copied == 0 && kernel_copy_unsupported (errsv)) {
+					handled = FALSE;
+				} else {
+					g_set_error_literal (error, G_IO_ERROR,
+							     g_io_error_from_errno (errsv),
+							     g_strerror (errsv));
+					*res = FALSE;
+				}
+				break;
+			}
+			if (n == 0 && use_copy_file_range) {
+				/* Files in sysfs and the like have less data than
+				 * their size says, GIO reads them to the end. Some
+				 * kernels also stop early across file systems, the
+				 * rest is read and written then.
+				 */
+				if (copied == 0) {
+					handled = FALSE;
+					break;
+				}
+				use_copy_file_range = FALSE;
+				continue;
+			}
+			if (n == 0) {
+				set_file_shrank_error (error);
+				*res = FALSE;
+				break;
+			}
+
+			copied += n;
+			if (progress_callback) {
+				progress_callback (copied, statbuf.st_size, progress_callback_data);
+			}
+		}
+		if (handled && *res) {
+			*backend = COPY_BACKEND_COPY_FILE_RANGE;
+		}
+		g_free (buffer);
+	}
+#else
+	handled = FALSE;
+#endif
+
+ out:
+	if (dest_fd >= 0) {
+		if (close (dest_fd) != 0 && handled && *res) {
+			errsv = errno;
+			g_set_error_literal (error, G_IO_ERROR,
+					     g_io_error_from_errno (errsv),
+					     g_strerror (errsv));
+			*res = FALSE;
+		}
+		if (!handled || !*res) {
+			unlink (dest_path);
+		}
+	}
+	if (src_fd >= 0) {
+		close (src_fd);
+	}
+	g_free (src_path);
+	g_free (dest_path);
+
+	return handled;
+}
+#endif
+
+/* Copies @src to @dest like g_file_copy(), but for local files first
+ * asks the kernel to clone the file (FICLONE, instant on btrfs and XFS)
+ * or to copy it without going through user space (copy_file_range(),
+ * which NFS 4.2 turns into a server-side copy). Sparse files only get
+ * their data copied, keeping the holes. @backend is set to the way that
+ * was used.
+ */
+static gboolean
+copy_file_contents (GFile *src,
+		    GFile *dest,
+		    GFileCopyFlags flags,
+		    GCancellable *cancellable,
+		    GFileProgressCallback progress_callback,
+		    gpointer progress_callback_data,
+		    CopyBackend *backend,
+		    GError **error)
+{
+#ifdef HAVE_KERNEL_COPY
+	gboolean res;
+
+	if (g_file_is_native (src) && g_file_is_native (dest) &&
+	    copy_file_in_kernel (src, dest, flags, cancellable,
+				 progress_callback, progress_callback_data,
+				 backend, &res, error)) {
+		return res;
+	}
+#endif
+
+	*backend = COPY_BACKEND_GIO;
+	return g_file_copy (src, dest,
+			    flags,
+			    cancellable,
+			    progress_callback,
+			    progress_callback_data,
+			    error);
+}
+
+static void
+count_copy_backend (CopyMoveJob *job,
+		    CopyBackend backend)
+{
+	g_atomic_int_inc (&job->n_copied_with[backend]);
+}
+
+/* The copy pipeline copies regular files found inside folders on a pool
+ * of threads, so many small files are copied at once. Threads only try
+ * the plain copy. Everything else happens on the job thread: progress,
+ * change notifications, undo data, and any failure. A failed file goes
+ * through copy_move_file() again, which shows the conflict and error
+ * dialogs and keeps skip and cancel working as before.
+ *
+ * Folders are created on the job thread before their files are queued.
+ * All queued files are finished before a folder's own attributes are
+ * copied.
+ */
+struct _CopyPipeline {
+	CopyMoveJob *job;
+	GThreadPool *pool;
+	GAsyncQueue *done;
+	int n_pending;
+};
+
+typedef struct {
+	GFile *src;
+	GFile *dest;
+	GFile *dest_dir;
+	goffset size;
+	GFileCopyFlags flags;
+	gboolean same_fs;
+	gboolean readonly_source_fs;
+	char **dest_fs_type;
+	gboolean *skipped_file;
+	GError *error;
+} PipelinedCopy;
+
+static void
+pipelined_copy_free (PipelinedCopy *copy)
+{
+	g_object_unref (copy->src);
+	g_object_unref (copy->dest);
+	g_object_unref (copy->dest_dir);
+	if (copy->error) {
+		g_error_free (copy->error);
+	}
+	g_free (copy);
+}
+
+static void
+copy_pipeline_thread_func (gpointer data,
+			   gpointer user_data)
+{
+	PipelinedCopy *copy;
+	CopyPipeline *pipeline;
+	CommonJob *job;
+	CopyBackend backend;
+	gboolean background;
+	int saved_io_priority;
+
+	copy = data;
+	pipeline = user_data;
+	job = (CommonJob *)pipeline->job;
+
+	/* Pool threads are shared, so only lower the priority for this file */
+	background = caja_progress_info_get_background (job->progress);
+	saved_io_priority = -1;
+	if (background) {
+		saved_io_priority = get_thread_io_priority ();
+		set_thread_io_priority (IOPRIO_PRIO_VALUE (IOPRIO_CLASS_IDLE, 0));
+	}
+
+	/* Without G_FILE_COPY_OVERWRITE the destination did not exist
+	 * unless we get G_IO_ERROR_EXISTS, so anything left there after
+	 * another error is our partial copy. Remove it, copy_move_file()
+	 * will try again.
+	 */
+	if (copy_file_contents (copy->src, copy->dest,
+				copy->flags,
+				job->cancellable,
+				NULL, NULL,
+				&backend,
+				&copy->error)) {
+		count_copy_backend (pipeline->job, backend);
+		/* Ignore errors here. Failure to copy metadata is not a hard error */
+		g_file_copy_attributes (copy->src, copy->dest,
+					copy->flags | G_FILE_COPY_ALL_METADATA,
+					job->cancellable, NULL);
+	} else if (!IS_IO_ERROR (copy->error, EXISTS)) {
+		g_file_delete (copy->dest, NULL, NULL);
+	}
+
+	if (background) {
+		set_thread_io_priority (saved_io_priority);
+	}
+
+	g_async_queue_push (pipeline->done, copy);
+}
+
+static CopyPipeline *
+copy_pipeline_new (CopyMoveJob *job)
+{
+	CopyPipeline *pipeline;
+
+	pipeline = g_new0 (CopyPipeline, 1);
+	pipeline->job = job;
+	pipeline->done = g_async_queue_new ();
+	pipeline->pool = g_thread_pool_new (copy_pipeline_thread_func,
+					    pipeline,
+					    COPY_PIPELINE_THREADS,
+					    FALSE,
+					    NULL);
+	if (pipeline->pool == NULL) {
+		g_async_queue_unref (pipeline->done);
+		g_free (pipeline);
+		return NULL;
+	}
+
+	return pipeline;
+}
+
+static void
+copy_pipeline_finish_one (CopyPipeline *pipeline,
+			  SourceInfo *source_info,
+			  TransferInfo *transfer_info)
+{
+	PipelinedCopy *copy;
+	CopyMoveJob *copy_job;
+	CommonJob *job;
+
+	copy = g_async_queue_pop (pipeline->done);
+	pipeline->n_pending--;
+
+	copy_job = pipeline->job;
+	job = (CommonJob *)copy_job;
+
+	if (copy->error == NULL) {
+		transfer_info->num_files ++;
+		transfer_info->num_bytes += copy->size;
+		report_copy_progress (copy_job, source_info, transfer_info);
+
+		if (copy_job->journal != NULL) {
+			caja_copy_journal_file_done (copy_job->journal, copy->src);
+		}
+
+		caja_file_changes_queue_file_added (copy->dest);
+
+		// Start UNDO-REDO
+		caja_undostack_manager_data_add_origin_target_pair (job->undo_redo_data, copy->src, copy->dest);
+		// End UNDO-REDO
+	} else if (!IS_IO_ERROR (copy->error, CANCELLED) &&
+		   !job_aborted (job)) {
+		copy_move_file (copy_job, copy->src, copy->dest_dir,
+				copy->same_fs, FALSE, copy->dest_fs_type,
+				source_info, transfer_info, NULL, NULL, FALSE,
+				copy->skipped_file, copy->readonly_source_fs,
+				FALSE);
+	}
+
+	pipelined_copy_free (copy);
+}
+
+/* Waits for every queued copy and accounts for it. */
+static void
+copy_pipeline_drain (CopyPipeline *pipeline,
+		     SourceInfo *source_info,
+		     TransferInfo *transfer_info)
+{
+	while (pipeline->n_pending > 0) {
+		copy_pipeline_finish_one (pipeline, source_info, transfer_info);
+	}
+}
+
+static void
+copy_pipeline_free (CopyPipeline *pipeline)
+{
+	g_assert (pipeline->n_pending == 0);
+
+	g_thread_pool_free (pipeline->pool, FALSE, TRUE);
+	g_async_queue_unref (pipeline->done);
+	g_free (pipeline);
+}
+
+/* Queues @src for copying into @dest_dir if it is a small regular file,
+ * returns FALSE if it should be copied the usual way.
+ */
+static gboolean
+copy_pipeline_add (CopyMoveJob *copy_job,
+		   GFile *src,
+		   GFileInfo *info,
+		   GFile *dest_dir,
+		   gboolean same_fs,
+		   char **dest_fs_type,
+		   SourceInfo *source_info,
+		   TransferInfo *transfer_info,
+		   gboolean *skipped_file,
+		   gboolean readonly_source_fs)
+{
+	CopyPipeline *pipeline;
+	PipelinedCopy *copy;
+	CommonJob *job;
+
+	pipeline = copy_job->pipeline;
+	job = (CommonJob *)copy_job;
+
+	if (pipeline == NULL ||
+	    copy_job->is_move ||
+	    g_file_info_get_file_type (info) != G_FILE_TYPE_REGULAR ||
+	    g_file_info_get_size (info) > COPY_PIPELINE_MAX_FILE_SIZE ||
+	    should_skip_file (job, src)) {
+		return FALSE;
+	}
+
+	/* copy_move_file() looks at files a resumed job may already have */
+	if (copy_job->journal != NULL &&
+	    caja_copy_journal_is_done (copy_job->journal, src)) {
+		return FALSE;
+	}
+
+	/* Trusted desktop files copied to the desktop need extra work */
+	if (copy_job->desktop_location != NULL &&
+	    g_file_equal (copy_job->desktop_location, dest_dir)) {
+		return FALSE;
+	}
+
+	while (pipeline->n_pending >= COPY_PIPELINE_MAX_PENDING) {
+		copy_pipeline_finish_one (pipeline, source_info, transfer_info);
+	}
+
+	copy = g_new0 (PipelinedCopy, 1);
+	copy->src = g_object_ref (src);
+	copy->dest = get_target_file (src, dest_dir, *dest_fs_type, same_fs);
+	copy->dest_dir = g_object_ref (dest_dir);
+	copy->size = g_file_info_get_size (info);
+	copy->flags = G_FILE_COPY_NOFOLLOW_SYMLINKS;
+	if (readonly_source_fs) {
+		copy->flags |= G_FILE_COPY_TARGET_DEFAULT_PERMS;
+	}
+	copy->same_fs = same_fs;
+	copy->readonly_source_fs = readonly_source_fs;
+	copy->dest_fs_type = dest_fs_type;
+	copy->skipped_file = skipped_file;
+
+	pipeline->n_pending++;
+	g_thread_pool_push (pipeline->pool, copy, NULL);
+
+	return TRUE;
+}
+
+typedef enum {
+	CREATE_DEST_DIR_RETRY,
+	CREATE_DEST_DIR_FAILED,
+	CREATE_DEST_DIR_SUCCESS
+} CreateDestDirResult;
+
+static CreateDestDirResult
+create_dest_dir (CommonJob *job,
+		 GFile *src,
+		 GFile **dest,
+		 gboolean same_fs,
+		 char **dest_fs_type)
+{
+	GError *error;
+	GFile *new_dest, *dest_dir;
+	char *primary, *secondary, *details;
+	int response;
+	gboolean handled_invalid_filename;
+
+	handled_invalid_filename = *dest_fs_type != NULL;
+
+ retry:
 	/* First create the directory, then copy stuff to it before
 	   copying the attributes, because we need to be sure we can write to it */
 
@@ -3498,6 +5213,7 @@ create_dest_dir (CommonJob *job,
 					CANCEL, SKIP, RETRY,
 					NULL);
 
+		note_aborting_error (job, response, error);
 		g_error_free (error);
 
 		if (response == 0 || response == GTK_RESPONSE_DELETE_EVENT) {
@@ -3584,7 +5300,9 @@ copy_move_directory (CopyMoveJob *copy_job,
  retry:
 	error = NULL;
 	enumerator = g_file_enumerate_children (src,
-						G_FILE_ATTRIBUTE_STANDARD_NAME,
+						G_FILE_ATTRIBUTE_STANDARD_NAME","
+						G_FILE_ATTRIBUTE_STANDARD_TYPE","
+						G_FILE_ATTRIBUTE_STANDARD_SIZE,
 						G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
 						job->cancellable,
 						&error);
@@ -3601,15 +5319,25 @@ copy_move_directory (CopyMoveJob *copy_job,
 						     g_file_info_get_name (info));
 
 			last_item = (last_item_above) && (!nextinfo);
-			copy_move_file (copy_job, src_file, *dest, same_fs, FALSE, &dest_fs_type,
-					source_info, transfer_info, NULL, NULL, FALSE, &local_skipped_file,
-					readonly_source_fs, last_item);
+			/* The last item disables pausing, so copy it here */
+			if (last_item ||
+			    !copy_pipeline_add (copy_job, src_file, info, *dest, same_fs, &dest_fs_type,
+						source_info, transfer_info, &local_skipped_file,
+						readonly_source_fs)) {
+				copy_move_file (copy_job, src_file, *dest, same_fs, FALSE, &dest_fs_type,
+						source_info, transfer_info, NULL, NULL, FALSE, &local_skipped_file,
+						readonly_source_fs, last_item);
+			}
 			g_object_unref (src_file);
 			g_object_unref (info);
 		}
 		if (nextinfo)
 			g_object_unref (nextinfo);
 
+		if (copy_job->pipeline != NULL) {
+			copy_pipeline_drain (copy_job->pipeline, source_info, transfer_info);
+		}
+
 		g_file_enumerator_close (enumerator, job->cancellable, NULL);
 		g_object_unref (enumerator);
 
@@ -3639,6 +5367,7 @@ copy_move_directory (CopyMoveJob *copy_job,
 						CANCEL, _("_Skip files"),
 						NULL);
 
+			note_aborting_error (job, response, error);
 			g_error_free (error);
 
 			if (response == 0 || response == GTK_RESPONSE_DELETE_EVENT) {
@@ -3684,6 +5413,7 @@ copy_move_directory (CopyMoveJob *copy_job,
 					CANCEL, SKIP, RETRY,
 					NULL);
 
+		note_aborting_error (job, response, error);
 		g_error_free (error);
 
 		if (response == 0 || response == GTK_RESPONSE_DELETE_EVENT) {
@@ -3722,7 +5452,7 @@ copy_move_directory (CopyMoveJob *copy_job,
 						primary,
 						secondary,
 						details,
-						(source_info->num_files - transfer_info->num_files) > 1,
+						more_files_left (source_info, transfer_info),
 						CANCEL, SKIP_ALL, SKIP,
 						NULL);
 
@@ -3739,6 +5469,8 @@ copy_move_directory (CopyMoveJob *copy_job,
 
 		skip:
 			g_error_free (error);
+		} else if (copy_job->journal != NULL) {
+			caja_copy_journal_file_done (copy_job->journal, src);
 		}
 	}
 
@@ -3882,8 +5614,82 @@ typedef struct {
 	goffset last_size;
 	SourceInfo *source_info;
 	TransferInfo *transfer_info;
+	/* Journaling of large files, only when not replacing @dest */
+	GFile *src;
+	GFile *dest;
+	gboolean use_journal;
+	gboolean journal_started;
+	goffset journal_offset;
 } ProgressData;
 
+/* Flushes the data written to @file so far to the disk, so that a
+ * checkpoint never covers more than survives the device going away.
+ * Returns FALSE for files without a local path.
+ */
+static gboolean
+sync_file_data (GFile *file)
+{
+	char *path;
+	int fd;
+	gboolean synced;
+
+	path = g_file_get_path (file);
+	if (path == NULL) {
+		return FALSE;
+	}
+
+	fd = open (path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	g_free (path);
+	if (fd < 0) {
+		return FALSE;
+	}
+
+	synced = fdatasync (fd) == 0;
+	close (fd);
+
+	return synced;
+}
+
+/* Writes checkpoints of a large file to the job's journal, so that an
+ * interrupted job can continue the file instead of starting over. The
+ * copied data is synced first, as the offset is trusted on resume.
+ */
+static void
+journal_copy_progress (ProgressData *pdata,
+		       goffset current_num_bytes,
+		       goffset total_num_bytes)
+{
+	CajaCopyJournal *journal;
+	GFileInfo *info;
+	guint64 mtime;
+
+	journal = pdata->job->journal;
+
+	if (!pdata->journal_started) {
+		/* Without an mtime the file can't be resumed, which is fine */
+		mtime = 0;
+		info = g_file_query_info (pdata->src,
+					  G_FILE_ATTRIBUTE_TIME_MODIFIED,
+					  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+					  NULL, NULL);
+		if (info != NULL) {
+			mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+			g_object_unref (info);
+		}
+
+		caja_copy_journal_file_started (journal, pdata->src, pdata->dest,
+						total_num_bytes, mtime);
+		pdata->journal_started = TRUE;
+	}
+
+	if (current_num_bytes - pdata->journal_offset >= COPY_JOURNAL_CHECKPOINT_INTERVAL) {
+		if (sync_file_data (pdata->dest)) {
+			caja_copy_journal_file_progress (journal, current_num_bytes);
+		}
+		pdata->journal_offset = current_num_bytes;
+	}
+}
+
 static void
 copy_file_progress_callback (goffset current_num_bytes,
 			     goffset total_num_bytes,
@@ -3892,17 +5698,246 @@ copy_file_progress_callback (goffset current_num_bytes,
 	ProgressData *pdata;
 	goffset new_size;
 
-	pdata = user_data;
+	pdata = user_data;
+
+	new_size = current_num_bytes - pdata->last_size;
+
+	if (new_size > 0) {
+		pdata->transfer_info->num_bytes += new_size;
+		pdata->last_size = current_num_bytes;
+		report_copy_progress (pdata->job,
+				      pdata->source_info,
+				      pdata->transfer_info);
+	}
+
+	if (pdata->use_journal &&
+	    total_num_bytes >= COPY_JOURNAL_MIN_FILE_SIZE &&
+	    current_num_bytes < total_num_bytes) {
+		journal_copy_progress (pdata, current_num_bytes, total_num_bytes);
+	}
+}
+
+#ifdef HAVE_KERNEL_COPY
+/* Copies the rest of a file the interrupted job got to @offset in.
+ * Returns FALSE if the files don't look the way the journal left them.
+ */
+static gboolean
+continue_partial_copy (ProgressData *pdata,
+		       goffset offset,
+		       goffset size,
+		       guint64 mtime,
+		       gboolean *res,
+		       GError **error)
+{
+	CommonJob *job;
+	char *src_path, *dest_path, *buffer;
+	struct stat src_stat, dest_stat;
+	int src_fd, dest_fd, errsv;
+	gboolean handled, use_copy_file_range;
+	goffset copied;
+	ssize_t n;
+
+	job = (CommonJob *)pdata->job;
+	src_path = g_file_get_path (pdata->src);
+	dest_path = g_file_get_path (pdata->dest);
+	src_fd = dest_fd = -1;
+	handled = FALSE;
+
+	if (src_path == NULL || dest_path == NULL) {
+		goto out;
+	}
+
+	src_fd = open (src_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	dest_fd = open (dest_path, O_WRONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (src_fd < 0 || dest_fd < 0 ||
+	    fstat (src_fd, &src_stat) != 0 || fstat (dest_fd, &dest_stat) != 0 ||
+	    !S_ISREG (src_stat.st_mode) || !S_ISREG (dest_stat.st_mode) ||
+	    src_stat.st_size != size || (guint64) src_stat.st_mtime != mtime) {
+		goto out;
+	}
+
+	/* Holes at the end were never written out */
+	offset = MIN (offset, dest_stat.st_size);
+
+	handled = TRUE;
+	*res = TRUE;
+
+	caja_copy_journal_file_started (pdata->job->journal, pdata->src, pdata->dest, size, mtime);
+	caja_copy_journal_file_progress (pdata->job->journal, offset);
+	pdata->journal_started = TRUE;
+	pdata->journal_offset = offset;
+	copy_file_progress_callback (offset, size, pdata);
+
+	use_copy_file_range = TRUE;
+	buffer = NULL;
+	errsv = 0;
+	copied = offset;
+	while (copied < size) {
+		if (g_cancellable_set_error_if_cancelled (job->cancellable, error)) {
+			*res = FALSE;
+			break;
+		}
+
+		n = copy_range_at (src_fd, dest_fd, copied,
+				   MIN (size - copied, COPY_FILE_RANGE_CHUNK_SIZE),
+				   &use_copy_file_range, &buffer);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			/* 0 means the file shrank, which the size check rules out */
+			errsv = n < 0 ? errno : EIO;
+			break;
+		}
+
+		copied += n;
+		copy_file_progress_callback (copied, size, pdata);
+	}
+	g_free (buffer);
+
+	/* Anything written past the last checkpoint is rewritten, but may
+	 * have gone further than the file now does.
+	 */
+	if (*res && errsv == 0 && ftruncate (dest_fd, size) != 0) {
+		errsv = errno;
+	}
+	if (close (dest_fd) != 0 && *res && errsv == 0) {
+		errsv = errno;
+	}
+	dest_fd = -1;
+
+	if (*res && errsv != 0) {
+		g_set_error_literal (error, G_IO_ERROR,
+				     g_io_error_from_errno (errsv),
+				     g_strerror (errsv));
+		*res = FALSE;
+	}
+
+ out:
+	if (dest_fd >= 0) {
+		close (dest_fd);
+	}
+	if (src_fd >= 0) {
+		close (src_fd);
+	}
+	g_free (src_path);
+	g_free (dest_path);
+
+	return handled;
+}
+#endif
+
+/* Continues a file that the interrupted job this job resumes was in
+ * the middle of, if the journal has it. Returns FALSE if the file must
+ * be copied the usual way, with any partial copy removed.
+ */
+static gboolean
+resume_partial_copy (ProgressData *pdata,
+		     gboolean *res,
+		     GError **error)
+{
+	CopyMoveJob *copy_job;
+	goffset offset, size;
+	guint64 mtime;
+
+	copy_job = pdata->job;
+
+	if (!caja_copy_journal_get_partial (copy_job->journal, pdata->src, pdata->dest,
+					    &offset, &size, &mtime)) {
+		return FALSE;
+	}
+
+#ifdef HAVE_KERNEL_COPY
+	if (g_file_is_native (pdata->src) && g_file_is_native (pdata->dest) &&
+	    continue_partial_copy (pdata, offset, size, mtime, res, error)) {
+		if (*res && copy_job->is_move) {
+			/* Finish the move the way g_file_move() would have */
+			g_file_copy_attributes (pdata->src, pdata->dest,
+						G_FILE_COPY_NOFOLLOW_SYMLINKS | G_FILE_COPY_ALL_METADATA,
+						((CommonJob *)copy_job)->cancellable, NULL);
+			*res = g_file_delete (pdata->src, ((CommonJob *)copy_job)->cancellable, error);
+		}
+		return TRUE;
+	}
+#endif
+
+	/* Start over. The journal only has files that were created by
+	 * the job, never ones it replaced.
+	 */
+	g_file_delete (pdata->dest, NULL, NULL);
+	return FALSE;
+}
+
+/* Accounts for a file the interrupted job already finished */
+static void
+skip_journaled_file (CopyMoveJob *copy_job,
+		     GFile *src,
+		     SourceInfo *source_info,
+		     TransferInfo *transfer_info)
+{
+	GFileInfo *info;
+
+	/* Moved files are gone, so they were not counted either */
+	if (copy_job->is_move) {
+		return;
+	}
+
+	info = g_file_query_info (src,
+				  G_FILE_ATTRIBUTE_STANDARD_SIZE,
+				  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+				  copy_job->common.cancellable,
+				  NULL);
+	if (info != NULL) {
+		transfer_info->num_bytes += g_file_info_get_size (info);
+		g_object_unref (info);
+	}
+
+	transfer_info->num_files ++;
+	report_copy_progress (copy_job, source_info, transfer_info);
+}
+
+/* The journal is written out in batches, so a resumed job can find
+ * files the interrupted one finished without getting them into the
+ * journal. A copy has the size and modification time of its source.
+ */
+static gboolean
+is_finished_copy (GFile *src,
+		  GFile *dest,
+		  GCancellable *cancellable)
+{
+	GFileInfo *src_info, *dest_info;
+	gboolean res;
+
+	src_info = g_file_query_info (src,
+				      G_FILE_ATTRIBUTE_STANDARD_TYPE","
+				      G_FILE_ATTRIBUTE_STANDARD_SIZE","
+				      G_FILE_ATTRIBUTE_TIME_MODIFIED,
+				      G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+				      cancellable,
+				      NULL);
+	dest_info = g_file_query_info (dest,
+				       G_FILE_ATTRIBUTE_STANDARD_TYPE","
+				       G_FILE_ATTRIBUTE_STANDARD_SIZE","
+				       G_FILE_ATTRIBUTE_TIME_MODIFIED,
+				       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+				       cancellable,
+				       NULL);
 
-	new_size = current_num_bytes - pdata->last_size;
+	res = src_info != NULL && dest_info != NULL &&
+	      g_file_info_get_file_type (src_info) == G_FILE_TYPE_REGULAR &&
+	      g_file_info_get_file_type (dest_info) == G_FILE_TYPE_REGULAR &&
+	      g_file_info_get_size (src_info) == g_file_info_get_size (dest_info) &&
+	      g_file_info_get_attribute_uint64 (src_info, G_FILE_ATTRIBUTE_TIME_MODIFIED) ==
+	      g_file_info_get_attribute_uint64 (dest_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
 
-	if (new_size > 0) {
-		pdata->transfer_info->num_bytes += new_size;
-		pdata->last_size = current_num_bytes;
-		report_copy_progress (pdata->job,
-				      pdata->source_info,
-				      pdata->transfer_info);
+	if (src_info != NULL) {
+		g_object_unref (src_info);
 	}
+	if (dest_info != NULL) {
+		g_object_unref (dest_info);
+	}
+
+	return res;
 }
 
 static gboolean
@@ -4128,6 +6163,7 @@ copy_move_file (CopyMoveJob *copy_job,
 	gboolean res;
 	int unique_name_nr;
 	gboolean handled_invalid_filename;
+	CopyBackend backend;
 
 	job = (CommonJob *)copy_job;
 
@@ -4151,6 +6187,26 @@ copy_move_file (CopyMoveJob *copy_job,
 		dest = get_target_file (src, dest_dir, *dest_fs_type, same_fs);
 	}
 
+	/* The journal has what the interrupted job finished, but a copy
+	 * may not have made it to the disk before the destination went
+	 * away. Folders are merged into, looking at each file again.
+	 */
+	if (copy_job->journal != NULL &&
+	    caja_copy_journal_is_done (copy_job->journal, src)) {
+		if (copy_job->is_move ||
+		    is_finished_copy (src, dest, job->cancellable)) {
+			skip_journaled_file (copy_job, src, source_info, transfer_info);
+			g_object_unref (dest);
+			return;
+		}
+		if (!is_dir (src) && g_file_query_exists (dest, job->cancellable)) {
+			/* The broken copy is the job's own, replacing it
+			 * loses nothing of the user's.
+			 */
+			overwrite = TRUE;
+		}
+	}
+
 	/* Don't allow recursive move/copy into itself.
 	 * (We would get a file system error if we proceeded but it is nicer to
 	 * detect and report it at this level) */
@@ -4168,7 +6224,7 @@ copy_move_file (CopyMoveJob *copy_job,
 					primary,
 					secondary,
 					NULL,
-					(source_info->num_files - transfer_info->num_files) > 1,
+					more_files_left (source_info, transfer_info),
 					CANCEL, SKIP_ALL, SKIP,
 					NULL);
 
@@ -4201,7 +6257,7 @@ copy_move_file (CopyMoveJob *copy_job,
 					primary,
 					secondary,
 					NULL,
-					(source_info->num_files - transfer_info->num_files) > 1,
+					more_files_left (source_info, transfer_info),
 					CANCEL, SKIP_ALL, SKIP,
 					NULL);
 
@@ -4232,12 +6288,21 @@ copy_move_file (CopyMoveJob *copy_job,
 	pdata.last_size = 0;
 	pdata.source_info = source_info;
 	pdata.transfer_info = transfer_info;
+	pdata.src = src;
+	pdata.dest = dest;
+	pdata.use_journal = copy_job->journal != NULL && !overwrite;
+	pdata.journal_started = FALSE;
+	pdata.journal_offset = 0;
 
 	if (!is_dir(src) && last_item)
 		/* this is the last file for this operation, cannot pause anymore */
 		caja_progress_info_disable_pause (job->progress);
 
-	if (copy_job->is_move) {
+	if (pdata.use_journal &&
+	    caja_copy_journal_is_resumed (copy_job->journal) &&
+	    resume_partial_copy (&pdata, &res, &error)) {
+		/* Picked up where the interrupted job stopped */
+	} else if (copy_job->is_move) {
 		res = g_file_move (src, dest,
 				   flags,
 				   job->cancellable,
@@ -4245,12 +6310,16 @@ copy_move_file (CopyMoveJob *copy_job,
 				   &pdata,
 				   &error);
 	} else {
-		res = g_file_copy (src, dest,
-				   flags,
-				   job->cancellable,
-				   copy_file_progress_callback,
-				   &pdata,
-				   &error);
+		res = copy_file_contents (src, dest,
+					  flags,
+					  job->cancellable,
+					  copy_file_progress_callback,
+					  &pdata,
+					  &backend,
+					  &error);
+		if (res) {
+			count_copy_backend (copy_job, backend);
+		}
 	}
 
 	if (res) {
@@ -4264,6 +6333,10 @@ copy_move_file (CopyMoveJob *copy_job,
 		transfer_info->num_files ++;
 		report_copy_progress (copy_job, source_info, transfer_info);
 
+		if (copy_job->journal != NULL) {
+			caja_copy_journal_file_done (copy_job->journal, src);
+		}
+
 		if (debuting_files) {
 			if (position) {
 				caja_file_changes_queue_schedule_position_set (dest, *position, job->screen_num);
@@ -4348,6 +6421,16 @@ copy_move_file (CopyMoveJob *copy_job,
 			goto retry;
 		}
 
+		if (!is_merge && !copy_job->is_move &&
+		    copy_job->journal != NULL &&
+		    caja_copy_journal_is_resumed (copy_job->journal) &&
+		    is_finished_copy (src, dest, job->cancellable)) {
+			caja_copy_journal_file_done (copy_job->journal, src);
+			skip_journaled_file (copy_job, src, source_info, transfer_info);
+			g_object_unref (dest);
+			return;
+		}
+
 		if (job->skip_all_conflict) {
 			goto out;
 		}
@@ -4495,10 +6578,11 @@ copy_move_file (CopyMoveJob *copy_job,
 					primary,
 					secondary,
 					details,
-					(source_info->num_files - transfer_info->num_files) > 1,
+					more_files_left (source_info, transfer_info),
 					CANCEL, SKIP_ALL, SKIP,
 					NULL);
 
+		note_aborting_error (job, response, error);
 		g_error_free (error);
 
 		if (response == 0 || response == GTK_RESPONSE_DELETE_EVENT) {
@@ -4556,6 +6640,7 @@ copy_files (CopyMoveJob *job,
 	}
 
 	unique_names = (job->destination == NULL);
+	job->pipeline = copy_pipeline_new (job);
 	i = 0;
 	for (l = job->files;
 	     l != NULL && !job_aborted (common);
@@ -4597,9 +6682,105 @@ copy_files (CopyMoveJob *job,
 		i++;
 	}
 
+	if (job->pipeline != NULL) {
+		copy_pipeline_drain (job->pipeline, source_info, transfer_info);
+		copy_pipeline_free (job->pipeline);
+		job->pipeline = NULL;
+	}
+
 	g_free (dest_fs_type);
 }
 
+static void
+add_job_device (CommonJob *job,
+		GFile *file)
+{
+	GFileInfo *info;
+	GMount *mount;
+	const char *id;
+	char *name;
+
+	info = g_file_query_info (file,
+				  G_FILE_ATTRIBUTE_ID_FILESYSTEM,
+				  0,
+				  job->cancellable,
+				  NULL);
+	if (info == NULL) {
+		return;
+	}
+
+	id = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILESYSTEM);
+	if (id != NULL) {
+		mount = g_file_find_enclosing_mount (file, job->cancellable, NULL);
+		if (mount != NULL) {
+			name = g_mount_get_name (mount);
+			g_object_unref (mount);
+		} else {
+			name = g_strdup (_("File System"));
+		}
+
+		caja_progress_info_add_device (job->progress, id, name);
+		g_free (name);
+	}
+
+	g_object_unref (info);
+}
+
+/* Tells the progress info which devices the job reads and writes, so
+ * that it only waits for other jobs on the same devices. Must be called
+ * before the job is started.
+ */
+static void
+add_job_devices (CommonJob *job,
+		 GList *files,
+		 GFile *dest)
+{
+	GHashTable *dirs;
+	GHashTableIter iter;
+	GList *l;
+	GFile *dir;
+
+	/* Looking at the parents is enough, and they are mostly the same */
+	dirs = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal,
+				      g_object_unref, NULL);
+	for (l = files; l != NULL; l = l->next) {
+		dir = g_file_get_parent (l->data);
+		if (dir == NULL) {
+			dir = g_object_ref (l->data);
+		}
+		g_hash_table_add (dirs, dir);
+	}
+	if (dest != NULL) {
+		g_hash_table_add (dirs, g_object_ref (dest));
+	}
+
+	g_hash_table_iter_init (&iter, dirs);
+	while (g_hash_table_iter_next (&iter, (gpointer *) &dir, NULL)) {
+		add_job_device (job, dir);
+	}
+
+	g_hash_table_destroy (dirs);
+}
+
+/* Removes the journal, unless the job was stopped at an error it may
+ * be worth resuming after, like a device going away. Jobs the user
+ * cancelled for any other reason, from a conflict or free space dialog
+ * or the progress window, are not kept.
+ */
+static void
+finish_journal (CopyMoveJob *job)
+{
+	gboolean keep;
+
+	if (job->journal == NULL) {
+		return;
+	}
+
+	keep = job_aborted (&job->common) && job->common.aborted_after_io_error;
+	caja_copy_journal_free (job->journal, !keep);
+	job->journal = NULL;
+}
+
 static gboolean
 copy_job_done (gpointer user_data)
 {
@@ -4644,15 +6825,7 @@ copy_job (GIOSchedulerJob *io_job,
 
 	dest_fs_id = NULL;
 
-	caja_progress_info_start (job->common.progress);
-
-	scan_sources (job->files,
-		      &source_info,
-		      common,
-		      OP_KIND_COPY);
-	if (job_aborted (common)) {
-		goto aborted;
-	}
+	memset (&source_info, 0, sizeof (source_info));
 
 	if (job->destination) {
 		dest = g_object_ref (job->destination);
@@ -4663,15 +6836,35 @@ copy_job (GIOSchedulerJob *io_job,
 		dest = g_file_get_parent (job->files->data);
 	}
 
+	add_job_devices (common, job->files, dest);
+	caja_progress_info_enable_background (job->common.progress);
+	caja_progress_info_start (job->common.progress);
+
+	/* Free space is checked as the sources are counted */
 	verify_destination (&job->common,
 			    dest,
 			    &dest_fs_id,
-			    source_info.num_bytes);
+			    -1);
+	if (job_aborted (common)) {
+		g_object_unref (dest);
+		goto aborted;
+	}
+
+	start_scan_sources (job->files,
+			    &source_info,
+			    common,
+			    OP_KIND_COPY,
+			    dest);
 	g_object_unref (dest);
 	if (job_aborted (common)) {
 		goto aborted;
 	}
 
+	/* Resumed jobs come with the journal of the interrupted one */
+	if (job->journal == NULL && job->destination != NULL) {
+		job->journal = caja_copy_journal_new (FALSE, job->files, job->destination);
+	}
+
 	g_timer_start (job->common.time);
 
 	memset (&transfer_info, 0, sizeof (transfer_info));
@@ -4680,6 +6873,10 @@ copy_job (GIOSchedulerJob *io_job,
 		    &source_info, &transfer_info);
 
  aborted:
+	stop_scan_sources (&source_info);
+	finish_journal (job);
+	/* The thread goes back to the pool */
+	leave_background_mode (job);
 
 	g_free (dest_fs_id);
 
@@ -4839,6 +7036,12 @@ move_file_prepare (CopyMoveJob *move_job,
 
 	job = (CommonJob *)move_job;
 
+	/* Moved before the job was interrupted */
+	if (move_job->journal != NULL &&
+	    caja_copy_journal_is_done (move_job->journal, src)) {
+		return;
+	}
+
 	dest = get_target_file (src, dest_dir, *dest_fs_type, same_fs);
 
 	/* Don't allow recursive move/copy into itself.
@@ -4891,6 +7094,10 @@ move_file_prepare (CopyMoveJob *move_job,
 			 NULL,
 			 &error)) {
 
+		if (move_job->journal != NULL) {
+			caja_copy_journal_file_done (move_job->journal, src);
+		}
+
 		if (debuting_files) {
 			g_hash_table_replace (debuting_files, g_object_ref (dest), GINT_TO_POINTER (TRUE));
 		}
@@ -5188,7 +7395,10 @@ move_job (GIOSchedulerJob *io_job,
 	dest_fs_type = NULL;
 
 	fallbacks = NULL;
+	memset (&source_info, 0, sizeof (source_info));
 
+	add_job_devices (common, job->files, job->destination);
+	caja_progress_info_enable_background (job->common.progress);
 	caja_progress_info_start (job->common.progress);
 
 	verify_destination (&job->common,
@@ -5199,6 +7409,10 @@ move_job (GIOSchedulerJob *io_job,
 		goto aborted;
 	}
 
+	if (job->journal == NULL) {
+		job->journal = caja_copy_journal_new (TRUE, job->files, job->destination);
+	}
+
 	/* This moves all files that we can do without copy + delete */
 	move_files_prepare (job, dest_fs_id, &dest_fs_type, &fallbacks);
 	if (job_aborted (common)) {
@@ -5209,10 +7423,11 @@ move_job (GIOSchedulerJob *io_job,
 	   so scan for size */
 
 	fallback_files = get_files_from_fallbacks (fallbacks);
-	scan_sources (fallback_files,
-		      &source_info,
-		      common,
-		      OP_KIND_MOVE);
+	start_scan_sources (fallback_files,
+			    &source_info,
+			    common,
+			    OP_KIND_MOVE,
+			    job->destination);
 
 	g_list_free (fallback_files);
 
@@ -5220,14 +7435,6 @@ move_job (GIOSchedulerJob *io_job,
 		goto aborted;
 	}
 
-	verify_destination (&job->common,
-			    job->destination,
-			    NULL,
-			    source_info.num_bytes);
-	if (job_aborted (common)) {
-		goto aborted;
-	}
-
 	memset (&transfer_info, 0, sizeof (transfer_info));
 	move_files (job,
 		    fallbacks,
@@ -5235,6 +7442,9 @@ move_job (GIOSchedulerJob *io_job,
 		    &source_info, &transfer_info);
 
  aborted:
+	stop_scan_sources (&source_info);
+	finish_journal (job);
+	leave_background_mode (job);
     	g_list_free_full (fallbacks, g_free);
 
 	g_free (dest_fs_id);
@@ -5296,6 +7506,110 @@ caja_file_operations_move (GList *files,
 				 job->common.cancellable);
 }
 
+static void
+resume_journaled_job (CajaCopyJournal *journal,
+		      GtkWindow *parent_window)
+{
+	CopyMoveJob *job;
+	GList *files;
+
+	files = caja_copy_journal_get_files (journal);
+
+	job = op_job_new (CopyMoveJob, parent_window, FALSE, contains_multiple_items (files));
+	job->is_move = caja_copy_journal_get_is_move (journal);
+	if (!job->is_move) {
+		job->desktop_location = caja_get_desktop_location ();
+	}
+	job->files = g_list_copy_deep (files, (GCopyFunc) g_object_ref, NULL);
+	job->destination = g_object_ref (caja_copy_journal_get_destination (journal));
+	job->debuting_files = g_hash_table_new_full (g_file_hash, (GEqualFunc)g_file_equal, g_object_unref, NULL);
+	job->journal = journal;
+	/* The folders there were created by the interrupted job */
+	job->common.merge_all = TRUE;
+
+	inhibit_power_manager ((CommonJob *)job,
+			       job->is_move ? _("Moving Files") : _("Copying Files"));
+
+	g_io_scheduler_push_job (job->is_move ? move_job : copy_job,
+				 job,
+				 NULL, /* destroy notify */
+				 0,
+				 job->common.cancellable);
+}
+
+static void
+resume_dialog_response (GtkDialog *dialog,
+			int response_id,
+			CajaCopyJournal *journal)
+{
+	GtkWindow *parent_window;
+
+	parent_window = gtk_window_get_transient_for (GTK_WINDOW (dialog));
+	gtk_widget_destroy (GTK_WIDGET (dialog));
+
+	if (response_id == GTK_RESPONSE_ACCEPT) {
+		resume_journaled_job (journal, parent_window);
+	} else if (response_id == GTK_RESPONSE_REJECT) {
+		caja_copy_journal_free (journal, TRUE);
+	} else {
+		/* Closed without an answer, ask again next time */
+		caja_copy_journal_free (journal, FALSE);
+	}
+}
+
+/* Offers to resume copy and move jobs that did not finish, because
+ * Caja crashed, the session ended or a device went away. Files that
+ * were done are skipped, and a large file that was being copied is
+ * continued where it stopped.
+ */
+void
+caja_file_operations_resume_interrupted (GtkWindow *parent_window)
+{
+	CajaCopyJournal *journal;
+	GtkDialog *dialog;
+	GError *error;
+	GList *paths, *l;
+	char *primary;
+	const char *secondary;
+
+	paths = caja_copy_journal_list_interrupted ();
+	for (l = paths; l != NULL; l = l->next) {
+		error = NULL;
+		journal = caja_copy_journal_open (l->data, &error);
+		if (journal == NULL) {
+			if (IS_IO_ERROR (error, INVALID_DATA)) {
+				g_unlink (l->data);
+			}
+			g_error_free (error);
+			continue;
+		}
+
+		if (caja_copy_journal_get_is_move (journal)) {
+			primary = f (_("Moving files to \"%B\" did not finish."),
+				     caja_copy_journal_get_destination (journal));
+			secondary = _("Files that were already moved will be skipped.");
+		} else {
+			primary = f (_("Copying files to \"%B\" did not finish."),
+				     caja_copy_journal_get_destination (journal));
+			secondary = _("Files that were already copied will be skipped.");
+		}
+
+		dialog = eel_create_question_dialog (primary,
+						     secondary,
+						     _("_Discard"), GTK_RESPONSE_REJECT,
+						     _("_Resume"), GTK_RESPONSE_ACCEPT,
+						     parent_window);
+		gtk_dialog_set_default_response (dialog, GTK_RESPONSE_ACCEPT);
+		g_signal_connect (dialog, "response",
+				  G_CALLBACK (resume_dialog_response), journal);
+		gtk_widget_show (GTK_WIDGET (dialog));
+
+		g_free (primary);
+	}
+
+	g_list_free_full (paths, g_free);
+}
+
 static void
 report_link_progress (CopyMoveJob *link_job, int total, int left)
 {
@@ -5710,11 +8024,13 @@ set_permissions_file (SetPermissionsJob *job,
 		// Start UNDO-REDO
 		caja_undostack_manager_data_add_file_permissions(common->undo_redo_data, file, current);
 		// End UNDO-REDO
-		current = (current & ~mask) | value;
+		value = (current & ~mask) | value;
 
-		g_file_set_attribute_uint32 (file, G_FILE_ATTRIBUTE_UNIX_MODE,
-					     current, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-					     common->cancellable, NULL);
+		if (value != current) {
+			g_file_set_attribute_uint32 (file, G_FILE_ATTRIBUTE_UNIX_MODE,
+						     value, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+						     common->cancellable, NULL);
+		}
 	}
 
 	if (!job_aborted (common) && g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY) {
@@ -5748,6 +8064,245 @@ set_permissions_file (SetPermissionsJob *job,
 	}
 }
 
+#if defined (HAVE_FDOPENDIR) && defined (HAVE_FCHMODAT)
+
+/* Changes permissions in a local folder tree with fchmodat() relative
+ * to folder descriptors, instead of a GIO query and set per file. Each
+ * folder is a task for a few threads, so subtrees are done in
+ * parallel. Files that already have the right mode are not touched.
+ * Like set_permissions_file(), errors are ignored.
+ */
+typedef struct {
+	SetPermissionsJob *job;
+	GThreadPool *pool;
+	int root_fd;
+
+	/* Protected by mutex */
+	GMutex mutex;
+	GCond cond;
+	int n_pending;
+	GList *changes;
+
+	int n_done; /* atomic */
+} LocalPermissions;
+
+/* Original mode of a changed file, for undo */
+typedef struct {
+	char *path;
+	guint32 mode;
+} PermissionsChange;
+
+static void
+local_permissions_queue_dir (LocalPermissions *local,
+			     char *path)
+{
+	g_mutex_lock (&local->mutex);
+	local->n_pending++;
+	g_mutex_unlock (&local->mutex);
+
+	g_thread_pool_push (local->pool, path, NULL);
+}
+
+/* Sets the mode of the entries of the folder at @data, a path relative
+ * to the root, and queues its subfolders.
+ */
+static void
+local_permissions_thread_func (gpointer data,
+			       gpointer user_data)
+{
+	LocalPermissions *local;
+	SetPermissionsJob *job;
+	PermissionsChange *change;
+	struct dirent *entry;
+	struct stat statbuf;
+	GList *changes;
+	DIR *dirp;
+	char *dir_path, *path;
+	guint32 value, mask, mode;
+	int fd, n_done;
+
+	local = user_data;
+	job = local->job;
+	dir_path = data;
+	changes = NULL;
+	n_done = 0;
+
+	dirp = NULL;
+	if (!job_aborted ((CommonJob *)job)) {
+		fd = openat (local->root_fd, dir_path,
+			     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		dirp = fd < 0 ? NULL : fdopendir (fd);
+		if (dirp == NULL && fd >= 0) {
+			close (fd);
+		}
+	}
+
+	while (dirp != NULL && !job_aborted ((CommonJob *)job) &&
+	       (entry = readdir (dirp)) != NULL) {
+		if (strcmp (entry->d_name, ".") == 0 ||
+		    strcmp (entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		if (fstatat (dirfd (dirp), entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) {
+			continue;
+		}
+		n_done++;
+
+		/* GIO refuses to set the mode of symlinks too */
+		if (S_ISLNK (statbuf.st_mode)) {
+			continue;
+		}
+
+		if (S_ISDIR (statbuf.st_mode)) {
+			value = job->dir_permissions;
+			mask = job->dir_mask;
+		} else {
+			value = job->file_permissions;
+			mask = job->file_mask;
+		}
+
+		if (strcmp (dir_path, ".") == 0) {
+			path = g_strdup (entry->d_name);
+		} else {
+			path = g_build_filename (dir_path, entry->d_name, NULL);
+		}
+
+		mode = (((guint32) statbuf.st_mode & ~mask) | value) & 07777;
+		if (mode != (statbuf.st_mode & 07777) &&
+		    fchmodat (dirfd (dirp), entry->d_name, mode, 0) == 0) {
+			change = g_new (PermissionsChange, 1);
+			change->path = g_strdup (path);
+			change->mode = statbuf.st_mode;
+			changes = g_list_prepend (changes, change);
+		}
+
+		/* The folder's own mode is set first, as set_permissions_file() does */
+		if (S_ISDIR (statbuf.st_mode)) {
+			local_permissions_queue_dir (local, path);
+		} else {
+			g_free (path);
+		}
+	}
+
+	if (dirp != NULL) {
+		closedir (dirp);
+	}
+	g_free (dir_path);
+
+	g_atomic_int_add (&local->n_done, n_done);
+
+	g_mutex_lock (&local->mutex);
+	local->changes = g_list_concat (changes, local->changes);
+	if (--local->n_pending == 0) {
+		g_cond_signal (&local->cond);
+	}
+	g_mutex_unlock (&local->mutex);
+}
+
+static void
+report_permissions_progress (CommonJob *job,
+			     int n_done)
+{
+	caja_progress_info_take_details (job->progress,
+					 g_strdup_printf (ngettext ("%'d file done",
+								    "%'d files done",
+								    n_done),
+							  n_done));
+	caja_progress_info_pulse_progress (job->progress);
+}
+
+/* Returns FALSE if @job's folder is not a local folder, and has to be
+ * done with set_permissions_file().
+ */
+static gboolean
+set_permissions_locally (SetPermissionsJob *job)
+{
+	LocalPermissions local;
+	PermissionsChange *change;
+	CommonJob *common;
+	struct stat statbuf;
+	GList *l;
+	GFile *file;
+	char *path;
+	guint32 mode;
+	gint64 deadline;
+
+	common = (CommonJob *)job;
+
+	path = g_file_get_path (job->file);
+	if (path == NULL) {
+		return FALSE;
+	}
+
+	memset (&local, 0, sizeof (local));
+	local.job = job;
+	local.root_fd = open (path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (local.root_fd < 0 || fstat (local.root_fd, &statbuf) != 0) {
+		if (local.root_fd >= 0) {
+			close (local.root_fd);
+		}
+		g_free (path);
+		return FALSE;
+	}
+	g_free (path);
+
+	local.pool = g_thread_pool_new (local_permissions_thread_func, &local,
+					LOCAL_PERMISSIONS_THREADS, FALSE, NULL);
+	if (local.pool == NULL) {
+		close (local.root_fd);
+		return FALSE;
+	}
+	g_mutex_init (&local.mutex);
+	g_cond_init (&local.cond);
+
+	mode = (((guint32) statbuf.st_mode & ~job->dir_mask) | job->dir_permissions) & 07777;
+	if (mode != (statbuf.st_mode & 07777) &&
+	    fchmod (local.root_fd, mode) == 0) {
+		// Start UNDO-REDO
+		caja_undostack_manager_data_add_file_permissions (common->undo_redo_data, job->file, statbuf.st_mode);
+		// End UNDO-REDO
+	}
+
+	local_permissions_queue_dir (&local, g_strdup ("."));
+
+	/* Wait for the threads, reporting progress as they go */
+	g_mutex_lock (&local.mutex);
+	while (local.n_pending > 0) {
+		deadline = g_get_monotonic_time () + 100 * NSEC_PER_MICROSEC;
+		if (!g_cond_wait_until (&local.cond, &local.mutex, deadline)) {
+			g_mutex_unlock (&local.mutex);
+			report_permissions_progress (common, g_atomic_int_get (&local.n_done));
+			g_mutex_lock (&local.mutex);
+		}
+	}
+	g_mutex_unlock (&local.mutex);
+
+	g_thread_pool_free (local.pool, FALSE, TRUE);
+	close (local.root_fd);
+
+	report_permissions_progress (common, g_atomic_int_get (&local.n_done));
+
+	for (l = local.changes; l != NULL; l = l->next) {
+		change = l->data;
+		// Start UNDO-REDO
+		file = g_file_resolve_relative_path (job->file, change->path);
+		caja_undostack_manager_data_add_file_permissions (common->undo_redo_data, file, change->mode);
+		g_object_unref (file);
+		// End UNDO-REDO
+		g_free (change->path);
+		g_free (change);
+	}
+	g_list_free (local.changes);
+
+	g_cond_clear (&local.cond);
+	g_mutex_clear (&local.mutex);
+
+	return TRUE;
+}
+
+#endif
+
 static gboolean
 set_permissions_job (GIOSchedulerJob *io_job,
 		     GCancellable *cancellable,
@@ -5755,6 +8310,7 @@ set_permissions_job (GIOSchedulerJob *io_job,
 {
 	SetPermissionsJob *job = user_data;
 	CommonJob *common;
+	gboolean handled;
 
 	common = (CommonJob *)job;
 	common->io_job = io_job;
@@ -5764,7 +8320,13 @@ set_permissions_job (GIOSchedulerJob *io_job,
 
 	caja_progress_info_start (job->common.progress);
 
-	set_permissions_file (job, job->file, NULL);
+	handled = FALSE;
+#if defined (HAVE_FDOPENDIR) && defined (HAVE_FCHMODAT)
+	handled = set_permissions_locally (job);
+#endif
+	if (!handled) {
+		set_permissions_file (job, job->file, NULL);
+	}
 
 	g_io_scheduler_job_send_to_mainloop_async (io_job,
 						   set_permissions_job_done,
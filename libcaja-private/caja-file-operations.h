@@ -121,6 +121,7 @@ void caja_file_operations_move      (GList                *files,
                                      GtkWindow            *parent_window,
                                      CajaCopyCallback  done_callback,
                                      gpointer              done_callback_data);
+void caja_file_operations_resume_interrupted (GtkWindow   *parent_window);
 void caja_file_operations_duplicate (GList                *files,
                                      GArray               *relative_item_points,
                                      GtkWindow            *parent_window,
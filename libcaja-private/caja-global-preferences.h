@@ -58,6 +58,10 @@ G_BEGIN_DECLS
 #define CAJA_PREFERENCES_CONFIRM_MOVE_TO_TRASH	"confirm-move-to-trash"
 #define CAJA_PREFERENCES_ENABLE_DELETE			"enable-delete"
 
+/* File operations */
+#define CAJA_PREFERENCES_OPERATIONS_PER_DEVICE		"operations-per-device"
+#define CAJA_PREFERENCES_BACKGROUND_COPY_SPEED		"background-copy-speed"
+
 /* Desktop options */
 #define CAJA_PREFERENCES_DESKTOP_IS_HOME_DIR		"desktop-is-home-dir"
 #define CAJA_PREFERENCES_SHOW_NOTIFICATIONS             "show-notifications"
@@ -183,10 +187,14 @@ typedef enum
 
 #define CAJA_PREFERENCES_SHOW_TEXT_IN_ICONS		    "show-icon-text"
 #define CAJA_PREFERENCES_SHOW_DIRECTORY_ITEM_COUNTS "show-directory-item-counts"
+#define CAJA_PREFERENCES_DEEP_COUNT_THREADS		"deep-count-threads"
 #define CAJA_PREFERENCES_SHOW_IMAGE_FILE_THUMBNAILS	"show-image-thumbnails"
 #define CAJA_PREFERENCES_IMAGE_FILE_THUMBNAIL_LIMIT	"thumbnail-limit"
+#define CAJA_PREFERENCES_THUMBNAIL_THREADS		"thumbnail-threads"
 #define CAJA_PREFERENCES_PREVIEW_SOUND		        "preview-sound"
 
+#define CAJA_PREFERENCES_SEARCH_INDEX_LOCATIONS		"search-index-locations"
+
     typedef enum
     {
         CAJA_COMPLEX_SEARCH_BAR,
@@ -1061,16 +1061,13 @@ prepare_pango_layout_for_measure_entire_text (CajaIconCanvasItem *item,
     }
 }
 
-static void
-prepare_pango_layout_for_draw (CajaIconCanvasItem *item,
-                               PangoLayout *layout)
+static int
+get_pango_layout_height_for_draw (CajaIconCanvasItem *item)
 {
     CajaIconCanvasItemPrivate *details;
     CajaIconContainer *container;
     gboolean needs_highlight;
 
-    prepare_pango_layout_width (item, layout);
-
     container = CAJA_ICON_CONTAINER (EEL_CANVAS_ITEM (item)->canvas);
     details = item->details;
 
@@ -1078,7 +1075,7 @@ prepare_pango_layout_for_draw (CajaIconCanvasItem *item,
 
     if (IS_COMPACT_VIEW (container))
     {
-        pango_layout_set_height (layout, -1);
+        return -1;
     }
     else if (needs_highlight ||
              details->is_highlighted_as_keyboard_focus ||
@@ -1086,7 +1083,7 @@ prepare_pango_layout_for_draw (CajaIconCanvasItem *item,
              container->details->label_position == CAJA_ICON_LABEL_POSITION_BESIDE)
     {
         /* VOODOO-TODO, cf. compute_text_rectangle() */
-        pango_layout_set_height (layout, G_MININT);
+        return G_MININT;
     }
     else
     {
@@ -1094,11 +1091,62 @@ prepare_pango_layout_for_draw (CajaIconCanvasItem *item,
          * the layout height already fits into max. layout lines. But pango should figure this
          * out itself (which it doesn't ATM).
          */
-        pango_layout_set_height (layout,
-                                 caja_icon_container_get_max_layout_lines_for_pango (container));
+        return caja_icon_container_get_max_layout_lines_for_pango (container);
     }
 }
 
+static void
+prepare_pango_layout_for_draw (CajaIconCanvasItem *item,
+                               PangoLayout *layout)
+{
+    prepare_pango_layout_width (item, layout);
+    pango_layout_set_height (layout, get_pango_layout_height_for_draw (item));
+}
+
+/* Everything the size of the label depends on. The texts come last,
+ * with their lengths, so that no two labels get the same key.
+ */
+static char *
+get_label_size_key (CajaIconCanvasItem *item)
+{
+    CajaIconCanvasItemPrivate *details;
+    CajaIconContainer *container;
+    PangoContext *context;
+    char *font, *key;
+    const char *editable_text, *additional_text;
+
+    container = CAJA_ICON_CONTAINER (EEL_CANVAS_ITEM (item)->canvas);
+    details = item->details;
+
+    if (container->details->font)
+    {
+        font = g_strdup (container->details->font);
+    }
+    else
+    {
+        context = gtk_widget_get_pango_context (GTK_WIDGET (container));
+        font = pango_font_description_to_string (pango_context_get_font_description (context));
+    }
+
+    editable_text = details->editable_text != NULL ? details->editable_text : "";
+    additional_text = details->additional_text != NULL ? details->additional_text : "";
+
+    key = g_strdup_printf ("%s %d|%d %d %d %d %d %d|%" G_GSIZE_FORMAT ":%s%" G_GSIZE_FORMAT ":%s",
+                           font,
+                           container->details->font ? 0 : container->details->font_size_table[container->details->zoom_level],
+                           (int) floor (caja_icon_canvas_item_get_max_text_width (item)),
+                           caja_icon_container_get_max_layout_lines (container),
+                           get_pango_layout_height_for_draw (item),
+                           IS_COMPACT_VIEW (container),
+                           container->details->label_position,
+                           caja_icon_container_is_layout_rtl (container),
+                           strlen (editable_text), editable_text,
+                           strlen (additional_text), additional_text);
+    g_free (font);
+
+    return key;
+}
+
 static void
 measure_label_text (CajaIconCanvasItem *item)
 {
@@ -1109,6 +1157,8 @@ measure_label_text (CajaIconCanvasItem *item)
     PangoLayout *editable_layout;
     PangoLayout *additional_layout;
     gboolean have_editable, have_additional;
+    CajaIconLabelSize size;
+    char *key;
 
     /* check to see if the cached values are still valid; if so, there's
      * no work necessary
@@ -1156,6 +1206,20 @@ measure_label_text (CajaIconCanvasItem *item)
     editable_layout = NULL;
     additional_layout = NULL;
 
+    /* Labels with the same text are measured once for all icons */
+    key = get_label_size_key (item);
+    if (caja_icon_container_lookup_label_size (container, key, &size))
+    {
+        details->text_width = size.text_width;
+        details->text_dx = size.text_dx;
+        details->text_height = size.text_height;
+        details->text_height_for_layout = size.text_height_for_layout;
+        details->text_height_for_entire_text = size.text_height_for_entire_text;
+        details->editable_text_height = size.editable_text_height;
+        g_free (key);
+        return;
+    }
+
     if (have_editable)
     {
         /* first, measure required text height: editable_height_for_entire_text
@@ -1226,6 +1290,15 @@ measure_label_text (CajaIconCanvasItem *item)
     /* extra to make it look nicer */
     details->text_width += TEXT_BACK_PADDING_X*2;
 
+    size.text_width = details->text_width;
+    size.text_dx = details->text_dx;
+    size.text_height = details->text_height;
+    size.text_height_for_layout = details->text_height_for_layout;
+    size.text_height_for_entire_text = details->text_height_for_entire_text;
+    size.editable_text_height = details->editable_text_height;
+    caja_icon_container_store_label_size (container, key, &size);
+    g_free (key);
+
     if (editable_layout)
     {
         g_object_unref (editable_layout);
@@ -1439,6 +1512,18 @@ caja_icon_canvas_item_set_is_visible (CajaIconCanvasItem       *item,
     }
 }
 
+gboolean
+caja_icon_canvas_item_get_is_visible (CajaIconCanvasItem *item)
+{
+    return item->details->is_visible;
+}
+
+void
+caja_icon_canvas_item_measure_label (CajaIconCanvasItem *item)
+{
+    measure_label_text (item);
+}
+
 void
 caja_icon_canvas_item_invalidate_label (CajaIconCanvasItem     *item)
 {
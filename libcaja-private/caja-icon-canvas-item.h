@@ -98,6 +98,7 @@ G_BEGIN_DECLS
             EelDPoint                     world_point,
             GtkCornerType                *corner);
     void        caja_icon_canvas_item_invalidate_label         (CajaIconCanvasItem       *item);
+    void        caja_icon_canvas_item_measure_label            (CajaIconCanvasItem       *item);
     void        caja_icon_canvas_item_invalidate_label_size    (CajaIconCanvasItem       *item);
     EelDRect    caja_icon_canvas_item_get_icon_rectangle       (const CajaIconCanvasItem *item);
     EelDRect    caja_icon_canvas_item_get_text_rectangle       (CajaIconCanvasItem       *item,
@@ -110,6 +111,7 @@ G_BEGIN_DECLS
             double i2w_dx, double i2w_dy);
     void        caja_icon_canvas_item_set_is_visible           (CajaIconCanvasItem       *item,
             gboolean                      visible);
+    gboolean    caja_icon_canvas_item_get_is_visible           (CajaIconCanvasItem       *item);
     /* whether the entire label text must be visible at all times */
     void        caja_icon_canvas_item_set_entire_text          (CajaIconCanvasItem       *icon_item,
             gboolean                      entire_text);
@@ -120,6 +120,22 @@
 /* Copied from CajaIconContainer */
 #define CAJA_ICON_CONTAINER_SEARCH_DIALOG_TIMEOUT 5
 
+/* Wait until scrolling pauses for this long (in milliseconds) before
+ * reordering thumbnail requests for the icons in view.
+ */
+#define UPDATE_VISIBLE_ICONS_DELAY 50
+
+/* Folders with at least this many icons get a virtualized layout, see
+ * should_virtualize_layout().
+ */
+#define VIRTUALIZED_ICON_COUNT 5000
+
+/* Number of label sizes kept for all icons of a container */
+#define LABEL_SIZE_CACHE_SIZE 20000
+
+/* Labels measured at a time when idle */
+#define MEASURE_LABELS_BATCH_SIZE 100
+
 /* Copied from CajaFile */
 #define UNDEFINED_TIME ((time_t) (-1))
 
@@ -190,6 +206,14 @@ static void          handle_vadjustment_changed                     (GtkAdjustme
         CajaIconContainer *container);
 static GList *       caja_icon_container_get_selected_icons (CajaIconContainer *container);
 static void          caja_icon_container_update_visible_icons   (CajaIconContainer *container);
+static void          update_materialized_icons                      (CajaIconContainer *container);
+static void          set_virtualized                                (CajaIconContainer *container,
+        gboolean               virtualized);
+static void          caja_icon_container_get_icon_text              (CajaIconContainer *container,
+        CajaIconData      *data,
+        char                 **editable_text,
+        char                 **additional_text,
+        gboolean               include_invisible);
 static void          reveal_icon                                    (CajaIconContainer *container,
         CajaIcon *icon);
 
@@ -1233,6 +1257,48 @@ typedef struct
     double y_offset;
 } IconPositions;
 
+/* Start of a line of icons laid out in rows */
+typedef struct
+{
+    guint start_index;
+    double y;
+} LayoutLine;
+
+static void
+record_layout_line (GArray *lines,
+                    guint start_index,
+                    double y)
+{
+    LayoutLine line;
+
+    if (lines == NULL)
+    {
+        return;
+    }
+
+    line.start_index = start_index;
+    line.y = y;
+    g_array_append_val (lines, line);
+}
+
+/* The next layout has to start from scratch */
+static void
+invalidate_layout_lines (CajaIconContainer *container)
+{
+    container->details->layout_lines_valid = FALSE;
+}
+
+/* An icon changed size or went away, the icons from there on have to be
+ * laid out again.
+ */
+static void
+icon_invalidate_layout (CajaIconContainer *container,
+                        CajaIcon *icon)
+{
+    container->details->layout_dirty_index = MIN (container->details->layout_dirty_index,
+                                                   icon->layout_index);
+}
+
 static void
 lay_down_one_line (CajaIconContainer *container,
                    GList *line_start,
@@ -1319,14 +1385,211 @@ lay_down_one_column (CajaIconContainer *container,
     }
 }
 
+/* Size of the images of an icon, at the current zoom level */
+static guint
+get_icon_image_size (CajaIconContainer *container,
+                     CajaIcon *icon)
+{
+    guint icon_size;
+    guint min_image_size, max_image_size;
+
+    /* compute the maximum size based on the scale factor */
+    min_image_size = MINIMUM_IMAGE_SIZE * EEL_CANVAS (container)->pixels_per_unit;
+    max_image_size = MAX (MAXIMUM_IMAGE_SIZE * EEL_CANVAS (container)->pixels_per_unit, CAJA_ICON_MAXIMUM_SIZE);
+
+    if (container->details->forced_icon_size > 0)
+    {
+        icon_size = container->details->forced_icon_size;
+    }
+    else
+    {
+        icon_get_size (container, icon, &icon_size);
+    }
+
+    icon_size = MAX (icon_size, min_image_size);
+    icon_size = MIN (icon_size, max_image_size);
+
+    return icon_size;
+}
+
+/* Blank image shown by icons whose images are not loaded; one is shared
+ * by all of them.
+ */
+static GdkPixbuf *
+get_placeholder_pixbuf (CajaIconContainer *container,
+                        guint icon_size)
+{
+    CajaIconContainerDetails *details;
+    int size;
+
+    details = container->details;
+    size = icon_size * gtk_widget_get_scale_factor (GTK_WIDGET (container));
+
+    if (details->placeholder_pixbuf != NULL &&
+        gdk_pixbuf_get_width (details->placeholder_pixbuf) != size)
+    {
+        g_clear_object (&details->placeholder_pixbuf);
+    }
+
+    if (details->placeholder_pixbuf == NULL)
+    {
+        details->placeholder_pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, size, size);
+        gdk_pixbuf_fill (details->placeholder_pixbuf, 0);
+    }
+
+    return details->placeholder_pixbuf;
+}
+
+/* Only big folders in the common layout are virtualized: icons in rows,
+ * labels below them, and a limit on the lines of a label, so that all
+ * icons fit in slots of the same size.
+ */
+static gboolean
+should_virtualize_layout (CajaIconContainer *container)
+{
+    return container->details->auto_layout &&
+           !container->details->tighter_layout &&
+           !caja_icon_container_get_is_desktop (container) &&
+           !caja_icon_container_is_layout_vertical (container) &&
+           container->details->label_position != CAJA_ICON_LABEL_POSITION_BESIDE &&
+           caja_icon_container_get_max_layout_lines (container) != G_MAXINT &&
+           g_hash_table_size (container->details->icon_set) >= VIRTUALIZED_ICON_COUNT;
+}
+
+/* Measures the slot every icon gets in a virtualized layout: the image at
+ * its size for the zoom level, and a label using all the lines allowed.
+ */
 static void
-lay_down_icons_horizontal (CajaIconContainer *container,
+measure_virtualized_slot (CajaIconContainer *container,
+                          CajaIcon *sample)
+{
+    CajaIconCanvasItem *probe;
+    EelDRect bounds, icon_bounds;
+    char *editable_text, *additional_text;
+    GString *text;
+    int i;
+
+    caja_icon_container_get_icon_text (container, sample->data,
+                                       &editable_text, &additional_text, FALSE);
+
+    text = g_string_new (NULL);
+    for (i = 0; i < caja_icon_container_get_max_layout_lines (container) * 16; i++)
+    {
+        g_string_append (text, "Wg ");
+    }
+
+    probe = CAJA_ICON_CANVAS_ITEM
+            (eel_canvas_item_new (EEL_CANVAS_GROUP (EEL_CANVAS (container)->root),
+                                  caja_icon_canvas_item_get_type (),
+                                  "visible", FALSE,
+                                  "editable_text", text->str,
+                                  "additional_text", additional_text,
+                                  NULL));
+    caja_icon_canvas_item_set_image (probe,
+                                     get_placeholder_pixbuf (container, get_icon_image_size (container, sample)));
+
+    caja_icon_canvas_item_get_bounds_for_layout (probe,
+            &bounds.x0, &bounds.y0,
+            &bounds.x1, &bounds.y1);
+    icon_bounds = caja_icon_canvas_item_get_icon_rectangle (probe);
+
+    container->details->slot_height_above = icon_bounds.y1 - bounds.y0;
+    container->details->slot_height_below = bounds.y1 - icon_bounds.y1;
+
+    eel_canvas_item_destroy (EEL_CANVAS_ITEM (probe));
+    g_string_free (text, TRUE);
+    g_free (editable_text);
+    g_free (additional_text);
+}
+
+/* Lays out icons in slots of the same size, without measuring them. Like
+ * lay_down_icons_horizontal() with labels below the icons. The icons are
+ * numbered from first_index, which picks the slot of the first one.
+ */
+static void
+lay_down_icons_virtualized (CajaIconContainer *container,
+                            GList *icons,
+                            guint first_index,
+                            double start_y)
+{
+    GList *p;
+    CajaIcon *icon;
+    EelDRect icon_bounds;
+    GtkAllocation allocation;
+    double canvas_width, grid_width, line_height, x, y;
+    int num_columns, column;
+    guint index;
+    gboolean is_rtl;
+
+    if (icons == NULL)
+    {
+        return;
+    }
+
+    gtk_widget_get_allocation (GTK_WIDGET (container), &allocation);
+    canvas_width = CANVAS_WIDTH(container, allocation);
+    num_columns = MAX (floor (canvas_width / STANDARD_ICON_GRID_WIDTH), 1);
+    grid_width = canvas_width / num_columns - 1;
+
+    measure_virtualized_slot (container, icons->data);
+
+    is_rtl = caja_icon_container_is_layout_rtl (container);
+
+    line_height = container->details->slot_height_below + ICON_PAD_BOTTOM +
+                  ICON_PAD_TOP + container->details->slot_height_above;
+
+    container->details->slot_top = start_y + CONTAINER_PAD_TOP;
+    container->details->slot_line_height = line_height;
+    container->details->slot_columns = num_columns;
+    g_ptr_array_set_size (container->details->slot_icons, first_index);
+
+    /* Start at the baseline of the line of the first icon */
+    y = start_y + CONTAINER_PAD_TOP + ICON_PAD_TOP + container->details->slot_height_above +
+        (first_index / num_columns) * line_height;
+    column = first_index % num_columns;
+    index = first_index;
+
+    for (p = icons; p != NULL; p = p->next)
+    {
+        icon = p->data;
+
+        if (column == num_columns)
+        {
+            y += line_height;
+            column = 0;
+        }
+
+        icon_bounds = caja_icon_canvas_item_get_icon_rectangle (icon->item);
+        x = ICON_PAD_LEFT + column * grid_width + (grid_width - (icon_bounds.x1 - icon_bounds.x0)) / 2;
+
+        icon_set_position (icon,
+                           is_rtl ? get_mirror_x_position (container, icon, x) : x,
+                           y - (icon_bounds.y1 - icon_bounds.y0));
+        caja_icon_canvas_item_set_entire_text (icon->item, FALSE);
+
+        icon->saved_ltr_x = is_rtl ? get_mirror_x_position (container, icon, icon->x) : icon->x;
+        icon->layout_index = index;
+        g_ptr_array_add (container->details->slot_icons, icon);
+
+        column++;
+        index++;
+    }
+}
+
+/* Lays out icons in lines, the first one at y. The icons are numbered from
+ * first_index, and if lines is given, where each line starts is recorded
+ * in it.
+ */
+static void
+lay_down_lines_horizontal (CajaIconContainer *container,
                            GList *icons,
-                           double start_y)
+                           guint first_index,
+                           double y,
+                           GArray *lines)
 {
     GList *p, *line_start;
     CajaIcon *icon;
-    double canvas_width, y;
+    double canvas_width;
     EelDRect bounds;
     EelDRect icon_bounds;
     EelDRect text_bounds;
@@ -1337,6 +1600,7 @@ lay_down_icons_horizontal (CajaIconContainer *container,
     double max_text_width, max_icon_width;
     int icon_width;
     int i;
+    guint index;
     GtkAllocation allocation;
     GArray *positions;
     IconPositions *position = NULL;
@@ -1386,8 +1650,9 @@ lay_down_icons_horizontal (CajaIconContainer *container,
 
     line_width = container->details->label_position == CAJA_ICON_LABEL_POSITION_BESIDE ? ICON_PAD_LEFT : 0;
     line_start = icons;
-    y = start_y + CONTAINER_PAD_TOP;
     i = 0;
+    index = first_index;
+    record_layout_line (lines, index, y);
 
     max_height_above = 0;
     max_height_below = 0;
@@ -1397,6 +1662,11 @@ lay_down_icons_horizontal (CajaIconContainer *container,
 
         icon = p->data;
 
+        if (lines != NULL)
+        {
+            icon->layout_index = index;
+        }
+
         /* Assume it's only one level hierarchy to avoid costly affine calculations */
         caja_icon_canvas_item_get_bounds_for_layout (icon->item,
                 &bounds.x0, &bounds.y0,
@@ -1447,6 +1717,7 @@ lay_down_icons_horizontal (CajaIconContainer *container,
             line_width = container->details->label_position == CAJA_ICON_LABEL_POSITION_BESIDE ? ICON_PAD_LEFT : 0;
             line_start = p;
             i = 0;
+            record_layout_line (lines, index, y);
 
             max_height_above = height_above;
             max_height_below = height_below;
@@ -1488,6 +1759,7 @@ lay_down_icons_horizontal (CajaIconContainer *container,
 
         /* Add this icon. */
         line_width += icon_width;
+        index++;
     }
 
     /* Lay down that last line of icons. */
@@ -1512,6 +1784,24 @@ lay_down_icons_horizontal (CajaIconContainer *container,
     g_array_free (positions, TRUE);
 }
 
+static void
+lay_down_icons_horizontal (CajaIconContainer *container,
+                           GList *icons,
+                           double start_y)
+{
+    GArray *lines;
+
+    /* Remember the lines when all icons are laid out */
+    lines = NULL;
+    if (icons == container->details->icons)
+    {
+        lines = container->details->layout_lines;
+        g_array_set_size (lines, 0);
+    }
+
+    lay_down_lines_horizontal (container, icons, 0, start_y + CONTAINER_PAD_TOP, lines);
+}
+
 static void
 get_max_icon_dimensions (GList *icon_start,
                          GList *icon_end,
@@ -2297,7 +2587,14 @@ lay_down_icons (CajaIconContainer *container, GList *icons, double start_y)
     {
     case CAJA_ICON_LAYOUT_L_R_T_B:
     case CAJA_ICON_LAYOUT_R_L_T_B:
-        lay_down_icons_horizontal (container, icons, start_y);
+        if (container->details->virtualized)
+        {
+            lay_down_icons_virtualized (container, icons, 0, start_y);
+        }
+        else
+        {
+            lay_down_icons_horizontal (container, icons, start_y);
+        }
         break;
 
     case CAJA_ICON_LAYOUT_T_B_L_R:
@@ -2317,9 +2614,142 @@ lay_down_icons (CajaIconContainer *container, GList *icons, double start_y)
     }
 }
 
+/* Merges two sorted lists of icons, keeping the icons of the first list
+ * first when they compare equal.
+ */
+static GList *
+merge_sorted_icons (CajaIconContainer *container,
+                    GList *icons,
+                    GList *new_icons)
+{
+    GList *result, *link;
+
+    result = NULL;
+    while (icons != NULL || new_icons != NULL)
+    {
+        if (icons == NULL ||
+                (new_icons != NULL && compare_icons (new_icons->data, icons->data, container) < 0))
+        {
+            link = new_icons;
+            new_icons = g_list_remove_link (new_icons, link);
+        }
+        else
+        {
+            link = icons;
+            icons = g_list_remove_link (icons, link);
+        }
+        result = g_list_concat (link, result);
+    }
+
+    return g_list_reverse (result);
+}
+
+/* Lays out again only the icons from the line of the first icon that was
+ * added, removed, moved or changed size since the last layout. The lines
+ * before it stay where they are. Returns FALSE if everything has to be
+ * laid out instead.
+ */
+static gboolean
+lay_down_icons_incrementally (CajaIconContainer *container)
+{
+    CajaIconContainerDetails *details;
+    GList *p, *next, *new_icons;
+    CajaIcon *icon;
+    GtkAllocation allocation;
+    LayoutLine line;
+    guint index, i;
+
+    details = container->details;
+
+    if (!details->layout_lines_valid
+            || (details->layout_mode != CAJA_ICON_LAYOUT_L_R_T_B
+                && details->layout_mode != CAJA_ICON_LAYOUT_R_L_T_B)
+            || details->label_position != CAJA_ICON_LABEL_POSITION_UNDER
+            || (!details->virtualized && details->layout_lines->len == 0))
+    {
+        return FALSE;
+    }
+
+    gtk_widget_get_allocation (GTK_WIDGET (container), &allocation);
+    if (CANVAS_WIDTH (container, allocation) != details->layout_canvas_width)
+    {
+        return FALSE;
+    }
+
+    /* Take out the icons that were added since the last layout */
+    new_icons = NULL;
+    for (p = details->icons; p != NULL; p = next)
+    {
+        next = p->next;
+        icon = p->data;
+
+        if (icon->layout_index == G_MAXUINT)
+        {
+            details->icons = g_list_remove_link (details->icons, p);
+            new_icons = g_list_concat (p, new_icons);
+        }
+    }
+
+    /* The old ones are usually still sorted, unless the sort order or
+     * the names changed.
+     */
+    for (p = details->icons; p != NULL && p->next != NULL; p = p->next)
+    {
+        if (compare_icons (p->data, p->next->data, container) > 0)
+        {
+            resort (container);
+            break;
+        }
+    }
+
+    sort_icons (container, &new_icons);
+    details->icons = merge_sorted_icons (container, details->icons, new_icons);
+
+    /* Find the first icon that is not where it was laid out */
+    index = 0;
+    for (p = details->icons; p != NULL && index < details->layout_dirty_index; p = p->next)
+    {
+        icon = p->data;
+
+        if (icon->layout_index != index)
+        {
+            break;
+        }
+        index++;
+    }
+
+    if (details->virtualized)
+    {
+        lay_down_icons_virtualized (container, p, index, 0);
+    }
+    else
+    {
+        /* Start over from the line it was in */
+        i = details->layout_lines->len - 1;
+        while (i > 0 && g_array_index (details->layout_lines, LayoutLine, i).start_index > index)
+        {
+            i--;
+        }
+        line = g_array_index (details->layout_lines, LayoutLine, i);
+        g_array_set_size (details->layout_lines, i);
+
+        lay_down_lines_horizontal (container,
+                                   g_list_nth (details->icons, line.start_index),
+                                   line.start_index, line.y,
+                                   details->layout_lines);
+    }
+
+    details->layout_dirty_index = G_MAXUINT;
+
+    return TRUE;
+}
+
 static void
 redo_layout_internal (CajaIconContainer *container)
 {
+    GtkAllocation allocation;
+
+    set_virtualized (container, should_virtualize_layout (container));
     finish_adding_new_icons (container);
 
     /* Don't do any re-laying-out during stretching. Later we
@@ -2328,10 +2758,22 @@ redo_layout_internal (CajaIconContainer *container)
      * and only re-lay-out when it's really needed.
      */
     if (container->details->auto_layout
-            && container->details->drag_state != DRAG_STATE_STRETCH)
+            && container->details->drag_state != DRAG_STATE_STRETCH
+            && !lay_down_icons_incrementally (container))
     {
         resort (container);
         lay_down_icons (container, container->details->icons, 0);
+
+        /* Only lines of icons with the labels below can be picked up
+         * again, the others depend on all icons.
+         */
+        gtk_widget_get_allocation (GTK_WIDGET (container), &allocation);
+        container->details->layout_lines_valid =
+            (container->details->layout_mode == CAJA_ICON_LAYOUT_L_R_T_B
+             || container->details->layout_mode == CAJA_ICON_LAYOUT_R_L_T_B)
+            && container->details->label_position == CAJA_ICON_LABEL_POSITION_UNDER;
+        container->details->layout_canvas_width = CANVAS_WIDTH (container, allocation);
+        container->details->layout_dirty_index = G_MAXUINT;
     }
 
     if (caja_icon_container_is_layout_rtl (container))
@@ -2343,6 +2785,7 @@ redo_layout_internal (CajaIconContainer *container)
 
     process_pending_icon_to_reveal (container);
     process_pending_icon_to_rename (container);
+    update_materialized_icons (container);
     caja_icon_container_update_visible_icons (container);
 }
 
@@ -2455,6 +2898,225 @@ button_event_modifies_selection (GdkEventButton *event)
     return (event->state & (GDK_CONTROL_MASK | GDK_SHIFT_MASK)) != 0;
 }
 
+typedef struct
+{
+    char *key;
+    CajaIconLabelSize size;
+    GList link;
+} LabelSizeEntry;
+
+static void
+label_size_entry_free (gpointer data)
+{
+    LabelSizeEntry *entry;
+
+    entry = data;
+    g_free (entry->key);
+    g_free (entry);
+}
+
+gboolean
+caja_icon_container_lookup_label_size (CajaIconContainer *container,
+                                       const char *key,
+                                       CajaIconLabelSize *size)
+{
+    CajaIconContainerDetails *details;
+    LabelSizeEntry *entry;
+
+    details = container->details;
+
+    entry = g_hash_table_lookup (details->label_sizes, key);
+    if (entry == NULL)
+    {
+        details->label_size_misses++;
+        return FALSE;
+    }
+
+    details->label_size_hits++;
+    g_queue_unlink (&details->label_size_lru, &entry->link);
+    g_queue_push_head_link (&details->label_size_lru, &entry->link);
+    *size = entry->size;
+
+    return TRUE;
+}
+
+void
+caja_icon_container_store_label_size (CajaIconContainer *container,
+                                      const char *key,
+                                      const CajaIconLabelSize *size)
+{
+    CajaIconContainerDetails *details;
+    LabelSizeEntry *entry;
+    GList *oldest;
+
+    details = container->details;
+
+    entry = g_hash_table_lookup (details->label_sizes, key);
+    if (entry != NULL)
+    {
+        entry->size = *size;
+        return;
+    }
+
+    entry = g_new0 (LabelSizeEntry, 1);
+    entry->key = g_strdup (key);
+    entry->size = *size;
+    entry->link.data = entry;
+    g_hash_table_insert (details->label_sizes, entry->key, entry);
+    g_queue_push_head_link (&details->label_size_lru, &entry->link);
+
+    while (details->label_size_lru.length > LABEL_SIZE_CACHE_SIZE)
+    {
+        oldest = g_queue_pop_tail_link (&details->label_size_lru);
+        entry = oldest->data;
+        g_hash_table_remove (details->label_sizes, entry->key);
+    }
+}
+
+/* Forget all measured label sizes, for when text is rendered differently
+ * with the same fonts.
+ */
+static void
+clear_label_sizes (CajaIconContainer *container)
+{
+    g_queue_init (&container->details->label_size_lru);
+    g_hash_table_remove_all (container->details->label_sizes);
+}
+
+/* Queues the labels to measure when idle: the visible icons first, then
+ * the ones within a page of the visible area. The rest are measured when
+ * they are needed.
+ */
+static void
+queue_labels_to_measure (CajaIconContainer *container)
+{
+    CajaIconContainerDetails *details;
+    GtkAdjustment *hadj, *vadj;
+    GtkAllocation allocation;
+    double min_x, min_y, max_x, max_y, page;
+    gboolean vertical;
+    GList *p;
+    CajaIcon *icon;
+
+    details = container->details;
+
+    hadj = gtk_scrollable_get_hadjustment (GTK_SCROLLABLE (container));
+    vadj = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (container));
+    gtk_widget_get_allocation (GTK_WIDGET (container), &allocation);
+
+    min_x = gtk_adjustment_get_value (hadj);
+    max_x = min_x + allocation.width;
+    min_y = gtk_adjustment_get_value (vadj);
+    max_y = min_y + allocation.height;
+
+    eel_canvas_c2w (EEL_CANVAS (container), min_x, min_y, &min_x, &min_y);
+    eel_canvas_c2w (EEL_CANVAS (container), max_x, max_y, &max_x, &max_y);
+
+    vertical = caja_icon_container_is_layout_vertical (container);
+    if (vertical)
+    {
+        page = max_x - min_x;
+        min_x -= page;
+        max_x += page;
+    }
+    else
+    {
+        page = max_y - min_y;
+        min_y -= page;
+        max_y += page;
+    }
+
+    for (p = details->icons; p != NULL; p = p->next)
+    {
+        icon = p->data;
+
+        if (caja_icon_canvas_item_get_is_visible (icon->item))
+        {
+            g_queue_push_head (&details->labels_to_measure, icon);
+            icon->measure_label_link = details->labels_to_measure.head;
+        }
+        else if (icon_is_positioned (icon) &&
+                 (vertical ? icon->x >= min_x && icon->x <= max_x
+                           : icon->y >= min_y && icon->y <= max_y))
+        {
+            g_queue_push_tail (&details->labels_to_measure, icon);
+            icon->measure_label_link = details->labels_to_measure.tail;
+        }
+    }
+}
+
+static gboolean
+measure_labels_callback (gpointer data)
+{
+    CajaIconContainerDetails *details;
+    CajaIcon *icon;
+    int i;
+
+    details = CAJA_ICON_CONTAINER (data)->details;
+
+    /* Only now the icons are laid out for the new sizes */
+    if (!details->labels_to_measure_queued)
+    {
+        queue_labels_to_measure (CAJA_ICON_CONTAINER (data));
+        details->labels_to_measure_queued = TRUE;
+    }
+
+    for (i = 0; i < MEASURE_LABELS_BATCH_SIZE && details->labels_to_measure.length > 0; i++)
+    {
+        icon = g_queue_pop_head (&details->labels_to_measure);
+        icon->measure_label_link = NULL;
+
+        caja_icon_canvas_item_measure_label (icon->item);
+    }
+
+    if (details->labels_to_measure.length > 0)
+    {
+        return TRUE;
+    }
+
+    details->measure_labels_idle_id = 0;
+
+    return FALSE;
+}
+
+static void
+unschedule_measure_labels (CajaIconContainer *container)
+{
+    CajaIconContainerDetails *details;
+    CajaIcon *icon;
+
+    details = container->details;
+
+    if (details->measure_labels_idle_id != 0)
+    {
+        g_source_remove (details->measure_labels_idle_id);
+        details->measure_labels_idle_id = 0;
+    }
+
+    while (details->labels_to_measure.length > 0)
+    {
+        icon = g_queue_pop_head (&details->labels_to_measure);
+        icon->measure_label_link = NULL;
+    }
+}
+
+/* Measures the labels near the visible area again when nothing else is
+ * going on, so that scrolling after a change of zoom finds them
+ * measured.
+ */
+static void
+schedule_measure_labels (CajaIconContainer *container)
+{
+    unschedule_measure_labels (container);
+
+    if (container->details->icons != NULL)
+    {
+        container->details->labels_to_measure_queued = FALSE;
+        container->details->measure_labels_idle_id =
+            g_idle_add_full (G_PRIORITY_LOW, measure_labels_callback, container, NULL);
+    }
+}
+
 /* invalidate the cached label sizes for all the icons */
 static void
 invalidate_label_sizes (CajaIconContainer *container)
@@ -2462,12 +3124,16 @@ invalidate_label_sizes (CajaIconContainer *container)
     GList *p;
     CajaIcon *icon = NULL;
 
+    invalidate_layout_lines (container);
+
     for (p = container->details->icons; p != NULL; p = p->next)
     {
         icon = p->data;
 
         caja_icon_canvas_item_invalidate_label_size (icon->item);
     }
+
+    schedule_measure_labels (container);
 }
 
 /* invalidate the entire labels (i.e. their attributes) for all the icons */
@@ -2477,12 +3143,16 @@ invalidate_labels (CajaIconContainer *container)
     GList *p;
     CajaIcon *icon = NULL;
 
+    invalidate_layout_lines (container);
+
     for (p = container->details->icons; p != NULL; p = p->next)
     {
         icon = p->data;
 
         caja_icon_canvas_item_invalidate_label (icon->item);
     }
+
+    schedule_measure_labels (container);
 }
 
 static gboolean
@@ -2611,37 +3281,98 @@ caja_icon_container_move_icon (CajaIconContainer *container,
             snap_position (container, icon, &x, &y);
         }
 
-        if (x != icon->x || y != icon->y)
+        if (x != icon->x || y != icon->y)
+        {
+            icon_set_position (icon, x, y);
+            emit_signal = update_position;
+        }
+
+        icon->saved_ltr_x = caja_icon_container_is_layout_rtl (container) ? get_mirror_x_position (container, icon, icon->x) : icon->x;
+    }
+
+    if (emit_signal)
+    {
+        position.x = icon->saved_ltr_x;
+        position.y = icon->y;
+        position.scale = scale;
+        g_signal_emit (container,
+                       signals[ICON_POSITION_CHANGED], 0,
+                       icon->data, &position);
+    }
+
+    if (raise)
+    {
+        icon_raise (icon);
+    }
+
+    /* FIXME bugzilla.gnome.org 42474:
+     * Handling of the scroll region is inconsistent here. In
+     * the scale-changing case, redo_layout is called, which updates the
+     * scroll region appropriately. In other cases, it's up to the
+     * caller to make sure the scroll region is updated. This could
+     * lead to hard-to-track-down bugs.
+     */
+}
+
+static EelIRect
+world_rect_to_canvas (EelCanvas *canvas, const EelDRect *rect)
+{
+    EelIRect canvas_rect;
+
+    eel_canvas_w2c (canvas, rect->x0, rect->y0, &canvas_rect.x0, &canvas_rect.y0);
+    eel_canvas_w2c (canvas, rect->x1, rect->y1, &canvas_rect.x1, &canvas_rect.y1);
+
+    return canvas_rect;
+}
+
+/* While the band is dragged, only icons under the previous or the current
+ * band can change their selection; everything else still has the selection
+ * it had when the band started.
+ */
+static gboolean
+rubberband_select_in_area (CajaIconContainer *container,
+                           const EelDRect *previous_rect,
+                           const EelDRect *current_rect)
+{
+    EelCanvas *canvas;
+    EelIRect canvas_rect, previous_canvas_rect;
+    CajaIcon *icon;
+    GList *items, *l;
+    gboolean selection_changed, is_in;
+
+    canvas = EEL_CANVAS (container);
+    canvas_rect = world_rect_to_canvas (canvas, current_rect);
+    previous_canvas_rect = world_rect_to_canvas (canvas, previous_rect);
+
+    items = eel_canvas_group_get_items_in_area (eel_canvas_root (canvas),
+                                                MIN (canvas_rect.x0, previous_canvas_rect.x0),
+                                                MIN (canvas_rect.y0, previous_canvas_rect.y0),
+                                                MAX (canvas_rect.x1, previous_canvas_rect.x1),
+                                                MAX (canvas_rect.y1, previous_canvas_rect.y1));
+
+    selection_changed = FALSE;
+    for (l = items; l != NULL; l = l->next)
+    {
+        if (!CAJA_IS_ICON_CANVAS_ITEM (l->data))
+        {
+            continue;
+        }
+
+        icon = CAJA_ICON_CANVAS_ITEM (l->data)->user_data;
+        if (icon == NULL)
         {
-            icon_set_position (icon, x, y);
-            emit_signal = update_position;
+            continue;
         }
 
-        icon->saved_ltr_x = caja_icon_container_is_layout_rtl (container) ? get_mirror_x_position (container, icon, icon->x) : icon->x;
-    }
-
-    if (emit_signal)
-    {
-        position.x = icon->saved_ltr_x;
-        position.y = icon->y;
-        position.scale = scale;
-        g_signal_emit (container,
-                       signals[ICON_POSITION_CHANGED], 0,
-                       icon->data, &position);
-    }
+        is_in = caja_icon_canvas_item_hit_test_rectangle (icon->item, canvas_rect);
 
-    if (raise)
-    {
-        icon_raise (icon);
+        selection_changed |= icon_set_selected
+                             (container, icon,
+                              is_in ^ icon->was_selected_before_rubberband);
     }
+    g_list_free (items);
 
-    /* FIXME bugzilla.gnome.org 42474:
-     * Handling of the scroll region is inconsistent here. In
-     * the scale-changing case, redo_layout is called, which updates the
-     * scroll region appropriately. In other cases, it's up to the
-     * caller to make sure the scroll region is updated. This could
-     * lead to hard-to-track-down bugs.
-     */
+    return selection_changed;
 }
 
 /* Implementation of rubberband selection.  */
@@ -2656,6 +3387,16 @@ rubberband_select (CajaIconContainer *container,
     EelCanvas *canvas;
     CajaIcon *icon = NULL;
 
+    if (previous_rect != NULL)
+    {
+        if (rubberband_select_in_area (container, previous_rect, current_rect))
+        {
+            g_signal_emit (container,
+                           signals[SELECTION_CHANGED], 0);
+        }
+        return;
+    }
+
     selection_changed = FALSE;
     canvas_rect_calculated = FALSE;
 
@@ -2871,6 +3612,10 @@ start_rubberbanding (CajaIconContainer *container,
 		(EEL_CANVAS (container), event->x, event->y,
 		 &band_info->start_x, &band_info->start_y);
 
+	/* Nothing is covered yet, don't reuse the last rubberband's area */
+	band_info->prev_rect.x0 = band_info->prev_rect.x1 = band_info->start_x;
+	band_info->prev_rect.y0 = band_info->prev_rect.y1 = band_info->start_y;
+
 	context = gtk_widget_get_style_context (GTK_WIDGET (container));
 	gtk_style_context_save (context);
 	gtk_style_context_add_class (context, GTK_STYLE_CLASS_RUBBERBAND);
@@ -4347,6 +5092,8 @@ destroy (GtkWidget *object)
         container->details->idle_id = 0;
     }
 
+    unschedule_measure_labels (container);
+
     if (container->details->stretch_idle_id != 0)
     {
         g_source_remove (container->details->stretch_idle_id);
@@ -4359,6 +5106,12 @@ destroy (GtkWidget *object)
         container->details->align_idle_id = 0;
     }
 
+    if (container->details->update_visible_icons_id != 0)
+    {
+        g_source_remove (container->details->update_visible_icons_id);
+        container->details->update_visible_icons_id = 0;
+    }
+
     if (container->details->selection_changed_id != 0)
     {
         g_source_remove (container->details->selection_changed_id);
@@ -4405,6 +5158,14 @@ finalize (GObject *object)
     details->icon_set = NULL;
 
     g_free (details->font);
+    g_clear_object (&details->placeholder_pixbuf);
+    g_array_free (details->layout_lines, TRUE);
+    g_ptr_array_free (details->slot_icons, TRUE);
+    g_hash_table_destroy (details->materialized_icons);
+
+    g_debug ("Label size cache: %u hits, %u misses",
+             details->label_size_hits, details->label_size_misses);
+    g_hash_table_destroy (details->label_sizes);
 
     if (details->a11y_item_action_queue != NULL)
     {
@@ -4627,6 +5388,7 @@ style_updated (GtkWidget *widget)
 
     if (gtk_widget_get_realized (widget))
     {
+        clear_label_sizes (container);
         invalidate_labels (container);
         caja_icon_container_request_update_all (container);
     }
@@ -6623,6 +7385,7 @@ handle_scale_factor_changed (GObject    *object,
                              GParamSpec *pspec,
                              gpointer    user_data)
 {
+    clear_label_sizes (CAJA_ICON_CONTAINER (object));
     invalidate_labels (CAJA_ICON_CONTAINER (object));
     caja_icon_container_request_update_all (CAJA_ICON_CONTAINER (object));
 }
@@ -6728,6 +7491,13 @@ caja_icon_container_init (CajaIconContainer *container)
 
     details->icon_set = g_hash_table_new (g_direct_hash, g_direct_equal);
     details->layout_timestamp = UNDEFINED_TIME;
+    details->layout_lines = g_array_new (FALSE, FALSE, sizeof (LayoutLine));
+    details->slot_icons = g_ptr_array_new ();
+    details->materialized_icons = g_hash_table_new (g_direct_hash, g_direct_equal);
+    details->layout_dirty_index = G_MAXUINT;
+    details->label_sizes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                           NULL, label_size_entry_free);
+    g_queue_init (&details->label_size_lru);
 
     details->zoom_level = CAJA_ZOOM_LEVEL_STANDARD;
 
@@ -6741,6 +7511,9 @@ caja_icon_container_init (CajaIconContainer *container)
 
     container->details = details;
 
+    /* Folders can hold many thousands of icons, all in the root group */
+    eel_canvas_group_set_spatial_index (eel_canvas_root (EEL_CANVAS (container)), TRUE);
+
     /* when the background changes, we must set up the label text color */
     background = eel_get_widget_background (GTK_WIDGET (container));
 
@@ -6998,6 +7771,7 @@ caja_icon_container_clear (CajaIconContainer *container)
     set_pending_icon_to_reveal (container, NULL);
     details->stretch_icon = NULL;
     details->drop_target = NULL;
+    unschedule_measure_labels (container);
 
     for (p = details->icons; p != NULL; p = p->next)
     {
@@ -7017,6 +7791,9 @@ caja_icon_container_clear (CajaIconContainer *container)
 
     g_hash_table_destroy (details->icon_set);
     details->icon_set = g_hash_table_new (g_direct_hash, g_direct_equal);
+    g_ptr_array_set_size (details->slot_icons, 0);
+    g_hash_table_remove_all (details->materialized_icons);
+    invalidate_layout_lines (container);
 
     caja_icon_container_update_scroll_region (container);
 }
@@ -7227,12 +8004,24 @@ icon_destroy (CajaIconContainer *container,
 
     details = container->details;
 
+    icon_invalidate_layout (container, icon);
+
     item = g_list_find (details->icons, icon);
     item = item->next ? item->next : item->prev;
     icon_to_focus = (item != NULL) ? item->data : NULL;
 
     details->icons = g_list_remove (details->icons, icon);
     details->new_icons = g_list_remove (details->new_icons, icon);
+    g_hash_table_remove (details->materialized_icons, icon);
+    if (icon->layout_index < details->slot_icons->len &&
+        g_ptr_array_index (details->slot_icons, icon->layout_index) == icon)
+    {
+        g_ptr_array_index (details->slot_icons, icon->layout_index) = NULL;
+    }
+    if (icon->measure_label_link != NULL)
+    {
+        g_queue_delete_link (&details->labels_to_measure, icon->measure_label_link);
+    }
     g_hash_table_remove (details->icon_set, icon->data);
 
     was_selected = icon->is_selected;
@@ -7436,6 +8225,236 @@ caja_icon_container_prioritize_thumbnailing (CajaIconContainer *container,
     klass->prioritize_thumbnailing (container, icon->data);
 }
 
+static void
+caja_icon_container_deprioritize_thumbnailing (CajaIconContainer *container,
+        CajaIcon *icon)
+{
+    CajaIconContainerClass *klass;
+
+    klass = CAJA_ICON_CONTAINER_GET_CLASS (container);
+    if (klass->deprioritize_thumbnailing != NULL)
+    {
+        klass->deprioritize_thumbnailing (container, icon->data);
+    }
+}
+
+/* Icons that must keep their images even when out of view */
+static gboolean
+icon_is_in_use (CajaIconContainer *container,
+                CajaIcon *icon)
+{
+    CajaIconContainerDetails *details;
+
+    details = container->details;
+
+    return icon == details->keyboard_focus ||
+           icon == details->drop_target ||
+           icon == details->stretch_icon ||
+           icon == get_icon_being_renamed (container);
+}
+
+/* Loads or drops the images of an icon in a virtualized layout. The icon
+ * stays centered on the baseline of its slot, in case the images are not
+ * the size of the placeholder.
+ */
+static void
+icon_set_materialized (CajaIconContainer *container,
+                       CajaIcon *icon,
+                       gboolean materialized)
+{
+    EelDRect before, after;
+    double dx, dy;
+
+    if (icon->is_materialized == materialized)
+    {
+        return;
+    }
+
+    before = caja_icon_canvas_item_get_icon_rectangle (icon->item);
+
+    icon->is_materialized = materialized;
+    caja_icon_container_update_icon (container, icon);
+
+    if (materialized)
+    {
+        g_hash_table_add (container->details->materialized_icons, icon);
+    }
+    else
+    {
+        g_hash_table_remove (container->details->materialized_icons, icon);
+        caja_icon_canvas_item_invalidate_label (icon->item);
+    }
+
+    if (!icon_is_positioned (icon))
+    {
+        return;
+    }
+
+    after = caja_icon_canvas_item_get_icon_rectangle (icon->item);
+    dx = ((before.x1 - before.x0) - (after.x1 - after.x0)) / 2;
+    dy = (before.y1 - before.y0) - (after.y1 - after.y0);
+
+    if (dx != 0 || dy != 0)
+    {
+        icon_set_position (icon, icon->x + dx, icon->y + dy);
+        icon->saved_ltr_x = caja_icon_container_is_layout_rtl (container) ?
+                            get_mirror_x_position (container, icon, icon->x) : icon->x;
+    }
+}
+
+static void
+set_virtualized (CajaIconContainer *container,
+                 gboolean virtualized)
+{
+    GList *p;
+    CajaIcon *icon;
+
+    if (container->details->virtualized == virtualized)
+    {
+        return;
+    }
+
+    container->details->virtualized = virtualized;
+    invalidate_layout_lines (container);
+    g_ptr_array_set_size (container->details->slot_icons, 0);
+    g_hash_table_remove_all (container->details->materialized_icons);
+
+    if (virtualized)
+    {
+        /* They all have their images still */
+        for (p = container->details->icons; p != NULL; p = p->next)
+        {
+            icon = p->data;
+
+            if (icon->is_materialized)
+            {
+                g_hash_table_add (container->details->materialized_icons, icon);
+            }
+        }
+    }
+    else
+    {
+        /* Every icon has its images again */
+        for (p = container->details->icons; p != NULL; p = p->next)
+        {
+            icon = p->data;
+
+            if (!icon->is_materialized)
+            {
+                icon->is_materialized = TRUE;
+                caja_icon_container_update_icon (container, icon);
+            }
+        }
+
+        g_clear_object (&container->details->placeholder_pixbuf);
+    }
+}
+
+/* In a virtualized layout the icons within a page of the visible area get
+ * their images, and the ones more than two pages away give them up.
+ */
+static void
+update_materialized_icon (CajaIconContainer *container,
+                          CajaIcon *icon,
+                          double min_y,
+                          double max_y)
+{
+    double page, top, bottom;
+
+    page = max_y - min_y;
+    top = icon->y;
+    bottom = icon->y + container->details->slot_height_above + container->details->slot_height_below;
+
+    if (!icon->is_materialized)
+    {
+        if (bottom >= min_y - page && top <= max_y + page)
+        {
+            icon_set_materialized (container, icon, TRUE);
+        }
+    }
+    else if ((bottom < min_y - 2 * page || top > max_y + 2 * page) &&
+             !icon_is_in_use (container, icon))
+    {
+        icon_set_materialized (container, icon, FALSE);
+    }
+}
+
+/* Runs right away on every scroll, so that no placeholders are left in
+ * view while scrolling. All slots are the same size, so the icons that
+ * may need their images are found from the lines in range, and the ones
+ * that may drop them among the materialized icons, without going
+ * through all the icons.
+ */
+static void
+update_materialized_icons (CajaIconContainer *container)
+{
+    CajaIconContainerDetails *details;
+    GtkAdjustment *vadj;
+    GtkAllocation allocation;
+    GHashTableIter iter;
+    gpointer key;
+    double min_x, min_y, max_y, page;
+    guint index, end;
+    GList *materialized, *l;
+    CajaIcon *icon;
+
+    details = container->details;
+
+    if (!details->virtualized || details->slot_icons->len == 0)
+    {
+        return;
+    }
+
+    vadj = gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (container));
+    gtk_widget_get_allocation (GTK_WIDGET (container), &allocation);
+
+    min_x = 0;
+    min_y = gtk_adjustment_get_value (vadj);
+    max_y = min_y + allocation.height;
+
+    eel_canvas_c2w (EEL_CANVAS (container),
+                    min_x, min_y, &min_x, &min_y);
+    eel_canvas_c2w (EEL_CANVAS (container),
+                    min_x, max_y, &min_x, &max_y);
+
+    /* The lines within a page of the visible area, see
+     * update_materialized_icon().
+     */
+    page = max_y - min_y;
+    index = (guint) MAX (floor ((min_y - page - details->slot_top) / details->slot_line_height), 0) *
+            details->slot_columns;
+    end = (guint) MAX (ceil ((max_y + page - details->slot_top) / details->slot_line_height) + 1, 0) *
+          details->slot_columns;
+    end = MIN (end, details->slot_icons->len);
+
+    for (; index < end; index++)
+    {
+        icon = g_ptr_array_index (details->slot_icons, index);
+
+        if (icon != NULL && !icon->is_materialized)
+        {
+            update_materialized_icon (container, icon, min_y, max_y);
+        }
+    }
+
+    materialized = NULL;
+    g_hash_table_iter_init (&iter, details->materialized_icons);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        materialized = g_list_prepend (materialized, key);
+    }
+    for (l = materialized; l != NULL; l = l->next)
+    {
+        icon = l->data;
+
+        if (icon_is_positioned (icon))
+        {
+            update_materialized_icon (container, icon, min_y, max_y);
+        }
+    }
+    g_list_free (materialized);
+}
+
 static void
 caja_icon_container_update_visible_icons (CajaIconContainer *container)
 {
@@ -7470,7 +8489,26 @@ caja_icon_container_update_visible_icons (CajaIconContainer *container)
     {
         icon = node->data;
 
-        if (icon_is_positioned (icon))
+        if (icon_is_positioned (icon) && container->details->virtualized)
+        {
+            visible = icon->y + container->details->slot_height_above +
+                      container->details->slot_height_below >= min_y &&
+                      icon->y <= max_y;
+
+            if (visible)
+            {
+                caja_icon_canvas_item_set_is_visible (icon->item, TRUE);
+                caja_icon_container_prioritize_thumbnailing (container,
+                        icon);
+            }
+            else if (caja_icon_canvas_item_get_is_visible (icon->item))
+            {
+                caja_icon_canvas_item_set_is_visible (icon->item, FALSE);
+                caja_icon_container_deprioritize_thumbnailing (container,
+                        icon);
+            }
+        }
+        else if (icon_is_positioned (icon))
         {
             eel_canvas_item_get_bounds (EEL_CANVAS_ITEM (icon->item),
                                         &x0,
@@ -7499,21 +8537,54 @@ caja_icon_container_update_visible_icons (CajaIconContainer *container)
                 caja_icon_container_prioritize_thumbnailing (container,
                         icon);
             }
-            else
+            else if (caja_icon_canvas_item_get_is_visible (icon->item))
             {
                 caja_icon_canvas_item_set_is_visible (icon->item, FALSE);
+                caja_icon_container_deprioritize_thumbnailing (container,
+                        icon);
             }
         }
     }
 }
 
+static gboolean
+update_visible_icons_timeout_callback (gpointer data)
+{
+    CajaIconContainer *container;
+
+    container = CAJA_ICON_CONTAINER (data);
+    container->details->update_visible_icons_id = 0;
+
+    caja_icon_container_update_visible_icons (container);
+
+    return FALSE;
+}
+
+/* Scrolling fires many adjustment changes, only reprioritize the
+ * thumbnails of the icons in view once it pauses.
+ */
+static void
+schedule_update_visible_icons (CajaIconContainer *container)
+{
+    if (container->details->update_visible_icons_id != 0)
+    {
+        g_source_remove (container->details->update_visible_icons_id);
+    }
+
+    container->details->update_visible_icons_id =
+        g_timeout_add (UPDATE_VISIBLE_ICONS_DELAY,
+                       update_visible_icons_timeout_callback,
+                       container);
+}
+
 static void
 handle_vadjustment_changed (GtkAdjustment *adjustment,
                             CajaIconContainer *container)
 {
     if (!caja_icon_container_is_layout_vertical (container))
     {
-        caja_icon_container_update_visible_icons (container);
+        update_materialized_icons (container);
+        schedule_update_visible_icons (container);
     }
 }
 
@@ -7523,17 +8594,47 @@ handle_hadjustment_changed (GtkAdjustment *adjustment,
 {
     if (caja_icon_container_is_layout_vertical (container))
     {
-        caja_icon_container_update_visible_icons (container);
+        schedule_update_visible_icons (container);
     }
 }
 
+/* Gives an icon its texts and a blank image of the right size, but does
+ * not load its images.
+ */
+static void
+update_icon_placeholder (CajaIconContainer *container,
+                         CajaIcon *icon)
+{
+    char *editable_text, *additional_text;
+
+    caja_icon_container_get_icon_text (container,
+                                       icon->data,
+                                       &editable_text,
+                                       &additional_text,
+                                       FALSE);
+
+    eel_canvas_item_set (EEL_CANVAS_ITEM (icon->item),
+                         "editable_text", editable_text,
+                         "additional_text", additional_text,
+                         "highlighted_for_drop", icon == container->details->drop_target,
+                         NULL);
+
+    caja_icon_canvas_item_set_image (icon->item,
+                                     get_placeholder_pixbuf (container, get_icon_image_size (container, icon)));
+    caja_icon_canvas_item_set_attach_points (icon->item, NULL, 0);
+    caja_icon_canvas_item_set_emblems (icon->item, NULL);
+    caja_icon_canvas_item_set_embedded_text (icon->item, NULL);
+
+    g_free (editable_text);
+    g_free (additional_text);
+}
+
 void
 caja_icon_container_update_icon (CajaIconContainer *container,
                                  CajaIcon *icon)
 {
     CajaIconContainerDetails *details;
     guint icon_size;
-    guint min_image_size, max_image_size;
     CajaIconInfo *icon_info;
     GdkPoint *attach_points;
     int n_attach_points;
@@ -7554,22 +8655,20 @@ caja_icon_container_update_icon (CajaIconContainer *container,
 
     details = container->details;
 
-    /* compute the maximum size based on the scale factor */
-    min_image_size = MINIMUM_IMAGE_SIZE * EEL_CANVAS (container)->pixels_per_unit;
-    max_image_size = MAX (MAXIMUM_IMAGE_SIZE * EEL_CANVAS (container)->pixels_per_unit, CAJA_ICON_MAXIMUM_SIZE);
-
-    /* Get the appropriate images for the file. */
-    if (container->details->forced_icon_size > 0)
+    if (details->virtualized && !icon->is_materialized)
     {
-        icon_size = container->details->forced_icon_size;
+        update_icon_placeholder (container, icon);
+        return;
     }
-    else
+
+    if (!details->virtualized)
     {
-        icon_get_size (container, icon, &icon_size);
+        /* Its size may change */
+        icon_invalidate_layout (container, icon);
     }
 
-    icon_size = MAX (icon_size, min_image_size);
-    icon_size = MIN (icon_size, max_image_size);
+    /* Get the appropriate images for the file. */
+    icon_size = get_icon_image_size (container, icon);
 
     /* Get the icons. */
     emblem_pixbufs = NULL;
@@ -7671,6 +8770,8 @@ static void
 finish_adding_icon (CajaIconContainer *container,
                     CajaIcon *icon)
 {
+    /* Images are loaded once the icon comes near the visible area */
+    icon->is_materialized = !container->details->virtualized;
     caja_icon_container_update_icon (container, icon);
     eel_canvas_item_show (EEL_CANVAS_ITEM (icon->item));
 
@@ -7854,6 +8955,7 @@ caja_icon_container_add (CajaIconContainer *container,
      */
     icon->has_lazy_position = is_old_or_unknown_icon_data (container, data);
     icon->scale = 1.0;
+    icon->layout_index = G_MAXUINT;
     icon->item = CAJA_ICON_CANVAS_ITEM
                  (eel_canvas_item_new (EEL_CANVAS_GROUP (EEL_CANVAS (container)->root),
                                        caja_icon_canvas_item_get_type (),
@@ -8618,6 +9720,7 @@ caja_icon_container_set_auto_layout (CajaIconContainer *container,
 
     reset_scroll_region_if_not_empty (container);
     container->details->auto_layout = auto_layout;
+    invalidate_layout_lines (container);
 
     if (!auto_layout)
     {
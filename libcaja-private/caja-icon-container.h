@@ -176,6 +176,8 @@ typedef struct
             gconstpointer client);
     void         (* prioritize_thumbnailing)  (CajaIconContainer *container,
             CajaIconData *data);
+    void         (* deprioritize_thumbnailing) (CajaIconContainer *container,
+            CajaIconData *data);
 
     /* Queries on icons for subclass/client.
      * These must be implemented => These are signals !
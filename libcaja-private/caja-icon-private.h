@@ -68,8 +68,34 @@ typedef struct
     eel_boolean_bit is_monitored : 1;
 
     eel_boolean_bit has_lazy_position : 1;
+
+    /* Whether the images of the icon are loaded. In a virtualized
+     * layout only the icons near the visible area have them.
+     */
+    eel_boolean_bit is_materialized : 1;
+
+    /* Position in the list of icons at the last layout, G_MAXUINT
+     * if the icon was not laid out yet.
+     */
+    guint layout_index;
+
+    /* The link of the icon in the labels to measure when idle, so that
+     * it is taken out right away when the icon goes.
+     */
+    GList *measure_label_link;
 } CajaIcon;
 
+/* Measured size of a label, see CajaIconCanvasItem. */
+typedef struct
+{
+    int text_width;
+    int text_dx;
+    int text_height;
+    int text_height_for_layout;
+    int text_height_for_entire_text;
+    int editable_text_height;
+} CajaIconLabelSize;
+
 /* Private CajaIconContainer members. */
 
 typedef struct
@@ -198,6 +224,47 @@ struct CajaIconContainerDetails
     /* Align idle id */
     guint align_idle_id;
 
+    /* Timeout for updating the visible icons after scrolling */
+    guint update_visible_icons_id;
+
+    /* Big folders are laid out in slots of the same size, so that only
+     * the icons near the visible area need their images loaded.
+     */
+    gboolean virtualized;
+    GdkPixbuf *placeholder_pixbuf;
+    double slot_height_above;
+    double slot_height_below;
+    /* The grid of the slots, and the icon in each, by layout_index */
+    double slot_top;
+    double slot_line_height;
+    int slot_columns;
+    GPtrArray *slot_icons;
+    /* Icons that have their images, the ones to look at for dropping
+     * them again.
+     */
+    GHashTable *materialized_icons;
+
+    /* Lines of the last layout of all the icons in rows, so that a
+     * later layout can start at the first line that changed.
+     */
+    GArray *layout_lines;
+    gboolean layout_lines_valid;
+    double layout_canvas_width;
+    guint layout_dirty_index;
+
+    /* Label sizes measured for all icons, most recently used first */
+    GHashTable *label_sizes;
+    GQueue label_size_lru;
+    guint label_size_hits;
+    guint label_size_misses;
+
+    /* Icons whose labels are measured when idle, the visible ones first,
+     * see CajaIcon.measure_label_link.
+     */
+    GQueue labels_to_measure;
+    gboolean labels_to_measure_queued;
+    guint measure_labels_idle_id;
+
     /* DnD info. */
     CajaIconDndInfo *dnd_info;
 
@@ -317,5 +384,11 @@ gboolean      caja_icon_container_scroll                      (CajaIconContainer
         int                    delta_x,
         int                    delta_y);
 void          caja_icon_container_update_scroll_region        (CajaIconContainer *container);
+gboolean      caja_icon_container_lookup_label_size           (CajaIconContainer *container,
+        const char            *key,
+        CajaIconLabelSize     *size);
+void          caja_icon_container_store_label_size            (CajaIconContainer *container,
+        const char            *key,
+        const CajaIconLabelSize *size);
 
 #endif /* CAJA_ICON_CONTAINER_PRIVATE_H */
@@ -79,6 +79,12 @@ struct _CajaProgressInfo
     gboolean waiting;
     GCond waiting_c;
 
+    /* Devices the operation reads or writes, id -> display name */
+    GHashTable *devices;
+
+    gboolean can_background;
+    gboolean background;
+
     GSource *idle_source;
     gboolean source_is_now;
 
@@ -127,6 +133,7 @@ caja_progress_info_finalize (GObject *object)
     g_free (info->status);
     g_free (info->details);
     g_object_unref (info->cancellable);
+    g_hash_table_destroy (info->devices);
 
     if (G_OBJECT_CLASS (caja_progress_info_parent_class)->finalize)
     {
@@ -295,7 +302,10 @@ typedef struct _ProgressWidgetData
     GtkProgressBar *progress_bar;
     GtkWidget *btstart;
     GtkWidget *btqueue;
+    GtkWidget *btbackground;
     ProgressWidgetState state;
+    /* Queued with the queue button rather than waiting for a device */
+    gboolean queued_by_user;
 } ProgressWidgetData;
 
 static void
@@ -305,6 +315,115 @@ progress_widget_data_free (ProgressWidgetData *data)
     g_free (data);
 }
 
+static GtkWidget *get_widgets_container (void);
+
+static int
+get_operations_per_device (void)
+{
+    return MAX (1, g_settings_get_int (caja_preferences,
+                                       CAJA_PREFERENCES_OPERATIONS_PER_DEVICE));
+}
+
+/* Whether a queued operation may start alongside the running ones:
+ * no device it uses may be used by operations-per-device running
+ * operations already. Operations that don't say which devices they use
+ * and those queued by hand only run when nothing else does. If
+ * busy_names is set, the names of the devices in the way are added.
+ */
+static gboolean
+op_can_run_now (ProgressWidgetData *data,
+                GList **busy_names)
+{
+    ProgressWidgetData *other;
+    GHashTable *usage;
+    GHashTableIter iter;
+    GList *children, *l;
+    gpointer id, name;
+    gboolean any_running, unknown_running, res;
+    int limit;
+
+    children = gtk_container_get_children (GTK_CONTAINER (get_widgets_container ()));
+    /* device id -> number of running operations using it */
+    usage = g_hash_table_new (g_str_hash, g_str_equal);
+    any_running = FALSE;
+    unknown_running = FALSE;
+
+    G_LOCK (progress_info);
+
+    for (l = children; l != NULL; l = l->next) {
+        other = (ProgressWidgetData*) g_object_get_data (G_OBJECT (l->data), "data");
+
+        if (other == data || is_op_paused (other->state))
+            continue;
+
+        any_running = TRUE;
+        if (g_hash_table_size (other->info->devices) == 0) {
+            unknown_running = TRUE;
+            continue;
+        }
+
+        g_hash_table_iter_init (&iter, other->info->devices);
+        while (g_hash_table_iter_next (&iter, &id, NULL)) {
+            g_hash_table_insert (usage, id,
+                                 GINT_TO_POINTER (GPOINTER_TO_INT (g_hash_table_lookup (usage, id)) + 1));
+        }
+    }
+
+    if (!any_running) {
+        res = TRUE;
+    } else if (data->queued_by_user || unknown_running ||
+               g_hash_table_size (data->info->devices) == 0) {
+        res = FALSE;
+    } else {
+        limit = get_operations_per_device ();
+        res = TRUE;
+
+        g_hash_table_iter_init (&iter, data->info->devices);
+        while (g_hash_table_iter_next (&iter, &id, &name)) {
+            if (GPOINTER_TO_INT (g_hash_table_lookup (usage, id)) >= limit) {
+                res = FALSE;
+                if (busy_names != NULL)
+                    *busy_names = g_list_prepend (*busy_names, g_strdup (name));
+            }
+        }
+    }
+
+    G_UNLOCK (progress_info);
+
+    g_hash_table_destroy (usage);
+    g_list_free (children);
+
+    return res;
+}
+
+static char *
+get_device_queue_status (CajaProgressInfo *info)
+{
+    GList *busy_names, *l;
+    GString *names;
+    char *res;
+
+    busy_names = NULL;
+    op_can_run_now (info->widget, &busy_names);
+    if (busy_names == NULL)
+        return g_strdup (_("queued"));
+
+    names = g_string_new (NULL);
+    for (l = busy_names; l != NULL; l = l->next) {
+        if (names->len > 0)
+            g_string_append (names, ", ");
+        g_string_append (names, l->data);
+    }
+
+    /* Translators: %s is a list of devices, like "File System, USB Stick" */
+    res = g_strdup_printf (_("waiting for %s"), names->str);
+
+    g_string_free (names, TRUE);
+    g_list_free_full (busy_names, g_free);
+
+    return res;
+}
+
 static void
 update_data (ProgressWidgetData *data)
 {
@@ -315,16 +434,19 @@ update_data (ProgressWidgetData *data)
 
     switch (data->state) {
         case STATE_PAUSED:
-            curstat = _("paused");
+            curstat = g_strdup (_("paused"));
             break;
         case STATE_PAUSING:
-            curstat = _("pausing");
+            curstat = g_strdup (_("pausing"));
             break;
         case STATE_QUEUED:
-            curstat = _("queued");
+            if (data->queued_by_user)
+                curstat = g_strdup (_("queued"));
+            else
+                curstat = get_device_queue_status (data->info);
             break;
         case STATE_QUEUING:
-            curstat = _("queuing");
+            curstat = g_strdup (_("queuing"));
             break;
         default:
             curstat = NULL;
@@ -336,6 +458,7 @@ update_data (ProgressWidgetData *data)
         t = status;
         status = g_strconcat (status, " \xE2\x80\x94 ", curstat, NULL);
         g_free (t);
+        g_free (curstat);
     }
 
     gtk_label_set_text (data->status, status);
@@ -355,52 +478,6 @@ get_widgets_container (void)
     GtkWidget * window = get_progress_window ();
     return gtk_bin_get_child (GTK_BIN (window));
 }
-static void
-foreach_get_running_operations (GtkWidget * widget, int * n)
-{
-    ProgressWidgetData *data = (ProgressWidgetData*) g_object_get_data (
-                G_OBJECT(widget), "data");
-
-    if (! is_op_paused (data->state))
-        (*n)++;
-}
-
-static int
-get_running_operations (void)
-{
-    GtkWidget * container = get_widgets_container();
-    int n = 0;
-
-    gtk_container_foreach (GTK_CONTAINER(container),
-                        (GtkCallback)foreach_get_running_operations, &n);
-    return n;
-}
-
-static void
-foreach_get_queued_widget (GtkWidget * widget, GtkWidget ** out)
-{
-    if (*out == NULL) {
-        ProgressWidgetData *data;
-
-        data = (ProgressWidgetData*) g_object_get_data (
-                G_OBJECT(widget), "data");
-
-        if (data->state == STATE_QUEUED || data->state == STATE_QUEUING)
-            *out = widget;
-    }
-}
-
-static GtkWidget *
-get_first_queued_widget (void)
-{
-    GtkWidget * container = get_widgets_container();
-    GtkWidget * out = NULL;
-
-    gtk_container_foreach (GTK_CONTAINER(container),
-                (GtkCallback)foreach_get_queued_widget, &out);
-    return out;
-}
-
 static void
 start_button_update_view (ProgressWidgetData *data)
 {
@@ -542,6 +619,9 @@ widget_state_transit_to (ProgressWidgetData *data,
 {
     data->state = newstate;
 
+    if (newstate == STATE_RUNNING)
+        data->queued_by_user = FALSE;
+
     if (newstate == STATE_PAUSING ||
         newstate == STATE_QUEUING ||
         newstate == STATE_QUEUED) {
@@ -565,22 +645,31 @@ widget_state_transit_to (ProgressWidgetData *data,
     update_data (data);
 }
 
+/* Starts the queued operations that don't get in the way of the
+ * running ones, in the order they were queued.
+ */
 static void
 update_queue (void)
 {
-    if (get_running_operations () == 0) {
-        GtkWidget *next;
+    GList *children, *child;
+    ProgressWidgetData *data;
 
-        next = get_first_queued_widget ();
+    children = gtk_container_get_children (GTK_CONTAINER (get_widgets_container ()));
+
+    for (child = children; child != NULL; child = child->next) {
+        data = (ProgressWidgetData*) g_object_get_data (
+                G_OBJECT(child->data), "data");
 
-        if (next != NULL) {
-            ProgressWidgetData *data;
+        if (data->state != STATE_QUEUED)
+            continue;
 
-            data = (ProgressWidgetData*) g_object_get_data (
-                    G_OBJECT(next), "data");
+        if (op_can_run_now (data, NULL))
             widget_state_transit_to (data, STATE_RUNNING);
-        }
+        else
+            update_data (data);
     }
+
+    g_list_free (children);
 }
 
 static void
@@ -750,9 +839,11 @@ queue_clicked (GtkWidget *queuebt,
     switch (data->state) {
         case STATE_RUNNING:
         case STATE_PAUSING:
+            data->queued_by_user = TRUE;
             widget_state_transit_to (data, STATE_QUEUING);
             break;
         case STATE_PAUSED:
+            data->queued_by_user = TRUE;
             widget_state_transit_to (data, STATE_QUEUED);
             break;
         default:
@@ -809,6 +900,39 @@ queue_button_init (ProgressWidgetData *data)
     g_signal_connect (button, "clicked", (GCallback)queue_clicked, data);
 }
 
+static void
+background_toggled (GtkToggleButton *button,
+                    ProgressWidgetData *data)
+{
+    caja_progress_info_set_background (data->info,
+                                       gtk_toggle_button_get_active (button));
+}
+
+static void
+background_button_init (ProgressWidgetData *data)
+{
+    GtkWidget *button, *image;
+
+    button = gtk_toggle_button_new ();
+    data->btbackground = button;
+
+    image = gtk_image_new_from_icon_name ("go-bottom", GTK_ICON_SIZE_BUTTON);
+
+    gtk_container_add (GTK_CONTAINER (button), image);
+    atk_object_set_name (gtk_widget_get_accessible (button), _("Run in Background"));
+    gtk_widget_set_tooltip_text (button, _("Run in background, with low disk priority"));
+
+    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (button),
+                                  caja_progress_info_get_background (data->info));
+
+    /* Only operations that know how to slow down get the button */
+    gtk_widget_set_no_show_all (button, TRUE);
+    gtk_widget_set_visible (button, data->info->can_background);
+    gtk_widget_show (image);
+
+    g_signal_connect (button, "toggled", (GCallback)background_toggled, data);
+}
+
 static GtkWidget *
 progress_widget_new (CajaProgressInfo *info)
 {
@@ -860,6 +984,7 @@ progress_widget_new (CajaProgressInfo *info)
 
     start_button_init (data);
     queue_button_init (data);
+    background_button_init (data);
 
     gtk_box_pack_start (GTK_BOX (hbox),
                         btcancel,
@@ -877,6 +1002,10 @@ progress_widget_new (CajaProgressInfo *info)
                         data->btqueue,
                         FALSE,FALSE,
                         0);
+    gtk_box_pack_start (GTK_BOX (hbox),
+                        data->btbackground,
+                        FALSE,FALSE,
+                        0);
 
     gtk_box_pack_start (GTK_BOX (vbox),
                         hbox,
@@ -925,7 +1054,7 @@ handle_new_progress_info (CajaProgressInfo *info)
 
     n_progress_ops++;
 
-    if (info->waiting && get_running_operations () > 0)
+    if (info->waiting && !op_can_run_now (info->widget, NULL))
         widget_state_transit_to (info->widget, STATE_QUEUED);
     else
         widget_state_transit_to (info->widget, STATE_RUNNING);
@@ -954,10 +1083,10 @@ new_op_started (CajaProgressInfo *info)
     if (!caja_progress_info_get_is_finished (info)) {
         handle_new_progress_info (info);
 
-        /* Start the job when no other job is running */
-        // TODO use user defined policies
+        /* Start the job when it doesn't share a device with too many
+         * running jobs */
         if (info->waiting) {
-            if (get_running_operations () == 0)
+            if (op_can_run_now (info->widget, NULL))
                 progress_info_set_waiting (info, FALSE);
         }
 
@@ -971,6 +1100,7 @@ static void
 caja_progress_info_init (CajaProgressInfo *info)
 {
     info->cancellable = g_cancellable_new ();
+    info->devices = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
     G_LOCK (progress_info);
     active_progress_infos = g_list_append (active_progress_infos, info);
@@ -990,6 +1120,35 @@ caja_progress_info_new (gboolean should_start, gboolean can_pause)
     return info;
 }
 
+/* Operations that don't share a device run in parallel, see
+ * op_can_run_now(). Call before caja_progress_info_start().
+ */
+void
+caja_progress_info_add_device (CajaProgressInfo *info,
+                               const char *id,
+                               const char *name)
+{
+    G_LOCK (progress_info);
+
+    g_hash_table_replace (info->devices, g_strdup (id), g_strdup (name));
+
+    G_UNLOCK (progress_info);
+}
+
+/* Lets the user switch the operation between running at full speed and
+ * in the background, see caja_progress_info_get_background(). Call
+ * before caja_progress_info_start().
+ */
+void
+caja_progress_info_enable_background (CajaProgressInfo *info)
+{
+    G_LOCK (progress_info);
+
+    info->can_background = TRUE;
+
+    G_UNLOCK (progress_info);
+}
+
 char *
 caja_progress_info_get_status (CajaProgressInfo *info)
 {
@@ -1121,6 +1280,34 @@ caja_progress_info_get_is_paused (CajaProgressInfo *info)
     return res;
 }
 
+/* Whether the operation should stay out of the way of other disk
+ * users. Polled by the operation, which may change it at any time.
+ */
+gboolean
+caja_progress_info_get_background (CajaProgressInfo *info)
+{
+    gboolean res;
+
+    G_LOCK (progress_info);
+
+    res = info->background;
+
+    G_UNLOCK (progress_info);
+
+    return res;
+}
+
+void
+caja_progress_info_set_background (CajaProgressInfo *info,
+                                   gboolean background)
+{
+    G_LOCK (progress_info);
+
+    info->background = background;
+
+    G_UNLOCK (progress_info);
+}
+
 static gboolean
 idle_callback (gpointer data)
 {
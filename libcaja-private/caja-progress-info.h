@@ -53,6 +53,10 @@ GType caja_progress_info_get_type (void) G_GNUC_CONST;
 CajaProgressInfo *caja_progress_info_new (gboolean should_start, gboolean can_pause);
 void caja_progress_info_get_ready (CajaProgressInfo *info);
 void caja_progress_info_disable_pause (CajaProgressInfo *info);
+void caja_progress_info_add_device (CajaProgressInfo *info,
+                                    const char *id,
+                                    const char *name);
+void caja_progress_info_enable_background (CajaProgressInfo *info);
 
 GList *       caja_get_all_progress_info (void);
 
@@ -64,6 +68,9 @@ void          caja_progress_info_cancel          (CajaProgressInfo *info);
 gboolean      caja_progress_info_get_is_started  (CajaProgressInfo *info);
 gboolean      caja_progress_info_get_is_finished (CajaProgressInfo *info);
 gboolean      caja_progress_info_get_is_paused   (CajaProgressInfo *info);
+gboolean      caja_progress_info_get_background  (CajaProgressInfo *info);
+void          caja_progress_info_set_background  (CajaProgressInfo *info,
+        gboolean              background);
 
 void          caja_progress_info_start           (CajaProgressInfo *info);
 void          caja_progress_info_finish          (CajaProgressInfo *info);
@@ -0,0 +1,2051 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * Copyright (C) 2026 MATE Developers
+ *
+ * Caja is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * Caja is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; see the file COPYING.  If not,
+ * write to the Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+/* A built-in file name index for the locations listed in the
+ * search-index-locations preference.
+ *
+ * Each location has an index file in the user cache directory that is
+ * memory mapped as is. It holds one fixed-size record per file, with
+ * the children of a folder stored next to each other, a sorted table
+ * of name trigrams with their posting lists, and a string pool.
+ *
+ * Changes reported by directory monitors go to a small in-memory delta
+ * (added records and removed ids) on top of the mapped file. The file
+ * is rebuilt in a thread when it is too old or the delta grows large;
+ * changes seen while rebuilding are replayed on the new file.
+ *
+ * Queries the index cannot answer (contained text, tags, or a location
+ * outside every index) are passed on to the simple engine.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <gio/gio.h>
+
+#include <eel/eel-gtk-macros.h>
+
+#include "caja-global-preferences.h"
+#include "caja-search-engine-index.h"
+#include "caja-search-engine-simple.h"
+
+#define BATCH_SIZE 500
+
+#define INDEX_MAGIC "CAJAIDX"
+#define INDEX_VERSION 1
+
+#define INDEX_NO_ENTRY G_MAXUINT32
+
+#define INDEX_ENTRY_DIRECTORY (1 << 0)
+
+/* Rebuild index files older than this when they are first loaded. */
+#define INDEX_REBUILD_AGE_SECONDS (24 * 60 * 60)
+
+/* Rebuild once this many changes have piled up in the delta. */
+#define INDEX_MAX_DELTA_CHANGES 10000
+
+/* Directory monitors are a limited resource (inotify watches); folders
+ * beyond this are only picked up by rebuilds.
+ */
+#define INDEX_MAX_MONITORS 8192
+
+/* Folders moved into an index are read in a thread up to this many
+ * entries, larger ones trigger a rebuild.
+ */
+#define INDEX_MAX_SYNC_ENTRIES 10000
+
+#define INDEX_ATTRIBUTES \
+	G_FILE_ATTRIBUTE_STANDARD_NAME "," \
+	G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," \
+	G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN "," \
+	G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
+	G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE "," \
+	G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED
+
+/* On-disk layout: header, entries, trigrams, postings, strings. */
+typedef struct
+{
+    char magic[8];
+    guint32 version;
+    guint32 n_entries;
+    guint32 n_trigrams;
+    guint32 n_postings;
+    guint32 strings_size;
+    guint32 padding;
+    gint64 created;
+} IndexHeader;
+
+typedef struct
+{
+    guint32 parent;       /* INDEX_NO_ENTRY for the root */
+    guint32 first_child;  /* children of a folder are contiguous */
+    guint32 n_children;
+    guint32 name;         /* string pool offsets */
+    guint32 folded_name;
+    guint32 mime_type;
+    guint32 flags;
+    guint32 padding;
+    gint64 mtime;
+    gint64 size;
+} IndexEntry;
+
+typedef struct
+{
+    guint32 trigram;
+    guint32 first;        /* into the postings */
+    guint32 count;
+} IndexTrigram;
+
+/* A record added after the index file was written. */
+typedef struct
+{
+    IndexEntry entry;
+    char *name;
+    char *folded_name;
+    const char *mime_type; /* interned */
+} DeltaEntry;
+
+typedef enum
+{
+    INDEX_EVENT_ADD,
+    INDEX_EVENT_REMOVE
+} IndexEventType;
+
+typedef struct
+{
+    IndexEventType type;
+    GFile *file;
+} IndexEvent;
+
+typedef struct
+{
+    char *root;
+    char *filename;
+
+    GMappedFile *mapped;
+    const IndexEntry *entries;
+    const IndexTrigram *trigrams;
+    const guint32 *postings;
+    const char *strings;
+    guint32 n_entries;
+    guint32 n_trigrams;
+
+    GPtrArray *added;     /* DeltaEntry, ids follow the mapped entries */
+    GHashTable *removed;  /* ids */
+    guint n_changes;
+
+    GHashTable *monitors; /* path -> GFileMonitor */
+    GThreadPool *subtree_pool; /* SubtreeRead, one at a time */
+
+    gboolean building;
+    GList *journal;       /* IndexEvent, kept while building */
+} SearchIndex;
+
+typedef struct
+{
+    char **words;
+    GList *mime_types;
+    gint64 timestamp;
+    gint64 size;
+    guint32 location;
+} IndexQuery;
+
+typedef struct IndexSearch IndexSearch;
+
+struct CajaSearchEngineIndexDetails
+{
+    CajaQuery *query;
+    CajaSearchEngine *fallback;
+    guint search_idle_id;
+    IndexSearch *active_search;
+};
+
+G_DEFINE_TYPE (CajaSearchEngineIndex,
+               caja_search_engine_index,
+               CAJA_TYPE_SEARCH_ENGINE);
+
+static CajaSearchEngineClass *parent_class = NULL;
+
+static GList *search_indexes = NULL;
+
+static void search_index_start_build (SearchIndex *index);
+
+static char *
+fold_name (const char *name)
+{
+    char *normalized, *folded;
+
+    normalized = g_utf8_normalize (name, -1, G_NORMALIZE_NFD);
+    if (normalized == NULL)
+    {
+        return g_utf8_strdown (name, -1);
+    }
+    folded = g_utf8_strdown (normalized, -1);
+    g_free (normalized);
+
+    return folded;
+}
+
+static inline guint32
+trigram_at (const char *p)
+{
+    return ((guint32) (guchar) p[0] << 16) |
+           ((guint32) (guchar) p[1] << 8) |
+           (guint32) (guchar) p[2];
+}
+
+/* Writing index files, runs in a thread. */
+
+typedef struct
+{
+    GArray *entries;
+    GString *strings;
+    GHashTable *shared_strings;
+} IndexWriter;
+
+static guint32
+index_writer_add_string (IndexWriter *writer, const char *str)
+{
+    guint32 offset;
+
+    offset = writer->strings->len;
+    g_string_append_len (writer->strings, str, strlen (str) + 1);
+
+    return offset;
+}
+
+static guint32
+index_writer_add_shared_string (IndexWriter *writer, const char *str)
+{
+    gpointer offset;
+
+    if (g_hash_table_lookup_extended (writer->shared_strings, str, NULL, &offset))
+    {
+        return GPOINTER_TO_UINT (offset);
+    }
+
+    offset = GUINT_TO_POINTER (index_writer_add_string (writer, str));
+    g_hash_table_insert (writer->shared_strings, g_strdup (str), offset);
+
+    return GPOINTER_TO_UINT (offset);
+}
+
+static void
+index_writer_add_entry (IndexWriter *writer,
+                        guint32 parent,
+                        const char *name,
+                        GFileInfo *info)
+{
+    IndexEntry entry = { 0 };
+    const char *display_name, *mime_type;
+    char *folded;
+
+    display_name = g_file_info_get_display_name (info);
+    folded = fold_name (display_name != NULL ? display_name : name);
+    mime_type = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE);
+
+    entry.parent = parent;
+    entry.name = index_writer_add_string (writer, name);
+    entry.folded_name = index_writer_add_string (writer, folded);
+    entry.mime_type = index_writer_add_shared_string (writer, mime_type != NULL ? mime_type : "");
+    entry.flags = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY ? INDEX_ENTRY_DIRECTORY : 0;
+    entry.mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    entry.size = g_file_info_get_size (info);
+
+    g_array_append_val (writer->entries, entry);
+    g_free (folded);
+}
+
+/* Reads the tree breadth first, so that the children of each folder
+ * end up next to each other.
+ */
+static gboolean
+index_writer_crawl (IndexWriter *writer, const char *root)
+{
+    GQueue directories = G_QUEUE_INIT;
+    GFileEnumerator *enumerator;
+    GFileInfo *info;
+    GFile *dir, *child;
+    guint32 id, first;
+
+    dir = g_file_new_for_path (root);
+    info = g_file_query_info (dir, INDEX_ATTRIBUTES,
+                              G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+    if (info == NULL || g_file_info_get_file_type (info) != G_FILE_TYPE_DIRECTORY)
+    {
+        if (info != NULL)
+        {
+            g_object_unref (info);
+        }
+        g_object_unref (dir);
+        return FALSE;
+    }
+    index_writer_add_entry (writer, INDEX_NO_ENTRY, root, info);
+    g_object_unref (info);
+
+    g_object_set_data (G_OBJECT (dir), "caja-index-id", GUINT_TO_POINTER (0));
+    g_queue_push_tail (&directories, dir);
+
+    while ((dir = g_queue_pop_head (&directories)) != NULL)
+    {
+        id = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (dir), "caja-index-id"));
+        first = writer->entries->len;
+
+        enumerator = g_file_enumerate_children (dir, INDEX_ATTRIBUTES,
+                                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                                NULL, NULL);
+        while (enumerator != NULL &&
+                (info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL)
+        {
+            /* Like the simple engine, skip hidden files and folders. */
+            if (!g_file_info_get_is_hidden (info))
+            {
+                if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+                {
+                    child = g_file_get_child (dir, g_file_info_get_name (info));
+                    g_object_set_data (G_OBJECT (child), "caja-index-id",
+                                       GUINT_TO_POINTER (writer->entries->len));
+                    g_queue_push_tail (&directories, child);
+                }
+                index_writer_add_entry (writer, id, g_file_info_get_name (info), info);
+            }
+            g_object_unref (info);
+        }
+        if (enumerator != NULL)
+        {
+            g_object_unref (enumerator);
+        }
+
+        g_array_index (writer->entries, IndexEntry, id).first_child = first;
+        g_array_index (writer->entries, IndexEntry, id).n_children = writer->entries->len - first;
+
+        g_object_unref (dir);
+    }
+
+    return TRUE;
+}
+
+static int
+compare_trigrams (gconstpointer a, gconstpointer b)
+{
+    guint32 trigram_a = *(const guint32 *) a;
+    guint32 trigram_b = *(const guint32 *) b;
+
+    return trigram_a < trigram_b ? -1 : trigram_a > trigram_b;
+}
+
+static gboolean
+index_writer_save (IndexWriter *writer, const char *filename, GError **error)
+{
+    GHashTable *postings;
+    GHashTableIter iter;
+    GArray *name_trigrams, *keys, *list;
+    GByteArray *data;
+    IndexHeader header = { { 0 } };
+    IndexTrigram record;
+    gpointer key, value;
+    const char *folded, *p;
+    guint32 i, j, trigram, n_postings;
+    gboolean ok;
+
+    /* Posting lists come out sorted because entries are visited in
+     * order.
+     */
+    postings = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) g_array_unref);
+    name_trigrams = g_array_new (FALSE, FALSE, sizeof (guint32));
+    for (i = 0; i < writer->entries->len; i++)
+    {
+        folded = writer->strings->str + g_array_index (writer->entries, IndexEntry, i).folded_name;
+
+        g_array_set_size (name_trigrams, 0);
+        for (p = folded; p[0] != '\0' && p[1] != '\0' && p[2] != '\0'; p++)
+        {
+            trigram = trigram_at (p);
+            g_array_append_val (name_trigrams, trigram);
+        }
+        g_array_sort (name_trigrams, compare_trigrams);
+
+        for (j = 0; j < name_trigrams->len; j++)
+        {
+            trigram = g_array_index (name_trigrams, guint32, j);
+            if (j > 0 && trigram == g_array_index (name_trigrams, guint32, j - 1))
+            {
+                continue;
+            }
+            list = g_hash_table_lookup (postings, GUINT_TO_POINTER (trigram));
+            if (list == NULL)
+            {
+                list = g_array_new (FALSE, FALSE, sizeof (guint32));
+                g_hash_table_insert (postings, GUINT_TO_POINTER (trigram), list);
+            }
+            g_array_append_val (list, i);
+        }
+    }
+    g_array_free (name_trigrams, TRUE);
+
+    keys = g_array_sized_new (FALSE, FALSE, sizeof (guint32), g_hash_table_size (postings));
+    g_hash_table_iter_init (&iter, postings);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+        trigram = GPOINTER_TO_UINT (key);
+        g_array_append_val (keys, trigram);
+    }
+    g_array_sort (keys, compare_trigrams);
+
+    memcpy (header.magic, INDEX_MAGIC, sizeof (INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.n_entries = writer->entries->len;
+    header.n_trigrams = keys->len;
+    header.strings_size = writer->strings->len;
+    header.created = g_get_real_time () / G_USEC_PER_SEC;
+
+    data = g_byte_array_new ();
+    g_byte_array_append (data, (guint8 *) &header, sizeof (header));
+    g_byte_array_append (data, (guint8 *) writer->entries->data,
+                         writer->entries->len * sizeof (IndexEntry));
+
+    n_postings = 0;
+    for (i = 0; i < keys->len; i++)
+    {
+        record.trigram = g_array_index (keys, guint32, i);
+        record.first = n_postings;
+        record.count = ((GArray *) g_hash_table_lookup (postings, GUINT_TO_POINTER (record.trigram)))->len;
+        n_postings += record.count;
+        g_byte_array_append (data, (guint8 *) &record, sizeof (record));
+    }
+    for (i = 0; i < keys->len; i++)
+    {
+        list = g_hash_table_lookup (postings, GUINT_TO_POINTER (g_array_index (keys, guint32, i)));
+        g_byte_array_append (data, (guint8 *) list->data, list->len * sizeof (guint32));
+    }
+    g_byte_array_append (data, (guint8 *) writer->strings->str, writer->strings->len);
+
+    ((IndexHeader *) data->data)->n_postings = n_postings;
+
+    ok = g_file_set_contents (filename, (const char *) data->data, data->len, error);
+
+    g_byte_array_unref (data);
+    g_array_free (keys, TRUE);
+    g_hash_table_destroy (postings);
+
+    return ok;
+}
+
+typedef struct
+{
+    SearchIndex *index;
+    char *root;
+    char *filename;
+    gboolean ok;
+} IndexBuild;
+
+static gboolean search_index_build_done_idle (gpointer user_data);
+
+static gpointer
+index_build_thread_func (gpointer user_data)
+{
+    IndexBuild *build;
+    IndexWriter writer;
+    GError *error;
+
+    build = user_data;
+
+    writer.entries = g_array_new (FALSE, FALSE, sizeof (IndexEntry));
+    writer.strings = g_string_new (NULL);
+    writer.shared_strings = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    index_writer_add_string (&writer, "");
+
+    error = NULL;
+    build->ok = index_writer_crawl (&writer, build->root) &&
+                index_writer_save (&writer, build->filename, &error);
+    if (error != NULL)
+    {
+        g_warning ("Could not write search index %s: %s", build->filename, error->message);
+        g_error_free (error);
+    }
+
+    g_array_free (writer.entries, TRUE);
+    g_string_free (writer.strings, TRUE);
+    g_hash_table_destroy (writer.shared_strings);
+
+    g_idle_add (search_index_build_done_idle, build);
+
+    return NULL;
+}
+
+/* Reading the mapped index and its delta. */
+
+/* Index files live in the cache directory and can be truncated or
+ * damaged, so every count and offset is checked before anything is
+ * read through it.
+ */
+static gboolean
+search_index_check (const char *contents, gsize length)
+{
+    const IndexHeader *header;
+    const IndexEntry *entries, *entry;
+    const IndexTrigram *trigrams;
+    const guint32 *postings;
+    guint64 needed;
+    guint32 i, j;
+
+    if (length < sizeof (IndexHeader))
+    {
+        return FALSE;
+    }
+
+    header = (const IndexHeader *) contents;
+    if (memcmp (header->magic, INDEX_MAGIC, sizeof (INDEX_MAGIC)) != 0 ||
+            header->version != INDEX_VERSION ||
+            header->n_entries == 0 ||
+            header->strings_size == 0)
+    {
+        return FALSE;
+    }
+
+    needed = sizeof (IndexHeader) +
+             (guint64) header->n_entries * sizeof (IndexEntry) +
+             (guint64) header->n_trigrams * sizeof (IndexTrigram) +
+             (guint64) header->n_postings * sizeof (guint32) +
+             header->strings_size;
+    if (needed != length || contents[length - 1] != '\0')
+    {
+        return FALSE;
+    }
+
+    entries = (const IndexEntry *) (contents + sizeof (IndexHeader));
+    trigrams = (const IndexTrigram *) (entries + header->n_entries);
+    postings = (const guint32 *) (trigrams + header->n_trigrams);
+
+    /* Parents are written before their children, which also keeps
+     * walks up the tree from looping.
+     */
+    for (i = 0; i < header->n_entries; i++)
+    {
+        entry = &entries[i];
+        if ((i == 0) != (entry->parent == INDEX_NO_ENTRY) ||
+                (i != 0 && entry->parent >= i) ||
+                entry->first_child > header->n_entries ||
+                entry->n_children > header->n_entries - entry->first_child ||
+                entry->name >= header->strings_size ||
+                entry->folded_name >= header->strings_size ||
+                entry->mime_type >= header->strings_size)
+        {
+            return FALSE;
+        }
+    }
+
+    for (i = 0; i < header->n_trigrams; i++)
+    {
+        if ((i != 0 && trigrams[i].trigram <= trigrams[i - 1].trigram) ||
+                trigrams[i].first > header->n_postings ||
+                trigrams[i].count > header->n_postings - trigrams[i].first)
+        {
+            return FALSE;
+        }
+
+        for (j = trigrams[i].first; j < trigrams[i].first + trigrams[i].count; j++)
+        {
+            if (postings[j] >= header->n_entries ||
+                    (j != trigrams[i].first && postings[j] <= postings[j - 1]))
+            {
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+/* Returns FALSE when the file is missing or fails the checks; callers
+ * rebuild it then.
+ */
+static gboolean
+search_index_map (SearchIndex *index)
+{
+    GMappedFile *mapped;
+    const IndexHeader *header;
+    const char *contents;
+
+    mapped = g_mapped_file_new (index->filename, FALSE, NULL);
+    if (mapped == NULL)
+    {
+        return FALSE;
+    }
+
+    contents = g_mapped_file_get_contents (mapped);
+    if (!search_index_check (contents, g_mapped_file_get_length (mapped)))
+    {
+        g_mapped_file_unref (mapped);
+        return FALSE;
+    }
+    header = (const IndexHeader *) contents;
+
+    if (index->mapped != NULL)
+    {
+        g_mapped_file_unref (index->mapped);
+    }
+    index->mapped = mapped;
+    index->n_entries = header->n_entries;
+    index->n_trigrams = header->n_trigrams;
+    index->entries = (const IndexEntry *) (contents + sizeof (IndexHeader));
+    index->trigrams = (const IndexTrigram *) (index->entries + header->n_entries);
+    index->postings = (const guint32 *) (index->trigrams + header->n_trigrams);
+    index->strings = (const char *) (index->postings + header->n_postings);
+
+    return TRUE;
+}
+
+static gboolean
+search_index_is_ready (SearchIndex *index)
+{
+    return index->mapped != NULL;
+}
+
+static guint32
+search_index_get_n_entries (SearchIndex *index)
+{
+    return index->n_entries + index->added->len;
+}
+
+static const IndexEntry *
+search_index_get_entry (SearchIndex *index, guint32 id)
+{
+    if (id < index->n_entries)
+    {
+        return &index->entries[id];
+    }
+
+    return &((DeltaEntry *) g_ptr_array_index (index->added, id - index->n_entries))->entry;
+}
+
+static const char *
+search_index_get_name (SearchIndex *index, guint32 id)
+{
+    if (id < index->n_entries)
+    {
+        return index->strings + index->entries[id].name;
+    }
+
+    return ((DeltaEntry *) g_ptr_array_index (index->added, id - index->n_entries))->name;
+}
+
+static const char *
+search_index_get_folded_name (SearchIndex *index, guint32 id)
+{
+    if (id < index->n_entries)
+    {
+        return index->strings + index->entries[id].folded_name;
+    }
+
+    return ((DeltaEntry *) g_ptr_array_index (index->added, id - index->n_entries))->folded_name;
+}
+
+static const char *
+search_index_get_mime_type (SearchIndex *index, guint32 id)
+{
+    if (id < index->n_entries)
+    {
+        return index->strings + index->entries[id].mime_type;
+    }
+
+    return ((DeltaEntry *) g_ptr_array_index (index->added, id - index->n_entries))->mime_type;
+}
+
+static char *
+search_index_get_path (SearchIndex *index, guint32 id)
+{
+    GPtrArray *names;
+    GString *path;
+    int i;
+
+    names = g_ptr_array_new ();
+    while (id != 0)
+    {
+        g_ptr_array_add (names, (gpointer) search_index_get_name (index, id));
+        id = search_index_get_entry (index, id)->parent;
+    }
+
+    path = g_string_new (index->root);
+    for (i = names->len - 1; i >= 0; i--)
+    {
+        if (path->len == 0 || path->str[path->len - 1] != G_DIR_SEPARATOR)
+        {
+            g_string_append_c (path, G_DIR_SEPARATOR);
+        }
+        g_string_append (path, g_ptr_array_index (names, i));
+    }
+    g_ptr_array_free (names, TRUE);
+
+    return g_string_free (path, FALSE);
+}
+
+static guint32
+search_index_find_child (SearchIndex *index, guint32 parent, const char *name)
+{
+    const IndexEntry *entry;
+    DeltaEntry *delta;
+    guint32 i, id;
+
+    if (parent < index->n_entries)
+    {
+        entry = &index->entries[parent];
+        for (i = 0; i < entry->n_children; i++)
+        {
+            id = entry->first_child + i;
+            if (strcmp (index->strings + index->entries[id].name, name) == 0 &&
+                    !g_hash_table_contains (index->removed, GUINT_TO_POINTER (id)))
+            {
+                return id;
+            }
+        }
+    }
+
+    for (i = 0; i < index->added->len; i++)
+    {
+        delta = g_ptr_array_index (index->added, i);
+        id = index->n_entries + i;
+        if (delta->entry.parent == parent &&
+                strcmp (delta->name, name) == 0 &&
+                !g_hash_table_contains (index->removed, GUINT_TO_POINTER (id)))
+        {
+            return id;
+        }
+    }
+
+    return INDEX_NO_ENTRY;
+}
+
+static guint32
+search_index_lookup_path (SearchIndex *index, const char *path)
+{
+    char **components;
+    guint32 id;
+    int i;
+
+    if (strcmp (path, index->root) == 0)
+    {
+        return 0;
+    }
+    if (!g_str_has_prefix (path, index->root) ||
+            (path[strlen (index->root)] != G_DIR_SEPARATOR &&
+             index->root[strlen (index->root) - 1] != G_DIR_SEPARATOR))
+    {
+        return INDEX_NO_ENTRY;
+    }
+
+    components = g_strsplit (path + strlen (index->root), G_DIR_SEPARATOR_S, -1);
+    id = 0;
+    for (i = 0; components[i] != NULL && id != INDEX_NO_ENTRY; i++)
+    {
+        if (components[i][0] != '\0')
+        {
+            id = search_index_find_child (index, id, components[i]);
+        }
+    }
+    g_strfreev (components);
+
+    return id;
+}
+
+/* An entry is gone when it or any of its ancestors was removed. */
+static gboolean
+search_index_entry_is_in (SearchIndex *index, guint32 id, guint32 location)
+{
+    gboolean inside;
+
+    if (id == location)
+    {
+        return FALSE;
+    }
+
+    inside = location == 0;
+    while (id != INDEX_NO_ENTRY)
+    {
+        if (g_hash_table_contains (index->removed, GUINT_TO_POINTER (id)))
+        {
+            return FALSE;
+        }
+        if (id == location)
+        {
+            inside = TRUE;
+        }
+        id = search_index_get_entry (index, id)->parent;
+    }
+
+    return inside;
+}
+
+/* Keeping the index up to date. */
+
+static void
+index_event_free (IndexEvent *event)
+{
+    g_object_unref (event->file);
+    g_free (event);
+}
+
+static void
+delta_entry_free (DeltaEntry *delta)
+{
+    g_free (delta->name);
+    g_free (delta->folded_name);
+    g_free (delta);
+}
+
+static void
+monitor_free (GFileMonitor *monitor)
+{
+    g_file_monitor_cancel (monitor);
+    g_object_unref (monitor);
+}
+
+static void
+search_index_note_change (SearchIndex *index)
+{
+    index->n_changes++;
+    if (index->n_changes > INDEX_MAX_DELTA_CHANGES)
+    {
+        search_index_start_build (index);
+    }
+}
+
+static void
+search_index_remove_file (SearchIndex *index, GFile *file)
+{
+    GHashTableIter iter;
+    gpointer key;
+    char *path;
+    guint32 id;
+    gsize len;
+
+    path = g_file_get_path (file);
+    if (path == NULL)
+    {
+        return;
+    }
+
+    id = search_index_lookup_path (index, path);
+    if (id != INDEX_NO_ENTRY && id != 0)
+    {
+        g_hash_table_add (index->removed, GUINT_TO_POINTER (id));
+        search_index_note_change (index);
+    }
+
+    len = strlen (path);
+    g_hash_table_iter_init (&iter, index->monitors);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        if (g_str_has_prefix (key, path) &&
+                (((char *) key)[len] == '\0' || ((char *) key)[len] == G_DIR_SEPARATOR))
+        {
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+
+    g_free (path);
+}
+
+static void search_index_monitor_changed (GFileMonitor *monitor,
+        GFile *child,
+        GFile *other_file,
+        GFileMonitorEvent event_type,
+        gpointer user_data);
+
+static void
+search_index_monitor_directory (SearchIndex *index, const char *path)
+{
+    GFileMonitor *monitor;
+    GFile *file;
+
+    if (g_hash_table_size (index->monitors) >= INDEX_MAX_MONITORS ||
+            g_hash_table_contains (index->monitors, path))
+    {
+        return;
+    }
+
+    file = g_file_new_for_path (path);
+    monitor = g_file_monitor_directory (file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+    g_object_unref (file);
+    if (monitor == NULL)
+    {
+        return;
+    }
+
+    g_signal_connect (monitor, "changed",
+                      G_CALLBACK (search_index_monitor_changed), index);
+    g_hash_table_insert (index->monitors, g_strdup (path), monitor);
+}
+
+static guint32
+search_index_add_delta (SearchIndex *index, guint32 parent, GFileInfo *info)
+{
+    DeltaEntry *delta;
+    const char *display_name, *mime_type;
+
+    display_name = g_file_info_get_display_name (info);
+    mime_type = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE);
+
+    delta = g_new0 (DeltaEntry, 1);
+    delta->name = g_strdup (g_file_info_get_name (info));
+    delta->folded_name = fold_name (display_name != NULL ? display_name : delta->name);
+    delta->mime_type = g_intern_string (mime_type != NULL ? mime_type : "");
+    delta->entry.parent = parent;
+    delta->entry.flags = g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY ? INDEX_ENTRY_DIRECTORY : 0;
+    delta->entry.mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    delta->entry.size = g_file_info_get_size (info);
+
+    g_ptr_array_add (index->added, delta);
+    search_index_note_change (index);
+
+    return index->n_entries + index->added->len - 1;
+}
+
+/* Folders that appear inside the index, for example by being moved
+ * there, are read in a thread and added to the delta afterwards.
+ */
+
+typedef struct
+{
+    int parent;           /* record index, -1 for the folder itself */
+    GFileInfo *info;
+    char *path;           /* folders only */
+} SubtreeRecord;
+
+typedef struct
+{
+    SearchIndex *index;
+    GFile *dir;
+    GArray *records;      /* SubtreeRecord, parents first */
+    gboolean complete;
+} SubtreeRead;
+
+static gboolean search_index_subtree_read_done_idle (gpointer user_data);
+
+/* Returns FALSE when the folder was too large to read. */
+static gboolean
+subtree_read_crawl (SubtreeRead *read, GFile *dir, int parent, guint *budget)
+{
+    GFileEnumerator *enumerator;
+    GFileInfo *info;
+    GFile *child;
+    SubtreeRecord record;
+    gboolean complete;
+
+    enumerator = g_file_enumerate_children (dir, INDEX_ATTRIBUTES,
+                                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                            NULL, NULL);
+    if (enumerator == NULL)
+    {
+        return TRUE;
+    }
+
+    complete = TRUE;
+    while (complete && (info = g_file_enumerator_next_file (enumerator, NULL, NULL)) != NULL)
+    {
+        if (g_file_info_get_is_hidden (info))
+        {
+            g_object_unref (info);
+        }
+        else if (*budget == 0)
+        {
+            g_object_unref (info);
+            complete = FALSE;
+        }
+        else
+        {
+            (*budget)--;
+            record.parent = parent;
+            record.info = info;
+            record.path = NULL;
+            if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+            {
+                child = g_file_get_child (dir, g_file_info_get_name (info));
+                record.path = g_file_get_path (child);
+                g_array_append_val (read->records, record);
+                complete = subtree_read_crawl (read, child, read->records->len - 1, budget);
+                g_object_unref (child);
+            }
+            else
+            {
+                g_array_append_val (read->records, record);
+            }
+        }
+    }
+    g_object_unref (enumerator);
+
+    return complete;
+}
+
+static void
+subtree_read_thread_func (gpointer data, gpointer user_data)
+{
+    SubtreeRead *read;
+    guint budget;
+
+    read = data;
+    budget = INDEX_MAX_SYNC_ENTRIES;
+    read->complete = subtree_read_crawl (read, read->dir, -1, &budget);
+
+    g_idle_add (search_index_subtree_read_done_idle, read);
+}
+
+static void
+search_index_read_subtree (SearchIndex *index, GFile *dir)
+{
+    SubtreeRead *read;
+
+    read = g_new0 (SubtreeRead, 1);
+    read->index = index;
+    read->dir = g_object_ref (dir);
+    read->records = g_array_new (FALSE, FALSE, sizeof (SubtreeRecord));
+
+    g_thread_pool_push (index->subtree_pool, read, NULL);
+}
+
+static gboolean
+search_index_subtree_read_done_idle (gpointer user_data)
+{
+    SubtreeRead *read;
+    SearchIndex *index;
+    SubtreeRecord *record;
+    DeltaEntry *delta;
+    GHashTable *known;
+    guint32 *ids, dir_id, parent, id;
+    char *path;
+    guint i;
+
+    read = user_data;
+    index = read->index;
+
+    /* The folder may have gone away or been covered by a rebuild in
+     * the meantime; ids are looked up again for that reason.
+     */
+    path = g_file_get_path (read->dir);
+    dir_id = path != NULL ? search_index_lookup_path (index, path) : INDEX_NO_ENTRY;
+    g_free (path);
+
+    if (dir_id != INDEX_NO_ENTRY && dir_id >= index->n_entries)
+    {
+        /* Children the monitor reported while the thread was reading
+         * are in the delta already.
+         */
+        known = g_hash_table_new (g_str_hash, g_str_equal);
+        for (i = 0; i < index->added->len; i++)
+        {
+            delta = g_ptr_array_index (index->added, i);
+            if (delta->entry.parent == dir_id &&
+                    !g_hash_table_contains (index->removed, GUINT_TO_POINTER (index->n_entries + i)))
+            {
+                g_hash_table_add (known, delta->name);
+            }
+        }
+
+        ids = g_new (guint32, read->records->len);
+        for (i = 0; i < read->records->len; i++)
+        {
+            record = &g_array_index (read->records, SubtreeRecord, i);
+            parent = record->parent < 0 ? dir_id : ids[record->parent];
+            id = INDEX_NO_ENTRY;
+            if (parent != INDEX_NO_ENTRY &&
+                    (record->parent >= 0 ||
+                     !g_hash_table_contains (known, g_file_info_get_name (record->info))))
+            {
+                id = search_index_add_delta (index, parent, record->info);
+                if (record->path != NULL)
+                {
+                    search_index_monitor_directory (index, record->path);
+                }
+            }
+            ids[i] = id;
+        }
+        g_free (ids);
+        g_hash_table_destroy (known);
+
+        if (!read->complete)
+        {
+            search_index_start_build (index);
+        }
+    }
+
+    for (i = 0; i < read->records->len; i++)
+    {
+        record = &g_array_index (read->records, SubtreeRecord, i);
+        g_object_unref (record->info);
+        g_free (record->path);
+    }
+    g_array_free (read->records, TRUE);
+    g_object_unref (read->dir);
+    g_free (read);
+
+    return FALSE;
+}
+
+static void
+search_index_add_file (SearchIndex *index, GFile *file)
+{
+    GFileInfo *info;
+    GFile *parent_file;
+    char *path, *parent_path, *name;
+    guint32 parent, existing;
+
+    path = g_file_get_path (file);
+    parent_file = g_file_get_parent (file);
+    if (path == NULL || parent_file == NULL)
+    {
+        g_free (path);
+        if (parent_file != NULL)
+        {
+            g_object_unref (parent_file);
+        }
+        return;
+    }
+    parent_path = g_file_get_path (parent_file);
+    g_object_unref (parent_file);
+
+    parent = parent_path != NULL ? search_index_lookup_path (index, parent_path) : INDEX_NO_ENTRY;
+    g_free (parent_path);
+
+    info = NULL;
+    if (parent != INDEX_NO_ENTRY)
+    {
+        info = g_file_query_info (file, INDEX_ATTRIBUTES,
+                                  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, NULL);
+    }
+    if (info == NULL || g_file_info_get_is_hidden (info))
+    {
+        if (info != NULL)
+        {
+            g_object_unref (info);
+        }
+        g_free (path);
+        return;
+    }
+
+    name = g_file_get_basename (file);
+    existing = search_index_find_child (index, parent, name);
+    g_free (name);
+
+    if (existing != INDEX_NO_ENTRY &&
+            (search_index_get_entry (index, existing)->flags & INDEX_ENTRY_DIRECTORY) != 0 &&
+            g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+    {
+        /* Already known folder; replacing it would drop its children. */
+        g_object_unref (info);
+        g_free (path);
+        return;
+    }
+
+    if (existing != INDEX_NO_ENTRY)
+    {
+        g_hash_table_add (index->removed, GUINT_TO_POINTER (existing));
+    }
+
+    search_index_add_delta (index, parent, info);
+    if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+    {
+        search_index_monitor_directory (index, path);
+        search_index_read_subtree (index, file);
+    }
+
+    g_object_unref (info);
+    g_free (path);
+}
+
+static void
+search_index_apply (SearchIndex *index, IndexEventType type, GFile *file)
+{
+    IndexEvent *event;
+
+    if (index->building)
+    {
+        event = g_new (IndexEvent, 1);
+        event->type = type;
+        event->file = g_object_ref (file);
+        index->journal = g_list_prepend (index->journal, event);
+    }
+
+    if (type == INDEX_EVENT_ADD)
+    {
+        search_index_add_file (index, file);
+    }
+    else
+    {
+        search_index_remove_file (index, file);
+    }
+}
+
+static void
+search_index_monitor_changed (GFileMonitor *monitor,
+                              GFile *child,
+                              GFile *other_file,
+                              GFileMonitorEvent event_type,
+                              gpointer user_data)
+{
+    SearchIndex *index;
+
+    index = user_data;
+
+    switch (event_type)
+    {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        search_index_apply (index, INDEX_EVENT_ADD, child);
+        break;
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+        search_index_apply (index, INDEX_EVENT_REMOVE, child);
+        break;
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        search_index_apply (index, INDEX_EVENT_REMOVE, child);
+        if (other_file != NULL)
+        {
+            search_index_apply (index, INDEX_EVENT_ADD, other_file);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+search_index_monitor_all (SearchIndex *index)
+{
+    guint32 id;
+    char *path;
+
+    for (id = 0;
+            id < index->n_entries && g_hash_table_size (index->monitors) < INDEX_MAX_MONITORS;
+            id++)
+    {
+        if ((index->entries[id].flags & INDEX_ENTRY_DIRECTORY) != 0)
+        {
+            path = search_index_get_path (index, id);
+            search_index_monitor_directory (index, path);
+            g_free (path);
+        }
+    }
+}
+
+static void
+search_index_start_build (SearchIndex *index)
+{
+    IndexBuild *build;
+    GThread *thread;
+
+    if (index->building)
+    {
+        return;
+    }
+    index->building = TRUE;
+
+    build = g_new0 (IndexBuild, 1);
+    build->index = index;
+    build->root = g_strdup (index->root);
+    build->filename = g_strdup (index->filename);
+
+    thread = g_thread_new ("caja-search-index", index_build_thread_func, build);
+    g_thread_unref (thread);
+}
+
+static gboolean
+search_index_build_done_idle (gpointer user_data)
+{
+    IndexBuild *build;
+    SearchIndex *index;
+    GList *journal, *l;
+    IndexEvent *event;
+
+    build = user_data;
+    index = build->index;
+
+    index->building = FALSE;
+    journal = g_list_reverse (index->journal);
+    index->journal = NULL;
+
+    if (build->ok && search_index_map (index))
+    {
+        /* Start over from the new file and replay what changed while
+         * it was being written; applying events twice is harmless.
+         */
+        g_ptr_array_set_size (index->added, 0);
+        g_hash_table_remove_all (index->removed);
+        g_hash_table_remove_all (index->monitors);
+        index->n_changes = 0;
+
+        search_index_monitor_all (index);
+        for (l = journal; l != NULL; l = l->next)
+        {
+            event = l->data;
+            search_index_apply (index, event->type, event->file);
+        }
+    }
+
+    g_list_free_full (journal, (GDestroyNotify) index_event_free);
+    g_free (build->root);
+    g_free (build->filename);
+    g_free (build);
+
+    return FALSE;
+}
+
+static SearchIndex *
+search_index_new (const char *root)
+{
+    SearchIndex *index;
+    GStatBuf statbuf;
+    char *dir, *checksum, *basename;
+
+    index = g_new0 (SearchIndex, 1);
+    index->root = g_strdup (root);
+
+    dir = g_build_filename (g_get_user_cache_dir (), "caja", "search-index", NULL);
+    g_mkdir_with_parents (dir, 0700);
+    checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, root, -1);
+    basename = g_strconcat (checksum, ".idx", NULL);
+    index->filename = g_build_filename (dir, basename, NULL);
+    g_free (basename);
+    g_free (checksum);
+    g_free (dir);
+
+    index->added = g_ptr_array_new_with_free_func ((GDestroyNotify) delta_entry_free);
+    index->removed = g_hash_table_new (NULL, NULL);
+    index->monitors = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, (GDestroyNotify) monitor_free);
+    index->subtree_pool = g_thread_pool_new (subtree_read_thread_func, NULL,
+                                             1, FALSE, NULL);
+
+    if (search_index_map (index))
+    {
+        search_index_monitor_all (index);
+    }
+
+    /* Changes made while Caja was not running are not seen by the
+     * monitors, so refresh old index files; damaged ones were not
+     * mapped and get rebuilt too.
+     */
+    if (!search_index_is_ready (index) ||
+            g_stat (index->filename, &statbuf) != 0 ||
+            statbuf.st_mtime + INDEX_REBUILD_AGE_SECONDS < g_get_real_time () / G_USEC_PER_SEC)
+    {
+        search_index_start_build (index);
+    }
+
+    return index;
+}
+
+static char *
+expand_index_location (const char *location)
+{
+    char *path, *canonical;
+
+    if (location[0] == '~')
+    {
+        path = g_build_filename (g_get_home_dir (), location + 1, NULL);
+    }
+    else
+    {
+        path = g_strdup (location);
+    }
+    if (!g_path_is_absolute (path))
+    {
+        g_free (path);
+        return NULL;
+    }
+
+    canonical = g_canonicalize_filename (path, NULL);
+    g_free (path);
+
+    return canonical;
+}
+
+/* Index files are kept for the life of the process; the preference is
+ * read the first time a search engine is created.
+ */
+static gboolean
+ensure_search_indexes (void)
+{
+    static gboolean initialized = FALSE;
+    char **locations, *root;
+    int i;
+
+    if (initialized)
+    {
+        return search_indexes != NULL;
+    }
+    initialized = TRUE;
+
+    locations = g_settings_get_strv (caja_preferences, CAJA_PREFERENCES_SEARCH_INDEX_LOCATIONS);
+    for (i = 0; locations[i] != NULL; i++)
+    {
+        root = expand_index_location (locations[i]);
+        if (root != NULL)
+        {
+            search_indexes = g_list_append (search_indexes, search_index_new (root));
+            g_free (root);
+        }
+    }
+    g_strfreev (locations);
+
+    return search_indexes != NULL;
+}
+
+/* Answering queries. */
+
+static gboolean
+search_index_entry_matches (SearchIndex *index, guint32 id, IndexQuery *query)
+{
+    const IndexEntry *entry;
+    const char *folded, *mime_type;
+    GList *l;
+    gboolean hit;
+    int i;
+
+    folded = search_index_get_folded_name (index, id);
+    for (i = 0; query->words[i] != NULL; i++)
+    {
+        if (strstr (folded, query->words[i]) == NULL)
+        {
+            return FALSE;
+        }
+    }
+
+    entry = search_index_get_entry (index, id);
+
+    if (query->mime_types != NULL)
+    {
+        mime_type = search_index_get_mime_type (index, id);
+        hit = FALSE;
+        for (l = query->mime_types; l != NULL; l = l->next)
+        {
+            if (g_content_type_equals (mime_type, l->data))
+            {
+                hit = TRUE;
+                break;
+            }
+        }
+        if (!hit)
+        {
+            return FALSE;
+        }
+    }
+
+    if (query->timestamp > 0 && query->timestamp < entry->mtime)
+    {
+        return FALSE;
+    }
+    if (query->timestamp < 0 && entry->mtime < ABS (query->timestamp))
+    {
+        return FALSE;
+    }
+
+    if (query->size > 0 && entry->size < query->size)
+    {
+        return FALSE;
+    }
+    if (query->size < 0 && ABS (query->size) < entry->size)
+    {
+        return FALSE;
+    }
+
+    return search_index_entry_is_in (index, id, query->location);
+}
+
+static const IndexTrigram *
+search_index_find_trigram (SearchIndex *index, guint32 trigram)
+{
+    guint32 low, high, mid;
+
+    low = 0;
+    high = index->n_trigrams;
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (index->trigrams[mid].trigram < trigram)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    if (low < index->n_trigrams && index->trigrams[low].trigram == trigram)
+    {
+        return &index->trigrams[low];
+    }
+
+    return NULL;
+}
+
+static int
+compare_trigram_counts (gconstpointer a, gconstpointer b)
+{
+    const IndexTrigram *trigram_a = *(const IndexTrigram * const *) a;
+    const IndexTrigram *trigram_b = *(const IndexTrigram * const *) b;
+
+    return trigram_a->count < trigram_b->count ? -1 : trigram_a->count > trigram_b->count;
+}
+
+/* Returns the sorted ids of mapped entries whose names contain every
+ * trigram of @word, or NULL if @word is too short to narrow things
+ * down.
+ */
+static GArray *
+search_index_get_candidates (SearchIndex *index, const char *word)
+{
+    GPtrArray *lists;
+    const IndexTrigram *trigram, *list;
+    GArray *candidates;
+    const char *p;
+    guint32 i, j, k, n, id;
+
+    if (strlen (word) < 3)
+    {
+        return NULL;
+    }
+
+    candidates = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+    lists = g_ptr_array_new ();
+    for (p = word; p[2] != '\0'; p++)
+    {
+        trigram = search_index_find_trigram (index, trigram_at (p));
+        if (trigram == NULL)
+        {
+            g_ptr_array_free (lists, TRUE);
+            return candidates;
+        }
+        g_ptr_array_add (lists, (gpointer) trigram);
+    }
+
+    /* Start from the rarest trigram and intersect the rest into it. */
+    g_ptr_array_sort (lists, compare_trigram_counts);
+    list = g_ptr_array_index (lists, 0);
+    g_array_append_vals (candidates, index->postings + list->first, list->count);
+
+    for (i = 1; i < lists->len && candidates->len > 0; i++)
+    {
+        list = g_ptr_array_index (lists, i);
+        n = 0;
+        k = 0;
+        for (j = 0; j < candidates->len; j++)
+        {
+            id = g_array_index (candidates, guint32, j);
+            while (k < list->count && index->postings[list->first + k] < id)
+            {
+                k++;
+            }
+            if (k < list->count && index->postings[list->first + k] == id)
+            {
+                g_array_index (candidates, guint32, n++) = id;
+            }
+        }
+        g_array_set_size (candidates, n);
+    }
+    g_ptr_array_free (lists, TRUE);
+
+    return candidates;
+}
+
+static GList *
+search_index_run_query (SearchIndex *index, IndexQuery *query)
+{
+    GArray *candidates;
+    const char *longest;
+    GList *hits;
+    char *path;
+    guint32 i, id;
+    int w;
+
+    longest = "";
+    for (w = 0; query->words[w] != NULL; w++)
+    {
+        if (strlen (query->words[w]) > strlen (longest))
+        {
+            longest = query->words[w];
+        }
+    }
+
+    hits = NULL;
+    candidates = search_index_get_candidates (index, longest);
+    if (candidates != NULL)
+    {
+        for (i = 0; i < candidates->len; i++)
+        {
+            id = g_array_index (candidates, guint32, i);
+            if (search_index_entry_matches (index, id, query))
+            {
+                path = search_index_get_path (index, id);
+                hits = g_list_prepend (hits, g_filename_to_uri (path, NULL, NULL));
+                g_free (path);
+            }
+        }
+        g_array_free (candidates, TRUE);
+    }
+
+    /* Without candidates from the trigrams, check every mapped entry,
+     * and always check the delta.
+     */
+    for (id = candidates != NULL ? index->n_entries : 0;
+            id < search_index_get_n_entries (index);
+            id++)
+    {
+        if (search_index_entry_matches (index, id, query))
+        {
+            path = search_index_get_path (index, id);
+            hits = g_list_prepend (hits, g_filename_to_uri (path, NULL, NULL));
+            g_free (path);
+        }
+    }
+
+    return g_list_reverse (hits);
+}
+
+/* Queries run in a thread on a copy of the index; the mapped file is
+ * shared, the delta is small enough to copy.
+ */
+static SearchIndex *
+search_index_snapshot (SearchIndex *index)
+{
+    SearchIndex *snapshot;
+    DeltaEntry *delta, *copy;
+    GHashTableIter iter;
+    gpointer key;
+    guint i;
+
+    snapshot = g_new0 (SearchIndex, 1);
+    snapshot->root = g_strdup (index->root);
+    snapshot->mapped = g_mapped_file_ref (index->mapped);
+    snapshot->entries = index->entries;
+    snapshot->trigrams = index->trigrams;
+    snapshot->postings = index->postings;
+    snapshot->strings = index->strings;
+    snapshot->n_entries = index->n_entries;
+    snapshot->n_trigrams = index->n_trigrams;
+
+    snapshot->added = g_ptr_array_new_full (index->added->len, (GDestroyNotify) delta_entry_free);
+    for (i = 0; i < index->added->len; i++)
+    {
+        delta = g_ptr_array_index (index->added, i);
+        copy = g_new (DeltaEntry, 1);
+        copy->entry = delta->entry;
+        copy->name = g_strdup (delta->name);
+        copy->folded_name = g_strdup (delta->folded_name);
+        copy->mime_type = delta->mime_type;
+        g_ptr_array_add (snapshot->added, copy);
+    }
+
+    snapshot->removed = g_hash_table_new (NULL, NULL);
+    g_hash_table_iter_init (&iter, index->removed);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+        g_hash_table_add (snapshot->removed, key);
+    }
+
+    return snapshot;
+}
+
+static void
+search_index_snapshot_free (SearchIndex *snapshot)
+{
+    g_free (snapshot->root);
+    g_mapped_file_unref (snapshot->mapped);
+    g_ptr_array_free (snapshot->added, TRUE);
+    g_hash_table_destroy (snapshot->removed);
+    g_free (snapshot);
+}
+
+/* Returns the ready index that can answer @query, if any. */
+static SearchIndex *
+search_index_for_query (CajaQuery *query, guint32 *location_id)
+{
+    GList *l, *tags;
+    GFile *location;
+    char *uri, *text, *path;
+    SearchIndex *index;
+
+    text = caja_query_get_contained_text (query);
+    tags = caja_query_get_tags (query);
+    if ((text != NULL && text[0] != '\0') || tags != NULL)
+    {
+        g_free (text);
+        g_list_free_full (tags, g_free);
+        return NULL;
+    }
+    g_free (text);
+
+    uri = caja_query_get_location (query);
+    location = uri != NULL ? g_file_new_for_uri (uri) : g_file_new_for_path ("/");
+    path = g_file_get_path (location);
+    g_object_unref (location);
+    g_free (uri);
+
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    index = NULL;
+    for (l = search_indexes; l != NULL && index == NULL; l = l->next)
+    {
+        if (search_index_is_ready (l->data))
+        {
+            *location_id = search_index_lookup_path (l->data, path);
+            if (*location_id != INDEX_NO_ENTRY)
+            {
+                index = l->data;
+            }
+        }
+    }
+    g_free (path);
+
+    return index;
+}
+
+static void
+finalize (GObject *object)
+{
+    CajaSearchEngineIndex *engine;
+
+    engine = CAJA_SEARCH_ENGINE_INDEX (object);
+
+    if (engine->details->search_idle_id != 0)
+    {
+        g_source_remove (engine->details->search_idle_id);
+    }
+
+    if (engine->details->fallback)
+    {
+        g_signal_handlers_disconnect_by_data (engine->details->fallback, engine);
+        g_object_unref (engine->details->fallback);
+    }
+
+    if (engine->details->query)
+    {
+        g_object_unref (engine->details->query);
+        engine->details->query = NULL;
+    }
+
+    g_free (engine->details);
+
+    EEL_CALL_PARENT (G_OBJECT_CLASS, finalize, (object));
+}
+
+struct IndexSearch
+{
+    CajaSearchEngineIndex *engine;
+    GCancellable *cancellable;
+    SearchIndex *snapshot;
+    IndexQuery query;
+    GList *hits;
+};
+
+static void
+index_search_free (IndexSearch *search)
+{
+    g_object_unref (search->engine);
+    g_object_unref (search->cancellable);
+    search_index_snapshot_free (search->snapshot);
+    g_strfreev (search->query.words);
+    g_list_free_full (search->query.mime_types, g_free);
+    g_list_free_full (search->hits, g_free);
+    g_free (search);
+}
+
+static gboolean
+search_done_idle (gpointer user_data)
+{
+    IndexSearch *search;
+    CajaSearchEngineIndex *engine;
+    GList *batch, *l;
+    int n;
+
+    search = user_data;
+    engine = search->engine;
+
+    if (g_cancellable_is_cancelled (search->cancellable))
+    {
+        index_search_free (search);
+        return FALSE;
+    }
+    engine->details->active_search = NULL;
+
+    /* Hand the hits over in batches, like the simple engine does. */
+    l = search->hits;
+    while (l != NULL)
+    {
+        batch = l;
+        for (n = 1; n < BATCH_SIZE && l->next != NULL; n++)
+        {
+            l = l->next;
+        }
+        if (l->next != NULL)
+        {
+            l->next->prev = NULL;
+        }
+        search->hits = l->next;
+        l->next = NULL;
+
+        caja_search_engine_hits_added (CAJA_SEARCH_ENGINE (engine), batch);
+        g_list_free_full (batch, g_free);
+
+        l = search->hits;
+    }
+
+    caja_search_engine_finished (CAJA_SEARCH_ENGINE (engine));
+
+    index_search_free (search);
+
+    return FALSE;
+}
+
+/* Short words and queries without text check every entry, so the
+ * matching is kept off the main loop.
+ */
+static gpointer
+search_thread_func (gpointer user_data)
+{
+    IndexSearch *search;
+
+    search = user_data;
+    search->hits = search_index_run_query (search->snapshot, &search->query);
+
+    g_idle_add (search_done_idle, search);
+
+    return NULL;
+}
+
+static gboolean
+search_idle (gpointer user_data)
+{
+    CajaSearchEngineIndex *engine;
+    SearchIndex *index;
+    IndexSearch *search;
+    GThread *thread;
+    guint32 location;
+    char *text, *folded;
+
+    engine = CAJA_SEARCH_ENGINE_INDEX (user_data);
+    engine->details->search_idle_id = 0;
+
+    index = search_index_for_query (engine->details->query, &location);
+    if (index == NULL)
+    {
+        caja_search_engine_finished (CAJA_SEARCH_ENGINE (engine));
+        return FALSE;
+    }
+
+    search = g_new0 (IndexSearch, 1);
+    search->engine = g_object_ref (engine);
+    search->cancellable = g_cancellable_new ();
+    search->snapshot = search_index_snapshot (index);
+
+    text = caja_query_get_text (engine->details->query);
+    folded = fold_name (text != NULL ? text : "");
+    search->query.words = g_strsplit (folded, " ", -1);
+    search->query.mime_types = caja_query_get_mime_types (engine->details->query);
+    search->query.timestamp = caja_query_get_timestamp (engine->details->query);
+    search->query.size = caja_query_get_size (engine->details->query);
+    search->query.location = location;
+    g_free (folded);
+    g_free (text);
+
+    engine->details->active_search = search;
+
+    thread = g_thread_new ("caja-search-index", search_thread_func, search);
+    g_thread_unref (thread);
+
+    return FALSE;
+}
+
+static void
+fallback_hits_added (CajaSearchEngine *fallback, GList *hits, CajaSearchEngine *engine)
+{
+    caja_search_engine_hits_added (engine, hits);
+}
+
+static void
+fallback_hits_subtracted (CajaSearchEngine *fallback, GList *hits, CajaSearchEngine *engine)
+{
+    caja_search_engine_hits_subtracted (engine, hits);
+}
+
+static void
+fallback_finished (CajaSearchEngine *fallback, CajaSearchEngine *engine)
+{
+    caja_search_engine_finished (engine);
+}
+
+static void
+fallback_error (CajaSearchEngine *fallback, const char *error_message, CajaSearchEngine *engine)
+{
+    caja_search_engine_error (engine, error_message);
+}
+
+static void
+caja_search_engine_index_start (CajaSearchEngine *engine)
+{
+    CajaSearchEngineIndex *index_engine;
+    guint32 location;
+
+    index_engine = CAJA_SEARCH_ENGINE_INDEX (engine);
+
+    if (index_engine->details->query == NULL ||
+            index_engine->details->search_idle_id != 0 ||
+            index_engine->details->active_search != NULL)
+    {
+        return;
+    }
+
+    if (search_index_for_query (index_engine->details->query, &location) != NULL)
+    {
+        index_engine->details->search_idle_id = g_idle_add (search_idle, engine);
+        return;
+    }
+
+    if (index_engine->details->fallback == NULL)
+    {
+        index_engine->details->fallback = caja_search_engine_simple_new ();
+        g_signal_connect (index_engine->details->fallback, "hits-added",
+                          G_CALLBACK (fallback_hits_added), engine);
+        g_signal_connect (index_engine->details->fallback, "hits-subtracted",
+                          G_CALLBACK (fallback_hits_subtracted), engine);
+        g_signal_connect (index_engine->details->fallback, "finished",
+                          G_CALLBACK (fallback_finished), engine);
+        g_signal_connect (index_engine->details->fallback, "error",
+                          G_CALLBACK (fallback_error), engine);
+    }
+
+    caja_search_engine_set_query (index_engine->details->fallback,
+                                  index_engine->details->query);
+    caja_search_engine_start (index_engine->details->fallback);
+}
+
+static void
+caja_search_engine_index_stop (CajaSearchEngine *engine)
+{
+    CajaSearchEngineIndex *index_engine;
+
+    index_engine = CAJA_SEARCH_ENGINE_INDEX (engine);
+
+    if (index_engine->details->search_idle_id != 0)
+    {
+        g_source_remove (index_engine->details->search_idle_id);
+        index_engine->details->search_idle_id = 0;
+    }
+
+    if (index_engine->details->active_search != NULL)
+    {
+        g_cancellable_cancel (index_engine->details->active_search->cancellable);
+        index_engine->details->active_search = NULL;
+    }
+
+    if (index_engine->details->fallback != NULL)
+    {
+        caja_search_engine_stop (index_engine->details->fallback);
+    }
+}
+
+static gboolean
+caja_search_engine_index_is_indexed (CajaSearchEngine *engine)
+{
+    CajaSearchEngineIndex *index_engine;
+    guint32 location;
+    GList *l;
+
+    index_engine = CAJA_SEARCH_ENGINE_INDEX (engine);
+
+    if (index_engine->details->query != NULL)
+    {
+        return search_index_for_query (index_engine->details->query, &location) != NULL;
+    }
+
+    for (l = search_indexes; l != NULL; l = l->next)
+    {
+        if (search_index_is_ready (l->data))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void
+caja_search_engine_index_set_query (CajaSearchEngine *engine, CajaQuery *query)
+{
+    CajaSearchEngineIndex *index_engine;
+
+    index_engine = CAJA_SEARCH_ENGINE_INDEX (engine);
+
+    if (query)
+    {
+        g_object_ref (query);
+    }
+
+    if (index_engine->details->query)
+    {
+        g_object_unref (index_engine->details->query);
+    }
+
+    index_engine->details->query = query;
+}
+
+static void
+caja_search_engine_index_class_init (CajaSearchEngineIndexClass *class)
+{
+    GObjectClass *gobject_class;
+    CajaSearchEngineClass *engine_class;
+
+    parent_class = g_type_class_peek_parent (class);
+
+    gobject_class = G_OBJECT_CLASS (class);
+    gobject_class->finalize = finalize;
+
+    engine_class = CAJA_SEARCH_ENGINE_CLASS (class);
+    engine_class->set_query = caja_search_engine_index_set_query;
+    engine_class->start = caja_search_engine_index_start;
+    engine_class->stop = caja_search_engine_index_stop;
+    engine_class->is_indexed = caja_search_engine_index_is_indexed;
+}
+
+static void
+caja_search_engine_index_init (CajaSearchEngineIndex *engine)
+{
+    engine->details = g_new0 (CajaSearchEngineIndexDetails, 1);
+}
+
+CajaSearchEngine *
+caja_search_engine_index_new (void)
+{
+    if (!ensure_search_indexes ())
+    {
+        return NULL;
+    }
+
+    return g_object_new (CAJA_TYPE_SEARCH_ENGINE_INDEX, NULL);
+}
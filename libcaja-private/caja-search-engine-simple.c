@@ -33,27 +33,58 @@
 
 #define BATCH_SIZE 500
 
+/* Upper bound for the number of crawler threads of one search. */
+#define SEARCH_MAX_THREADS 16
+
+/* How long an idle crawler waits for more directories before it checks
+ * for cancellation again.
+ */
+#define SEARCH_IDLE_WAIT_MSEC 50
+
+/* Files are searched for contained text in chunks of this size. */
+#define CONTENT_CHUNK_SIZE (256 * 1024)
+
+/* Pre-folded form of the text to look for inside files. */
+typedef struct
+{
+    char *folded;       /* normalized and lower-cased */
+    gsize folded_len;
+    gboolean is_ascii;
+    gsize overlap;      /* bytes kept between chunks */
+} ContentMatcher;
+
 typedef struct
 {
     CajaSearchEngineSimple *engine;
     GCancellable *cancellable;
 
     char *contained_text;
+    ContentMatcher matcher;
+    gboolean odt2txt_available;
     GList *mime_types;
     GList *tags;
     char **words;
     GList *found_list;
 
+    /* Shared by the crawler threads, protected by lock. */
+    GMutex lock;
+    GCond cond;
     GQueue *directories; /* GFiles */
-
     GHashTable *visited;
+    int n_busy_workers;
+    int n_running_workers;
 
-    gint n_processed_files;
-    GList *uri_hits;
     gint64 timestamp;
     gint64 size;
 } SearchThreadData;
 
+typedef struct
+{
+    SearchThreadData *data;
+    gint n_processed_files;
+    GList *uri_hits;
+} SearchWorker;
+
 struct CajaSearchEngineSimpleDetails
 {
     CajaQuery *query;
@@ -69,6 +100,10 @@ G_DEFINE_TYPE (CajaSearchEngineSimple,
 
 static CajaSearchEngineClass *parent_class = NULL;
 
+static void content_matcher_init  (ContentMatcher *matcher,
+                                   const char     *str);
+static void content_matcher_clear (ContentMatcher *matcher);
+
 static void
 finalize (GObject *object)
 {
@@ -126,8 +161,14 @@ search_thread_data_new (CajaSearchEngineSimple *engine,
     data->timestamp = caja_query_get_timestamp (query);
     data->size = caja_query_get_size (query);
     data->contained_text = caja_query_get_contained_text (query);
+    if (data->contained_text != NULL)
+    {
+        content_matcher_init (&data->matcher, data->contained_text);
+    }
 
     data->cancellable = g_cancellable_new ();
+    g_mutex_init (&data->lock);
+    g_cond_init (&data->cond);
 
     return data;
 }
@@ -143,8 +184,10 @@ search_thread_data_free (SearchThreadData *data)
     g_strfreev (data->words);
     g_list_free_full (data->tags, g_free);
     g_list_free_full (data->mime_types, g_free);
-    g_list_free_full (data->uri_hits, g_free);
     g_free (data->contained_text);
+    content_matcher_clear (&data->matcher);
+    g_mutex_clear (&data->lock);
+    g_cond_clear (&data->cond);
     g_free (data);
 }
 
@@ -192,20 +235,20 @@ search_thread_add_hits_idle (gpointer user_data)
 }
 
 static void
-send_batch (SearchThreadData *data)
+send_batch (SearchWorker *worker)
 {
-    data->n_processed_files = 0;
+    worker->n_processed_files = 0;
 
-    if (data->uri_hits)
+    if (worker->uri_hits)
     {
         SearchHits *hits;
 
         hits = g_new (SearchHits, 1);
-        hits->uris = data->uri_hits;
-        hits->thread_data = data;
+        hits->uris = worker->uri_hits;
+        hits->thread_data = worker->data;
         g_idle_add (search_thread_add_hits_idle, hits);
     }
-    data->uri_hits = NULL;
+    worker->uri_hits = NULL;
 }
 
 #define G_FILE_ATTRIBUTE_XATTR_XDG_TAGS "xattr::xdg.tags"
@@ -374,9 +417,9 @@ read_odt (const char *filepath) {
 }
 
 static inline gchar *
-utf8_normalize_strdown (const char *str) {
+utf8_normalize_strdown (const char *str, gssize len) {
     gchar* lower = NULL;
-    gchar *normalized = g_utf8_normalize (str, -1, G_NORMALIZE_DEFAULT);
+    gchar *normalized = g_utf8_normalize (str, len, G_NORMALIZE_DEFAULT);
 
     if (normalized)
         lower = g_utf8_strdown (normalized, -1);
@@ -386,57 +429,252 @@ utf8_normalize_strdown (const char *str) {
     return lower;
 }
 
+static void
+content_matcher_init (ContentMatcher *matcher, const char *str)
+{
+    const char *p;
+
+    matcher->folded = utf8_normalize_strdown (str, -1);
+    if (matcher->folded == NULL)
+        matcher->folded = g_strdup ("");
+    matcher->folded_len = strlen (matcher->folded);
+
+    matcher->is_ascii = TRUE;
+    for (p = matcher->folded; *p != '\0'; p++) {
+        if ((guchar) *p >= 0x80) {
+            matcher->is_ascii = FALSE;
+            break;
+        }
+    }
+
+    /* Case folding can shrink a character to a third of its size, so
+     * this is enough to catch any match that straddles two chunks.
+     */
+    matcher->overlap = matcher->folded_len * 4;
+}
+
+static void
+content_matcher_clear (ContentMatcher *matcher)
+{
+    g_free (matcher->folded);
+    matcher->folded = NULL;
+}
+
+/* Lower-cases ASCII letters in place and tells whether @len bytes of
+ * @text are all ASCII. Simple enough for the compiler to vectorize.
+ */
+static inline gboolean
+ascii_strdown_in_place (char *text, gsize len)
+{
+    guchar high;
+    gsize i;
+
+    high = 0;
+    for (i = 0; i < len; i++) {
+        guchar c = text[i];
+
+        high |= c;
+        text[i] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+
+    return (high & 0x80) == 0;
+}
+
+/* Substring scan that lets the (vectorized) libc memchr skip to
+ * candidate positions for the first byte.
+ */
+static inline gboolean
+memchr_find (const char *haystack, gsize len, const char *needle, gsize needle_len)
+{
+    const char *p, *last;
+
+    if (needle_len > len)
+        return FALSE;
+
+    p = haystack;
+    last = haystack + len - needle_len;
+    while (p <= last &&
+           (p = memchr (p, needle[0], last - p + 1)) != NULL) {
+        if (memcmp (p + 1, needle + 1, needle_len - 1) == 0)
+            return TRUE;
+        p++;
+    }
+
+    return FALSE;
+}
+
+/* Searches @len bytes of UTF-8 @text, which may be modified. Only
+ * falls back to Unicode normalization and case folding when the text
+ * is not ASCII.
+ */
+static gboolean
+content_matcher_search (ContentMatcher *matcher, char *text, gsize len)
+{
+    gchar *lower_text;
+    gboolean found;
+
+    /* ASCII text folds to itself, so it can only contain an ASCII
+     * needle.
+     */
+    if (ascii_strdown_in_place (text, len)) {
+        return matcher->is_ascii &&
+               memchr_find (text, len, matcher->folded, matcher->folded_len);
+    }
+
+    lower_text = utf8_normalize_strdown (text, len);
+    found = lower_text != NULL && strstr (lower_text, matcher->folded) != NULL;
+    g_free (lower_text);
+
+    return found;
+}
+
+/* Returns the largest offset <= @len that does not split a UTF-8
+ * character.
+ */
+static inline gsize
+utf8_boundary (const char *text, gsize len)
+{
+    gsize i;
+
+    for (i = len; i > 0 && len - i < 4; i--) {
+        if (((guchar) text[i - 1] & 0xc0) != 0x80) {
+            /* text[i - 1] starts a character; keep it if complete. */
+            if ((gsize) (g_utf8_skip[(guchar) text[i - 1]]) <= len - (i - 1))
+                return len;
+            return i - 1;
+        }
+    }
+
+    return len;
+}
+
+static gboolean
+file_contains_text (const char *filepath,
+                    ContentMatcher *matcher,
+                    GCancellable *cancellable)
+{
+    GFile *file;
+    GFileInputStream *stream;
+    char *buffer;
+    gsize carry, len, end, start;
+    gssize n_read;
+    gboolean found;
+
+    file = g_file_new_for_path (filepath);
+    stream = g_file_read (file, cancellable, NULL);
+    g_object_unref (file);
+    if (stream == NULL)
+        return FALSE;
+
+    buffer = g_malloc (CONTENT_CHUNK_SIZE + matcher->overlap + 4);
+    carry = 0;
+    found = FALSE;
+
+    while (!found) {
+        n_read = g_input_stream_read (G_INPUT_STREAM (stream),
+                                      buffer + carry, CONTENT_CHUNK_SIZE,
+                                      cancellable, NULL);
+        if (n_read <= 0)
+            break;
+
+        len = carry + n_read;
+        end = utf8_boundary (buffer, len);
+        found = content_matcher_search (matcher, buffer, end);
+
+        /* Keep the tail of this chunk plus any incomplete character
+         * for the next round.
+         */
+        start = end - MIN (matcher->overlap, end);
+        while (start < end && ((guchar) buffer[start] & 0xc0) == 0x80)
+            start++;
+        carry = len - start;
+        memmove (buffer, buffer + start, carry);
+    }
+
+    g_free (buffer);
+    g_object_unref (stream);
+
+    return found;
+}
+
 static inline gboolean
 is_file_has_str (
     const char *filepath,
-    const char *str,
+    ContentMatcher *matcher,
     const char *mime_type,
-    gboolean odt2txt_available)
+    gboolean odt2txt_available,
+    GCancellable *cancellable)
 {
-    gboolean rc = TRUE;
-    gchar *contents = NULL;
-    gchar *lower_contents = NULL;
-    gchar *lower_str = NULL;
+    gboolean rc;
+    gchar *contents;
 
-    if (str[0] == '\0') {
+    if (matcher->folded_len == 0) {
         return TRUE;
     }
 
     if (g_content_type_is_mime_type (mime_type, "text/plain")) {
-        rc = g_file_get_contents (filepath, &contents, NULL, NULL);
+        return file_contains_text (filepath, matcher, cancellable);
     }
-    else {
-        if (!odt2txt_available) {
-            g_warning ("Can't search in file '%s'. odt2txt not found.", filepath);
-            rc = FALSE;
-        }
-        else {
-            contents = read_odt (filepath);
-            if (!contents)
-                rc = FALSE;
-        }
-    }
-
-    if (rc) {
-        lower_str = utf8_normalize_strdown (str);
-        lower_contents = utf8_normalize_strdown (contents);
 
-        if (lower_str && lower_contents && strstr (lower_contents, lower_str))
-            rc = TRUE;
-        else
-            rc = FALSE;
+    if (!odt2txt_available) {
+        g_warning ("Can't search in file '%s'. odt2txt not found.", filepath);
+        return FALSE;
     }
 
+    contents = read_odt (filepath);
+    if (!contents)
+        return FALSE;
+
+    rc = content_matcher_search (matcher, contents, strlen (contents));
     g_free (contents);
-    g_free (lower_str);
-    g_free (lower_contents);
 
     return rc;
 }
 
+/* Queues the subdirectories found by one visit_directory call, skipping
+ * the ones some thread has already seen, and wakes idle crawlers.
+ */
+static void
+queue_subdirectories (SearchThreadData *data,
+                      GList *subdirs,
+                      GList *ids)
+{
+    GList *l, *id;
+    gboolean queued;
+
+    queued = FALSE;
+
+    g_mutex_lock (&data->lock);
+    for (l = subdirs, id = ids; l != NULL; l = l->next, id = id->next)
+    {
+        if (id->data != NULL)
+        {
+            if (g_hash_table_contains (data->visited, id->data))
+            {
+                g_object_unref (l->data);
+                continue;
+            }
+            g_hash_table_add (data->visited, id->data);
+            id->data = NULL;
+        }
+
+        g_queue_push_tail (data->directories, l->data);
+        queued = TRUE;
+    }
+    if (queued)
+    {
+        g_cond_broadcast (&data->cond);
+    }
+    g_mutex_unlock (&data->lock);
+
+    g_list_free (subdirs);
+    g_list_free_full (ids, g_free);
+}
+
 static void
-visit_directory (GFile *dir, SearchThreadData *data)
+visit_directory (GFile *dir, SearchWorker *worker)
 {
+    SearchThreadData *data;
     GFileEnumerator *enumerator;
     GFileInfo *info;
     GFile *child;
@@ -445,13 +683,15 @@ visit_directory (GFile *dir, SearchThreadData *data)
     gboolean hit;
     int i;
     GList *l;
-    const char *id;
-    gboolean visited;
+    GList *subdirs, *subdir_ids;
     GTimeVal result;
     gchar *attributes;
     GString *attr_string;
     gchar *filepath = NULL;
-    gboolean odt2txt_available = FALSE;
+
+    data = worker->data;
+    subdirs = NULL;
+    subdir_ids = NULL;
 
     attr_string = g_string_new (STD_ATTRIBUTES);
     if (data->mime_types != NULL || data->contained_text != NULL) {
@@ -468,10 +708,6 @@ visit_directory (GFile *dir, SearchThreadData *data)
         g_string_append (attr_string, "," G_FILE_ATTRIBUTE_STANDARD_SIZE);
     }
 
-    if (data->contained_text != NULL) {
-        odt2txt_available = check_odt2txt();
-    }
-
     attributes = g_string_free (attr_string, FALSE);
     enumerator = g_file_enumerate_children (dir, (const char*)attributes, 0,
                                             data->cancellable, NULL);
@@ -567,7 +803,8 @@ visit_directory (GFile *dir, SearchThreadData *data)
             ) {
                 g_free (filepath);
                 filepath = g_file_get_path (child);
-                hit = is_file_has_str (filepath, data->contained_text, mime_type, odt2txt_available);
+                hit = is_file_has_str (filepath, &data->matcher, mime_type,
+                                       data->odt2txt_available, data->cancellable);
             }
             else {
                 hit = FALSE;
@@ -576,36 +813,20 @@ visit_directory (GFile *dir, SearchThreadData *data)
 
         if (hit)
         {
-            data->uri_hits = g_list_prepend (data->uri_hits, g_file_get_uri (child));
+            worker->uri_hits = g_list_prepend (worker->uri_hits, g_file_get_uri (child));
         }
 
-        data->n_processed_files++;
-        if (data->n_processed_files > BATCH_SIZE)
+        worker->n_processed_files++;
+        if (worker->n_processed_files > BATCH_SIZE)
         {
-            send_batch (data);
+            send_batch (worker);
         }
 
         if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
         {
-            id = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE);
-            visited = FALSE;
-            if (id)
-            {
-                if (g_hash_table_lookup_extended (data->visited,
-                                                  id, NULL, NULL))
-                {
-                    visited = TRUE;
-                }
-                else
-                {
-                    g_hash_table_insert (data->visited, g_strdup (id), NULL);
-                }
-            }
-
-            if (!visited)
-            {
-                g_queue_push_tail (data->directories, g_object_ref (child));
-            }
+            subdirs = g_list_prepend (subdirs, g_object_ref (child));
+            subdir_ids = g_list_prepend (subdir_ids,
+                                         g_strdup (g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE)));
         }
 
         g_object_unref (child);
@@ -615,14 +836,79 @@ next:
 
     g_free (filepath);
     g_object_unref (enumerator);
+
+    queue_subdirectories (data, g_list_reverse (subdirs), g_list_reverse (subdir_ids));
+}
+
+/* Crawler thread. Takes directories from the shared queue until it is
+ * empty and no other crawler can add more to it.
+ */
+static gpointer
+search_worker_func (gpointer user_data)
+{
+    SearchWorker *worker;
+    SearchThreadData *data;
+    GFile *dir;
+    gboolean last;
+
+    worker = user_data;
+    data = worker->data;
+
+    g_mutex_lock (&data->lock);
+    while (!g_cancellable_is_cancelled (data->cancellable))
+    {
+        dir = g_queue_pop_head (data->directories);
+        if (dir == NULL)
+        {
+            if (data->n_busy_workers == 0)
+            {
+                break;
+            }
+            g_cond_wait_until (&data->cond, &data->lock,
+                               g_get_monotonic_time () + SEARCH_IDLE_WAIT_MSEC * G_TIME_SPAN_MILLISECOND);
+            continue;
+        }
+
+        data->n_busy_workers++;
+        g_mutex_unlock (&data->lock);
+
+        visit_directory (dir, worker);
+        g_object_unref (dir);
+
+        g_mutex_lock (&data->lock);
+        data->n_busy_workers--;
+        if (data->n_busy_workers == 0 && g_queue_is_empty (data->directories))
+        {
+            g_cond_broadcast (&data->cond);
+        }
+    }
+    g_mutex_unlock (&data->lock);
+
+    send_batch (worker);
+    g_free (worker);
+
+    g_mutex_lock (&data->lock);
+    data->n_running_workers--;
+    last = data->n_running_workers == 0;
+    g_mutex_unlock (&data->lock);
+
+    if (last)
+    {
+        g_idle_add (search_thread_done_idle, data);
+    }
+
+    return NULL;
 }
 
 static gpointer
 search_thread_func (gpointer user_data)
 {
     SearchThreadData *data;
+    SearchWorker *worker;
     GFile *dir;
     GFileInfo *info;
+    GThread *thread;
+    int i, n_workers;
 
     data = user_data;
 
@@ -636,22 +922,33 @@ search_thread_func (gpointer user_data)
         id = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE);
         if (id)
         {
-            g_hash_table_insert (data->visited, g_strdup (id), NULL);
+            g_hash_table_add (data->visited, g_strdup (id));
         }
         g_object_unref (info);
     }
 
-    while (!g_cancellable_is_cancelled (data->cancellable) &&
-            (dir = g_queue_pop_head (data->directories)) != NULL)
+    if (data->contained_text != NULL) {
+        data->odt2txt_available = check_odt2txt();
+    }
+
+    /* Crawling is mostly waiting for I/O, so use more threads than
+     * processors, this thread being one of them.
+     */
+    n_workers = CLAMP (g_get_num_processors () * 2, 2, SEARCH_MAX_THREADS);
+    data->n_running_workers = n_workers;
+
+    for (i = 1; i < n_workers; i++)
     {
-        visit_directory (dir, data);
-        g_object_unref (dir);
+        worker = g_new0 (SearchWorker, 1);
+        worker->data = data;
+        thread = g_thread_new ("caja-search-simple", search_worker_func, worker);
+        g_thread_unref (thread);
     }
-    send_batch (data);
 
-    g_idle_add (search_thread_done_idle, data);
+    worker = g_new0 (SearchWorker, 1);
+    worker->data = data;
 
-    return NULL;
+    return search_worker_func (worker);
 }
 
 static void
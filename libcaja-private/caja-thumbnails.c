@@ -44,6 +44,7 @@
 #include <eel/eel-vfs-extensions.h>
 
 #include "caja-thumbnails.h"
+#include "caja-debug-log.h"
 #include "caja-directory-notify.h"
 #include "caja-global-preferences.h"
 #include "caja-file-utilities.h"
@@ -60,10 +61,21 @@
 /* Cool-off period between last file modification time and thumbnail creation */
 #define THUMBNAIL_CREATION_DELAY_SECS 3
 
-static void thumbnail_thread_func (GTask        *task,
-                                   gpointer      source_object,
-                                   gpointer      task_data,
-                                   GCancellable *cancellable);
+/* Size of MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL thumbnails */
+#define THUMBNAIL_NORMAL_SIZE 128
+
+#define THUMBNAIL_LOAD_BUFFER_SIZE 65536
+
+/* Image types we decode ourselves, straight at thumbnail size, instead
+   of going through the thumbnail factory. */
+static const char *fast_thumbnail_mime_types[] =
+{
+    "image/jpeg",
+    "image/png",
+    "image/webp"
+};
+
+static gpointer thumbnail_thread_func (gpointer data);
 
 /* structure used for making thumbnails, associating a uri with where the thumbnail is to be stored */
 
@@ -72,36 +84,49 @@ typedef struct
     char *image_uri;
     char *mime_type;
     time_t original_file_mtime;
+    /* Set while a thumbnail thread works on it, the info is then not
+       in the thumbnails_to_make queue. */
+    gboolean in_progress;
+    /* Set when the request is removed while in progress, the result
+       is dropped instead of saved. */
+    gboolean cancelled;
+    /* Whether the icon is in view, as told by caja_thumbnail_prioritize()
+       and caja_thumbnail_deprioritize(). */
+    gboolean displayed;
 } CajaThumbnailInfo;
 
 /*
  * Thumbnail thread state.
  */
 
-/* The id of the idle handler used to start the thumbnail thread, or 0 if no
+/* The id of the idle handler used to start thumbnail threads, or 0 if no
    idle handler is currently registered. */
 static guint thumbnail_thread_starter_id = 0;
 
 /* Our mutex used when accessing data shared between the main thread and the
-   thumbnail thread, i.e. the thumbnail_thread_is_running flag and the
+   thumbnail threads, i.e. the thumbnail_threads_running count and the
    thumbnails_to_make list. */
 static GMutex thumbnails_mutex;
 
-/* A flag to indicate whether a thumbnail thread is running, so we don't
-   start more than one. Lock thumbnails_mutex when accessing this. */
-static volatile gboolean thumbnail_thread_is_running = FALSE;
+/* The number of running thumbnail threads, and the most we start, read
+   from the thumbnail-threads preference. Lock thumbnails_mutex when
+   accessing these. */
+static guint thumbnail_threads_running = 0;
+static guint thumbnail_threads_max = 0;
+
+/* Thumbnails made, and how many of those were for icons out of view when
+   they were done. Lock thumbnails_mutex when accessing these. */
+static guint thumbnails_generated = 0;
+static guint thumbnails_generated_not_displayed = 0;
 
 /* The list of CajaThumbnailInfo structs containing information about the
-   thumbnails we are making. Lock thumbnails_mutex when accessing this. */
+   thumbnails waiting to be made. Lock thumbnails_mutex when accessing this. */
 static volatile GQueue thumbnails_to_make = G_QUEUE_INIT;
 
-/* Quickly check if uri is in thumbnails_to_make list */
+/* Quickly check if uri is waiting or being thumbnailed. Maps to the list
+   node, which is unlinked from thumbnails_to_make while in progress. */
 static GHashTable *thumbnails_to_make_hash = NULL;
 
-/* The currently thumbnailed icon. it also exists in the thumbnails_to_make list
- * to avoid adding it again. Lock thumbnails_mutex when accessing this. */
-static CajaThumbnailInfo *currently_thumbnailing = NULL;
-
 static MateDesktopThumbnailFactory *thumbnail_factory = NULL;
 
 static gboolean
@@ -152,14 +177,29 @@ get_thumbnail_factory (void)
     return thumbnail_factory;
 }
 
+static guint
+get_max_thumbnail_threads (void)
+{
+    int n_threads;
+
+    n_threads = g_settings_get_int (caja_preferences, CAJA_PREFERENCES_THUMBNAIL_THREADS);
+    if (n_threads <= 0)
+    {
+        n_threads = g_get_num_processors ();
+    }
+
+    return n_threads;
+}
+
 /* This function is added as a very low priority idle function to start the
-   thread to create any needed thumbnails. It is added with a very low priority
+   threads to create any needed thumbnails. It is added with a very low priority
    so that it doesn't delay showing the directory in the icon/list views.
    We want to show the files in the directory as quickly as possible. */
 static gboolean
 thumbnail_thread_starter_cb (gpointer data)
 {
-    GTask *task;
+    GThread *thread;
+    guint max_threads;
 
     /* Don't do this in thread, since g_object_ref is not threadsafe */
     if (thumbnail_factory == NULL)
@@ -167,21 +207,27 @@ thumbnail_thread_starter_cb (gpointer data)
         thumbnail_factory = get_thumbnail_factory ();
     }
 
-#ifdef DEBUG_THUMBNAILS
-    g_message ("(Main Thread) Creating thumbnails thread\n");
-#endif
-    /* We set a flag to indicate the thread is running, so we don't create
-       a new one. We don't need to lock a mutex here, as the thumbnail
-       thread isn't running yet. And we know we won't create the thread
-       twice, as we also check thumbnail_thread_starter_id before
-       scheduling this idle function. */
-    thumbnail_thread_is_running = TRUE;
-    task = g_task_new (NULL, NULL, NULL, NULL);
-    g_task_run_in_thread (task, thumbnail_thread_func);
+    max_threads = get_max_thumbnail_threads ();
+
+    g_mutex_lock (&thumbnails_mutex);
 
     thumbnail_thread_starter_id = 0;
+    thumbnail_threads_max = max_threads;
+
+    /* Start one thread per waiting thumbnail, up to the limit. Threads
+       exit by themselves once the queue is empty. */
+    while (thumbnail_threads_running < thumbnail_threads_max &&
+            thumbnail_threads_running < g_queue_get_length ((GQueue *)&thumbnails_to_make))
+    {
+#ifdef DEBUG_THUMBNAILS
+        g_message ("(Main Thread) Creating thumbnails thread\n");
+#endif
+        thumbnail_threads_running++;
+        thread = g_thread_new ("caja-thumbnails", thumbnail_thread_func, NULL);
+        g_thread_unref (thread);
+    }
 
-    g_object_unref (task);
+    g_mutex_unlock (&thumbnails_mutex);
 
     return FALSE;
 }
@@ -200,16 +246,23 @@ caja_thumbnail_remove_from_queue (const char *file_uri)
 
     if (thumbnails_to_make_hash)
     {
+        CajaThumbnailInfo *info;
         GList *node;
 
         node = g_hash_table_lookup (thumbnails_to_make_hash, file_uri);
+        info = node ? node->data : NULL;
 
-        if (node && node->data != currently_thumbnailing)
+        if (info && !info->in_progress)
         {
             g_hash_table_remove (thumbnails_to_make_hash, file_uri);
-            free_thumbnail_info (node->data);
+            free_thumbnail_info (info);
             g_queue_delete_link ((GQueue *)&thumbnails_to_make, node);
         }
+        else if (info)
+        {
+            /* The thread making it drops the result. */
+            info->cancelled = TRUE;
+        }
     }
 
     /*********************************
@@ -240,7 +293,12 @@ caja_thumbnail_prioritize (const char *file_uri)
 
         node = g_hash_table_lookup (thumbnails_to_make_hash, file_uri);
 
-        if (node && node->data != currently_thumbnailing)
+        if (node)
+        {
+            ((CajaThumbnailInfo *) node->data)->displayed = TRUE;
+        }
+
+        if (node && !((CajaThumbnailInfo *) node->data)->in_progress)
         {
             g_queue_unlink ((GQueue *)&thumbnails_to_make, node);
             g_queue_push_head_link ((GQueue *)&thumbnails_to_make, node);
@@ -257,6 +315,50 @@ caja_thumbnail_prioritize (const char *file_uri)
     g_mutex_unlock (&thumbnails_mutex);
 }
 
+/* Called when the icon for file_uri scrolls out of view. Its request
+   goes to the back of the queue, behind the ones for icons still shown.
+   A thumbnail already being made is finished, as it would only be made
+   again when the icon comes back. */
+void
+caja_thumbnail_deprioritize (const char *file_uri)
+{
+#ifdef DEBUG_THUMBNAILS
+    g_message ("(Deprioritize) Locking mutex\n");
+#endif
+    g_mutex_lock (&thumbnails_mutex);
+
+    /*********************************
+     * MUTEX LOCKED
+     *********************************/
+
+    if (thumbnails_to_make_hash)
+    {
+        GList *node;
+
+        node = g_hash_table_lookup (thumbnails_to_make_hash, file_uri);
+
+        if (node)
+        {
+            ((CajaThumbnailInfo *) node->data)->displayed = FALSE;
+        }
+
+        if (node && !((CajaThumbnailInfo *) node->data)->in_progress)
+        {
+            g_queue_unlink ((GQueue *)&thumbnails_to_make, node);
+            g_queue_push_tail_link ((GQueue *)&thumbnails_to_make, node);
+        }
+    }
+
+    /*********************************
+     * MUTEX UNLOCKED
+     *********************************/
+
+#ifdef DEBUG_THUMBNAILS
+    g_message ("(Deprioritize) Unlocking mutex\n");
+#endif
+    g_mutex_unlock (&thumbnails_mutex);
+}
+
 /***************************************************************************
  * Thumbnail Thread Functions.
  ***************************************************************************/
@@ -439,11 +541,13 @@ caja_create_thumbnail (CajaFile *file)
         g_hash_table_insert (thumbnails_to_make_hash,
                              info->image_uri,
                              node);
-        /* If the thumbnail thread isn't running, and we haven't
-           scheduled an idle function to start it up, do that now.
-           We don't want to start it until all the other work is done,
-           so the GUI will be updated as quickly as possible.*/
-        if (thumbnail_thread_is_running == FALSE &&
+        /* If there are fewer thumbnail threads than waiting thumbnails,
+           and we haven't scheduled an idle function to start more, do that
+           now. We don't want to start them until all the other work is
+           done, so the GUI will be updated as quickly as possible.*/
+        if ((thumbnail_threads_max == 0 ||
+                thumbnail_threads_running < thumbnail_threads_max) &&
+                thumbnail_threads_running < g_queue_get_length ((GQueue *)&thumbnails_to_make) &&
                 thumbnail_thread_starter_id == 0)
         {
             thumbnail_thread_starter_id = g_idle_add_full (G_PRIORITY_LOW, thumbnail_thread_starter_cb, NULL, NULL);
@@ -460,6 +564,7 @@ caja_create_thumbnail (CajaFile *file)
         /* The file in the queue might need a new original mtime */
         existing_info = existing->data;
         existing_info->original_file_mtime = info->original_file_mtime;
+        existing_info->cancelled = FALSE;
         free_thumbnail_info (info);
     }
 
@@ -473,17 +578,156 @@ caja_create_thumbnail (CajaFile *file)
     g_mutex_unlock (&thumbnails_mutex);
 }
 
-/* thumbnail_thread is invoked as a separate thread to to make thumbnails. */
+static gboolean
+can_thumbnail_in_process (const char *mime_type)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (fast_thumbnail_mime_types); i++)
+    {
+        if (g_strcmp0 (mime_type, fast_thumbnail_mime_types[i]) == 0)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Only scale down, like the thumbnail factory does. For JPEG this lets
+   the decoder skip most of the work on large photos. */
+static void
+thumbnail_loader_size_prepared (GdkPixbufLoader *loader,
+                                int width,
+                                int height,
+                                gpointer user_data)
+{
+    double scale;
+
+    if (MAX (width, height) <= THUMBNAIL_NORMAL_SIZE)
+    {
+        return;
+    }
+
+    scale = (double) THUMBNAIL_NORMAL_SIZE / MAX (width, height);
+    gdk_pixbuf_loader_set_size (loader,
+                                MAX (floor (scale * width + 0.5), 1),
+                                MAX (floor (scale * height + 0.5), 1));
+}
+
+/* Makes a thumbnail without the thumbnail factory, or returns NULL if it
+   should be made the usual way. */
+static GdkPixbuf *
+generate_thumbnail_in_process (const char *image_uri,
+                               const char *mime_type)
+{
+    GdkPixbufLoader *loader;
+    GFileInputStream *stream;
+    GdkPixbuf *pixbuf;
+    GFile *file;
+    guchar *buffer;
+    gssize bytes_read;
+    gboolean res;
+
+    if (!can_thumbnail_in_process (mime_type))
+    {
+        return NULL;
+    }
+
+    /* The loader for the type might not be installed. */
+    loader = gdk_pixbuf_loader_new_with_mime_type (mime_type, NULL);
+    if (loader == NULL)
+    {
+        return NULL;
+    }
+    g_signal_connect (loader, "size-prepared",
+                      G_CALLBACK (thumbnail_loader_size_prepared),
+                      NULL);
+
+    file = g_file_new_for_uri (image_uri);
+    stream = g_file_read (file, NULL, NULL);
+    g_object_unref (file);
+
+    res = stream != NULL;
+    buffer = g_malloc (THUMBNAIL_LOAD_BUFFER_SIZE);
+    while (res)
+    {
+        bytes_read = g_input_stream_read (G_INPUT_STREAM (stream),
+                                          buffer, THUMBNAIL_LOAD_BUFFER_SIZE,
+                                          NULL, NULL);
+        if (bytes_read <= 0)
+        {
+            res = bytes_read == 0;
+            break;
+        }
+        res = gdk_pixbuf_loader_write (loader, buffer, bytes_read, NULL);
+    }
+    g_free (buffer);
+
+    if (stream != NULL)
+    {
+        g_object_unref (stream);
+    }
+
+    /* Always close the loader, it complains when finalized otherwise. */
+    res = gdk_pixbuf_loader_close (loader, NULL) && res;
+
+    pixbuf = NULL;
+    if (res && gdk_pixbuf_loader_get_pixbuf (loader) != NULL)
+    {
+        pixbuf = gdk_pixbuf_apply_embedded_orientation (gdk_pixbuf_loader_get_pixbuf (loader));
+    }
+    g_object_unref (loader);
+
+    return pixbuf;
+}
+
+/* Called by a thumbnail thread when it is done with a thumbnail. The
+   request is dropped, unless the original file mtime of the request
+   changed while we were working on it. Then we need to redo the thumbnail. */
 static void
-thumbnail_thread_func (GTask        *task,
-                       gpointer      source_object,
-                       gpointer      task_data,
-                       GCancellable *cancellable)
+thumbnail_thread_finish (GList *node, time_t current_orig_mtime)
 {
-    CajaThumbnailInfo *info = NULL;
+    CajaThumbnailInfo *info;
+
+    info = node->data;
+
+    g_mutex_lock (&thumbnails_mutex);
+
+    /*********************************
+     * MUTEX LOCKED
+     *********************************/
+
+    info->in_progress = FALSE;
+
+    if (info->original_file_mtime == current_orig_mtime)
+    {
+        g_hash_table_remove (thumbnails_to_make_hash, info->image_uri);
+        free_thumbnail_info (info);
+        g_list_free_1 (node);
+    }
+    else
+    {
+        g_queue_push_head_link ((GQueue *)&thumbnails_to_make, node);
+    }
+
+    /*********************************
+     * MUTEX UNLOCKED
+     *********************************/
+
+    g_mutex_unlock (&thumbnails_mutex);
+}
+
+/* thumbnail_thread is invoked as separate threads to make thumbnails. */
+static gpointer
+thumbnail_thread_func (gpointer data)
+{
+    CajaThumbnailInfo *info;
     GdkPixbuf *pixbuf;
-    time_t current_orig_mtime = 0;
+    time_t current_orig_mtime;
     time_t current_time;
+    gboolean cancelled, displayed;
+    guint n_generated, n_not_displayed;
     GList *node;
 
     /* We loop until there are no more thumbails to make, at which point
@@ -499,43 +743,25 @@ thumbnail_thread_func (GTask        *task,
          * MUTEX LOCKED
          *********************************/
 
-        /* Pop the last thumbnail we just made off the head of the
-           list and free it. I did this here so we only have to lock
-           the mutex once per thumbnail, rather than once before
-           creating it and once after.
-           Don't pop the thumbnail off the queue if the original file
-           mtime of the request changed. Then we need to redo the thumbnail.
-        */
-        if (currently_thumbnailing &&
-                currently_thumbnailing->original_file_mtime == current_orig_mtime)
-        {
-            g_assert (info == currently_thumbnailing);
-            node = g_hash_table_lookup (thumbnails_to_make_hash, info->image_uri);
-            g_assert (node != NULL);
-            g_hash_table_remove (thumbnails_to_make_hash, info->image_uri);
-            free_thumbnail_info (info);
-            g_queue_delete_link ((GQueue *)&thumbnails_to_make, node);
-        }
-        currently_thumbnailing = NULL;
-
-        /* If there are no more thumbnails to make, reset the
-           thumbnail_thread_is_running flag, unlock the mutex, and
-           exit the thread. */
+        /* If there are no more thumbnails to make, drop out of the
+           thread count, unlock the mutex, and exit the thread. */
         if (g_queue_is_empty ((GQueue *)&thumbnails_to_make))
         {
 #ifdef DEBUG_THUMBNAILS
             g_message ("(Thumbnail Thread) Exiting\n");
 #endif
-            thumbnail_thread_is_running = FALSE;
+            thumbnail_threads_running--;
             g_mutex_unlock (&thumbnails_mutex);
-            return;
+            return NULL;
         }
 
-        /* Get the next one to make. We leave it on the list until it
+        /* Get the next one to make. It stays in the hash table until it
            is created so the main thread doesn't add it again while we
-           are creating it. */
-        info = g_queue_peek_head ((GQueue *)&thumbnails_to_make);
-        currently_thumbnailing = info;
+           are creating it, and other threads don't pick it up. */
+        node = g_queue_pop_head_link ((GQueue *)&thumbnails_to_make);
+        info = node->data;
+        info->in_progress = TRUE;
+        info->cancelled = FALSE;
         current_orig_mtime = info->original_file_mtime;
         /*********************************
          * MUTEX UNLOCKED
@@ -560,6 +786,7 @@ thumbnail_thread_func (GTask        *task,
             /* Reschedule thumbnailing via a change notification */
             g_timeout_add_seconds (1, thumbnail_thread_notify_file_changed,
                                    g_strdup (info->image_uri));
+            thumbnail_thread_finish (node, current_orig_mtime);
             continue;
         }
 
@@ -569,11 +796,49 @@ thumbnail_thread_func (GTask        *task,
                    info->image_uri);
 #endif
 
-        pixbuf = mate_desktop_thumbnail_factory_generate_thumbnail (thumbnail_factory,
-                 info->image_uri,
-                 info->mime_type);
+        /* Common image types are decoded right at thumbnail size, the
+           factory would decode the whole image first. The result is saved
+           by the factory all the same, as a freedesktop.org thumbnail. */
+        pixbuf = generate_thumbnail_in_process (info->image_uri,
+                                                info->mime_type);
 
-        if (pixbuf)
+        if (pixbuf == NULL)
+        {
+            pixbuf = mate_desktop_thumbnail_factory_generate_thumbnail (thumbnail_factory,
+                     info->image_uri,
+                     info->mime_type);
+        }
+
+        g_mutex_lock (&thumbnails_mutex);
+        cancelled = info->cancelled;
+        displayed = info->displayed;
+        if (!cancelled)
+        {
+            thumbnails_generated++;
+            if (!displayed)
+            {
+                thumbnails_generated_not_displayed++;
+            }
+        }
+        n_generated = thumbnails_generated;
+        n_not_displayed = thumbnails_generated_not_displayed;
+        g_mutex_unlock (&thumbnails_mutex);
+
+        if (!cancelled && !displayed)
+        {
+            caja_debug_log (FALSE, CAJA_DEBUG_LOG_DOMAIN_THUMBNAILS,
+                            "thumbnail for %s made while not displayed (%u of %u)",
+                            info->image_uri, n_not_displayed, n_generated);
+        }
+
+        if (cancelled)
+        {
+#ifdef DEBUG_THUMBNAILS
+            g_message ("(Thumbnail Thread) Thumbnail cancelled: %s\n",
+                       info->image_uri);
+#endif
+        }
+        else if (pixbuf)
         {
 #ifdef DEBUG_THUMBNAILS
 			g_message ("(Thumbnail Thread) Saving thumbnail: %s\n",
@@ -583,7 +848,6 @@ thumbnail_thread_func (GTask        *task,
                     pixbuf,
                     info->image_uri,
                     current_orig_mtime);
-            g_object_unref (pixbuf);
         }
         else
         {
@@ -595,10 +859,18 @@ thumbnail_thread_func (GTask        *task,
                     info->image_uri,
                     current_orig_mtime);
         }
+
+        if (pixbuf)
+        {
+            g_object_unref (pixbuf);
+        }
+
         /* We need to call caja_file_changed(), but I don't think that is
            thread safe. So add an idle handler and do it from the main loop. */
         g_idle_add_full (G_PRIORITY_HIGH_IDLE,
                          thumbnail_thread_notify_file_changed,
                          g_strdup (info->image_uri), NULL);
+
+        thumbnail_thread_finish (node, current_orig_mtime);
     }
 }
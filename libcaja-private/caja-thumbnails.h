@@ -39,5 +39,6 @@ gboolean   caja_thumbnail_is_mimetype_limited_by_size
 /* Queue handling: */
 void       caja_thumbnail_remove_from_queue     (const char   *file_uri);
 void       caja_thumbnail_prioritize            (const char   *file_uri);
+void       caja_thumbnail_deprioritize          (const char   *file_uri);
 
 #endif /* CAJA_THUMBNAILS_H */
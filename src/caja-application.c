@@ -116,6 +116,7 @@ struct _CajaApplicationPrivate {
     gboolean force_desktop;
     gboolean autostart;
     gchar *geometry;
+    guint resume_idle_id;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (CajaApplication, caja_application, GTK_TYPE_APPLICATION);
@@ -487,6 +488,12 @@ caja_application_finalize (GObject *object)
         application->automount_idle_id = 0;
     }
 
+    if (application->priv->resume_idle_id != 0)
+    {
+        g_source_remove (application->priv->resume_idle_id);
+        application->priv->resume_idle_id = 0;
+    }
+
     if (fdb_manager != NULL)
     {
         g_object_unref (fdb_manager);
@@ -621,6 +628,17 @@ automount_all_volumes_idle_cb (gpointer data)
     return FALSE;
 }
 
+static gboolean
+resume_interrupted_operations_idle_cb (gpointer data)
+{
+    CajaApplication *application = CAJA_APPLICATION (data);
+
+    caja_file_operations_resume_interrupted (NULL);
+
+    application->priv->resume_idle_id = 0;
+    return FALSE;
+}
+
 static void
 selection_get_cb (GtkWidget          *widget,
                   GtkSelectionData   *selection_data,
@@ -2314,6 +2332,12 @@ caja_application_startup (GApplication *app)
                      automount_all_volumes_idle_cb,
                      self, NULL);
 
+    /* offer to finish copies and moves cut short last time */
+    self->priv->resume_idle_id =
+    g_idle_add_full (G_PRIORITY_LOW,
+                     resume_interrupted_operations_idle_cb,
+                     self, NULL);
+
     /* Check the user's ~/.caja directories and post warnings
      * if there are problems.
      */
@@ -52,6 +52,7 @@
 #include <eel/eel-self-checks.h>
 
 #include <libcaja-private/caja-debug-log.h>
+#include <libcaja-private/caja-directory-private.h>
 #include <libcaja-private/caja-global-preferences.h>
 #include <libcaja-private/caja-icon-names.h>
 
@@ -73,10 +74,16 @@ static int debug_log_pipes[2];
 static gboolean debug_log_io_cb (GIOChannel *io, GIOCondition condition, gpointer data)
 {
     char a;
+    char *statistics;
 
     while (read (debug_log_pipes[0], &a, 1) != 1)
         ;
 
+    statistics = caja_directory_get_async_job_statistics ();
+    caja_debug_log (FALSE, CAJA_DEBUG_LOG_DOMAIN_USER,
+                    "async job queues:\n%s", statistics);
+    g_free (statistics);
+
     caja_debug_log (TRUE, CAJA_DEBUG_LOG_DOMAIN_USER,
                     "user requested dump of debug log");
 
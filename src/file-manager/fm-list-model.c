@@ -1051,12 +1051,42 @@ add_dummy_row (FMListModel *model, FileEntry *parent_entry)
     gtk_tree_path_free (path);
 }
 
+static void
+file_entry_inserted (FMListModel *model, FileEntry *file_entry,
+                     gboolean replace_dummy)
+{
+    GtkTreeIter iter;
+    GtkTreePath *path;
+
+    iter.stamp = model->details->stamp;
+    iter.user_data = file_entry->ptr;
+
+    path = gtk_tree_model_get_path (GTK_TREE_MODEL (model), &iter);
+    if (replace_dummy)
+    {
+        gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, &iter);
+    }
+    else
+    {
+        gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, &iter);
+    }
+
+    if (caja_file_is_directory (file_entry->file))
+    {
+        file_entry->files = g_sequence_new ((GDestroyNotify)file_entry_free);
+
+        add_dummy_row (model, file_entry);
+
+        gtk_tree_model_row_has_child_toggled (GTK_TREE_MODEL (model),
+                                              path, &iter);
+    }
+    gtk_tree_path_free (path);
+}
+
 gboolean
 fm_list_model_add_file (FMListModel *model, CajaFile *file,
                         CajaDirectory *directory)
 {
-    GtkTreeIter iter;
-    GtkTreePath *path;
     FileEntry *file_entry;
     GSequenceIter *ptr, *parent_ptr;
     GSequence *files;
@@ -1123,31 +1153,108 @@ fm_list_model_add_file (FMListModel *model, CajaFile *file,
 
     g_hash_table_insert (parent_hash, file, file_entry->ptr);
 
-    iter.stamp = model->details->stamp;
-    iter.user_data = file_entry->ptr;
+    file_entry_inserted (model, file_entry, replace_dummy);
 
-    path = gtk_tree_model_get_path (GTK_TREE_MODEL (model), &iter);
-    if (replace_dummy)
+    return TRUE;
+}
+
+/* Adds files of the same directory, like fm_list_model_add_file() for each
+ * of them. The new files are sorted once and merged into the rows, instead
+ * of searching the rows for each file.
+ */
+void
+fm_list_model_add_files (FMListModel *model, GList *files,
+                         CajaDirectory *directory)
+{
+    FileEntry *file_entry, *parent_entry;
+    GSequenceIter *parent_ptr, *ptr;
+    GSequence *sequence;
+    GHashTable *parent_hash;
+    GList *new_entries, *l;
+    gboolean replace_dummy;
+
+    parent_ptr = g_hash_table_lookup (model->details->directory_reverse_map,
+                                      directory);
+    if (parent_ptr)
     {
-        gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, &iter);
+        parent_entry = g_sequence_get (parent_ptr);
+        parent_hash = parent_entry->reverse_map;
+        sequence = parent_entry->files;
     }
     else
     {
-        gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, &iter);
+        parent_entry = NULL;
+        parent_hash = model->details->top_reverse_map;
+        sequence = model->details->files;
     }
 
-    if (caja_file_is_directory (file))
+    new_entries = NULL;
+    for (l = files; l != NULL; l = l->next)
     {
-        file_entry->files = g_sequence_new ((GDestroyNotify)file_entry_free);
+        if (g_hash_table_contains (parent_hash, l->data))
+        {
+            g_warning ("file already in tree (parent_ptr: %p)!!!\n", parent_ptr);
+            continue;
+        }
 
-        add_dummy_row (model, file_entry);
+        file_entry = g_new0 (FileEntry, 1);
+        file_entry->file = caja_file_ref (l->data);
+        file_entry->parent = parent_entry;
+        new_entries = g_list_prepend (new_entries, file_entry);
 
-        gtk_tree_model_row_has_child_toggled (GTK_TREE_MODEL (model),
-                                              path, &iter);
+        /* Catch files that are in the list twice */
+        g_hash_table_insert (parent_hash, file_entry->file, NULL);
     }
-    gtk_tree_path_free (path);
 
-    return TRUE;
+    if (new_entries == NULL)
+    {
+        return;
+    }
+
+    new_entries = g_list_sort_with_data (new_entries,
+                                         fm_list_model_file_entry_compare_func,
+                                         model);
+
+    replace_dummy = FALSE;
+
+    if (parent_entry != NULL)
+    {
+        /* See fm_list_model_add_file() */
+        parent_entry->loaded = 1;
+        if (g_sequence_get_length (sequence) == 1)
+        {
+            GSequenceIter *dummy_ptr = g_sequence_get_iter_at_pos (sequence, 0);
+            FileEntry *dummy_entry = g_sequence_get (dummy_ptr);
+            if (dummy_entry->file == NULL)
+            {
+                model->details->stamp++;
+                g_sequence_remove (dummy_ptr);
+
+                replace_dummy = TRUE;
+            }
+        }
+    }
+
+    ptr = g_sequence_get_begin_iter (sequence);
+    for (l = new_entries; l != NULL; l = l->next)
+    {
+        file_entry = l->data;
+
+        while (!g_sequence_iter_is_end (ptr) &&
+                fm_list_model_file_entry_compare_func (g_sequence_get (ptr), file_entry, model) <= 0)
+        {
+            ptr = g_sequence_iter_next (ptr);
+        }
+
+        file_entry->ptr = g_sequence_insert_before (ptr, file_entry);
+        g_hash_table_insert (parent_hash, file_entry->file, file_entry->ptr);
+
+        /* The first file takes the place of the dummy row */
+        file_entry_inserted (model, file_entry, replace_dummy);
+        replace_dummy = FALSE;
+    }
+
+    g_list_free (new_entries);
 }
 
 void
@@ -1240,6 +1347,37 @@ fm_list_model_get_length (FMListModel *model)
     return g_sequence_get_length (model->details->files);
 }
 
+/* Unloads the subdirectories below a row that is going away. The rows
+ * themselves go with it, deleting a row deletes its children too.
+ */
+static void
+fm_list_model_unload_children (FMListModel *model, FileEntry *file_entry)
+{
+    GSequenceIter *child_ptr;
+    FileEntry *child_file_entry;
+
+    for (child_ptr = g_sequence_get_begin_iter (file_entry->files);
+            !g_sequence_iter_is_end (child_ptr);
+            child_ptr = g_sequence_iter_next (child_ptr))
+    {
+        child_file_entry = g_sequence_get (child_ptr);
+
+        if (child_file_entry->files != NULL)
+        {
+            fm_list_model_unload_children (model, child_file_entry);
+        }
+
+        if (child_file_entry->subdirectory != NULL)
+        {
+            g_signal_emit (model,
+                           list_model_signals[SUBDIRECTORY_UNLOADED], 0,
+                           child_file_entry->subdirectory);
+            g_hash_table_remove (model->details->directory_reverse_map,
+                                 child_file_entry->subdirectory);
+        }
+    }
+}
+
 static void
 fm_list_model_remove (FMListModel *model, GtkTreeIter *iter)
 {
@@ -1253,34 +1391,7 @@ fm_list_model_remove (FMListModel *model, GtkTreeIter *iter)
 
     if (file_entry->files != NULL)
     {
-        GSequenceIter *child_ptr = NULL;
-        FileEntry *child_file_entry = NULL;
-
-        while (g_sequence_get_length (file_entry->files) > 0)
-        {
-            child_ptr = g_sequence_get_begin_iter (file_entry->files);
-            child_file_entry = g_sequence_get (child_ptr);
-
-            if (child_file_entry->file != NULL)
-            {
-                fm_list_model_remove_file (model,
-                                           child_file_entry->file,
-                                           file_entry->subdirectory);
-            }
-            else
-            {
-                path = gtk_tree_model_get_path (GTK_TREE_MODEL (model), iter);
-                gtk_tree_path_append_index (path, 0);
-                model->details->stamp++;
-                g_sequence_remove (child_ptr);
-                gtk_tree_model_row_deleted (GTK_TREE_MODEL (model), path);
-                gtk_tree_path_free (path);
-            }
-
-            /* the parent iter didn't actually change */
-            iter->stamp = model->details->stamp;
-        }
-
+        fm_list_model_unload_children (model, file_entry);
     }
 
     if (file_entry->file != NULL)   /* Don't try to remove dummy row */
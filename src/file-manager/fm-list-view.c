@@ -56,6 +56,7 @@
 #include <libcaja-private/caja-icon-dnd.h>
 #include <libcaja-private/caja-metadata.h>
 #include <libcaja-private/caja-module.h>
+#include <libcaja-private/caja-thumbnails.h>
 #include <libcaja-private/caja-tree-view-drag-dest.h>
 #include <libcaja-private/caja-view-factory.h>
 #include <libcaja-private/caja-clipboard.h>
@@ -114,6 +115,16 @@ struct FMListViewDetails
     gulong clipboard_handler_id;
 
     GQuark last_sort_attr;
+
+    /* Files in the rows in view, for ordering thumbnail requests */
+    GList *visible_files;
+    guint update_visible_rows_id;
+
+    /* Files added since the last flush_added_files(), newest first,
+     * all of them in the same directory.
+     */
+    GList *added_files;
+    CajaDirectory *added_files_directory;
 };
 
 struct SelectionForeachData
@@ -128,6 +139,10 @@ struct SelectionForeachData
 /* Wait for the rename to end when activating a file being renamed */
 #define WAIT_FOR_RENAME_ON_ACTIVATE 200
 
+/* Wait until scrolling pauses for this long before reordering thumbnail
+ * requests for the rows in view */
+#define UPDATE_VISIBLE_ROWS_DELAY 50
+
 static int                      click_policy_auto_value;
 static CajaFileSortType         default_sort_order_auto_value;
 static gboolean			default_sort_reversed_auto_value;
@@ -139,6 +154,7 @@ static GdkCursor *              hand_cursor = NULL;
 static GtkTargetList *          source_target_list = NULL;
 
 static GList *fm_list_view_get_selection                   (FMDirectoryView   *view);
+static void   flush_added_files                            (FMListView        *list_view);
 static GList *fm_list_view_get_selection_for_file_transfer (FMDirectoryView   *view);
 static void   fm_list_view_set_zoom_level                  (FMListView        *view,
         CajaZoomLevel  new_level,
@@ -1208,6 +1224,8 @@ fm_list_view_reveal_selection (FMDirectoryView *view)
 
     g_return_if_fail (FM_IS_LIST_VIEW (view));
 
+    flush_added_files (FM_LIST_VIEW (view));
+
     selection = fm_directory_view_get_selection (view);
 
     /* Make sure at least one of the selected items is scrolled into view */
@@ -1645,6 +1663,157 @@ get_icon_scale_callback (FMListModel *model,
     return gtk_widget_get_scale_factor (GTK_WIDGET (view->details->tree_view));
 }
 
+/* Moves to the row below iter on screen, descending into expanded rows. */
+static gboolean
+get_next_displayed_iter (GtkTreeView *tree_view,
+                         GtkTreeModel *model,
+                         GtkTreeIter *iter)
+{
+    GtkTreeIter next, parent;
+    GtkTreePath *path;
+    gboolean expanded;
+
+    path = gtk_tree_model_get_path (model, iter);
+    expanded = gtk_tree_view_row_expanded (tree_view, path);
+    gtk_tree_path_free (path);
+
+    if (expanded && gtk_tree_model_iter_children (model, &next, iter))
+    {
+        *iter = next;
+        return TRUE;
+    }
+
+    for (;;)
+    {
+        next = *iter;
+        if (gtk_tree_model_iter_next (model, &next))
+        {
+            *iter = next;
+            return TRUE;
+        }
+        if (!gtk_tree_model_iter_parent (model, &parent, iter))
+        {
+            return FALSE;
+        }
+        *iter = parent;
+    }
+}
+
+static void
+set_file_thumbnail_priority (CajaFile *file, gboolean visible)
+{
+    char *uri;
+
+    if (!caja_file_is_thumbnailing (file))
+    {
+        return;
+    }
+
+    uri = caja_file_get_uri (file);
+    if (visible)
+    {
+        caja_thumbnail_prioritize (uri);
+    }
+    else
+    {
+        caja_thumbnail_deprioritize (uri);
+    }
+    g_free (uri);
+}
+
+/* Moves thumbnail requests for the rows in view to the front of the
+ * queue, and those for rows that scrolled away to the back.
+ */
+static void
+update_visible_rows (FMListView *view)
+{
+    GtkTreeModel *model;
+    GtkTreePath *start, *end, *path;
+    GtkTreeIter iter;
+    GList *visible, *l;
+    CajaFile *file;
+    gboolean more;
+
+    model = GTK_TREE_MODEL (view->details->model);
+    visible = NULL;
+
+    if (gtk_tree_view_get_visible_range (view->details->tree_view, &start, &end))
+    {
+        more = gtk_tree_model_get_iter (model, &iter, start);
+        while (more)
+        {
+            file = NULL;
+            gtk_tree_model_get (model, &iter,
+                                FM_LIST_MODEL_FILE_COLUMN, &file,
+                                -1);
+            if (file != NULL)
+            {
+                visible = g_list_prepend (visible, file);
+            }
+
+            path = gtk_tree_model_get_path (model, &iter);
+            more = gtk_tree_path_compare (path, end) < 0 &&
+                   get_next_displayed_iter (view->details->tree_view, model, &iter);
+            gtk_tree_path_free (path);
+        }
+        gtk_tree_path_free (start);
+        gtk_tree_path_free (end);
+    }
+
+    for (l = view->details->visible_files; l != NULL; l = l->next)
+    {
+        if (g_list_find (visible, l->data) == NULL)
+        {
+            set_file_thumbnail_priority (l->data, FALSE);
+        }
+    }
+
+    /* The list is bottom row first, so the top row ends up at the head
+     * of the queue.
+     */
+    for (l = visible; l != NULL; l = l->next)
+    {
+        set_file_thumbnail_priority (l->data, TRUE);
+    }
+
+    caja_file_list_free (view->details->visible_files);
+    view->details->visible_files = visible;
+}
+
+static gboolean
+update_visible_rows_timeout_callback (gpointer data)
+{
+    FMListView *view;
+
+    view = FM_LIST_VIEW (data);
+    view->details->update_visible_rows_id = 0;
+
+    update_visible_rows (view);
+
+    return FALSE;
+}
+
+static void
+schedule_update_visible_rows (FMListView *view)
+{
+    if (view->details->update_visible_rows_id != 0)
+    {
+        g_source_remove (view->details->update_visible_rows_id);
+    }
+
+    view->details->update_visible_rows_id =
+        g_timeout_add (UPDATE_VISIBLE_ROWS_DELAY,
+                       update_visible_rows_timeout_callback,
+                       view);
+}
+
+static void
+vadjustment_changed_callback (GtkAdjustment *adjustment,
+                              FMListView *view)
+{
+    schedule_update_visible_rows (view);
+}
+
 static void
 create_and_set_up_tree_view (FMListView *view)
 {
@@ -1845,17 +2014,65 @@ create_and_set_up_tree_view (FMListView *view)
     gtk_widget_show (GTK_WIDGET (view->details->tree_view));
     gtk_container_add (GTK_CONTAINER (view), GTK_WIDGET (view->details->tree_view));
 
+    g_signal_connect_object (gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (view)),
+                             "value-changed",
+                             G_CALLBACK (vadjustment_changed_callback), view, 0);
+    g_signal_connect_object (gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (view)),
+                             "changed",
+                             G_CALLBACK (vadjustment_changed_callback), view, 0);
+
     atk_obj = gtk_widget_get_accessible (GTK_WIDGET (view->details->tree_view));
     atk_object_set_name (atk_obj, _("List View"));
 }
 
+/* Adds the files collected by fm_list_view_add_file() to the model, all
+ * at once.
+ */
+static void
+flush_added_files (FMListView *list_view)
+{
+    GList *files;
+
+    if (list_view->details->added_files == NULL)
+    {
+        return;
+    }
+
+    files = g_list_reverse (list_view->details->added_files);
+    list_view->details->added_files = NULL;
+
+    fm_list_model_add_files (list_view->details->model, files,
+                             list_view->details->added_files_directory);
+
+    caja_file_list_free (files);
+    caja_directory_unref (list_view->details->added_files_directory);
+    list_view->details->added_files_directory = NULL;
+}
+
 static void
 fm_list_view_add_file (FMDirectoryView *view, CajaFile *file, CajaDirectory *directory)
 {
-    FMListModel *model;
+    FMListView *list_view;
+
+    list_view = FM_LIST_VIEW (view);
+
+    /* Files are added in batches between begin_file_changes and
+     * end_file_changes, see fm_list_view_end_file_changes(). Anything
+     * looking for their rows, like selecting the files just pasted,
+     * flushes the batch first.
+     */
+    if (list_view->details->added_files != NULL &&
+            list_view->details->added_files_directory != directory)
+    {
+        flush_added_files (list_view);
+    }
 
-    model = FM_LIST_VIEW (view)->details->model;
-    fm_list_model_add_file (model, file, directory);
+    if (list_view->details->added_files == NULL)
+    {
+        list_view->details->added_files_directory = caja_directory_ref (directory);
+    }
+    list_view->details->added_files = g_list_prepend (list_view->details->added_files,
+                                                      caja_file_ref (file));
 }
 
 static char **
@@ -2077,6 +2294,9 @@ fm_list_view_clear (FMDirectoryView *view)
         stop_cell_editing (list_view);
         fm_list_model_clear (list_view->details->model);
     }
+
+    caja_file_list_free (list_view->details->visible_files);
+    list_view->details->visible_files = NULL;
 }
 
 static void
@@ -2115,6 +2335,7 @@ fm_list_view_file_changed (FMDirectoryView *view, CajaFile *file, CajaDirectory
 
     listview = FM_LIST_VIEW (view);
 
+    flush_added_files (listview);
     fm_list_model_file_changed (listview->details->model, file, directory);
 
     if (listview->details->renaming_file != NULL &&
@@ -2170,6 +2391,8 @@ fm_list_view_get_selection (FMDirectoryView *view)
 {
     GList *list;
 
+    flush_added_files (FM_LIST_VIEW (view));
+
     list = NULL;
 
     gtk_tree_selection_selected_foreach (gtk_tree_view_get_selection (FM_LIST_VIEW (view)->details->tree_view),
@@ -2218,6 +2441,8 @@ fm_list_view_get_selection_for_file_transfer (FMDirectoryView *view)
 {
     struct SelectionForeachData selection_data;
 
+    flush_added_files (FM_LIST_VIEW (view));
+
     selection_data.list = NULL;
     selection_data.selection = gtk_tree_view_get_selection (FM_LIST_VIEW (view)->details->tree_view);
 
@@ -2232,12 +2457,16 @@ fm_list_view_get_item_count (FMDirectoryView *view)
 {
     g_return_val_if_fail (FM_IS_LIST_VIEW (view), 0);
 
+    flush_added_files (FM_LIST_VIEW (view));
+
     return fm_list_model_get_length (FM_LIST_VIEW (view)->details->model);
 }
 
 static gboolean
 fm_list_view_is_empty (FMDirectoryView *view)
 {
+    flush_added_files (FM_LIST_VIEW (view));
+
     return fm_list_model_is_empty (FM_LIST_VIEW (view)->details->model);
 }
 
@@ -2248,6 +2477,8 @@ fm_list_view_end_file_changes (FMDirectoryView *view)
 
     list_view = FM_LIST_VIEW (view);
 
+    flush_added_files (list_view);
+
     if (list_view->details->new_selection_path)
     {
         gtk_tree_view_set_cursor (list_view->details->tree_view,
@@ -2273,6 +2504,8 @@ fm_list_view_remove_file (FMDirectoryView *view, CajaFile *file, CajaDirectory *
     list_view = FM_LIST_VIEW (view);
     tree_model = GTK_TREE_MODEL(list_view->details->model);
 
+    flush_added_files (list_view);
+
     if (fm_list_model_get_tree_iter_from_file (list_view->details->model, file, directory, &iter))
     {
         GtkTreePath *file_path;
@@ -2336,6 +2569,7 @@ fm_list_view_set_selection (FMDirectoryView *view, GList *selection)
     CajaFile *file = NULL;
 
     list_view = FM_LIST_VIEW (view);
+    flush_added_files (list_view);
     tree_selection = gtk_tree_view_get_selection (list_view->details->tree_view);
 
     g_signal_handlers_block_by_func (tree_selection, list_selection_changed_callback, view);
@@ -2370,6 +2604,7 @@ fm_list_view_invert_selection (FMDirectoryView *view)
     GList *selection = NULL;
 
     list_view = FM_LIST_VIEW (view);
+    flush_added_files (list_view);
     tree_selection = gtk_tree_view_get_selection (list_view->details->tree_view);
 
     g_signal_handlers_block_by_func (tree_selection, list_selection_changed_callback, view);
@@ -2401,6 +2636,7 @@ fm_list_view_invert_selection (FMDirectoryView *view)
 static void
 fm_list_view_select_all (FMDirectoryView *view)
 {
+    flush_added_files (FM_LIST_VIEW (view));
     gtk_tree_selection_select_all (gtk_tree_view_get_selection (FM_LIST_VIEW (view)->details->tree_view));
 }
 
@@ -2894,6 +3130,7 @@ fm_list_view_start_renaming_file (FMDirectoryView *view,
     gint start_offset, end_offset;
 
     list_view = FM_LIST_VIEW (view);
+    flush_added_files (list_view);
 
     /* Select all if we are in renaming mode already */
     if (list_view->details->file_name_column && list_view->details->editable_widget)
@@ -3091,6 +3328,23 @@ fm_list_view_dispose (GObject *object)
         list_view->details->renaming_file_activate_timeout = 0;
     }
 
+    if (list_view->details->update_visible_rows_id != 0)
+    {
+        g_source_remove (list_view->details->update_visible_rows_id);
+        list_view->details->update_visible_rows_id = 0;
+    }
+
+    caja_file_list_free (list_view->details->added_files);
+    list_view->details->added_files = NULL;
+    if (list_view->details->added_files_directory != NULL)
+    {
+        caja_directory_unref (list_view->details->added_files_directory);
+        list_view->details->added_files_directory = NULL;
+    }
+
+    caja_file_list_free (list_view->details->visible_files);
+    list_view->details->visible_files = NULL;
+
     if (list_view->details->clipboard_handler_id != 0)
     {
         g_signal_handler_disconnect (caja_clipboard_monitor_get (),
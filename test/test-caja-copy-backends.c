@@ -0,0 +1,235 @@
+#include <config.h>
+#ifdef HAVE_COPY_FILE_RANGE
+#define _GNU_SOURCE
+#endif
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+
+/* Compares the ways the copy code can copy file contents: a FICLONE
+ * reflink, copy_file_range() and GIO's g_file_copy().
+ *
+ * Run it on the file system to measure, for example a loopback image:
+ *
+ *   truncate -s 4G fs.img && mkfs.btrfs fs.img
+ *   sudo mount -o loop fs.img /mnt && sudo chown $USER /mnt
+ *   test-caja-copy-backends /mnt 512
+ *
+ * Usage: test-caja-copy-backends <directory> [size-in-mb] [rounds]
+ */
+
+#define DEFAULT_SIZE_MB 256
+#define DEFAULT_ROUNDS 3
+#define CHUNK_SIZE (8 * 1024 * 1024)
+
+typedef gboolean (*CopyFunc) (const char *src, const char *dest, GError **error);
+
+static gboolean
+set_errno_error (GError **error, const char *what)
+{
+	int errsv = errno;
+
+	g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+		     "%s: %s", what, g_strerror (errsv));
+	return FALSE;
+}
+
+static gboolean
+open_pair (const char *src, const char *dest, int *src_fd, int *dest_fd, GError **error)
+{
+	*src_fd = open (src, O_RDONLY);
+	if (*src_fd < 0) {
+		return set_errno_error (error, "open source");
+	}
+	*dest_fd = open (dest, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (*dest_fd < 0) {
+		close (*src_fd);
+		return set_errno_error (error, "open destination");
+	}
+	return TRUE;
+}
+
+static gboolean
+copy_with_clone (const char *src, const char *dest, GError **error)
+{
+#if defined (HAVE_LINUX_FS_H) && defined (FICLONE)
+	int src_fd, dest_fd;
+	gboolean res;
+
+	if (!open_pair (src, dest, &src_fd, &dest_fd, error)) {
+		return FALSE;
+	}
+	res = ioctl (dest_fd, FICLONE, src_fd) == 0 ||
+	      set_errno_error (error, "FICLONE");
+	close (src_fd);
+	close (dest_fd);
+	return res;
+#else
+	g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+			     "FICLONE not available");
+	return FALSE;
+#endif
+}
+
+static gboolean
+copy_with_copy_file_range (const char *src, const char *dest, GError **error)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+	int src_fd, dest_fd;
+	struct stat statbuf;
+	goffset copied;
+	ssize_t n;
+	gboolean res;
+
+	if (!open_pair (src, dest, &src_fd, &dest_fd, error)) {
+		return FALSE;
+	}
+	res = fstat (src_fd, &statbuf) == 0 || set_errno_error (error, "fstat");
+	for (copied = 0; res && copied < statbuf.st_size; copied += n) {
+		n = copy_file_range (src_fd, NULL, dest_fd, NULL,
+				     MIN (statbuf.st_size - copied, CHUNK_SIZE), 0);
+		if (n <= 0) {
+			res = set_errno_error (error, "copy_file_range");
+		}
+	}
+	close (src_fd);
+	close (dest_fd);
+	return res;
+#else
+	g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+			     "copy_file_range not available");
+	return FALSE;
+#endif
+}
+
+static gboolean
+copy_with_gio (const char *src, const char *dest, GError **error)
+{
+	GFile *src_file, *dest_file;
+	gboolean res;
+
+	src_file = g_file_new_for_path (src);
+	dest_file = g_file_new_for_path (dest);
+	res = g_file_copy (src_file, dest_file, G_FILE_COPY_NOFOLLOW_SYMLINKS,
+			   NULL, NULL, NULL, error);
+	g_object_unref (src_file);
+	g_object_unref (dest_file);
+	return res;
+}
+
+static char *
+create_source (const char *dir, guint size_mb)
+{
+	char *path, *buffer;
+	FILE *file;
+	guint i, j;
+
+	path = g_build_filename (dir, "caja-copy-backends-source", NULL);
+	file = fopen (path, "w");
+	if (file == NULL) {
+		g_printerr ("could not create %s\n", path);
+		exit (1);
+	}
+
+	/* Random-ish data, so compressing file systems don't cheat */
+	buffer = g_malloc (1024 * 1024);
+	for (i = 0; i < size_mb; i++) {
+		for (j = 0; j < 1024 * 1024 / sizeof (guint32); j++) {
+			((guint32 *) buffer)[j] = g_random_int ();
+		}
+		if (fwrite (buffer, 1024 * 1024, 1, file) != 1) {
+			g_printerr ("could not write %s\n", path);
+			exit (1);
+		}
+	}
+	g_free (buffer);
+	fclose (file);
+
+	return path;
+}
+
+static void
+run_backend (const char *name, CopyFunc func,
+	     const char *src, const char *dir,
+	     guint size_mb, guint rounds)
+{
+	GError *error;
+	GTimer *timer;
+	char *dest;
+	gdouble elapsed, best;
+	guint i;
+
+	dest = g_build_filename (dir, "caja-copy-backends-dest", NULL);
+	timer = g_timer_new ();
+	best = -1;
+
+	for (i = 0; i < rounds; i++) {
+		g_unlink (dest);
+		sync ();
+
+		error = NULL;
+		g_timer_start (timer);
+		if (!func (src, dest, &error)) {
+			g_print ("%-16s failed: %s\n", name, error->message);
+			g_error_free (error);
+			best = -1;
+			break;
+		}
+		/* Count the time to get the data to disk, not only into the cache */
+		sync ();
+		elapsed = g_timer_elapsed (timer, NULL);
+		if (best < 0 || elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	if (best >= 0) {
+		g_print ("%-16s %8.3f s  %10.1f MB/s\n",
+			 name, best, size_mb / MAX (best, 1e-6));
+	}
+
+	g_unlink (dest);
+	g_timer_destroy (timer);
+	g_free (dest);
+}
+
+int
+main (int argc, char **argv)
+{
+	guint size_mb, rounds;
+	char *src;
+
+	if (argc < 2) {
+		g_print ("Usage: test-caja-copy-backends <directory> [size-in-mb] [rounds]\n");
+		return 1;
+	}
+
+	size_mb = argc > 2 ? (guint) atoi (argv[2]) : DEFAULT_SIZE_MB;
+	rounds = argc > 3 ? (guint) atoi (argv[3]) : DEFAULT_ROUNDS;
+	if (size_mb == 0 || rounds == 0) {
+		g_print ("Usage: test-caja-copy-backends <directory> [size-in-mb] [rounds]\n");
+		return 1;
+	}
+
+	src = create_source (argv[1], size_mb);
+	g_print ("copying a %u MB file in %s, best of %u\n", size_mb, argv[1], rounds);
+
+	run_backend ("FICLONE", copy_with_clone, src, argv[1], size_mb, rounds);
+	run_backend ("copy_file_range", copy_with_copy_file_range, src, argv[1], size_mb, rounds);
+	run_backend ("g_file_copy", copy_with_gio, src, argv[1], size_mb, rounds);
+
+	g_unlink (src);
+	g_free (src);
+
+	return 0;
+}
@@ -0,0 +1,206 @@
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libcaja-private/caja-copy-journal.h>
+
+/* Writes a copy journal the way an interrupted job leaves it, then
+ * reads it back and checks what a resumed job would see: the finished
+ * files and how far the large file got, including after a crash cut
+ * the last record short, and after resuming such a job and being
+ * interrupted again.
+ *
+ * The journals live in a temporary configuration folder, the real
+ * one is left alone.
+ *
+ * Usage: test-caja-copy-journal
+ */
+
+static GFile *
+file_for (const char *path)
+{
+	return g_file_new_for_path (path);
+}
+
+static CajaCopyJournal *
+open_only_journal (char **path)
+{
+	CajaCopyJournal *journal;
+	GError *error;
+	GList *paths;
+
+	paths = caja_copy_journal_list_interrupted ();
+	g_assert_cmpuint (g_list_length (paths), ==, 1);
+
+	error = NULL;
+	journal = caja_copy_journal_open (paths->data, &error);
+	g_assert_no_error (error);
+	g_assert_nonnull (journal);
+
+	/* An open journal is locked, so it is not offered twice */
+	g_assert_null (caja_copy_journal_list_interrupted ());
+
+	*path = g_strdup (paths->data);
+	g_list_free_full (paths, g_free);
+
+	return journal;
+}
+
+static void
+append (const char *path, const char *text)
+{
+	FILE *file;
+
+	file = fopen (path, "a");
+	g_assert_nonnull (file);
+	fputs (text, file);
+	fclose (file);
+}
+
+int
+main (int argc, char **argv)
+{
+	CajaCopyJournal *journal;
+	GFile *dest, *big, *big_dest, *small, *other, *short_name, *long_name;
+	GList *files, *paths, *torn_files;
+	char *root, *path, *contents;
+	goffset offset, size;
+	guint64 mtime;
+
+	root = g_build_filename (g_get_tmp_dir (), "caja-copy-journal-XXXXXX", NULL);
+	if (g_mkdtemp (root) == NULL) {
+		g_printerr ("could not create temporary directory\n");
+		return 1;
+	}
+	g_setenv ("XDG_CONFIG_HOME", root, TRUE);
+
+	dest = file_for ("/media/usb");
+	big = file_for ("/home/user/disk image.iso");
+	big_dest = file_for ("/media/usb/disk image.iso");
+	small = file_for ("/home/user/notes.txt");
+	other = file_for ("/home/user/other.txt");
+	files = g_list_append (NULL, big);
+	files = g_list_append (files, small);
+	files = g_list_append (files, other);
+
+	/* The job that gets interrupted */
+	journal = caja_copy_journal_new (FALSE, files, dest);
+	g_assert_nonnull (journal);
+	g_assert_false (caja_copy_journal_is_resumed (journal));
+	g_assert_null (caja_copy_journal_list_interrupted ());
+
+	caja_copy_journal_file_done (journal, small);
+	caja_copy_journal_file_started (journal, big, big_dest, G_GINT64_CONSTANT (4000000000), 1234567890);
+	caja_copy_journal_file_progress (journal, 1000000000);
+	caja_copy_journal_file_progress (journal, 2000000000);
+	caja_copy_journal_free (journal, FALSE);
+
+	/* Resuming it */
+	journal = open_only_journal (&path);
+	g_assert_true (caja_copy_journal_is_resumed (journal));
+	g_assert_false (caja_copy_journal_get_is_move (journal));
+	g_assert_true (g_file_equal (caja_copy_journal_get_destination (journal), dest));
+	g_assert_cmpuint (g_list_length (caja_copy_journal_get_files (journal)), ==, 3);
+	g_assert_true (g_file_equal (caja_copy_journal_get_files (journal)->data, big));
+
+	g_assert_true (caja_copy_journal_is_done (journal, small));
+	g_assert_false (caja_copy_journal_is_done (journal, other));
+	g_assert_false (caja_copy_journal_is_done (journal, big));
+
+	g_assert_true (caja_copy_journal_get_partial (journal, big, big_dest, &offset, &size, &mtime));
+	g_assert_cmpint (offset, ==, 2000000000);
+	g_assert_cmpint (size, ==, G_GINT64_CONSTANT (4000000000));
+	g_assert_cmpuint (mtime, ==, 1234567890);
+	/* Only the same destination can be continued */
+	g_assert_false (caja_copy_journal_get_partial (journal, big, dest, &offset, &size, &mtime));
+	g_assert_false (caja_copy_journal_get_partial (journal, other, big_dest, &offset, &size, &mtime));
+
+	caja_copy_journal_file_done (journal, other);
+	caja_copy_journal_free (journal, FALSE);
+
+	/* A crash in the middle of a record */
+	append (path, "P 3000");
+	g_free (path);
+	journal = open_only_journal (&path);
+	g_assert_true (caja_copy_journal_is_done (journal, small));
+	g_assert_true (caja_copy_journal_is_done (journal, other));
+	g_assert_true (caja_copy_journal_get_partial (journal, big, big_dest, &offset, &size, &mtime));
+	g_assert_cmpint (offset, ==, 2000000000);
+
+	/* Records after the cut off one still count */
+	caja_copy_journal_file_done (journal, big);
+	caja_copy_journal_free (journal, FALSE);
+
+	g_free (path);
+	journal = open_only_journal (&path);
+	g_assert_true (caja_copy_journal_is_done (journal, big));
+	g_assert_false (caja_copy_journal_get_partial (journal, big, big_dest, &offset, &size, &mtime));
+
+	/* Finishing removes it */
+	caja_copy_journal_free (journal, TRUE);
+	g_assert_null (caja_copy_journal_list_interrupted ());
+	g_assert_false (g_file_test (path, G_FILE_TEST_EXISTS));
+	g_free (path);
+
+	/* A record cut short that looks like another file's: "D .../a"
+	 * from "D .../ab". Resuming drops it, so being interrupted again
+	 * does not turn it into a complete record.
+	 */
+	short_name = file_for ("/home/user/a");
+	long_name = file_for ("/home/user/ab");
+	torn_files = g_list_append (NULL, short_name);
+	torn_files = g_list_append (torn_files, long_name);
+	journal = caja_copy_journal_new (FALSE, torn_files, dest);
+	caja_copy_journal_free (journal, FALSE);
+
+	journal = open_only_journal (&path);
+	caja_copy_journal_free (journal, FALSE);
+	append (path, "D file:///home/user/a");
+
+	g_free (path);
+	journal = open_only_journal (&path);
+	g_assert_false (caja_copy_journal_is_done (journal, short_name));
+	caja_copy_journal_free (journal, FALSE);
+
+	g_assert_true (g_file_get_contents (path, &contents, NULL, NULL));
+	g_assert_true (g_str_has_suffix (contents, "\n"));
+	g_assert_null (strstr (contents, "D file:///home/user/a"));
+	g_free (contents);
+
+	g_free (path);
+	journal = open_only_journal (&path);
+	g_assert_false (caja_copy_journal_is_done (journal, short_name));
+	g_assert_false (caja_copy_journal_is_done (journal, long_name));
+	caja_copy_journal_free (journal, TRUE);
+	g_free (path);
+	g_list_free_full (torn_files, g_object_unref);
+
+	/* Something else in the folder is not resumed */
+	path = g_build_filename (root, "caja", "journals", "bogus.journal", NULL);
+	g_assert_true (g_file_set_contents (path, "not a journal\n", -1, NULL));
+	paths = caja_copy_journal_list_interrupted ();
+	g_assert_cmpuint (g_list_length (paths), ==, 1);
+	g_assert_null (caja_copy_journal_open (paths->data, NULL));
+	g_list_free_full (paths, g_free);
+	g_unlink (path);
+	g_free (path);
+
+	path = g_build_filename (root, "caja", "journals", NULL);
+	g_rmdir (path);
+	g_free (path);
+	path = g_build_filename (root, "caja", NULL);
+	g_rmdir (path);
+	g_free (path);
+	g_rmdir (root);
+	g_free (root);
+
+	g_list_free_full (files, g_object_unref);
+	g_object_unref (dest);
+	g_object_unref (big_dest);
+
+	g_print ("copy journal: all checks passed\n");
+
+	return 0;
+}
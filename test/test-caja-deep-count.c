@@ -0,0 +1,170 @@
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libcaja-private/caja-file.h>
+#include <libcaja-private/caja-file-attributes.h>
+
+/* Deep-counts a synthetic tree made mostly of hard links and reports
+ * entries per second.
+ *
+ * Usage: test-caja-deep-count [n-links] [links-per-dir]
+ */
+
+#define DEFAULT_LINK_COUNT 1000000
+#define DEFAULT_LINKS_PER_DIR 1000
+
+static GTimer *timer;
+static guint n_links;
+static guint links_per_dir;
+
+static char *
+create_tree (void)
+{
+	char *root, *target, *dir, *path;
+	guint i, n_dirs;
+
+	root = g_build_filename (g_get_tmp_dir (), "caja-deep-count-XXXXXX", NULL);
+	if (g_mkdtemp (root) == NULL) {
+		g_printerr ("could not create temporary directory\n");
+		exit (1);
+	}
+
+	target = g_build_filename (root, "target", NULL);
+	if (!g_file_set_contents (target, "caja", -1, NULL)) {
+		g_printerr ("could not create %s\n", target);
+		exit (1);
+	}
+
+	n_dirs = (n_links + links_per_dir - 1) / links_per_dir;
+	dir = NULL;
+	for (i = 0; i < n_links; i++) {
+		if (i % links_per_dir == 0) {
+			g_free (dir);
+			dir = g_strdup_printf ("%s/d%u", root, i / links_per_dir);
+			g_mkdir (dir, 0755);
+		}
+		path = g_strdup_printf ("%s/l%u", dir, i);
+		if (link (target, path) != 0) {
+			g_printerr ("link %s failed\n", path);
+			exit (1);
+		}
+		g_free (path);
+	}
+	g_free (dir);
+	g_free (target);
+
+	g_print ("created %u hard links in %u directories under %s\n",
+		 n_links, n_dirs, root);
+
+	return root;
+}
+
+static void
+remove_tree (const char *root)
+{
+	GDir *dir, *subdir;
+	const char *name, *child;
+	char *path, *child_path;
+
+	dir = g_dir_open (root, 0, NULL);
+	if (dir == NULL) {
+		return;
+	}
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		path = g_build_filename (root, name, NULL);
+		subdir = g_dir_open (path, 0, NULL);
+		if (subdir != NULL) {
+			while ((child = g_dir_read_name (subdir)) != NULL) {
+				child_path = g_build_filename (path, child, NULL);
+				g_unlink (child_path);
+				g_free (child_path);
+			}
+			g_dir_close (subdir);
+			g_rmdir (path);
+		} else {
+			g_unlink (path);
+		}
+		g_free (path);
+	}
+	g_dir_close (dir);
+	g_rmdir (root);
+}
+
+static void
+file_changed (CajaFile *file, gpointer data)
+{
+	guint directory_count, file_count, unreadable_count;
+	goffset total_size, total_size_on_disk;
+	CajaRequestStatus status;
+	gdouble elapsed;
+	guint entries;
+
+	status = caja_file_get_deep_counts (file,
+					    &directory_count,
+					    &file_count,
+					    &unreadable_count,
+					    &total_size,
+					    &total_size_on_disk,
+					    TRUE);
+	if (status != CAJA_REQUEST_DONE) {
+		return;
+	}
+
+	elapsed = g_timer_elapsed (timer, NULL);
+	entries = directory_count + file_count;
+
+	g_print ("deep count: %u directories, %u files, %u unreadable, "
+		 "%" G_GINT64_FORMAT " bytes\n",
+		 directory_count, file_count, unreadable_count,
+		 (gint64) total_size);
+	g_print ("%u entries in %.3f s: %.0f entries/sec\n",
+		 entries, elapsed, entries / MAX (elapsed, 1e-6));
+
+	gtk_main_quit ();
+}
+
+int
+main (int argc, char **argv)
+{
+	CajaFile *file;
+	GFile *location;
+	char *root;
+	gpointer client;
+
+	gtk_init (&argc, &argv);
+
+	n_links = argc > 1 ? (guint) atoi (argv[1]) : DEFAULT_LINK_COUNT;
+	links_per_dir = argc > 2 ? (guint) atoi (argv[2]) : DEFAULT_LINKS_PER_DIR;
+	if (n_links == 0 || links_per_dir == 0) {
+		g_print ("Usage: test-caja-deep-count [n-links] [links-per-dir]\n");
+		return 1;
+	}
+
+	root = create_tree ();
+
+	location = g_file_new_for_path (root);
+	file = caja_file_get (location);
+	g_object_unref (location);
+
+	client = g_new0 (int, 1);
+	timer = g_timer_new ();
+
+	g_signal_connect (file, "changed", G_CALLBACK (file_changed), NULL);
+	caja_file_monitor_add (file, client,
+			       CAJA_FILE_ATTRIBUTE_INFO |
+			       CAJA_FILE_ATTRIBUTE_DEEP_COUNTS);
+
+	gtk_main ();
+
+	caja_file_monitor_remove (file, client);
+	caja_file_unref (file);
+	g_timer_destroy (timer);
+	g_free (client);
+
+	remove_tree (root);
+	g_free (root);
+
+	return 0;
+}
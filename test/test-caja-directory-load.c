@@ -0,0 +1,141 @@
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+
+#include <libcaja-private/caja-directory.h>
+#include <libcaja-private/caja-file-attributes.h>
+
+/* Loads directories of increasing size and reports the time until the
+ * first files arrive and until loading is done.
+ *
+ * Usage: test-caja-directory-load [n-files...]
+ */
+
+static const guint default_sizes[] = { 10000, 100000, 1000000 };
+
+typedef struct {
+	GMainLoop *loop;
+	GTimer *timer;
+	gdouble first_files;
+	guint n_files;
+} LoadRun;
+
+static char *
+create_directory (guint n_files)
+{
+	char *root, *path;
+	guint i;
+
+	root = g_build_filename (g_get_tmp_dir (), "caja-directory-load-XXXXXX", NULL);
+	if (g_mkdtemp (root) == NULL) {
+		g_printerr ("could not create temporary directory\n");
+		exit (1);
+	}
+
+	for (i = 0; i < n_files; i++) {
+		path = g_strdup_printf ("%s/file-%07u", root, i);
+		if (!g_file_set_contents (path, "", 0, NULL)) {
+			g_printerr ("could not create %s\n", path);
+			exit (1);
+		}
+		g_free (path);
+	}
+
+	return root;
+}
+
+static void
+remove_directory (const char *root)
+{
+	GDir *dir;
+	const char *name;
+	char *path;
+
+	dir = g_dir_open (root, 0, NULL);
+	if (dir != NULL) {
+		while ((name = g_dir_read_name (dir)) != NULL) {
+			path = g_build_filename (root, name, NULL);
+			g_unlink (path);
+			g_free (path);
+		}
+		g_dir_close (dir);
+	}
+	g_rmdir (root);
+}
+
+static void
+files_added (CajaDirectory *directory,
+	     GList *added_files,
+	     LoadRun *run)
+{
+	if (run->n_files == 0) {
+		run->first_files = g_timer_elapsed (run->timer, NULL);
+	}
+	run->n_files += g_list_length (added_files);
+}
+
+static void
+done_loading (CajaDirectory *directory,
+	      LoadRun *run)
+{
+	g_main_loop_quit (run->loop);
+}
+
+static void
+load_directory (guint n_files)
+{
+	CajaDirectory *directory;
+	LoadRun run = { NULL };
+	char *root, *uri;
+	gdouble total;
+
+	root = create_directory (n_files);
+	uri = g_filename_to_uri (root, NULL, NULL);
+
+	run.loop = g_main_loop_new (NULL, FALSE);
+	run.timer = g_timer_new ();
+
+	directory = caja_directory_get_by_uri (uri);
+	g_signal_connect (directory, "files-added", G_CALLBACK (files_added), &run);
+	g_signal_connect (directory, "done-loading", G_CALLBACK (done_loading), &run);
+	caja_directory_file_monitor_add (directory, &run, TRUE,
+					 CAJA_FILE_ATTRIBUTE_INFO,
+					 NULL, NULL);
+
+	g_main_loop_run (run.loop);
+	total = g_timer_elapsed (run.timer, NULL);
+
+	g_print ("%8u files: first files after %8.3f ms, done after %8.3f ms (%u files seen)\n",
+		 n_files, run.first_files * 1000, total * 1000, run.n_files);
+
+	caja_directory_file_monitor_remove (directory, &run);
+	g_signal_handlers_disconnect_by_data (directory, &run);
+	caja_directory_unref (directory);
+
+	g_timer_destroy (run.timer);
+	g_main_loop_unref (run.loop);
+
+	remove_directory (root);
+	g_free (uri);
+	g_free (root);
+}
+
+int
+main (int argc, char **argv)
+{
+	int i;
+
+	gtk_init (&argc, &argv);
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++) {
+			load_directory ((guint) atoi (argv[i]));
+		}
+	} else {
+		for (i = 0; i < (int) G_N_ELEMENTS (default_sizes); i++) {
+			load_directory (default_sizes[i]);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+
+#include <libcaja-private/caja-file-operations.h>
+
+/* Trashes a folder full of small files, once file by file with
+ * g_file_trash() and once with the trash job, and reports files per
+ * second for both.
+ *
+ * Everything happens in a temporary folder in the home folder, which
+ * also holds the trash used (XDG_DATA_HOME is pointed there), so the
+ * real trash is left alone. Settings are kept in memory, so no
+ * confirmation dialogs are shown.
+ *
+ * Usage: test-caja-trash [n-files]
+ */
+
+#define DEFAULT_FILE_COUNT 50000
+
+static GTimer *timer;
+
+static GList *
+create_files (const char *root, const char *name, guint n_files)
+{
+	GList *files;
+	char *dir, *path;
+	guint i;
+
+	dir = g_build_filename (root, name, NULL);
+	g_mkdir (dir, 0755);
+
+	files = NULL;
+	for (i = 0; i < n_files; i++) {
+		path = g_strdup_printf ("%s/log-%07u.txt", dir, i);
+		if (!g_file_set_contents (path, "caja", -1, NULL)) {
+			g_printerr ("could not create %s\n", path);
+			exit (1);
+		}
+		files = g_list_prepend (files, g_file_new_for_path (path));
+		g_free (path);
+	}
+	g_free (dir);
+
+	return g_list_reverse (files);
+}
+
+static void
+remove_tree (const char *path)
+{
+	GDir *dir;
+	const char *name;
+	char *child;
+
+	dir = g_dir_open (path, 0, NULL);
+	if (dir == NULL) {
+		g_unlink (path);
+		return;
+	}
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		child = g_build_filename (path, name, NULL);
+		remove_tree (child);
+		g_free (child);
+	}
+	g_dir_close (dir);
+	g_rmdir (path);
+}
+
+static void
+report (const char *name, guint n_files, gdouble elapsed)
+{
+	g_print ("%-16s %8u files in %8.3f s: %10.0f files/sec\n",
+		 name, n_files, elapsed, n_files / MAX (elapsed, 1e-6));
+}
+
+static void
+trash_with_gio (GList *files)
+{
+	GError *error;
+	GList *l;
+
+	g_timer_start (timer);
+	for (l = files; l != NULL; l = l->next) {
+		error = NULL;
+		if (!g_file_trash (l->data, NULL, &error)) {
+			g_printerr ("g_file_trash failed: %s\n", error->message);
+			g_error_free (error);
+			exit (1);
+		}
+	}
+	report ("g_file_trash", g_list_length (files), g_timer_elapsed (timer, NULL));
+}
+
+static void
+trash_done (GHashTable *debuting_uris,
+	    gboolean user_cancel,
+	    gpointer callback_data)
+{
+	report ("trash job", GPOINTER_TO_UINT (callback_data),
+		g_timer_elapsed (timer, NULL));
+	gtk_main_quit ();
+}
+
+static void
+trash_with_job (GList *files)
+{
+	g_timer_start (timer);
+	caja_file_operations_trash_or_delete (files, NULL, trash_done,
+					      GUINT_TO_POINTER (g_list_length (files)));
+	gtk_main ();
+}
+
+int
+main (int argc, char **argv)
+{
+	GList *files;
+	char *root, *data_dir;
+	guint n_files;
+
+	/* Set up before anything looks at the data dir or settings */
+	root = g_build_filename (g_get_home_dir (), ".caja-trash-test-XXXXXX", NULL);
+	if (g_mkdtemp (root) == NULL) {
+		g_printerr ("could not create temporary directory\n");
+		return 1;
+	}
+	data_dir = g_build_filename (root, "data", NULL);
+	g_setenv ("XDG_DATA_HOME", data_dir, TRUE);
+	g_setenv ("GSETTINGS_BACKEND", "memory", TRUE);
+
+	gtk_init (&argc, &argv);
+
+	n_files = argc > 1 ? (guint) atoi (argv[1]) : DEFAULT_FILE_COUNT;
+	if (n_files == 0) {
+		g_print ("Usage: test-caja-trash [n-files]\n");
+		remove_tree (root);
+		return 1;
+	}
+
+	timer = g_timer_new ();
+
+	files = create_files (root, "gio", n_files);
+	trash_with_gio (files);
+	g_list_free_full (files, g_object_unref);
+
+	files = create_files (root, "job", n_files);
+	trash_with_job (files);
+	g_list_free_full (files, g_object_unref);
+
+	g_timer_destroy (timer);
+
+	remove_tree (root);
+	g_free (data_dir);
+	g_free (root);
+
+	return 0;
+}
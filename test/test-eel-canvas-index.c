@@ -0,0 +1,164 @@
+#include <gtk/gtk.h>
+#include <stdlib.h>
+
+#include <eel/eel-canvas.h>
+#include <eel/eel-canvas-rect-ellipse.h>
+
+/* Fills a canvas with a grid of items, the way the icon view lays out a
+ * big folder, and reports how long drawing a window-sized frame and
+ * picking the item under the pointer take, without and with the spatial
+ * index of the root group.
+ *
+ * Usage: test-eel-canvas-index [max-items]
+ */
+
+#define DEFAULT_MAX_ITEMS 100000
+#define COLUMNS 100
+#define SPACING 100
+#define ITEM_SIZE 64
+#define VIEW_WIDTH 1024
+#define VIEW_HEIGHT 768
+#define FRAMES 50
+#define PICKS 20000
+
+static GtkWidget *
+create_canvas (guint n_items, gboolean indexed)
+{
+	GtkWidget *window, *canvas;
+	EelCanvasGroup *root;
+	GdkRGBA color = { 0.2, 0.4, 0.8, 1.0 };
+	guint i, rows;
+	double x, y;
+
+	window = gtk_offscreen_window_new ();
+	canvas = eel_canvas_new ();
+	gtk_widget_set_size_request (canvas, VIEW_WIDTH, VIEW_HEIGHT);
+	gtk_container_add (GTK_CONTAINER (window), canvas);
+
+	root = eel_canvas_root (EEL_CANVAS (canvas));
+	eel_canvas_group_set_spatial_index (root, indexed);
+
+	rows = (n_items + COLUMNS - 1) / COLUMNS;
+	eel_canvas_set_scroll_region (EEL_CANVAS (canvas), 0, 0,
+				      COLUMNS * SPACING, MAX (rows, 1) * SPACING);
+
+	for (i = 0; i < n_items; i++) {
+		x = (i % COLUMNS) * SPACING;
+		y = (i / COLUMNS) * SPACING;
+		eel_canvas_item_new (root, EEL_TYPE_CANVAS_RECT,
+				     "x1", x, "y1", y,
+				     "x2", x + ITEM_SIZE, "y2", y + ITEM_SIZE,
+				     "fill-color-rgba", &color,
+				     NULL);
+	}
+
+	gtk_widget_show_all (window);
+	while (gtk_events_pending ()) {
+		gtk_main_iteration ();
+	}
+	eel_canvas_update_now (EEL_CANVAS (canvas));
+
+	return canvas;
+}
+
+static double
+time_frames (GtkWidget *canvas, guint n_items)
+{
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	GTimer *timer;
+	guint i, rows;
+	int max_y;
+	double elapsed;
+
+	surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, VIEW_WIDTH, VIEW_HEIGHT);
+	rows = (n_items + COLUMNS - 1) / COLUMNS;
+	max_y = MAX ((int) (rows * SPACING) - VIEW_HEIGHT, 0);
+
+	timer = g_timer_new ();
+	for (i = 0; i < FRAMES; i++) {
+		/* Scroll through the folder, like dragging the scrollbar */
+		eel_canvas_scroll_to (EEL_CANVAS (canvas), 0, max_y * i / FRAMES);
+
+		cr = cairo_create (surface);
+		gtk_widget_draw (canvas, cr);
+		cairo_destroy (cr);
+	}
+	elapsed = g_timer_elapsed (timer, NULL);
+
+	g_timer_destroy (timer);
+	cairo_surface_destroy (surface);
+
+	return elapsed / FRAMES;
+}
+
+static double
+time_picks (GtkWidget *canvas, guint n_items)
+{
+	GTimer *timer;
+	GRand *rand;
+	guint i, rows, hits;
+	double elapsed;
+
+	rows = (n_items + COLUMNS - 1) / COLUMNS;
+	rand = g_rand_new_with_seed (42);
+	hits = 0;
+
+	timer = g_timer_new ();
+	for (i = 0; i < PICKS; i++) {
+		if (eel_canvas_get_item_at (EEL_CANVAS (canvas),
+					    g_rand_double_range (rand, 0, COLUMNS * SPACING),
+					    g_rand_double_range (rand, 0, MAX (rows, 1) * SPACING)) != NULL) {
+			hits++;
+		}
+	}
+	elapsed = g_timer_elapsed (timer, NULL);
+
+	g_timer_destroy (timer);
+	g_rand_free (rand);
+
+	/* Keep the compiler from dropping the picks */
+	if (hits > PICKS) {
+		g_print ("impossible\n");
+	}
+
+	return elapsed / PICKS;
+}
+
+static void
+run (guint n_items, gboolean indexed)
+{
+	GtkWidget *canvas;
+	double frame, pick;
+
+	canvas = create_canvas (n_items, indexed);
+	frame = time_frames (canvas, n_items);
+	pick = time_picks (canvas, n_items);
+
+	g_print ("%8u items %-10s frame %9.3f ms  pick %9.3f us\n",
+		 n_items, indexed ? "indexed" : "list",
+		 frame * 1000, pick * 1000000);
+
+	gtk_widget_destroy (gtk_widget_get_toplevel (canvas));
+}
+
+int
+main (int argc, char **argv)
+{
+	guint max_items, n_items;
+
+	gtk_init (&argc, &argv);
+
+	max_items = argc > 1 ? (guint) atoi (argv[1]) : DEFAULT_MAX_ITEMS;
+	if (max_items == 0) {
+		g_print ("Usage: test-eel-canvas-index [max-items]\n");
+		return 1;
+	}
+
+	for (n_items = 1000; n_items <= max_items; n_items *= 10) {
+		run (n_items, FALSE);
+		run (n_items, TRUE);
+	}
+
+	return 0;
+}